@@ -112,6 +112,18 @@ public:
 	};
 	std::map<uint32_t, VersionBatcher> versionBatcher;
 
+	// Point read batching
+	struct GetValueBatch : ReferenceCounted<GetValueBatch> {
+		Reference<LocationInfo> location;
+		Version version;
+		std::map<Key, Promise<Optional<Value>>> values;
+		Promise<Void> full;
+		Future<Void> actor;
+
+		GetValueBatch( Reference<LocationInfo> const& location, Version version ) : location(location), version(version) {}
+	};
+	std::map< std::pair<LocationInfo*, Version>, Reference<GetValueBatch> > getValueBatches;
+
 	// Client status updater
 	struct ClientStatusUpdater {
 		std::vector<BinaryWriter> inStatusQ;
@@ -475,6 +475,8 @@ struct KeyValueStoreType {
 		SSD_BTREE_V1,
 		MEMORY,
 		SSD_BTREE_V2,
+		SSD_LSM,
+		SSD_REDWOOD_V1,
 		END
 	};
 
@@ -493,6 +495,8 @@ struct KeyValueStoreType {
 			case SSD_BTREE_V1: return "ssd-1";
 			case SSD_BTREE_V2: return "ssd-2";
 			case MEMORY: return "memory";
+			case SSD_LSM: return "ssd-lsm";
+			case SSD_REDWOOD_V1: return "ssd-redwood-experimental";
 			default: return "unknown";
 		}
 	}
@@ -60,6 +60,8 @@ ClientKnobs::ClientKnobs(bool randomize) {
 
 	init( MAX_BATCH_SIZE,                           20 ); if( randomize && BUGGIFY ) MAX_BATCH_SIZE = 1; // Note that SERVER_KNOBS->START_TRANSACTION_MAX_BUDGET_SIZE is set to match this value
 	init( GRV_BATCH_TIMEOUT,                     0.005 ); if( randomize && BUGGIFY ) GRV_BATCH_TIMEOUT = 0.1;
+	init( GET_VALUE_BATCH_MAX_KEYS,                  1 ); if( randomize && BUGGIFY ) GET_VALUE_BATCH_MAX_KEYS = g_random->randomInt(2, 100);
+	init( GET_VALUE_BATCH_DELAY,                   0.0 ); if( randomize && BUGGIFY ) GET_VALUE_BATCH_DELAY = 0.001;
 
 	init( LOCATION_CACHE_EVICTION_SIZE,         100000 );
 	init( LOCATION_CACHE_EVICTION_SIZE_SIM,         10 ); if( randomize && BUGGIFY ) LOCATION_CACHE_EVICTION_SIZE_SIM = 3;
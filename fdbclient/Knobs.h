@@ -59,6 +59,10 @@ public:
 	int MAX_BATCH_SIZE;
 	double GRV_BATCH_TIMEOUT;
 
+	// Concurrent point reads served by the same storage servers at the same version are combined into one GetValuesRequest
+	int GET_VALUE_BATCH_MAX_KEYS; // <= 1 disables batching
+	double GET_VALUE_BATCH_DELAY;
+
 	// When locationCache in DatabaseContext gets to be this size, items will be evicted
 	int LOCATION_CACHE_EVICTION_SIZE;
 	int LOCATION_CACHE_EVICTION_SIZE_SIM;
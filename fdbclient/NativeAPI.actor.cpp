@@ -1174,6 +1174,56 @@ Future<Void> Transaction::warmRange(Database cx, KeyRange keys) {
 	return warmRange_impl(this, cx, keys);
 }
 
+ACTOR Future<Void> sendGetValueBatch( Database cx, Reference<DatabaseContext::GetValueBatch> batch, int taskID ) {
+	wait( batch->full.getFuture() || delay( CLIENT_KNOBS->GET_VALUE_BATCH_DELAY, taskID ) );
+
+	auto it = cx->getValueBatches.find( std::make_pair( batch->location.getPtr(), batch->version ) );
+	if( it != cx->getValueBatches.end() && it->second == batch )
+		cx->getValueBatches.erase( it );
+
+	state GetValuesRequest req;
+	req.version = batch->version;
+	req.keys.reserve( req.arena, batch->values.size() );
+	for(auto& v : batch->values)
+		req.keys.push_back_deep( req.arena, v.first );
+
+	try {
+		GetValuesReply reply = wait( loadBalance( batch->location, &StorageServerInterface::getValues, req, TaskDefaultPromiseEndpoint, false, cx->enableLocalityLoadBalance ? &cx->queueModel : NULL ) );
+		auto kv = reply.data.begin();
+		for(auto& v : batch->values) {
+			if( kv != reply.data.end() && kv->key == v.first ) {
+				v.second.send( Optional<Value>( Value( kv->value, reply.arena ) ) );
+				++kv;
+			} else {
+				v.second.send( Optional<Value>() );
+			}
+		}
+	} catch( Error& e ) {
+		if( e.code() == error_code_actor_cancelled ) throw;
+		for(auto& v : batch->values)
+			v.second.sendError( e );
+	}
+	return Void();
+}
+
+// Joins the pending batch of point reads for this storage team and version, starting one if there is none
+Future<Optional<Value>> getValueBatched( Database const& cx, Reference<LocationInfo> const& location, Key const& key, Version version, int taskID ) {
+	auto batchKey = std::make_pair( location.getPtr(), version );
+	Reference<DatabaseContext::GetValueBatch> batch = cx->getValueBatches[batchKey];
+	if( !batch ) {
+		batch = Reference<DatabaseContext::GetValueBatch>( new DatabaseContext::GetValueBatch( location, version ) );
+		cx->getValueBatches[batchKey] = batch;
+		batch->actor = sendGetValueBatch( cx, batch, taskID );
+	}
+
+	Future<Optional<Value>> value = batch->values[key].getFuture();
+	if( batch->values.size() >= CLIENT_KNOBS->GET_VALUE_BATCH_MAX_KEYS ) {
+		cx->getValueBatches.erase( batchKey );
+		batch->full.send( Void() );
+	}
+	return value;
+}
+
 ACTOR Future<Optional<Value>> getValue( Future<Version> version, Key key, Database cx, TransactionInfo info, Reference<TransactionLogInfo> trLogInfo )
 {
 	state Version ver = wait( version );
@@ -1202,11 +1252,18 @@ ACTOR Future<Optional<Value>> getValue( Future<Version> version, Key key, Databa
 			startTime = timer_int();
 			startTimeD = now();
 			++cx->transactionPhysicalReads;
-			state GetValueReply reply = wait( loadBalance( ssi.second, &StorageServerInterface::getValue, GetValueRequest(key, ver, getValueID), TaskDefaultPromiseEndpoint, false, cx->enableLocalityLoadBalance ? &cx->queueModel : NULL ) );
+			state Optional<Value> value;
+			if( CLIENT_KNOBS->GET_VALUE_BATCH_MAX_KEYS > 1 && !getValueID.present() ) {
+				Optional<Value> _value = wait( getValueBatched( cx, ssi.second, key, ver, info.taskID ) );
+				value = _value;
+			} else {
+				GetValueReply reply = wait( loadBalance( ssi.second, &StorageServerInterface::getValue, GetValueRequest(key, ver, getValueID), TaskDefaultPromiseEndpoint, false, cx->enableLocalityLoadBalance ? &cx->queueModel : NULL ) );
+				value = reply.value;
+			}
 			double latency = now() - startTimeD;
 			cx->readLatencies.addSample(latency);
 			if (trLogInfo) {
-				int valueSize = reply.value.present() ? reply.value.get().size() : 0;
+				int valueSize = value.present() ? value.get().size() : 0;
 				trLogInfo->addLog(FdbClientLogEvents::EventGet(startTimeD, latency, valueSize, key));
 			}
 			cx->getValueCompleted->latency = timer_int() - startTime;
@@ -1217,9 +1274,9 @@ ACTOR Future<Optional<Value>> getValue( Future<Version> version, Key key, Databa
 				/*TraceEvent("TransactionDebugGetValueDone", getValueID.get())
 					.detail("Key", printable(key))
 					.detail("ReqVersion", ver)
-					.detail("ReplySize", reply.value.present() ? reply.value.get().size() : -1);*/
+					.detail("ReplySize", value.present() ? value.get().size() : -1);*/
 			}
-			return reply.value;
+			return value;
 		} catch (Error& e) {
 			cx->getValueCompleted->latency = timer_int() - startTime;
 			cx->getValueCompleted->log();
@@ -1228,7 +1285,7 @@ ACTOR Future<Optional<Value>> getValue( Future<Version> version, Key key, Databa
 				/*TraceEvent("TransactionDebugGetValueDone", getValueID.get())
 					.detail("Key", printable(key))
 					.detail("ReqVersion", ver)
-					.detail("ReplySize", reply.value.present() ? reply.value.get().size() : -1);*/
+					.detail("ReplySize", value.present() ? value.get().size() : -1);*/
 			}
 			if (e.code() == error_code_wrong_shard_server || e.code() == error_code_all_alternatives_failed ||
 				(e.code() == error_code_transaction_too_old && ver == latestVersion) ) {
@@ -89,6 +89,42 @@ const KeyRef JSONSchemas::statusSchema = LiteralStringRef(R"statusSchema(
                      "seconds":5.0,
                      "versions":12341234
                   },
+                  "fetches_active":0,
+                  "fetching_shards":[
+                     {
+                        "begin":"",
+                        "end":"",
+                        "fetched_bytes":12341234,
+                        "elapsed_seconds":5.0,
+                        "bytes_per_second":0.0
+                     }
+                  ],
+                  "read_cache":{
+                     "hits":{
+                        "hz":0.0,
+                        "counter":0,
+                        "roughness":0.0
+                     },
+                     "misses":{
+                        "hz":0.0,
+                        "counter":0,
+                        "roughness":0.0
+                     },
+                     "hit_rate":0.0,
+                     "bytes":12341234
+                  },
+                  "read_latency_statistics":{
+                     "count":0,
+                     "p50_seconds":0.0,
+                     "p99_seconds":0.0,
+                     "p999_seconds":0.0
+                  },
+                  "peek_latency_statistics":{
+                     "count":0,
+                     "p50_seconds":0.0,
+                     "p99_seconds":0.0,
+                     "p999_seconds":0.0
+                  },
                   "id":"eb84471d68c12d1d26f692a50000003f",
                   "finished_queries":{
                      "hz":0.0,
@@ -231,6 +267,94 @@ const KeyRef JSONSchemas::statusSchema = LiteralStringRef(R"statusSchema(
          "transaction_start_seconds":0.0,
          "commit_seconds":0.02
       },
+      "commit_latency_stages":{
+         "proxy":{
+            "get_commit_version":{
+               "count":0,
+               "median_seconds":0.0,
+               "p99_seconds":0.0,
+               "max_seconds":0.0
+            },
+            "resolution":{
+               "count":0,
+               "median_seconds":0.0,
+               "p99_seconds":0.0,
+               "max_seconds":0.0
+            },
+            "post_resolution":{
+               "count":0,
+               "median_seconds":0.0,
+               "p99_seconds":0.0,
+               "max_seconds":0.0
+            },
+            "logging":{
+               "count":0,
+               "median_seconds":0.0,
+               "p99_seconds":0.0,
+               "max_seconds":0.0
+            },
+            "reply":{
+               "count":0,
+               "median_seconds":0.0,
+               "p99_seconds":0.0,
+               "max_seconds":0.0
+            },
+            "total":{
+               "count":0,
+               "median_seconds":0.0,
+               "p99_seconds":0.0,
+               "max_seconds":0.0
+            }
+         },
+         "resolver":{
+            "queue_wait":{
+               "count":0,
+               "median_seconds":0.0,
+               "p99_seconds":0.0,
+               "max_seconds":0.0
+            },
+            "resolve":{
+               "count":0,
+               "median_seconds":0.0,
+               "p99_seconds":0.0,
+               "max_seconds":0.0
+            }
+         },
+         "log":{
+            "wait_for_version":{
+               "count":0,
+               "median_seconds":0.0,
+               "p99_seconds":0.0,
+               "max_seconds":0.0
+            },
+            "durable":{
+               "count":0,
+               "median_seconds":0.0,
+               "p99_seconds":0.0,
+               "max_seconds":0.0
+            },
+            "total":{
+               "count":0,
+               "median_seconds":0.0,
+               "p99_seconds":0.0,
+               "max_seconds":0.0
+            }
+         },
+         "storage":{
+            "apply":{
+               "count":0,
+               "median_seconds":0.0,
+               "p99_seconds":0.0,
+               "max_seconds":0.0
+            },
+            "durable":{
+               "count":0,
+               "median_seconds":0.0,
+               "p99_seconds":0.0,
+               "max_seconds":0.0
+            }
+         }
+      },
       "clients":{
          "count":1,
          "supported_versions":[
@@ -366,6 +490,12 @@ const KeyRef JSONSchemas::statusSchema = LiteralStringRef(R"statusSchema(
                "counter":0,
                "roughness":0.0
             }
+         },
+         "commit_latency_statistics":{
+            "count":0,
+            "p50_seconds":0.0,
+            "p99_seconds":0.0,
+            "p999_seconds":0.0
          }
       },
       "cluster_controller_timestamp":1415650089,
@@ -427,6 +557,8 @@ const KeyRef JSONSchemas::statusSchema = LiteralStringRef(R"statusSchema(
              "ssd",
              "ssd-1",
              "ssd-2",
+             "ssd-lsm",
+             "ssd-redwood-experimental",
              "memory"
          ]},
          "coordinators_count":1,
@@ -628,6 +760,8 @@ const KeyRef JSONSchemas::configurationSchema = LiteralStringRef(R"configSchema(
         "ssd",
         "ssd-1",
         "ssd-2",
+        "ssd-lsm",
+        "ssd-redwood-experimental",
         "memory"
     ]},
     "auto_proxies":3,
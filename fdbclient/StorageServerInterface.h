@@ -58,6 +58,9 @@ struct StorageServerInterface {
 	RequestStream<ReplyPromise<KeyValueStoreType>> getKeyValueStoreType;
 	RequestStream<struct WatchValueRequest> watchValue;
 
+	// Reads several keys at one version; throws wrong_shard_server if any of them is not readable on this server
+	RequestStream<struct GetValuesRequest> getValues;
+
 	explicit StorageServerInterface(UID uid) : uniqueID( uid ) {}
 	StorageServerInterface() : uniqueID( g_random->randomUniqueID() ) {}
 	NetworkAddress address() const { return getVersion.getEndpoint().address; }
@@ -72,11 +75,14 @@ struct StorageServerInterface {
 
 		if( ar.protocolVersion() >= 0x0FDB00A200090001LL )
 			ar & watchValue;
+		if( ar.protocolVersion() >= 0x0FDB00B061030001LL )
+			ar & getValues;
 	}
 	bool operator == (StorageServerInterface const& s) const { return uniqueID == s.uniqueID; }
 	bool operator < (StorageServerInterface const& s) const { return uniqueID < s.uniqueID; }
 	void initEndpoints() {
 		getValue.getEndpoint( TaskLoadBalancedEndpoint );
+		getValues.getEndpoint( TaskLoadBalancedEndpoint );
 		getKey.getEndpoint( TaskLoadBalancedEndpoint );
 		getKeyValues.getEndpoint( TaskLoadBalancedEndpoint );
 	}
@@ -121,6 +127,31 @@ struct GetValueRequest {
 	}
 };
 
+struct GetValuesReply : public LoadBalancedReply {
+	Arena arena;
+	VectorRef<KeyValueRef> data;	// Only the requested keys which are present, in key order
+
+	template <class Ar>
+	void serialize( Ar& ar ) {
+		ar & arena & *(LoadBalancedReply*)this & data;
+	}
+};
+
+struct GetValuesRequest {
+	Arena arena;
+	VectorRef<KeyRef> keys;	// Sorted and unique
+	Version version;
+	Optional<UID> debugID;
+	ReplyPromise<GetValuesReply> reply;
+
+	GetValuesRequest() {}
+
+	template <class Ar>
+	void serialize( Ar& ar ) {
+		ar & keys & version & debugID & reply & arena;
+	}
+};
+
 struct WatchValueRequest {
 	Key key;
 	Optional<Value> value;
@@ -145,7 +176,7 @@ struct GetKeyValuesReply : public LoadBalancedReply {
 
 	template <class Ar>
 	void serialize( Ar& ar ) {
-		ar & *(LoadBalancedReply*)this & data & version & more & arena;
+		ar & arena & *(LoadBalancedReply*)this & data & version & more;
 	}
 };
 
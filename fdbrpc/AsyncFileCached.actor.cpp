@@ -26,18 +26,20 @@ Optional<Reference<EvictablePageCache>> pc4k, pc64k;
 //The simulator needs to store separate page caches for each machine
 static std::map<NetworkAddress, std::pair<Reference<EvictablePageCache>, Reference<EvictablePageCache>>> simulatorPageCaches;
 
+static void* fastAllocatePage4K() { return FastAllocator<4096>::allocate(); }
+static void fastReleasePage4K(void* p) { FastAllocator<4096>::release(p); }
+
+void* (*EvictablePageCache::allocatePage4K)() = &fastAllocatePage4K;
+void (*EvictablePageCache::releasePage4K)(void*) = &fastReleasePage4K;
+
 EvictablePage::~EvictablePage() {
 	if (data) {
 		if (pageCache->pageSize == 4096)
-			FastAllocator<4096>::release(data);
+			EvictablePageCache::releasePage4K(data);
 		else
 			aligned_free(data);
 	}
-	if (index > -1) {
-		pageCache->pages[index] = pageCache->pages.back();
-		pageCache->pages[index]->index = index;
-		pageCache->pages.pop_back();
-	}
+	pageCache->remove(this);
 }
 
 std::map< std::string, OpenFileInfo > AsyncFileCached::openFiles;
@@ -89,14 +91,32 @@ Future<Void> AsyncFileCached::read_write_impl( AsyncFileCached* self, void* data
 	int64_t pageOffset = offset - offsetInPage;
 
 	int remaining = length;
+	int coalesced = 0;  // Pages following this one which coalesceMissingReads() has already found and is reading
 
 	while (remaining) {
-		++self->countFileCacheFinds;
-		++self->countCacheFinds;
 		auto p = self->pages.find( pageOffset );
-		if ( p == self->pages.end() ) {
-			AFCPage* page = new AFCPage( self, pageOffset );
-			p = self->pages.insert( std::make_pair(pageOffset, page) ).first;
+		if ( coalesced ) {
+			ASSERT( p != self->pages.end() );
+			--coalesced;
+		} else if ( p == self->pages.end() ) {
+			++self->countFileCacheFinds;
+			++self->countCacheFinds;
+			++self->countFileCacheMisses;
+			++self->countCacheMisses;
+			if ( !writing )
+				coalesced = self->coalesceMissingReads( pageOffset, offsetInPage + remaining );
+			if ( coalesced ) {
+				p = self->pages.find( pageOffset );
+			} else {
+				AFCPage* page = new AFCPage( self, pageOffset );
+				p = self->pages.insert( std::make_pair(pageOffset, page) ).first;
+			}
+		} else {
+			++self->countFileCacheFinds;
+			++self->countCacheFinds;
+			++self->countFileCacheHits;
+			++self->countCacheHits;
+			self->pageCache->updateHit( p->second );
 		}
 
 		int bytesInPage = std::min(self->pageCache->pageSize - offsetInPage, remaining);
@@ -121,6 +141,36 @@ Future<Void> AsyncFileCached::read_write_impl( AsyncFileCached* self, void* data
 	return waitForAll( actors );
 }
 
+// A read that misses on several adjacent pages reads them with one large read of the underlying file rather than one
+// read per page, so sequential reads (such as read-ahead for range scans) stream from the disk.  Returns the number of
+// pages after the one at pageOffset that are being read this way, or 0 if the page at pageOffset should be read alone.
+int AsyncFileCached::coalesceMissingReads( int64_t pageOffset, int length ) {
+	int maxPages = std::min<int64_t>( FLOW_KNOBS->PAGE_CACHE_MAX_COALESCED_READ_PAGES, (length + pageCache->pageSize - 1) / pageCache->pageSize );
+	int count = 0;
+	// Like AFCPage::readThrough, only pages that existed before any writes we haven't read back are read from the file
+	while ( count < maxPages && pageOffset + int64_t(count) * pageCache->pageSize < prevLength &&
+			pages.find( pageOffset + int64_t(count) * pageCache->pageSize ) == pages.end() )
+		++count;
+	if ( count < 2 ) return 0;
+
+	Promise<Void> loaded;
+	std::vector<AFCPage*> run;
+	for(int i = 0; i < count; i++) {
+		int64_t offset = pageOffset + int64_t(i) * pageCache->pageSize;
+		AFCPage* page = new AFCPage( this, offset );
+		page->notReading = loaded.getFuture();  // before the next allocation, which could otherwise evict this page
+		pages[offset] = page;
+		run.push_back( page );
+	}
+	countFileCacheFinds += count-1;
+	countCacheFinds += count-1;
+	countFileCacheMisses += count-1;
+	countCacheMisses += count-1;
+
+	AFCPage::readThroughRun( run, loaded );
+	return count-1;
+}
+
 Future<Void> AsyncFileCached::readZeroCopy( void** data, int* length, int64_t offset ) {
 	++countFileCacheReads;
 	++countCacheReads;
@@ -131,8 +181,14 @@ Future<Void> AsyncFileCached::readZeroCopy( void** data, int* length, int64_t of
 
 	auto p = pages.find( offset );
 	if ( p == pages.end() ) {
+		++countFileCacheMisses;
+		++countCacheMisses;
 		AFCPage* page = new AFCPage( this, offset );
 		p = pages.insert( std::make_pair(offset, page) ).first;
+	} else {
+		++countFileCacheHits;
+		++countCacheHits;
+		pageCache->updateHit( p->second );
 	}
 
 	*data = p->second->data;
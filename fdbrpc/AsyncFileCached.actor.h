@@ -27,49 +27,164 @@
 #elif !defined(FLOW_ASYNCFILECACHED_ACTOR_H)
 	#define FLOW_ASYNCFILECACHED_ACTOR_H
 
+#include <list>
+
 #include "flow/flow.h"
 #include "IAsyncFile.h"
 #include "flow/Knobs.h"
+#include "flow/Hash3.h"
 #include "flow/TDMetric.actor.h"
 #include "flow/network.h"
 #include "flow/actorcompiler.h"  // This must be the last #include.
 
+// Identifies a page across evictions: a hash of the file name and the page's offset in the file
+typedef std::pair<uint32_t, int64_t> CachePageID;
+
+struct CachePageIDHash {
+	size_t operator()( CachePageID const& id ) const { return std::hash<int64_t>()( id.second ) ^ ( size_t(id.first) << 1 ); }
+};
+
 struct EvictablePage {
 	void* data;
 	int index;
 	class Reference<struct EvictablePageCache> pageCache;
+	CachePageID id;
+	bool frequent;  // ARC: on the frequently used list rather than the recently used list
+	std::list<EvictablePage*>::iterator lruEntry;
 
 	virtual bool evict() = 0; // true if page was evicted, false if it isn't immediately evictable (but will be evicted regardless if possible)
 
-	EvictablePage(Reference<EvictablePageCache> pageCache) : data(0), index(-1), pageCache(pageCache) {}
+	EvictablePage(Reference<EvictablePageCache> pageCache, CachePageID id) : data(0), index(-1), pageCache(pageCache), id(id), frequent(false) {}
 	virtual ~EvictablePage();
 };
 
 struct EvictablePageCache : ReferenceCounted<EvictablePageCache> {
-	EvictablePageCache() : pageSize(0), maxPages(0) {}
-	explicit EvictablePageCache(int pageSize, int64_t maxSize) : pageSize(pageSize), maxPages(maxSize / pageSize) {}
+	enum CacheEvictionType { RANDOM = 0, ARC = 1 };
+
+	static CacheEvictionType evictionPolicyStringToEnum(const std::string &policy) {
+		std::string cep = policy;
+		std::transform(cep.begin(), cep.end(), cep.begin(), ::tolower);
+		if (cep == "arc")
+			return ARC;
+		if (cep != "random")
+			TraceEvent(SevWarnAlways, "UnknownCacheEvictionPolicy").detail("Policy", policy);
+		return RANDOM;
+	}
+
+	EvictablePageCache() : pageSize(0), maxPages(0), cacheEvictionType(RANDOM), arcTarget(0) {}
+	explicit EvictablePageCache(int pageSize, int64_t maxSize) : pageSize(pageSize), maxPages(maxSize / pageSize), cacheEvictionType(evictionPolicyStringToEnum(FLOW_KNOBS->CACHE_EVICTION_POLICY)), arcTarget(0) {}
+
+	// Where 4k pages come from; an IAsyncFile implementation may replace these to cache pages in memory it has registered with the kernel
+	static void* (*allocatePage4K)();
+	static void (*releasePage4K)(void*);
 
 	void allocate(EvictablePage* page) {
 		try_evict();
 		try_evict();
-		page->data = pageSize == 4096 ? FastAllocator<4096>::allocate() : aligned_alloc(4096,pageSize);
+		page->data = pageSize == 4096 ? allocatePage4K() : aligned_alloc(4096,pageSize);
 		page->index = pages.size();
 		pages.push_back(page);
+		if (cacheEvictionType == ARC)
+			arcInsert(page);
+	}
+
+	// Called when a cached page is found for a read or write
+	void updateHit(EvictablePage* page) {
+		if (cacheEvictionType == ARC) {
+			auto& list = page->frequent ? frequentPages : recentPages;
+			frequentPages.splice(frequentPages.begin(), list, page->lruEntry);
+			page->frequent = true;
+		}
 	}
 
 	void try_evict() {
 		if (pages.size() >= (uint64_t)maxPages && !pages.empty()) {
 			for (int i = 0; i < FLOW_KNOBS->MAX_EVICT_ATTEMPTS; i++) { // If we don't manage to evict anything, just go ahead and exceed the cache limit
-				int toEvict = g_random->randomInt(0, pages.size());
-				if (pages[toEvict]->evict())
-					break;
+				if (cacheEvictionType == ARC) {
+					if (arcEvict())
+						break;
+				} else {
+					int toEvict = g_random->randomInt(0, pages.size());
+					if (pages[toEvict]->evict())
+						break;
+				}
 			}
 		}
 	}
 
+	void remove(EvictablePage* page) {
+		if (page->index > -1) {
+			pages[page->index] = pages.back();
+			pages[page->index]->index = page->index;
+			pages.pop_back();
+			if (cacheEvictionType == ARC)
+				(page->frequent ? frequentPages : recentPages).erase(page->lruEntry);
+		}
+	}
+
 	std::vector<EvictablePage*> pages;
 	int pageSize;
 	int64_t maxPages;
+	CacheEvictionType cacheEvictionType;
+
+private:
+	// Adaptive Replacement Cache.  Resident pages are split between a list of pages used once since they were cached and
+	// a list of pages used again, each kept in LRU order (most recent first).  The IDs of pages recently evicted from each
+	// list are remembered on ghost lists, and a miss on a ghost moves arcTarget, the share of the cache given to the
+	// recently used list, towards the list that would have kept the page.  A large scan only ever fills the recently used
+	// list, so the pages which are actually reused stay cached.
+	std::list<EvictablePage*> recentPages, frequentPages;
+	std::list<CachePageID> recentGhosts, frequentGhosts;
+	std::unordered_map<CachePageID, std::pair<bool, std::list<CachePageID>::iterator>, CachePageIDHash> ghosts;
+	int64_t arcTarget;
+
+	void arcInsert(EvictablePage* page) {
+		auto g = ghosts.find(page->id);
+		if (g != ghosts.end()) {
+			if (g->second.first) {
+				arcTarget = std::max<int64_t>(0, arcTarget - std::max<int64_t>(1, recentGhosts.size() / frequentGhosts.size()));
+				frequentGhosts.erase(g->second.second);
+			} else {
+				arcTarget = std::min<int64_t>(maxPages, arcTarget + std::max<int64_t>(1, frequentGhosts.size() / recentGhosts.size()));
+				recentGhosts.erase(g->second.second);
+			}
+			ghosts.erase(g);
+			page->frequent = true;
+			page->lruEntry = frequentPages.insert(frequentPages.begin(), page);
+		} else {
+			page->frequent = false;
+			page->lruEntry = recentPages.insert(recentPages.begin(), page);
+		}
+		trimGhosts();
+	}
+
+	bool arcEvict() {
+		bool fromRecent = !recentPages.empty() && ((int64_t)recentPages.size() > arcTarget || frequentPages.empty());
+		auto& list = fromRecent ? recentPages : frequentPages;
+		EvictablePage* page = list.back();
+		CachePageID id = page->id;
+		if (page->evict()) {
+			auto& ghostList = fromRecent ? recentGhosts : frequentGhosts;
+			ghosts[id] = std::make_pair(!fromRecent, ghostList.insert(ghostList.begin(), id));
+			trimGhosts();
+			return true;
+		}
+		// The page is busy (dirty, being read or flushed, or referenced by a zero-copy read), so look at it again later
+		list.splice(list.begin(), list, page->lruEntry);
+		return false;
+	}
+
+	// Keep the recently used pages and their ghosts within the cache size, and all ghosts within the cache size
+	void trimGhosts() {
+		while (recentPages.size() + recentGhosts.size() > (uint64_t)maxPages && !recentGhosts.empty()) {
+			ghosts.erase(recentGhosts.back());
+			recentGhosts.pop_back();
+		}
+		while (recentGhosts.size() + frequentGhosts.size() > (uint64_t)maxPages && !frequentGhosts.empty()) {
+			ghosts.erase(frequentGhosts.back());
+			frequentGhosts.pop_back();
+		}
+	}
 };
 
 struct OpenFileInfo : NonCopyable {
@@ -181,6 +296,7 @@ public:
 private:
 	static std::map< std::string, OpenFileInfo > openFiles;
 	std::string filename;
+	uint32_t filenameHash;
 	Reference<IAsyncFile> uncached;
 	int64_t length;
 	int64_t prevLength;
@@ -195,6 +311,9 @@ private:
 	Int64MetricHandle countFileCacheWritesBlocked;
 	Int64MetricHandle countFileCachePageReadsMerged;
 	Int64MetricHandle countFileCacheReadBytes;
+	Int64MetricHandle countFileCacheHits;
+	Int64MetricHandle countFileCacheMisses;
+	Int64MetricHandle countFileCacheEvictions;
 
 	Int64MetricHandle countCacheFinds;
 	Int64MetricHandle countCacheReads;
@@ -203,9 +322,12 @@ private:
 	Int64MetricHandle countCacheWritesBlocked;
 	Int64MetricHandle countCachePageReadsMerged;
 	Int64MetricHandle countCacheReadBytes;
+	Int64MetricHandle countCacheHits;
+	Int64MetricHandle countCacheMisses;
+	Int64MetricHandle countCacheEvictions;
 
 	AsyncFileCached( Reference<IAsyncFile> uncached, const std::string& filename, int64_t length, Reference<EvictablePageCache> pageCache ) 
-		: uncached(uncached), filename(filename), length(length), prevLength(length), pageCache(pageCache) {
+		: uncached(uncached), filename(filename), filenameHash(hashlittle(filename.c_str(), filename.size(), 0)), length(length), prevLength(length), pageCache(pageCache) {
 		if( !g_network->isSimulated() ) {
 			countFileCacheWrites.init(         LiteralStringRef("AsyncFile.CountFileCacheWrites"), filename);
 			countFileCacheReads.init(          LiteralStringRef("AsyncFile.CountFileCacheReads"), filename);
@@ -214,6 +336,9 @@ private:
 			countFileCachePageReadsMerged.init(LiteralStringRef("AsyncFile.CountFileCachePageReadsMerged"), filename);
 			countFileCacheFinds.init(          LiteralStringRef("AsyncFile.CountFileCacheFinds"), filename);
 			countFileCacheReadBytes.init(      LiteralStringRef("AsyncFile.CountFileCacheReadBytes"), filename);
+			countFileCacheHits.init(           LiteralStringRef("AsyncFile.CountFileCacheHits"), filename);
+			countFileCacheMisses.init(         LiteralStringRef("AsyncFile.CountFileCacheMisses"), filename);
+			countFileCacheEvictions.init(      LiteralStringRef("AsyncFile.CountFileCacheEvictions"), filename);
 
 			countCacheWrites.init(         LiteralStringRef("AsyncFile.CountCacheWrites"));
 			countCacheReads.init(          LiteralStringRef("AsyncFile.CountCacheReads"));
@@ -222,6 +347,9 @@ private:
 			countCachePageReadsMerged.init(LiteralStringRef("AsyncFile.CountCachePageReadsMerged"));
 			countCacheFinds.init(          LiteralStringRef("AsyncFile.CountCacheFinds"));
 			countCacheReadBytes.init(      LiteralStringRef("AsyncFile.CountCacheReadBytes"));
+			countCacheHits.init(           LiteralStringRef("AsyncFile.CountCacheHits"));
+			countCacheMisses.init(         LiteralStringRef("AsyncFile.CountCacheMisses"));
+			countCacheEvictions.init(      LiteralStringRef("AsyncFile.CountCacheEvictions"));
 
 		}
 	}
@@ -262,6 +390,8 @@ private:
 
 	static Future<Void> read_write_impl( AsyncFileCached* self, void* data, int length, int64_t offset, bool writing );
 
+	int coalesceMissingReads( int64_t pageOffset, int length );
+
 	static Future<Void> truncate_impl( AsyncFileCached* self, int64_t size );
 
 	void remove_page( AFCPage* page );
@@ -270,6 +400,8 @@ private:
 struct AFCPage : public EvictablePage, public FastAllocated<AFCPage> {
 	virtual bool evict() {
 		if ( notReading.isReady() && notFlushing.isReady() && !dirty && !zeroCopyRefCount && !truncated ) {
+			++owner->countFileCacheEvictions;
+			++owner->countCacheEvictions;
 			owner->remove_page( this );
 			delete this;
 			return true;
@@ -367,6 +499,42 @@ struct AFCPage : public EvictablePage, public FastAllocated<AFCPage> {
 		return Void();
 	}
 
+	// Reads adjacent pages, none of which has been read yet, with one read of the underlying file.  The pages wait on
+	// loaded, so they can't be evicted until it is sent.
+	ACTOR static void readThroughRun( std::vector<AFCPage*> run, Promise<Void> loaded ) {
+		state AsyncFileCached* owner = run[0]->owner;
+		state int pageSize = run[0]->pageCache->pageSize;
+		state int length = pageSize * run.size();
+		state uint8_t* buf = (uint8_t*)aligned_alloc( 4096, length );
+		state Error err;
+		try {
+			int bytes = wait( owner->uncached->read( buf, length, run[0]->pageOffset ) );
+			if (bytes != length) {
+				TraceEvent("ReadThroughShortRead").detail("ReadAmount", bytes).detail("Length", length).detail("PageOffset", run[0]->pageOffset);
+				memset( buf + bytes, 0, length - bytes );
+			}
+		} catch (Error& e) {
+			err = e;
+		}
+		if (err.code() != invalid_error_code) {
+			aligned_free( buf );
+			for(auto page : run)
+				page->zeroCopyRefCount = 0;
+			TraceEvent("ReadThroughFailed").error(err);
+			loaded.sendError(err);
+			return;
+		}
+		for(int i = 0; i < run.size(); i++) {
+			// A write of the whole page while the read was outstanding has already made the page valid
+			if (!run[i]->valid) {
+				memcpy( run[i]->data, buf + i * pageSize, pageSize );
+				run[i]->valid = true;
+			}
+		}
+		aligned_free( buf );
+		loaded.send(Void());
+	}
+
 	ACTOR static Future<Void> writeThrough( AFCPage* self, Promise<Void> writing ) {
 		// writeThrough can be called on a page that is not dirty, just to wait for a previous writeThrough to finish.  In that
 		// case we don't want to do any disk I/O
@@ -445,7 +613,7 @@ struct AFCPage : public EvictablePage, public FastAllocated<AFCPage> {
 		return Void();
 	}
 
-	AFCPage( AsyncFileCached* owner, int64_t offset ) : EvictablePage(owner->pageCache), owner(owner), pageOffset(offset), dirty(false), valid(false), truncated(false), notReading(Void()), notFlushing(Void()), zeroCopyRefCount(0), flushableIndex(-1), writeThroughCount(0) {
+	AFCPage( AsyncFileCached* owner, int64_t offset ) : EvictablePage(owner->pageCache, CachePageID(owner->filenameHash, offset)), owner(owner), pageOffset(offset), dirty(false), valid(false), truncated(false), notReading(Void()), notFlushing(Void()), zeroCopyRefCount(0), flushableIndex(-1), writeThroughCount(0) {
 		pageCache->allocate(this);
 	}
 
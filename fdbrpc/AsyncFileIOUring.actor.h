@@ -0,0 +1,661 @@
+/*
+ * AsyncFileIOUring.actor.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#ifdef __linux__
+
+// When actually compiled (NO_INTELLISENSE), include the generated version of this file.  In intellisense use the source version.
+#if defined(NO_INTELLISENSE) && !defined(FLOW_ASYNCFILEIOURING_ACTOR_G_H)
+	#define FLOW_ASYNCFILEIOURING_ACTOR_G_H
+	#include "AsyncFileIOUring.actor.g.h"
+#elif !defined(FLOW_ASYNCFILEIOURING_ACTOR_H)
+	#define FLOW_ASYNCFILEIOURING_ACTOR_H
+
+#include "IAsyncFile.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include "fdbrpc/linux_io_uring.h"
+#include "fdbrpc/AsyncFileCached.actor.h"
+#include "flow/Knobs.h"
+#include "flow/UnitTest.h"
+#include <stdio.h>
+#include "flow/genericactors.actor.h"
+#include "flow/actorcompiler.h"  // This must be the last #include.
+
+// An unbuffered file doing its I/O through an io_uring shared by all files of the process, in place of AsyncFileKAIO.
+// Requests are queued by priority as in AsyncFileKAIO and submitted with one io_uring_enter per run loop iteration.
+// fdatasync is a ring operation too, rather than a hop through the eio thread pool.  Reads and writes to pages of the
+// page cache use the buffer registered with the ring, so the kernel need not map them on each request.
+class AsyncFileIOUring : public IAsyncFile, public ReferenceCounted<AsyncFileIOUring> {
+public:
+	static Future<Reference<IAsyncFile>> open( std::string filename, int flags, int mode, void* ignore ) {
+		ASSERT( flags & OPEN_UNBUFFERED );
+
+		if (flags & OPEN_LOCK)
+			mode |= 02000;  // Enable mandatory locking for this file if it is supported by the filesystem
+
+		std::string open_filename = filename;
+		if (flags & OPEN_ATOMIC_WRITE_AND_CREATE) {
+			ASSERT( (flags & OPEN_CREATE) && (flags & OPEN_READWRITE) && !(flags & OPEN_EXCLUSIVE) );
+			open_filename = filename + ".part";
+		}
+
+		int fd = ::open( open_filename.c_str(), openFlags(flags) | O_DIRECT, mode );
+		if (fd<0) {
+			Error e = errno==ENOENT ? file_not_found() : io_error();
+			TraceEvent("AsyncFileIOUringOpenFailed").error(e).detail("Filename", filename).detailf("Flags", "%x", flags)
+				.detailf("OSFlags", "%x", openFlags(flags) | O_DIRECT).detailf("Mode", "0%o", mode).GetLastError();
+			return e;
+		} else {
+			TraceEvent("AsyncFileIOUringOpen")
+				.detail("Filename", filename)
+				.detail("Flags", flags)
+				.detail("Mode", mode)
+				.detail("Fd", fd);
+		}
+
+		Reference<AsyncFileIOUring> r(new AsyncFileIOUring( fd, flags, filename ));
+
+		if (flags & OPEN_LOCK) {
+			// Acquire a "write" lock for the entire file
+			flock lockDesc;
+			lockDesc.l_type = F_WRLCK;
+			lockDesc.l_whence = SEEK_SET;
+			lockDesc.l_start = 0;
+			lockDesc.l_len = 0;
+			lockDesc.l_pid = 0;
+			if (fcntl(fd, F_SETLK, &lockDesc) == -1) {
+				TraceEvent(SevError, "UnableToLockFile").detail("Filename", filename).GetLastError();
+				return io_error();
+			}
+		}
+
+		struct stat buf;
+		if (fstat( fd, &buf )) {
+			TraceEvent("AsyncFileIOUringFStatError").detail("Fd",fd).detail("Filename", filename).GetLastError();
+			return io_error();
+		}
+
+		r->lastFileSize = r->nextFileSize = buf.st_size;
+		return Reference<IAsyncFile>(std::move(r));
+	}
+
+	// Returns false, leaving nothing set up, if the kernel does not support io_uring; the caller should then use AsyncFileKAIO
+	static bool init( Reference<IEventFD> ev, double ioTimeout ) {
+		int entries = 1;
+		while (entries < std::max(FLOW_KNOBS->IO_URING_ENTRIES, FLOW_KNOBS->MAX_OUTSTANDING))
+			entries *= 2;
+
+		linux_io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		int ring = io_uring_setup( entries, &p );
+		if (ring < 0) {
+			TraceEvent(SevWarnAlways, "IOUringSetupError").detail("Entries", entries).GetLastError();
+			return false;
+		}
+
+		size_t sqRingBytes = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+		size_t cqRingBytes = p.cq_off.cqes + p.cq_entries * sizeof(linux_io_uring_cqe);
+		size_t sqeBytes = p.sq_entries * sizeof(linux_io_uring_sqe);
+		uint8_t* sq = (uint8_t*)mmap( 0, sqRingBytes, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQ_RING );
+		uint8_t* cq = (uint8_t*)mmap( 0, cqRingBytes, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_CQ_RING );
+		void* sqes = mmap( 0, sqeBytes, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQES );
+		int evfd = ev->getFD();
+		if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED || io_uring_register( ring, IORING_REGISTER_EVENTFD, &evfd, 1 ) < 0) {
+			TraceEvent(SevWarnAlways, "IOUringMapError").GetLastError();
+			if (sq != MAP_FAILED) munmap( sq, sqRingBytes );
+			if (cq != MAP_FAILED) munmap( cq, cqRingBytes );
+			if (sqes != MAP_FAILED) munmap( sqes, sqeBytes );
+			::close( ring );
+			return false;
+		}
+
+		ctx.ring = ring;
+		ctx.sqHead = (uint32_t*)(sq + p.sq_off.head);
+		ctx.sqTail = (uint32_t*)(sq + p.sq_off.tail);
+		ctx.sqMask = *(uint32_t*)(sq + p.sq_off.ring_mask);
+		ctx.sqEntries = p.sq_entries;
+		ctx.sqArray = (uint32_t*)(sq + p.sq_off.array);
+		ctx.sqes = (linux_io_uring_sqe*)sqes;
+		ctx.cqHead = (uint32_t*)(cq + p.cq_off.head);
+		ctx.cqTail = (uint32_t*)(cq + p.cq_off.tail);
+		ctx.cqMask = *(uint32_t*)(cq + p.cq_off.ring_mask);
+		ctx.cqes = (linux_io_uring_cqe*)(cq + p.cq_off.cqes);
+
+		if( !g_network->isSimulated() ) {
+			ctx.countSubmit.init(LiteralStringRef("AsyncFile.CountIOUringSubmit"));
+			ctx.countCollect.init(LiteralStringRef("AsyncFile.CountIOUringCollect"));
+			ctx.countFixed.init(LiteralStringRef("AsyncFile.CountIOUringFixedBuffer"));
+			ctx.countPreSubmitTruncate.init(LiteralStringRef("AsyncFile.CountPreIOUringSubmitTruncate"));
+		}
+
+		registerPages();
+
+		TraceEvent("IOUringInit").detail("Entries", p.sq_entries).detail("CQEntries", p.cq_entries)
+			.detail("RegisteredBytes", ctx.registeredEnd - ctx.registeredBegin);
+
+		setTimeout(ioTimeout);
+		poll(ev);
+
+		g_network->setGlobal(INetwork::enRunCycleFunc, (flowGlobalType) &AsyncFileIOUring::launch);
+		return true;
+	}
+
+	static bool active() { return ctx.ring >= 0; }
+	static void setTimeout(double ioTimeout) { ctx.setIOTimeout(ioTimeout); }
+
+	virtual void addref() { ReferenceCounted<AsyncFileIOUring>::addref(); }
+	virtual void delref() { ReferenceCounted<AsyncFileIOUring>::delref(); }
+
+	virtual Future<int> read( void* data, int length, int64_t offset ) {
+		++countFileLogicalReads;
+		++countLogicalReads;
+
+		if(failed) {
+			return io_timeout();
+		}
+
+		IOBlock *io = new IOBlock(IORING_OP_READV, fd);
+		io->buf = data;
+		io->nbytes = length;
+		io->offset = offset;
+
+		enqueue(io, this);
+		return io->result.getFuture();
+	}
+	virtual Future<Void> write( void const* data, int length, int64_t offset ) {
+		++countFileLogicalWrites;
+		++countLogicalWrites;
+
+		if(failed) {
+			return io_timeout();
+		}
+
+		IOBlock *io = new IOBlock(IORING_OP_WRITEV, fd);
+		io->buf = (void*)data;
+		io->nbytes = length;
+		io->offset = offset;
+
+		nextFileSize = std::max( nextFileSize, offset+length );
+
+		enqueue(io, this);
+		return success(io->result.getFuture());
+	}
+	virtual Future<Void> truncate( int64_t size ) {
+		++countFileLogicalWrites;
+		++countLogicalWrites;
+
+		if(failed) {
+			return io_timeout();
+		}
+
+		int result = -1;
+		bool completed = false;
+		if( ctx.fallocateSupported && size >= lastFileSize ) {
+			result = fallocate( fd, 0, 0, size);
+			if (result != 0) {
+				int fallocateErrCode = errno;
+				TraceEvent("AsyncFileIOUringAllocateError").detail("Fd",fd).detail("Filename", filename).GetLastError();
+				if ( fallocateErrCode == EOPNOTSUPP ) {
+					// Mark fallocate as unsupported. Try again with truncate.
+					ctx.fallocateSupported = false;
+				} else {
+					return io_error();
+				}
+			} else {
+				completed = true;
+			}
+		}
+		if ( !completed )
+			result = ftruncate(fd, size);
+
+		if(result != 0) {
+			TraceEvent("AsyncFileIOUringTruncateError").detail("Fd",fd).detail("Filename", filename).GetLastError();
+			return io_error();
+		}
+
+		lastFileSize = nextFileSize = size;
+
+		return Void();
+	}
+
+	ACTOR static Future<Void> throwErrorIfFailed( Reference<AsyncFileIOUring> self, Future<Void> sync ) {
+		wait( sync );
+		if(self->failed) {
+			throw io_timeout();
+		}
+		return Void();
+	}
+
+	virtual Future<Void> sync() {
+		++countFileLogicalWrites;
+		++countLogicalWrites;
+
+		if(failed) {
+			return io_timeout();
+		}
+
+		// As with fdatasync(2), this covers the writes which have completed, not those still in the ring
+		IOBlock *io = new IOBlock(IORING_OP_FSYNC, fd);
+		io->fsyncFlags = IORING_FSYNC_DATASYNC;
+		enqueue(io, this);
+		Future<Void> fsync = throwErrorIfFailed(Reference<AsyncFileIOUring>::addRef(this), success(io->result.getFuture()));
+
+		if (flags & OPEN_ATOMIC_WRITE_AND_CREATE) {
+			flags &= ~OPEN_ATOMIC_WRITE_AND_CREATE;
+
+			return AsyncFileEIO::waitAndAtomicRename( fsync, filename+".part", filename );
+		}
+
+		return fsync;
+	}
+	virtual Future<int64_t> size() { return nextFileSize; }
+	virtual int64_t debugFD() {
+		return fd;
+	}
+	virtual std::string getFilename() {
+		return filename;
+	}
+	~AsyncFileIOUring() {
+		close(fd);
+	}
+
+	static void launch() {
+		if (ctx.queue.size() && ctx.outstanding < FLOW_KNOBS->MAX_OUTSTANDING) {
+			double begin = timer_monotonic();
+			if (!ctx.outstanding) ctx.ioStallBegin = begin;
+
+			// Only this thread writes the submission tail; the kernel advances the head as it consumes entries
+			uint32_t tail = *ctx.sqTail;
+			uint32_t head = __atomic_load_n( ctx.sqHead, __ATOMIC_ACQUIRE );
+			int n = std::min<size_t>( FLOW_KNOBS->MAX_OUTSTANDING - ctx.outstanding, ctx.queue.size() );
+			n = std::min<int>( n, ctx.sqEntries - (tail - head) );
+
+			for(int i=0; i<n; i++) {
+				auto io = ctx.queue.top();
+				ctx.queue.pop();
+				io->startTime = now();
+
+				if(ctx.ioTimeout > 0) {
+					ctx.appendToRequestList(io);
+				}
+
+				if (io->owner->lastFileSize != io->owner->nextFileSize) {
+					++ctx.countPreSubmitTruncate;
+					io->owner->truncate(io->owner->nextFileSize);
+				}
+
+				uint32_t index = tail & ctx.sqMask;
+				io->prepare( ctx.sqes[index] );
+				ctx.sqArray[index] = index;
+				tail++;
+			}
+			__atomic_store_n( ctx.sqTail, tail, __ATOMIC_RELEASE );
+			ctx.outstanding += n;
+			ctx.unsubmitted += n;
+
+			int rc;
+			loop {
+				rc = io_uring_enter( ctx.ring, ctx.unsubmitted, 0, 0 );
+				if (rc>=0 || errno!=EINTR) break;
+			}
+			if (rc >= 0) {
+				ctx.unsubmitted -= rc;
+			} else if (errno != EAGAIN && errno != EBUSY) {
+				// Entries that were not consumed stay in the ring and are submitted again next time
+				TraceEvent(SevError, "IOUringEnterError").suppressFor(1.0).detail("Unsubmitted", ctx.unsubmitted).GetLastError();
+			}
+			++ctx.countSubmit;
+
+			double elapsed = timer_monotonic() - begin;
+			g_network->networkMetrics.secSquaredSubmit += elapsed*elapsed/2;
+			if(elapsed > FLOW_KNOBS->SLOW_LOOP_CUTOFF && g_nondeterministic_random->random01() < elapsed) {
+				TraceEvent("SlowIOUringLaunch").detail("Elapsed", elapsed).detail("Submitted", n).detail("Queued", ctx.queue.size());
+			}
+		}
+	}
+
+	bool failed;
+private:
+	int fd, flags;
+	int64_t lastFileSize, nextFileSize;
+	std::string filename;
+	Int64MetricHandle countFileLogicalWrites;
+	Int64MetricHandle countFileLogicalReads;
+
+	Int64MetricHandle countLogicalWrites;
+	Int64MetricHandle countLogicalReads;
+
+	struct IOBlock : FastAllocated<IOBlock> {
+		uint8_t opcode;
+		int fd;
+		void* buf;
+		int nbytes;
+		int64_t offset;
+		uint32_t fsyncFlags;
+		iovec iov;
+
+		Promise<int> result;
+		Reference<AsyncFileIOUring> owner;
+		int64_t prio;
+		IOBlock *prev;
+		IOBlock *next;
+		double startTime;
+
+		struct indirect_order_by_priority { bool operator () ( IOBlock* a, IOBlock* b ) { return a->prio < b->prio; } };
+
+		IOBlock(uint8_t opcode, int fd) : opcode(opcode), fd(fd), buf(nullptr), nbytes(0), offset(0), fsyncFlags(0), prev(nullptr), next(nullptr), startTime(0) {}
+
+		int getTask() const { return (prio>>32)+1; }
+
+		void prepare( linux_io_uring_sqe& sqe ) {
+			memset( &sqe, 0, sizeof(sqe) );
+			sqe.fd = fd;
+			sqe.off = offset;
+			sqe.user_data = (uint64_t)this;
+			if (opcode == IORING_OP_FSYNC) {
+				sqe.opcode = opcode;
+				sqe.op_flags = fsyncFlags;
+			} else if (isRegistered( buf, nbytes )) {
+				++ctx.countFixed;
+				sqe.opcode = opcode == IORING_OP_READV ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+				sqe.addr = (uint64_t)buf;
+				sqe.len = nbytes;
+				sqe.buf_index = 0;
+			} else {
+				iov.iov_base = buf;
+				iov.iov_len = nbytes;
+				sqe.opcode = opcode;
+				sqe.addr = (uint64_t)&iov;
+				sqe.len = 1;
+			}
+		}
+
+		ACTOR static void deliver( Promise<int> result, bool failed, int r, int task ) {
+			wait( delay(0, task) );
+			if (failed) result.sendError(io_timeout());
+			else if (r < 0) result.sendError(io_error());
+			else result.send(r);
+		}
+
+		void setResult( int r ) {
+			if (r<0) {
+				struct stat fst;
+				fstat( fd, &fst );
+
+				errno = -r;
+				TraceEvent("AsyncFileIOUringIOError").GetLastError().detail("Fd", fd).detail("Op", opcode).detail("Nbytes", nbytes).detail("Offset", offset).detail("Ptr", int64_t(buf))
+					.detail("Size", fst.st_size).detail("Filename", owner->filename);
+			}
+			deliver( result, owner->failed, r, getTask() );
+			delete this;
+		}
+
+		void timeout(bool warnOnly) {
+			TraceEvent(SevWarnAlways, "AsyncFileIOUringTimeout").detail("Fd", fd).detail("Op", opcode).detail("Nbytes", nbytes).detail("Offset", offset).detail("Ptr", int64_t(buf))
+				.detail("Filename", owner->filename);
+			g_network->setGlobal(INetwork::enASIOTimedOut, (flowGlobalType)true);
+
+			if(!warnOnly)
+				owner->failed = true;
+		}
+	};
+
+	struct Context {
+		int ring;
+		uint32_t *sqHead, *sqTail, *sqArray;
+		uint32_t sqMask, sqEntries;
+		linux_io_uring_sqe* sqes;
+		uint32_t *cqHead, *cqTail;
+		uint32_t cqMask;
+		linux_io_uring_cqe* cqes;
+
+		int outstanding;  // Entries placed in the ring and not yet completed
+		int unsubmitted;  // Entries placed in the ring that io_uring_enter has not yet consumed
+		double ioStallBegin;
+		bool fallocateSupported;
+		std::priority_queue<IOBlock*, std::vector<IOBlock*>, IOBlock::indirect_order_by_priority> queue;
+		Int64MetricHandle countSubmit;
+		Int64MetricHandle countCollect;
+		Int64MetricHandle countFixed;
+		Int64MetricHandle countPreSubmitTruncate;
+
+		// The buffer registered with the ring, from which page cache pages are allocated
+		uint8_t *registeredBegin, *registeredEnd;
+		std::vector<void*> freePages;
+
+		double ioTimeout;
+		bool timeoutWarnOnly;
+		IOBlock *submittedRequestList;
+
+		uint32_t opsIssued;
+		Context() : ring(-1), sqHead(nullptr), sqTail(nullptr), sqArray(nullptr), sqMask(0), sqEntries(0), sqes(nullptr), cqHead(nullptr), cqTail(nullptr), cqMask(0), cqes(nullptr),
+			outstanding(0), unsubmitted(0), ioStallBegin(0), fallocateSupported(true), registeredBegin(nullptr), registeredEnd(nullptr), submittedRequestList(nullptr), opsIssued(0) {
+			setIOTimeout(0);
+		}
+
+		void setIOTimeout(double timeout) {
+			ioTimeout = fabs(timeout);
+			timeoutWarnOnly = timeout < 0;
+		}
+
+		void appendToRequestList(IOBlock *io) {
+			ASSERT(!io->next && !io->prev);
+
+			if(submittedRequestList) {
+				io->prev = submittedRequestList->prev;
+				io->prev->next = io;
+
+				submittedRequestList->prev = io;
+				io->next = submittedRequestList;
+			}
+			else {
+				submittedRequestList = io;
+				io->next = io->prev = io;
+			}
+		}
+
+		void removeFromRequestList(IOBlock *io) {
+			if(io->next == nullptr) {
+				ASSERT(io->prev == nullptr);
+				return;
+			}
+
+			ASSERT(io->prev != nullptr);
+
+			if(io == io->next) {
+				ASSERT(io == submittedRequestList && io == io->prev);
+				submittedRequestList = nullptr;
+			}
+			else {
+				io->next->prev = io->prev;
+				io->prev->next = io->next;
+
+				if(submittedRequestList == io) {
+					submittedRequestList = io->next;
+				}
+			}
+
+			io->next = io->prev = nullptr;
+		}
+	};
+	static Context ctx;
+
+	explicit AsyncFileIOUring(int fd, int flags, std::string const& filename) : fd(fd), flags(flags), filename(filename), failed(false) {
+		if( !g_network->isSimulated() ) {
+			countFileLogicalWrites.init(LiteralStringRef("AsyncFile.CountFileLogicalWrites"), filename);
+			countFileLogicalReads.init( LiteralStringRef("AsyncFile.CountFileLogicalReads"), filename);
+			countLogicalWrites.init(LiteralStringRef("AsyncFile.CountLogicalWrites"));
+			countLogicalReads.init( LiteralStringRef("AsyncFile.CountLogicalReads"));
+		}
+	}
+
+	static bool isRegistered( void const* p, int length ) {
+		return (uint8_t const*)p >= ctx.registeredBegin && (uint8_t const*)p + length <= ctx.registeredEnd;
+	}
+
+	static void* allocatePage() {
+		if (ctx.freePages.empty())
+			return FastAllocator<4096>::allocate();
+		void* p = ctx.freePages.back();
+		ctx.freePages.pop_back();
+		return p;
+	}
+
+	static void releasePage( void* p ) {
+		if (isRegistered( p, 4096 ))
+			ctx.freePages.push_back( p );
+		else
+			FastAllocator<4096>::release( p );
+	}
+
+	static void registerPages() {
+		// The kernel limits each registered buffer to 1GB, and all of them to RLIMIT_MEMLOCK; without one, pages are simply not fixed
+		int64_t bytes = std::min<int64_t>( FLOW_KNOBS->IO_URING_REGISTERED_PAGES, (1<<30) / 4096 ) * 4096;
+		if (bytes <= 0) return;
+
+		uint8_t* base = (uint8_t*)aligned_alloc( 4096, bytes );
+		iovec iov;
+		iov.iov_base = base;
+		iov.iov_len = bytes;
+		if (io_uring_register( ctx.ring, IORING_REGISTER_BUFFERS, &iov, 1 ) < 0) {
+			TraceEvent(SevWarnAlways, "IOUringRegisterBuffersError").detail("Bytes", bytes).GetLastError();
+			aligned_free( base );
+			return;
+		}
+
+		ctx.registeredBegin = base;
+		ctx.registeredEnd = base + bytes;
+		ctx.freePages.reserve( bytes / 4096 );
+		for(int64_t offset = bytes - 4096; offset >= 0; offset -= 4096)
+			ctx.freePages.push_back( base + offset );
+
+		EvictablePageCache::allocatePage4K = &AsyncFileIOUring::allocatePage;
+		EvictablePageCache::releasePage4K = &AsyncFileIOUring::releasePage;
+	}
+
+	void enqueue( IOBlock* io, AsyncFileIOUring* owner ) {
+		ASSERT( int64_t(io->buf) % 4096 == 0 && io->offset % 4096 == 0 && io->nbytes % 4096 == 0 );
+
+		io->prio = (int64_t(g_network->getCurrentTask())<<32) - (++ctx.opsIssued);
+		io->owner = Reference<AsyncFileIOUring>::addRef(owner);
+
+		ctx.queue.push(io);
+	}
+
+	static int openFlags(int flags) {
+		int oflags = 0;
+		ASSERT( bool(flags & OPEN_READONLY) != bool(flags & OPEN_READWRITE) );  // readonly xor readwrite
+		if( flags & OPEN_EXCLUSIVE ) oflags |= O_EXCL;
+		if( flags & OPEN_CREATE )    oflags |= O_CREAT;
+		if( flags & OPEN_READONLY )  oflags |= O_RDONLY;
+		if( flags & OPEN_READWRITE ) oflags |= O_RDWR;
+		if( flags & OPEN_ATOMIC_WRITE_AND_CREATE ) oflags |= O_TRUNC;
+		return oflags;
+	}
+
+	ACTOR static void poll( Reference<IEventFD> ev ) {
+		loop {
+			int64_t evfd_count = wait( ev->read() );
+
+			wait(delay(0, TaskDiskIOComplete));
+
+			uint32_t head = *ctx.cqHead;
+			uint32_t tail = __atomic_load_n( ctx.cqTail, __ATOMIC_ACQUIRE );
+			int n = tail - head;
+
+			++ctx.countCollect;
+			if (n) {
+				double t = timer_monotonic();
+				double elapsed = t - ctx.ioStallBegin;
+				ctx.ioStallBegin = t;
+				g_network->networkMetrics.secSquaredDiskStall += elapsed*elapsed/2;
+			}
+
+			ctx.outstanding -= n;
+
+			if(ctx.ioTimeout > 0) {
+				double currentTime = now();
+				while(ctx.submittedRequestList && currentTime - ctx.submittedRequestList->startTime > ctx.ioTimeout) {
+					ctx.submittedRequestList->timeout(ctx.timeoutWarnOnly);
+					ctx.removeFromRequestList(ctx.submittedRequestList);
+				}
+			}
+
+			for(; head != tail; head++) {
+				linux_io_uring_cqe const& cqe = ctx.cqes[head & ctx.cqMask];
+				IOBlock* iob = (IOBlock*)cqe.user_data;
+
+				if(ctx.ioTimeout > 0) {
+					ctx.removeFromRequestList(iob);
+				}
+
+				iob->setResult( cqe.res );
+			}
+			__atomic_store_n( ctx.cqHead, tail, __ATOMIC_RELEASE );
+		}
+	}
+};
+
+TEST_CASE("fdbrpc/AsyncFileIOUring/ReadWrite") {
+	if(AsyncFileIOUring::active()) { // Only when Net2FileSystem chose this over AsyncFileKAIO
+		state Reference<IAsyncFile> f = wait(AsyncFileIOUring::open("/tmp/__IOURING_TEST_FILE__", IAsyncFile::OPEN_UNBUFFERED | IAsyncFile::OPEN_READWRITE | IAsyncFile::OPEN_CREATE, 0666, nullptr));
+		state int pages = 256;
+		// Pages both from the registered buffer (when there is one) and from elsewhere
+		state std::vector<void*> bufs;
+		state int i;
+		for(i = 0; i < 16; i++)
+			bufs.push_back(i%2 ? EvictablePageCache::allocatePage4K() : FastAllocator<4096>::allocate());
+
+		state std::vector<Future<Void>> writes;
+		for(i = 0; i < pages; i++) {
+			void* buf = bufs[i % bufs.size()];
+			memset(buf, i % bufs.size(), 4096);
+			writes.push_back(f->write(buf, 4096, int64_t(i) * 4096));
+		}
+		wait(waitForAll(writes));
+		wait(f->sync());
+
+		for(i = 0; i < pages; i++) {
+			void* buf = bufs[(i+1) % bufs.size()];
+			int bytesRead = wait(f->read(buf, 4096, int64_t(i) * 4096));
+			ASSERT(bytesRead == 4096);
+			for(int b = 0; b < 4096; b++)
+				ASSERT(((uint8_t*)buf)[b] == i % bufs.size());
+		}
+
+		for(i = 0; i < bufs.size(); i++) {
+			if(i%2) EvictablePageCache::releasePage4K(bufs[i]);
+			else FastAllocator<4096>::release(bufs[i]);
+		}
+		wait(AsyncFileEIO::deleteFile(f->getFilename(), true));
+	}
+
+	return Void();
+}
+
+AsyncFileIOUring::Context AsyncFileIOUring::ctx;
+
+#include "flow/unactorcompiler.h"
+#endif
+#endif
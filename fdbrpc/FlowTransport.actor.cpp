@@ -28,6 +28,7 @@
 #include "FailureMonitor.h"
 #include "crc32c.h"
 #include "simulator.h"
+#include "zlib/zlib.h"
 
 #if VALGRIND
 #include <memcheck.h>
@@ -41,6 +42,10 @@ const UID WLTOKEN_PING_PACKET(-1, 1);
 const UID TOKEN_IGNORE_PACKET(0, 2);
 const uint64_t TOKEN_STREAM_FLAG = 1;
 
+// The high bit of a packet's length marks a packet whose contents were deflated.  They are sent as the uncompressed length
+// followed by a raw deflate stream, and the checksum covers them as sent.
+const uint32_t COMPRESSED_PACKET_FLAG = 0x80000000;
+
 
 class EndpointMap : NonCopyable {
 public:
@@ -192,9 +197,11 @@ public:
 
 #define CONNECT_PACKET_V0 0x0FDB00A444020001LL
 #define CONNECT_PACKET_V1 0x0FDB00A446030001LL
+#define CONNECT_PACKET_V2 0x0FDB00B061040001LL
 #define CONNECT_PACKET_V0_SIZE 14
 #define CONNECT_PACKET_V1_SIZE 22
 #define CONNECT_PACKET_V2_SIZE 26
+#define CONNECT_PACKET_V3_SIZE 30
 
 #pragma pack( push, 1 )
 struct ConnectPacket {
@@ -203,21 +210,67 @@ struct ConnectPacket {
 	uint16_t canonicalRemotePort;  // Port number to reconnect to the originating process
 	uint64_t connectionId;         // Multi-version clients will use the same Id for both connections, other connections will set this to zero. Added at protocol Version 0x0FDB00A444020001.
 	uint32_t canonicalRemoteIp;    // IP Address to reconnect to the originating process
+	uint32_t options;              // ConnectPacket::Options flags for this connection. Added at protocol version 0x0FDB00B061040001.
+
+	enum Options {
+		ACCEPTS_COMPRESSION = 1        // The originating process wants large packets sent to it deflated
+	};
 
 	size_t minimumSize() {
 		if (protocolVersion < CONNECT_PACKET_V0) return CONNECT_PACKET_V0_SIZE;
 		if (protocolVersion < CONNECT_PACKET_V1) return CONNECT_PACKET_V1_SIZE;
-		return CONNECT_PACKET_V2_SIZE;
+		if (protocolVersion < CONNECT_PACKET_V2) return CONNECT_PACKET_V2_SIZE;
+		return CONNECT_PACKET_V3_SIZE;
 	}
 };
 
-static_assert( sizeof(ConnectPacket) == CONNECT_PACKET_V2_SIZE, "ConnectPacket packed incorrectly" );
+static_assert( sizeof(ConnectPacket) == CONNECT_PACKET_V3_SIZE, "ConnectPacket packed incorrectly" );
 #pragma pack( pop )
 
 static Future<Void> connectionReader( TransportData* const& transport, Reference<IConnection> const& conn, Peer* const& peer, Promise<Peer*> const& onConnected );
 
 static PacketID sendPacket( TransportData* self, ISerializeSource const& what, const Endpoint& destination, bool reliable, bool openConnection );
 
+struct PeerCompressionStats {
+	// Packets deflated before being sent to the peer (or found not to be worth it), and inflated after being received
+	// from it, since these were last logged.  The CPU time is that spent in zlib on the network thread.
+	int64_t packetsCompressed, packetsIncompressible, bytesBeforeCompression, bytesAfterCompression;
+	int64_t packetsDecompressed, bytesBeforeDecompression, bytesAfterDecompression;
+	double compressionSeconds, decompressionSeconds;
+	double lastLogged;
+
+	PeerCompressionStats() : lastLogged(now()) { reset(); }
+
+	void reset() {
+		packetsCompressed = packetsIncompressible = bytesBeforeCompression = bytesAfterCompression = 0;
+		packetsDecompressed = bytesBeforeDecompression = bytesAfterDecompression = 0;
+		compressionSeconds = decompressionSeconds = 0;
+	}
+
+	void log( NetworkAddress const& peer ) {
+		if (packetsCompressed || packetsIncompressible || packetsDecompressed) {
+			TraceEvent("PeerCompression")
+				.detail("PeerAddr", peer)
+				.detail("Elapsed", now() - lastLogged)
+				.detail("PacketsCompressed", packetsCompressed)
+				.detail("PacketsIncompressible", packetsIncompressible)
+				.detail("BytesBeforeCompression", bytesBeforeCompression)
+				.detail("BytesAfterCompression", bytesAfterCompression)
+				.detail("CompressionRatio", bytesAfterCompression ? (double)bytesBeforeCompression / bytesAfterCompression : 0.0)
+				.detail("CompressionCPUSeconds", compressionSeconds)
+				.detail("CompressionCPUSecondsPerGB", bytesBeforeCompression ? compressionSeconds * 1e9 / bytesBeforeCompression : 0.0)
+				.detail("PacketsDecompressed", packetsDecompressed)
+				.detail("BytesBeforeDecompression", bytesBeforeDecompression)
+				.detail("BytesAfterDecompression", bytesAfterDecompression)
+				.detail("DecompressionRatio", bytesBeforeDecompression ? (double)bytesAfterDecompression / bytesBeforeDecompression : 0.0)
+				.detail("DecompressionCPUSeconds", decompressionSeconds)
+				.detail("DecompressionCPUSecondsPerGB", bytesAfterDecompression ? decompressionSeconds * 1e9 / bytesAfterDecompression : 0.0);
+		}
+		reset();
+		lastLogged = now();
+	}
+};
+
 struct Peer : NonCopyable {
 	TransportData* transport;
 	NetworkAddress destination;
@@ -232,9 +285,11 @@ struct Peer : NonCopyable {
 	double reconnectionDelay;
 	int peerReferences;
 	bool incompatibleProtocolVersionNewer;
+	bool compressPackets;  // The peer asked for large packets to be deflated on the current connection, and so do we
+	PeerCompressionStats compression;
 
 	explicit Peer( TransportData* transport, NetworkAddress const& destination )
-		: transport(transport), destination(destination), outgoingConnectionIdle(false), lastConnectTime(0.0), reconnectionDelay(FLOW_KNOBS->INITIAL_RECONNECTION_TIME), compatible(true), incompatibleProtocolVersionNewer(false), peerReferences(-1)
+		: transport(transport), destination(destination), outgoingConnectionIdle(false), lastConnectTime(0.0), reconnectionDelay(FLOW_KNOBS->INITIAL_RECONNECTION_TIME), compatible(true), incompatibleProtocolVersionNewer(false), peerReferences(-1), compressPackets(false)
 	{
 		connect = connectionKeeper(this);
 	}
@@ -259,6 +314,7 @@ struct Peer : NonCopyable {
 		pkt.connectPacketLength = sizeof(pkt)-sizeof(pkt.connectPacketLength);
 		pkt.protocolVersion = currentProtocolVersion;
 		pkt.connectionId = transport->transportId;
+		pkt.options = FLOW_KNOBS->NETWORK_COMPRESSION ? ConnectPacket::ACCEPTS_COMPRESSION : 0;
 
 		PacketBuffer* pb_first = new PacketBuffer;
 		PacketWriter wr( pb_first, NULL, Unversioned() );
@@ -319,6 +375,9 @@ struct Peer : NonCopyable {
 
 			wait( delayJittered( FLOW_KNOBS->CONNECTION_MONITOR_LOOP_TIME ) );
 
+			if (now() - peer->compression.lastLogged >= FLOW_KNOBS->NETWORK_COMPRESSION_LOGGING_INTERVAL)
+				peer->compression.log( peer->destination );
+
 			// SOMEDAY: Stop monitoring and close the connection after a long period of inactivity with no reliable or onDisconnect requests outstanding
 
 			state ReplyPromise<Void> reply;
@@ -385,6 +444,7 @@ struct Peer : NonCopyable {
 					if (_conn) {
 						conn = _conn;
 						TraceEvent("ConnectionExchangingConnectPacket", conn->getDebugID()).suppressFor(1.0).detail("PeerAddr", self->destination);
+						self->compressPackets = false;  // Until the peer's ConnectPacket says otherwise
 						self->prependConnectPacket();
 					} else {
 						TraceEvent("ConnectionTimedOut", conn ? conn->getDebugID() : UID()).suppressFor(1.0).detail("PeerAddr", self->destination);
@@ -452,6 +512,85 @@ TransportData::~TransportData() {
 	}
 }
 
+// Calls f(data, bytes) for each contiguous range of the len bytes starting offset bytes into the chain of buffers at b.
+// Buffers are not necessarily full, and may refer to bytes elsewhere (see PacketWriter::serializeArenaBytes)
+template <class F>
+static void forEachPacketRange( SendBuffer const* b, int offset, uint32_t len, F const& f ) {
+	while (len > 0) {
+		if (offset >= b->bytes_written) {
+			offset -= b->bytes_written;
+			b = b->next;
+			continue;
+		}
+		uint32_t n = std::min(len, (uint32_t)(b->bytes_written - offset));
+		f( b->data + offset, n );
+		len -= n;
+		offset += n;
+	}
+}
+
+// Returns the compressed form of a packet's contents (see COMPRESSED_PACKET_FLAG), or an empty string if they don't
+// compress to NETWORK_COMPRESSION_MAX_RATIO of their size
+static Standalone<StringRef> deflatePacket( SendBuffer const* b, int offset, uint32_t len ) {
+	z_stream z;
+	memset( &z, 0, sizeof(z) );
+	if (deflateInit2( &z, FLOW_KNOBS->NETWORK_COMPRESSION_LEVEL, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY ) != Z_OK)
+		return Standalone<StringRef>();
+
+	int limit = len * FLOW_KNOBS->NETWORK_COMPRESSION_MAX_RATIO;
+	Standalone<StringRef> out = makeString( sizeof(len) + limit );
+	memcpy( mutateString(out), &len, sizeof(len) );
+	z.next_out = mutateString(out) + sizeof(len);
+	z.avail_out = limit;
+
+	uint32_t remaining = len;
+	bool ok = true;
+	forEachPacketRange( b, offset, len, [&](uint8_t const* data, uint32_t bytes) {
+		if (!ok) return;
+		remaining -= bytes;
+		z.next_in = (Bytef*)data;
+		z.avail_in = bytes;
+		int r = deflate( &z, remaining ? Z_NO_FLUSH : Z_FINISH );
+		// Input is left over only if the output is already longer than it's worth
+		ok = z.avail_in == 0 && (remaining ? r == Z_OK || r == Z_BUF_ERROR : r == Z_STREAM_END);
+	});
+	deflateEnd( &z );
+
+	if (!ok) return Standalone<StringRef>();
+	return out.substr( 0, sizeof(len) + limit - z.avail_out );
+}
+
+static Standalone<StringRef> inflatePacket( StringRef compressed, NetworkAddress const& peerAddress ) {
+	uint32_t len;
+	if (compressed.size() < sizeof(len)) {
+		TraceEvent(SevError, "Net2_InflateFailed").detail("FromPeer", peerAddress.toString()).detail("Length", compressed.size());
+		throw platform_error();
+	}
+	memcpy( &len, compressed.begin(), sizeof(len) );
+	if (len > FLOW_KNOBS->PACKET_LIMIT) {
+		TraceEvent(SevError, "Net2_PacketLimitExceeded").detail("FromPeer", peerAddress.toString()).detail("Length", (int)len);
+		throw platform_error();
+	}
+
+	Standalone<StringRef> out = makeString( len );
+	z_stream z;
+	memset( &z, 0, sizeof(z) );
+	int r = inflateInit2( &z, -MAX_WBITS );
+	if (r == Z_OK) {
+		z.next_in = (Bytef*)compressed.begin() + sizeof(len);
+		z.avail_in = compressed.size() - sizeof(len);
+		z.next_out = mutateString(out);
+		z.avail_out = len;
+		r = inflate( &z, Z_FINISH );
+		inflateEnd( &z );
+	}
+	if (r != Z_STREAM_END || z.avail_out != 0 || z.avail_in != 0) {
+		TraceEvent(SevError, "Net2_InflateFailed").detail("FromPeer", peerAddress.toString()).detail("Length", compressed.size()).detail("ZlibResult", r);
+		throw platform_error();
+	}
+	return out;
+}
+
 ACTOR static void deliver( TransportData* self, Endpoint destination, ArenaReader reader, bool inReadSocket ) {
 	int priority = self->endpoints.getPriority(destination.token);
 	if (priority < TaskReadSocket || !inReadSocket) {
@@ -484,7 +623,7 @@ ACTOR static void deliver( TransportData* self, Endpoint destination, ArenaReade
 		g_network->setCurrentTask( TaskReadSocket );
 }
 
-static void scanPackets( TransportData* transport, uint8_t*& unprocessed_begin, uint8_t* e, Arena& arena, NetworkAddress const& peerAddress, uint64_t peerProtocolVersion ) {
+static void scanPackets( TransportData* transport, uint8_t*& unprocessed_begin, uint8_t* e, Arena& arena, Peer* peer, NetworkAddress const& peerAddress, uint64_t peerProtocolVersion ) {
 	// Find each complete packet in the given byte range and queue a ready task to deliver it.
 	// Remove the complete packets from the range by increasing unprocessed_begin.
 	// There won't be more than 64K of data plus one packet, so this shouldn't take a long time.
@@ -507,6 +646,8 @@ static void scanPackets( TransportData* transport, uint8_t*& unprocessed_begin,
 			if (e-p < sizeof(uint32_t)) break;
 			packetLen = *(uint32_t*)p; p += sizeof(uint32_t);
 		}
+		bool compressed = (packetLen & COMPRESSED_PACKET_FLAG) != 0;
+		packetLen &= ~COMPRESSED_PACKET_FLAG;
 
 		if (packetLen > FLOW_KNOBS->PACKET_LIMIT) {
 			TraceEvent(SevError, "Net2_PacketLimitExceeded").detail("FromPeer", peerAddress.toString()).detail("Length", (int)packetLen);
@@ -514,7 +655,7 @@ static void scanPackets( TransportData* transport, uint8_t*& unprocessed_begin,
 		}
 
 		if (e-p<packetLen) break;
-		ASSERT( packetLen >= sizeof(UID) );
+		ASSERT( compressed || packetLen >= sizeof(UID) );
 
 		if (checksumEnabled) {
 			bool isBuggifyEnabled = false;
@@ -556,7 +697,18 @@ static void scanPackets( TransportData* transport, uint8_t*& unprocessed_begin,
 #if VALGRIND
 		VALGRIND_CHECK_MEM_IS_DEFINED(p, packetLen);
 #endif
-		ArenaReader reader( arena, StringRef(p, packetLen), AssumeVersion(peerProtocolVersion) );
+		Standalone<StringRef> packet( StringRef(p, packetLen), arena );
+		if (compressed) {
+			double start = timer();
+			packet = inflatePacket( packet, peerAddress );
+			ASSERT( packet.size() >= sizeof(UID) );
+			peer->compression.packetsDecompressed++;
+			peer->compression.bytesBeforeDecompression += packetLen;
+			peer->compression.bytesAfterDecompression += packet.size();
+			peer->compression.decompressionSeconds += timer() - start;
+		}
+
+		ArenaReader reader( packet.arena(), packet, AssumeVersion(peerProtocolVersion) );
 		UID token; reader >> token;
 
 		++transport->countPacketsReceived;
@@ -679,10 +831,12 @@ ACTOR static Future<Void> connectionReader(
 						expectConnectPacket = false;
 
 						peerProtocolVersion = p->protocolVersion;
+						bool compressPackets = compatible && FLOW_KNOBS->NETWORK_COMPRESSION && connectPacketSize >= CONNECT_PACKET_V3_SIZE && (p->options & ConnectPacket::ACCEPTS_COMPRESSION);
 						if (peer != nullptr) {
 							// Outgoing connection; port information should be what we expect
 							TraceEvent("ConnectedOutgoing").suppressFor(1.0).detail("PeerAddr", NetworkAddress( p->canonicalRemoteIp, p->canonicalRemotePort ) );
 							peer->compatible = compatible;
+							peer->compressPackets = compressPackets;
 							peer->incompatibleProtocolVersionNewer = incompatibleProtocolVersionNewer;
 							if (!compatible) {
 								peer->transport->numIncompatibleConnections++;
@@ -695,6 +849,7 @@ ACTOR static Future<Void> connectionReader(
 							}
 							peer = transport->getPeer(peerAddress);
 							peer->compatible = compatible;
+							peer->compressPackets = compressPackets;
 							peer->incompatibleProtocolVersionNewer = incompatibleProtocolVersionNewer;
 							if (!compatible) {
 								peer->transport->numIncompatibleConnections++;
@@ -706,7 +861,7 @@ ACTOR static Future<Void> connectionReader(
 					}
 				}
 				if (compatible) {
-					scanPackets( transport, unprocessed_begin, unprocessed_end, arena, peerAddress, peerProtocolVersion );
+					scanPackets( transport, unprocessed_begin, unprocessed_end, arena, peer, peerAddress, peerProtocolVersion );
 				}
 				else if(!expectConnectPacket) {
 					unprocessed_begin = unprocessed_end;
@@ -888,6 +1043,23 @@ void FlowTransport::addWellKnownEndpoint( Endpoint& endpoint, NetworkMessageRece
 	ASSERT( endpoint.token == otoken );
 }
 
+// Undoes the writing of a packet which began bytesWritten bytes into first, the last buffer in the chain at the time
+static void discardPacket( PacketBuffer* first, int bytesWritten, ReliablePacket* rp ) {
+	for (ReliablePacket* c = rp; c; ) {
+		ReliablePacket* n = c->cont;
+		c->buffer->delref();
+		if (c != rp) delete c;
+		c = n;
+	}
+	for (PacketBuffer* b = first->nextPacketBuffer(); b; ) {
+		PacketBuffer* n = b->nextPacketBuffer();
+		b->delref();
+		b = n;
+	}
+	first->next = NULL;
+	first->bytes_written = bytesWritten;
+}
+
 static PacketID sendPacket( TransportData* self, ISerializeSource const& what, const Endpoint& destination, bool reliable, bool openConnection ) {
 	if (destination.address == self->localAddress) {
 		TEST(true); // "Loopback" delivery
@@ -944,27 +1116,41 @@ static PacketID sendPacket( TransportData* self, ISerializeSource const& what, c
 		pb = wr.finish();
 		len = wr.size() - packetInfoSize;
 
-		if (checksumEnabled) {
-			// Find the correct place to start calculating checksum
-			uint32_t checksumUnprocessedLength = len;
-			prevBytesWritten += packetInfoSize;
-			if (prevBytesWritten >= PacketBuffer::DATA_SIZE) {
-				prevBytesWritten -= PacketBuffer::DATA_SIZE;
-				checksumPb = checksumPb->nextPacketBuffer();
+		bool compressed = false;
+		if (peer->compressPackets && len >= (uint32_t)FLOW_KNOBS->NETWORK_COMPRESSION_MIN_BYTES) {
+			double start = timer();
+			Standalone<StringRef> deflated = deflatePacket( checksumPb, prevBytesWritten + packetInfoSize, len );
+			if (deflated.size()) {
+				// Write the packet again in place of what was just serialized, with the deflated contents usually sent
+				// from their own arena
+				discardPacket( checksumPb, prevBytesWritten, rp );
+				PacketWriter cwr( checksumPb, rp, AssumeVersion(currentProtocolVersion) );
+				cwr.writeAhead( packetInfoSize, &packetInfoBuffer );
+				cwr.setArena( deflated.arena() );
+				cwr.serializeArenaBytes( deflated );
+				pb = cwr.finish();
+
+				peer->compression.packetsCompressed++;
+				peer->compression.bytesBeforeCompression += len;
+				peer->compression.bytesAfterCompression += deflated.size();
+				len = cwr.size() - packetInfoSize;
+				compressed = true;
+			} else {
+				peer->compression.packetsIncompressible++;
 			}
+			peer->compression.compressionSeconds += timer() - start;
+		}
 
-			// Checksum calculation
-			while (checksumUnprocessedLength > 0) {
-				uint32_t processLength = std::min(checksumUnprocessedLength, (uint32_t)(PacketBuffer::DATA_SIZE - prevBytesWritten));
-				checksum = crc32c_append(checksum, checksumPb->data + prevBytesWritten, processLength);
-				checksumUnprocessedLength -= processLength;
-				checksumPb = checksumPb->nextPacketBuffer();
-				prevBytesWritten = 0;
-			}
+		if (checksumEnabled) {
+			// Checksum calculation, starting after the packet info
+			forEachPacketRange( checksumPb, prevBytesWritten + packetInfoSize, len, [&](uint8_t const* data, uint32_t bytes) {
+				checksum = crc32c_append(checksum, data, bytes);
+			});
 		}
 
 		// Write packet length and checksum into packet buffer
-		packetInfoBuffer.write(&len, sizeof(len));
+		uint32_t lengthAndFlags = compressed ? len | COMPRESSED_PACKET_FLAG : len;
+		packetInfoBuffer.write(&lengthAndFlags, sizeof(lengthAndFlags));
 		if (checksumEnabled) {
 			packetInfoBuffer.write(&checksum, sizeof(checksum), sizeof(len));
 		}
@@ -35,6 +35,7 @@
 #include "AsyncFileEIO.actor.h"
 #include "AsyncFileWinASIO.actor.h"
 #include "AsyncFileKAIO.actor.h"
+#include "AsyncFileIOUring.actor.h"
 #include "flow/AsioReactor.h"
 #include "flow/Platform.h"
 #include "AsyncFileWriteChecker.h"
@@ -59,7 +60,7 @@ Future< Reference<class IAsyncFile> > Net2FileSystem::open( std::string filename
 	Future<Reference<IAsyncFile>> f;
 #ifdef __linux__
 	if ( (flags & IAsyncFile::OPEN_UNBUFFERED) && !(flags & IAsyncFile::OPEN_NO_AIO) )
-		f = AsyncFileKAIO::open(filename, flags, mode, NULL);
+		f = useIOUring ? AsyncFileIOUring::open(filename, flags, mode, NULL) : AsyncFileKAIO::open(filename, flags, mode, NULL);
 	else
 #endif
 	f = Net2AsyncFile::open(filename, flags, mode, static_cast<boost::asio::io_service*> ((void*) g_network->global(INetwork::enASIOService)));
@@ -87,7 +88,9 @@ Net2FileSystem::Net2FileSystem(double ioTimeout, std::string fileSystemPath)
 {
 	Net2AsyncFile::init();
 #ifdef __linux__
-	AsyncFileKAIO::init( Reference<IEventFD>(N2::ASIOReactor::getEventFD()), ioTimeout );
+	useIOUring = FLOW_KNOBS->USE_IO_URING && AsyncFileIOUring::init( Reference<IEventFD>(N2::ASIOReactor::getEventFD()), ioTimeout );
+	if (!useIOUring)
+		AsyncFileKAIO::init( Reference<IEventFD>(N2::ASIOReactor::getEventFD()), ioTimeout );
 
 	if (fileSystemPath.empty()) {
 		checkFileSystem = false;
@@ -46,6 +46,7 @@ public:
 #ifdef __linux__
 	dev_t fileSystemDeviceId;
 	bool checkFileSystem;
+	bool useIOUring;  // AsyncFileIOUring rather than AsyncFileKAIO for unbuffered files
 #endif
 };
 
@@ -0,0 +1,106 @@
+/*
+ * linux_io_uring.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// io_uring system calls and ring layout, as of the 5.2 kernel ABI (eventfd registration is the newest feature used).
+// Like linux_kaio.h, these are declared here rather than taken from kernel or liburing headers, which our build images lack.
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+enum {
+	IORING_OP_NOP = 0,
+	IORING_OP_READV = 1,
+	IORING_OP_WRITEV = 2,
+	IORING_OP_FSYNC = 3,
+	IORING_OP_READ_FIXED = 4,
+	IORING_OP_WRITE_FIXED = 5
+};
+
+enum {
+	IORING_FSYNC_DATASYNC = 1
+};
+
+enum {
+	IORING_ENTER_GETEVENTS = 1
+};
+
+enum {
+	IORING_REGISTER_BUFFERS = 0,
+	IORING_UNREGISTER_BUFFERS = 1,
+	IORING_REGISTER_EVENTFD = 4
+};
+
+static const uint64_t IORING_OFF_SQ_RING = 0;
+static const uint64_t IORING_OFF_CQ_RING = 0x8000000ULL;
+static const uint64_t IORING_OFF_SQES = 0x10000000ULL;
+
+struct linux_io_uring_sqe {
+	uint8_t opcode;
+	uint8_t flags;
+	uint16_t ioprio;
+	int32_t fd;
+	uint64_t off;
+	uint64_t addr;
+	uint32_t len;
+	uint32_t op_flags;  // rw_flags or fsync_flags, depending on opcode
+	uint64_t user_data;
+	uint16_t buf_index;  // For IORING_OP_{READ,WRITE}_FIXED, the registered buffer that addr falls in
+	uint16_t pad1;
+	uint32_t pad2;
+	uint64_t pad3[2];
+};
+
+struct linux_io_uring_cqe {
+	uint64_t user_data;
+	int32_t res;
+	uint32_t flags;
+};
+
+struct linux_io_sqring_offsets {
+	uint32_t head, tail, ring_mask, ring_entries, flags, dropped, array, resv1;
+	uint64_t resv2;
+};
+
+struct linux_io_cqring_offsets {
+	uint32_t head, tail, ring_mask, ring_entries, overflow, cqes;
+	uint64_t resv[2];
+};
+
+struct linux_io_uring_params {
+	uint32_t sq_entries, cq_entries, flags, sq_thread_cpu, sq_thread_idle;
+	uint32_t resv[5];
+	linux_io_sqring_offsets sq_off;
+	linux_io_cqring_offsets cq_off;
+};
+
+static_assert( sizeof(linux_io_uring_sqe) == 64, "io_uring sqe layout" );
+static_assert( sizeof(linux_io_uring_cqe) == 16, "io_uring cqe layout" );
+static_assert( sizeof(linux_io_uring_params) == 120, "io_uring params layout" );
+
+static int io_uring_setup(unsigned entries, linux_io_uring_params* p) { return syscall( __NR_io_uring_setup, entries, p ); }
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) { return syscall( __NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0 ); }
+static int io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) { return syscall( __NR_io_uring_register, fd, opcode, arg, nr_args ); }
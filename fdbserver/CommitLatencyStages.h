@@ -0,0 +1,89 @@
+/*
+ * CommitLatencyStages.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FDBSERVER_COMMITLATENCYSTAGES_H
+#define FDBSERVER_COMMITLATENCYSTAGES_H
+#pragma once
+
+#include "flow/flow.h"
+#include "flow/LatencyHistogram.h"
+#include "fdbclient/FDBTypes.h"
+#include "fdbserver/Knobs.h"
+
+// Commit versions are traced end to end by sampling on the version itself, so that the proxy, tlogs and storage servers
+// all pick the same commits and log them under the same CommitDebug ID without anything extra being sent between them.
+inline uint64_t commitTraceHash( Version v ) {
+	uint64_t h = v;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+inline bool isCommitTraceSampled( Version v ) {
+	return commitTraceHash(v) < SERVER_KNOBS->COMMIT_TRACE_SAMPLE_RATE * 18446744073709551616.0;
+}
+
+inline UID commitTraceID( Version v ) {
+	return UID( commitTraceHash(v), v );
+}
+
+// Latency of each stage a commit passes through on one role, logged every COMMIT_LATENCY_STAGES_INTERVAL as a CommitLatencyStages
+// event with the histogram of each stage, which status merges across the cluster.  Stages are numbered in the order of the names
+// given to the constructor.  A stage spanning a wait is timed with now(), so that all of them are in simulated time in simulation;
+// only one which never waits, and so would always be 0 by now(), is timed with timer().
+class CommitLatencyStages : NonCopyable {
+public:
+	CommitLatencyStages( UID id, std::vector<std::string> const& names ) : id(id), lastLogged(now()) {
+		for(auto& name : names)
+			stages.push_back( Stage(name) );
+		logger = recurring( [this](){ log(); }, SERVER_KNOBS->COMMIT_LATENCY_STAGES_INTERVAL );
+	}
+
+	void addSample( int stage, double seconds ) {
+		stages[stage].latency.record( seconds );
+	}
+
+private:
+	struct Stage {
+		std::string name;
+		LatencyHistogram latency;
+		explicit Stage( std::string const& name ) : name(name) {}
+	};
+
+	UID id;
+	double lastLogged;
+	std::vector<Stage> stages;
+	Future<Void> logger;
+
+	void log() {
+		TraceEvent ev("CommitLatencyStages", id);
+		ev.detail("Elapsed", now() - lastLogged);
+		for(auto& s : stages) {
+			ev.detail(s.name + "Count", s.latency.count()).detail(s.name + "Median", s.latency.median())
+				.detail(s.name + "P99", s.latency.percentile(0.99)).detail(s.name + "Max", s.latency.max())
+				.detail(s.name + "Histogram", s.latency.toTraceString());
+			s.latency.clear();
+		}
+		ev.trackLatest( (id.toString() + "/CommitLatencyStages").c_str() );
+		lastLogged = now();
+	}
+};
+
+#endif
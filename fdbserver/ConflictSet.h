@@ -25,7 +25,7 @@
 #include "fdbclient/CommitTransaction.h"
 
 struct ConflictSet;
-ConflictSet* newConflictSet();
+ConflictSet* newConflictSet( int threadCount );
 void clearConflictSet( ConflictSet*, Version );
 void destroyConflictSet(ConflictSet*);
 
@@ -22,6 +22,8 @@
 #include "fdbrpc/IAsyncFile.h"
 #include "Knobs.h"
 #include "fdbrpc/simulator.h"
+#include "fdbrpc/ContinuousSample.h"
+#include "fdbrpc/Smoother.h"
 #include "flow/actorcompiler.h"  // This must be the last #include.
 
 typedef bool(*compare_pages)(void*,void*);
@@ -114,8 +116,9 @@ public:
 	RawDiskQueue_TwoFiles( std::string basename, UID dbgid, int64_t fileSizeWarningLimit )
 		: basename(basename), onError(delayed(error.getFuture())), onStopped(stopped.getFuture()),
 		readingFile(-1), readingPage(-1), writingPos(-1), dbgid(dbgid),
-		dbg_file0BeginSeq(0), fileExtensionBytes(10<<20), readingBuffer( dbgid ),
-		readyToPush(Void()), fileSizeWarningLimit(fileSizeWarningLimit), lastCommit(Void()), isFirstCommit(true)
+		file0BeginSeq(0), fileExtensionBytes(10<<20), readingBuffer( dbgid ),
+		readyToPush(Void()), fileSizeWarningLimit(fileSizeWarningLimit), lastCommit(Void()), isFirstCommit(true),
+		syncLatency(1.0), commitMetrics(1000)
 	{
 		if(BUGGIFY)
 			fileExtensionBytes = 8<<10;
@@ -141,9 +144,10 @@ public:
 		readingPage = page;
 	}
 
-	Future<Void> setPoppedPage( int file, int64_t page, int64_t debugSeq ) { return setPoppedPage(this, file, page, debugSeq); }
+	Future<Void> setPoppedPage( int file, int64_t page, int64_t pageSeq ) { return setPoppedPage(this, file, page, pageSeq); }
 
 	Future<Standalone<StringRef>> readNextPage() { return readNextPage(this); }
+	Future<Standalone<StringRef>> readPages( int64_t seq, int64_t length ) { return readPages(this, seq, length); }
 	Future<Void> truncateBeforeLastReadPage() { return truncateBeforeLastReadPage(this); }
 
 	Future<Void> getError() { return onError; }
@@ -183,7 +187,7 @@ public:
 	std::string filename(int i) const { return basename + format("%d.fdq", i); }
 
 	UID dbgid;
-	int64_t dbg_file0BeginSeq;
+	int64_t file0BeginSeq;  // The sequence number of the first byte of files[0]; files[1] follows it directly
 	int64_t fileSizeWarningLimit;
 
 	Promise<Void> error, stopped;
@@ -205,6 +209,48 @@ public:
 
 	Int64MetricHandle stallCount;
 
+	Smoother syncLatency;  // Of the sync stage of recent commits; DiskQueue waits up to about this long to group commits
+
+	// Latencies of the stages of pushAndCommit, and of group commit in DiskQueue, traced and reset every DISK_QUEUE_METRICS_INTERVAL
+	struct CommitMetrics {
+		ContinuousSample<double> groupWait, pushWait, write, sync, total;
+		ContinuousSample<int> commitsPerGroup, bytesPerGroup;
+		double lastLogged;
+
+		explicit CommitMetrics( int sampleSize )
+			: groupWait(sampleSize), pushWait(sampleSize), write(sampleSize), sync(sampleSize), total(sampleSize),
+			  commitsPerGroup(sampleSize), bytesPerGroup(sampleSize), lastLogged(now()) {}
+
+		void clear() {
+			groupWait.clear(); pushWait.clear(); write.clear(); sync.clear(); total.clear();
+			commitsPerGroup.clear(); bytesPerGroup.clear();
+		}
+	} commitMetrics;
+
+	template <class T>
+	static void detailSample( TraceEvent& ev, std::string const& name, ContinuousSample<T>& sample ) {
+		ev.detail(name + "Mean", sample.mean())
+		  .detail(name + "P50", sample.median())
+		  .detail(name + "P99", sample.percentile(0.99))
+		  .detail(name + "Max", sample.max());
+	}
+
+	void logCommitMetrics() {
+		if (now() - commitMetrics.lastLogged < SERVER_KNOBS->DISK_QUEUE_METRICS_INTERVAL) return;
+		TraceEvent ev("DiskQueueCommitMetrics", dbgid);
+		ev.detail("Elapsed", now() - commitMetrics.lastLogged).detail("SmoothSyncLatency", syncLatency.smoothTotal());
+		detailSample(ev, "GroupWait", commitMetrics.groupWait);
+		detailSample(ev, "PushWait", commitMetrics.pushWait);
+		detailSample(ev, "Write", commitMetrics.write);
+		detailSample(ev, "Sync", commitMetrics.sync);
+		detailSample(ev, "Total", commitMetrics.total);
+		detailSample(ev, "CommitsPerGroup", commitMetrics.commitsPerGroup);
+		detailSample(ev, "BytesPerGroup", commitMetrics.bytesPerGroup);
+		ev.detail("File0Name", files[0].dbgFilename);
+		commitMetrics.clear();
+		commitMetrics.lastLogged = now();
+	}
+
 	struct TrackMe : NonCopyable {
 		RawDiskQueue_TwoFiles* self;
 		TrackMe( RawDiskQueue_TwoFiles* self ) : self(self) {
@@ -240,7 +286,7 @@ public:
 					pageData = pageData.substr( p );
 				}
 
-				dbg_file0BeginSeq += files[0].size;
+				file0BeginSeq += files[0].size;
 				std::swap(files[0], files[1]);
 				files[1].popped = 0;
 				writingPos = 0;
@@ -275,6 +321,8 @@ public:
 		state UID dbgid = self->dbgid;
 		state vector<Reference<SyncQueue>> syncFiles;
 		state Future<Void> lastCommit = self->lastCommit;
+		state double startTime = now();
+		state double pushTime, writtenTime, syncedTime;
 		try {
 			// pushing might need to wait for previous pushes to start (to maintain order) or for
 			// a previous commit to finish if stall() was called
@@ -289,6 +337,7 @@ public:
 			}
 
 			wait( ready );
+			pushTime = now();
 
 			TEST( pageData.size() > sizeof(Page) ); // push more than one page of data
 
@@ -297,6 +346,7 @@ public:
 			ASSERT( syncFiles.size() >= 1 && syncFiles.size() <= 2 );
 			TEST(2==syncFiles.size());  // push spans both files
 			wait( pushed );
+			writtenTime = now();
 
 			delete pageMem;
 			pageMem = 0;
@@ -304,6 +354,7 @@ public:
 			Future<Void> sync = syncFiles[0]->onSync();
 			for(int i=1; i<syncFiles.size(); i++) sync = sync && syncFiles[i]->onSync();
 			wait( sync );
+			syncedTime = now();
 			wait( lastCommit );
 
 			//Calling check_yield instead of yield to avoid a destruction ordering problem in simulation
@@ -313,7 +364,14 @@ public:
 
 			self->updatePopped( poppedPages*sizeof(Page) );
 
-			/*TraceEvent("RDQCommitEnd", self->dbgid).detail("DeltaPopped", poppedPages*sizeof(Page)).detail("PoppedCommitted", self->dbg_file0BeginSeq + self->files[0].popped + self->files[1].popped)
+			self->syncLatency.setTotal( syncedTime - writtenTime );
+			self->commitMetrics.pushWait.addSample( pushTime - startTime );
+			self->commitMetrics.write.addSample( writtenTime - pushTime );
+			self->commitMetrics.sync.addSample( syncedTime - writtenTime );
+			self->commitMetrics.total.addSample( now() - startTime );
+			self->logCommitMetrics();
+
+			/*TraceEvent("RDQCommitEnd", self->dbgid).detail("DeltaPopped", poppedPages*sizeof(Page)).detail("PoppedCommitted", self->file0BeginSeq + self->files[0].popped + self->files[1].popped)
 				.detail("File0Size", self->files[0].size).detail("File1Size", self->files[1].size)
 				.detail("File0Name", self->files[0].dbgFilename).detail("SyncedFiles", syncFiles.size());*/
 
@@ -340,11 +398,11 @@ public:
 	}
 
 
-	ACTOR static Future<Void> setPoppedPage( RawDiskQueue_TwoFiles *self, int file, int64_t page, int64_t debugSeq ) {
+	ACTOR static Future<Void> setPoppedPage( RawDiskQueue_TwoFiles *self, int file, int64_t page, int64_t pageSeq ) {
 		self->files[file].popped = page*sizeof(Page);
 		if (file) self->files[0].popped = self->files[0].size;
 		else self->files[1].popped = 0;
-		self->dbg_file0BeginSeq = debugSeq - self->files[1].popped - self->files[0].popped;
+		self->file0BeginSeq = pageSeq - self->files[1].popped - self->files[0].popped;
 
 		//If we are starting in file 1, we truncate file 0 in case it has been corrupted.
 		//  In particular, we are trying to avoid a dropped or corrupted write to the first page of file 0 causing it to be sequenced before file 1,
@@ -492,6 +550,7 @@ public:
 
 				self->files[0].popped = self->files[0].size;
 				self->files[1].popped = 0;
+				self->file0BeginSeq = -self->files[0].size;
 				self->writingPos = 0;
 				self->readingFile = 2;
 				return Standalone<StringRef>();
@@ -594,6 +653,41 @@ public:
 		}
 	}
 
+	// Reads the pages holding sequence numbers [seq, seq+length), which must be page aligned and written
+	ACTOR static Future<Standalone<StringRef>> readPages(RawDiskQueue_TwoFiles* self, int64_t seq, int64_t length) {
+		state StringBuffer result( self->dbgid );
+		ASSERT( seq % sizeof(Page) == 0 && length % sizeof(Page) == 0 && length > 0 );
+		ASSERT( self->readingFile == 2 && seq >= self->file0BeginSeq );
+
+		result.alignReserve( sizeof(Page), length );
+		uint8_t* p = (uint8_t*)result.append( length );
+
+		// Hold the files rather than their positions in files[], which a push may swap while the reads are outstanding
+		vector<Future<int>> reads;
+		int64_t pos = seq - self->file0BeginSeq;
+		for(int i=0; i<2 && length; i++) {
+			if (pos >= self->files[i].size) {
+				pos -= self->files[i].size;
+				continue;
+			}
+			int64_t len = std::min( length, self->files[i].size - pos );
+			reads.push_back( self->files[i].f->read( p, len, pos ) );
+			p += len;
+			length -= len;
+			pos = 0;
+		}
+		ASSERT( !length );
+
+		try {
+			wait( waitForAll(reads) );
+		} catch (Error& e) {
+			TraceEvent(SevError, "RDQReadPagesError", self->dbgid).error(e, true).detail("Seq", seq).detail("File0Name", self->files[0].dbgFilename);
+			if (!self->error.isSet()) self->error.sendError(e);
+			throw;
+		}
+		return result.str;
+	}
+
 	ACTOR static UNCANCELLABLE Future<Void> truncateFile(RawDiskQueue_TwoFiles* self, int file, int64_t pos) {
 		state TrackMe trackMe(self);
 		TraceEvent("DQTruncateFile", self->dbgid).detail("File", file).detail("Pos", pos).detail("File0Name", self->files[0].dbgFilename);
@@ -629,6 +723,7 @@ public:
 			if (swap) {
 				std::swap(self->files[0], self->files[1]);
 				self->files[0].popped = self->files[0].size;
+				self->file0BeginSeq -= self->files[0].size;
 			}
 
 			return Void();
@@ -644,7 +739,8 @@ class DiskQueue : public IDiskQueue {
 public:
 	DiskQueue( std::string basename, UID dbgid, int64_t fileSizeWarningLimit )
 		: rawQueue( new RawDiskQueue_TwoFiles(basename, dbgid,fileSizeWarningLimit) ), dbgid(dbgid), anyPopped(false), nextPageSeq(0), poppedSeq(0), lastPoppedSeq(0),
-		  nextReadLocation(-1), readBufPage(NULL), readBufPos(0), pushed_page_buffer(NULL), recovered(false), lastCommittedSeq(0), warnAlwaysForMemory(true)
+		  nextReadLocation(-1), readBufPage(NULL), readBufPos(0), pushed_page_buffer(NULL), recovered(false), lastCommittedSeq(0), warnAlwaysForMemory(true),
+		  groupPending(false), group_page_buffer(NULL), groupPoppedPages(0), groupCommits(0), groupStart(0)
 	{
 	}
 
@@ -665,6 +761,12 @@ public:
 		}
 		return endLocation();
 	}
+	virtual location getNextPushLocation() {
+		ASSERT( recovered );
+		// A push begins in the unused part of the back page, or else on a new page
+		if (pushedPageCount() && backPage().remainingCapacity()) return backPage().endSeq();
+		return nextPageSeq + sizeof(PageHeader);
+	}
 	virtual void pop( location upTo ) {
 		ASSERT( !upTo.hi );
 		ASSERT( !recovered || upTo.lo <= endLocation() );
@@ -702,7 +804,7 @@ public:
 	virtual Future<Void> commit() {
 		ASSERT( recovered );
 		if (!pushedPageCount()) {
-			if (!anyPopped) return Void();
+			if (!anyPopped) return groupPending ? groupCommitted.getFuture() : Future<Void>(Void());
 			anyPopped = false;
 			addEmptyPage();
 		}
@@ -726,12 +828,44 @@ public:
 			.detail("RawFile0Name", rawQueue->files[0].dbgFilename);*/
 
 		lastCommittedSeq = backPage().endSeq();
-		auto f = rawQueue->pushAndCommit( pushed_page_buffer->ref(), pushed_page_buffer, poppedSeq/sizeof(Page) - lastPoppedSeq/sizeof(Page) );
+		uint64_t poppedPages = poppedSeq/sizeof(Page) - lastPoppedSeq/sizeof(Page);
 		lastPoppedSeq = poppedSeq;
+		StringBuffer* pages = pushed_page_buffer;
 		pushed_page_buffer = 0;
+
+		if (!groupPending) {
+			if (!SERVER_KNOBS->DISK_QUEUE_GROUP_COMMIT || rawQueue->lastCommit.isReady())
+				return pushAndCommit( pages, poppedPages, 1, 0 );
+
+			// Rather than queueing another write and sync behind the commit in flight, start a group that
+			// later commits join and that is written and synced all at once
+			TEST(true); // DiskQueue group commit started
+			groupPending = true;
+			group_page_buffer = pages;
+			groupPoppedPages = poppedPages;
+			groupCommits = 1;
+			groupStart = now();
+			groupFlusher = waitAndFlushGroup(this);
+		} else {
+			// Each commit still ends with a page of its own, so the pages written are the same as if the commits were not grouped
+			TEST(true); // DiskQueue commit joined a group
+			group_page_buffer->alignReserve( sizeof(Page), group_page_buffer->size() + pages->size() );
+			group_page_buffer->append( pages->ref() );
+			delete pages;
+			groupPoppedPages += poppedPages;
+			groupCommits++;
+		}
+
+		Future<Void> f = groupCommitted.getFuture();
+		if (group_page_buffer->size() >= SERVER_KNOBS->DISK_QUEUE_GROUP_COMMIT_BYTES) {
+			TEST(true); // DiskQueue group commit reached its byte limit
+			flushGroup();
+		}
 		return f;
 	}
 	void stall() {
+		// The pending group holds commits made before the stall, so it must not be held back by it
+		if (groupPending) flushGroup();
 		rawQueue->stall();
 	}
 
@@ -739,19 +873,23 @@ public:
 
 	virtual location getNextReadLocation() { return nextReadLocation; }
 
+	virtual Future<Standalone<StringRef>> read( location from, location to ) { return read(this, from, to); }
+
 	virtual Future<Void> getError() { return rawQueue->getError(); }
 	virtual Future<Void> onClosed() { return rawQueue->onClosed(); }
 	virtual void dispose() {
+		if (groupPending) flushGroup();
 		TraceEvent("DQDestroy", dbgid).detail("LastPoppedSeq", lastPoppedSeq).detail("PoppedSeq", poppedSeq).detail("NextPageSeq", nextPageSeq).detail("File0Name", rawQueue->files[0].dbgFilename);
 		rawQueue->dispose();
 		delete this;
 	}
 	virtual void close() {
+		if (groupPending) flushGroup();
 		TraceEvent("DQClose", dbgid)
 			.detail("LastPoppedSeq", lastPoppedSeq)
 			.detail("PoppedSeq", poppedSeq)
 			.detail("NextPageSeq", nextPageSeq)
-			.detail("PoppedCommitted", rawQueue->dbg_file0BeginSeq + rawQueue->files[0].popped + rawQueue->files[1].popped)
+			.detail("PoppedCommitted", rawQueue->file0BeginSeq + rawQueue->files[0].popped + rawQueue->files[1].popped)
 			.detail("File0Name", rawQueue->files[0].dbgFilename);
 		rawQueue->close();
 		delete this;
@@ -824,6 +962,38 @@ private:
 		}
 	}
 
+	Future<Void> pushAndCommit( StringBuffer* pages, uint64_t poppedPages, int commits, double groupWait ) {
+		rawQueue->commitMetrics.groupWait.addSample( groupWait );
+		rawQueue->commitMetrics.commitsPerGroup.addSample( commits );
+		rawQueue->commitMetrics.bytesPerGroup.addSample( pages->size() );
+		return rawQueue->pushAndCommit( pages->ref(), pages, poppedPages );
+	}
+
+	void flushGroup() {
+		ASSERT( groupPending );
+		groupPending = false;
+		Future<Void> f = pushAndCommit( group_page_buffer, groupPoppedPages, groupCommits, now() - groupStart );
+		group_page_buffer = 0;
+		forwardCommit( f, groupCommitted );
+		groupCommitted = Promise<Void>();
+	}
+
+	ACTOR static Future<Void> waitAndFlushGroup( DiskQueue* self ) {
+		// Flush when the commit in flight finishes, or sooner if it is taking longer than syncs have lately
+		wait( ready(self->rawQueue->lastCommit) || delay( std::min( SERVER_KNOBS->DISK_QUEUE_GROUP_COMMIT_MAX_DELAY, self->rawQueue->syncLatency.smoothTotal() ) ) );
+		if (self->groupPending) self->flushGroup();
+		return Void();
+	}
+
+	ACTOR static void forwardCommit( Future<Void> commit, Promise<Void> committed ) {
+		try {
+			wait( commit );
+			committed.send(Void());
+		} catch (Error& e) {
+			committed.sendError(e);
+		}
+	}
+
 	void readFromBuffer( StringBuffer& result, int& bytes ) {
 		// extract up to bytes from readBufPage into result
 		int len = std::min( readBufPage->payloadSize - readBufPos, bytes );
@@ -916,6 +1086,43 @@ private:
 		return result.str;
 	}
 
+	ACTOR static Future<Standalone<StringRef>> read( DiskQueue *self, location from, location to ) {
+		ASSERT( self->recovered && !from.hi && !to.hi );
+		ASSERT( to.lo <= self->lastCommittedSeq );
+		state loc_t begin = std::max<loc_t>( from.lo, self->poppedSeq );
+		state loc_t end = to.lo;
+		if (begin >= end) return Standalone<StringRef>();
+
+		state loc_t firstPageSeq = begin/sizeof(Page)*sizeof(Page);
+		state loc_t endPageSeq = ((end-1)/sizeof(Page) + 1)*sizeof(Page);
+		Standalone<StringRef> pages = wait( self->rawQueue->readPages( firstPageSeq, endPageSeq - firstPageSeq ) );
+
+		// The payload bytes are at most the bytes between the locations
+		Standalone<StringRef> result = makeString( end - begin );
+		uint8_t* out = mutateString(result);
+		for(Page* p = (Page*)pages.begin(); p != (Page*)pages.end(); ++p) {
+			loc_t seq = firstPageSeq + ((uint8_t*)p - pages.begin());
+			if (seq + sizeof(Page) <= self->poppedSeq) {
+				// Popped while we were reading it, so it may have been overwritten
+				TEST(true);  // DiskQueue read of a page popped during the read
+				continue;
+			}
+			if (!p->checkHash() || p->seq != seq) {
+				TraceEvent(SevError, "DQReadInvalidPage", self->dbgid).detail("Seq", seq).detail("PageSeq", p->seq).detail("From", from).detail("To", to)
+					.detail("PoppedSeq", self->poppedSeq).detail("File0Name", self->rawQueue->files[0].dbgFilename);
+				throw checksum_failed();
+			}
+			loc_t payloadSeq = seq + sizeof(PageHeader);
+			loc_t b = std::max<loc_t>( begin, payloadSeq );
+			loc_t e = std::min<loc_t>( end, payloadSeq + p->payloadSize );
+			if (b < e) {
+				memcpy( out, p->payload + (b - payloadSeq), e - b );
+				out += e - b;
+			}
+		}
+		return Standalone<StringRef>( result.substr(0, out - result.begin()), result.arena() );
+	}
+
 	ACTOR static Future<bool> findStart( DiskQueue* self ) {
 		Standalone<StringRef> epbuf = wait( self->rawQueue->readFirstAndLastPages( &comparePages ) );
 		ASSERT( epbuf.size() % sizeof(Page) == 0 );
@@ -1019,6 +1226,15 @@ private:
 	Page const& backPage() const { return ((Page*)pushed_page_buffer->ref().end())[-1]; }
 	int pushedPageCount() const { return pushed_page_buffer ? pushed_page_buffer->size() / sizeof(Page) : 0; }
 
+	// Group commit: commits made while another is in flight are gathered and written and synced together
+	bool groupPending;
+	StringBuffer* group_page_buffer;  // Committed pages of the pending group, not yet passed to rawQueue
+	uint64_t groupPoppedPages;
+	int groupCommits;
+	double groupStart;
+	Promise<Void> groupCommitted;  // Set when the pending group is durable
+	Future<Void> groupFlusher;
+
 	// Recovery state
 	bool recovered;
 	loc_t nextReadLocation;
@@ -1053,6 +1269,8 @@ public:
 		return pushed;
 	}
 
+	virtual location getNextPushLocation() { return queue->getNextPushLocation(); }
+
 	virtual void pop( location upTo ) {
 		popped = std::max(popped, upTo);
 		ASSERT_WE_THINK(committed >= popped);
@@ -1086,6 +1304,8 @@ public:
 		return commitFuture;
 	}
 
+	virtual Future<Standalone<StringRef>> read( location from, location to ) { return queue->read(from, to); }
+
 	virtual StorageBytes getStorageBytes() { return queue->getStorageBytes(); }
 
 private:
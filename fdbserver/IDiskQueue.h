@@ -39,6 +39,11 @@ public:
 			if (hi>r.hi) return false;
 			return lo < r.lo;
 		}
+
+		template <class Ar>
+		void serialize(Ar& ar) {
+			ar & hi & lo;
+		}
 	};
 
 	// Before calling push or commit, the caller *must* perform recovery by calling readNext() until it returns less than the requested number of bytes.
@@ -47,9 +52,14 @@ public:
 	virtual location getNextReadLocation() = 0;    // Returns a location >= the location of all bytes previously returned by readNext(), and <= the location of all bytes subsequently returned
 
 	virtual location push( StringRef contents ) = 0;  // Appends the given bytes to the byte stream.  Returns a location token representing the *end* of the contents.
+	virtual location getNextPushLocation() = 0;    // Returns the location of the first byte of the next push()
 	virtual void pop( location upTo ) = 0;            // Removes all bytes before the given location token from the byte stream.
 	virtual Future<Void> commit() = 0;  // returns when all prior pushes and pops are durable.  If commit does not return (due to close or a crash), any prefix of the pushed bytes and any prefix of the popped bytes may be durable.
 
+	// Returns the committed bytes between two locations, after recovery.  Bytes before the first unpopped byte are not returned, so `from` may be
+	// a location from before recovery began.  If the range is popped while the read is in progress, part of the result may be missing.
+	virtual Future<Standalone<StringRef>> read( location from, location to ) = 0;
+
 	virtual int getCommitOverhead() = 0; // returns the amount of unused space that would be written by a commit that immediately followed this call
 
 	virtual StorageBytes getStorageBytes() = 0;
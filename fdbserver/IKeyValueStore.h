@@ -77,17 +77,24 @@ protected:
 };
 
 extern IKeyValueStore* keyValueStoreSQLite( std::string const& filename, UID logID, KeyValueStoreType storeType, bool checkChecksums=false, bool checkIntegrity=false );
-extern IKeyValueStore* keyValueStoreMemory( std::string const& basename, UID logID, int64_t memoryLimit );
+// Only storage servers allow checkpoints (see MEMORY_CHECKPOINTS), since versions before them cannot recover such a store
+extern IKeyValueStore* keyValueStoreMemory( std::string const& basename, UID logID, int64_t memoryLimit, bool allowCheckpoints=false );
+extern IKeyValueStore* keyValueStoreLSM( std::string const& filename, UID logID );
+extern IKeyValueStore* keyValueStoreRedwoodV1( std::string const& filename, UID logID );
 extern IKeyValueStore* keyValueStoreLogSystem( class IDiskQueue* queue, UID logID, int64_t memoryLimit, bool disableSnapshot, bool replaceContent, bool exactRecovery );
 
-inline IKeyValueStore* openKVStore( KeyValueStoreType storeType, std::string const& filename, UID logID, int64_t memoryLimit, bool checkChecksums=false, bool checkIntegrity=false ) {
+inline IKeyValueStore* openKVStore( KeyValueStoreType storeType, std::string const& filename, UID logID, int64_t memoryLimit, bool checkChecksums=false, bool checkIntegrity=false, bool allowCheckpoints=false ) {
 	switch( storeType ) {
 	case KeyValueStoreType::SSD_BTREE_V1:
 		return keyValueStoreSQLite(filename, logID, KeyValueStoreType::SSD_BTREE_V1, false, checkIntegrity);
 	case KeyValueStoreType::SSD_BTREE_V2:
 		return keyValueStoreSQLite(filename, logID, KeyValueStoreType::SSD_BTREE_V2, checkChecksums, checkIntegrity);
 	case KeyValueStoreType::MEMORY:
-		return keyValueStoreMemory( filename, logID, memoryLimit );
+		return keyValueStoreMemory( filename, logID, memoryLimit, allowCheckpoints );
+	case KeyValueStoreType::SSD_LSM:
+		return keyValueStoreLSM( filename, logID );
+	case KeyValueStoreType::SSD_REDWOOD_V1:
+		return keyValueStoreRedwoodV1( filename, logID );
 	default:
 		UNREACHABLE();
 	}
@@ -0,0 +1,90 @@
+/*
+ * IPager.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FDBSERVER_IPAGER_H
+#define FDBSERVER_IPAGER_H
+#pragma once
+
+#include "IKeyValueStore.h"
+
+typedef uint32_t LogicalPageID;
+static const LogicalPageID invalidLogicalPageID = std::numeric_limits<LogicalPageID>::max();
+
+// A buffer for the contents of one page.  Its size is the usable page size of the pager that created it, which
+// excludes any space the pager reserves in each page for itself.
+class IPage {
+public:
+	virtual uint8_t const* begin() const = 0;
+	virtual uint8_t* mutate() = 0;
+	virtual int size() const = 0;
+
+	StringRef asStringRef() const { return StringRef( begin(), size() ); }
+
+	virtual void addref() const = 0;
+	virtual void delref() const = 0;
+
+protected:
+	virtual ~IPage() {}
+};
+
+// A pager stores fixed size pages in a file, and makes a set of page writes and frees durable atomically with each
+// commit.  Pages are copy-on-write: a page is only written after being returned by newPageID(), and is never
+// written again while a version that may still be read refers to it.  A page which a commit at version v stops
+// using is freed at v, and is only reused once every version before v has been forgotten with setOldestVersion().
+class IPager : public IClosable {
+public:
+	virtual Reference<IPage> newPageBuffer() = 0;
+	virtual int getUsablePageSize() = 0;
+
+	// Returns a page which no readable version uses, to be written with updatePage() before the next commit
+	virtual Future<LogicalPageID> newPageID() = 0;
+	virtual void updatePage( LogicalPageID pageID, Reference<IPage> data ) = 0;
+
+	// Neither version v nor any later version uses the page
+	virtual void freePage( LogicalPageID pageID, Version v ) = 0;
+
+	// Throws checksum_failed if the page is not intact
+	virtual Future<Reference<const IPage>> readPage( LogicalPageID pageID ) = 0;
+
+	// Versions before v will not be read again, so pages freed at or before v can be reused once that is durable
+	virtual void setOldestVersion( Version v ) = 0;
+	virtual Version getOldestVersion() = 0;
+
+	// The version of the last commit
+	virtual Version getLatestVersion() = 0;
+
+	// A small amount of data, at most getMaxMetaKeySize() bytes, made durable with each commit
+	virtual Key getMetaKey() = 0;
+	virtual void setMetaKey( KeyRef metaKey ) = 0;
+	virtual int getMaxMetaKeySize() = 0;
+
+	// Makes every page written or freed and the meta key durable, as version v
+	virtual Future<Void> commit( Version v ) = 0;
+
+	virtual StorageBytes getStorageBytes() = 0;
+
+	// Creates the file or recovers the last commit; no other method may be called until it is ready
+	virtual Future<Void> init() = 0;
+
+protected:
+	virtual ~IPager() {}
+};
+
+#endif
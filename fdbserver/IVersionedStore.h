@@ -0,0 +1,78 @@
+/*
+ * IVersionedStore.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FDBSERVER_IVERSIONEDSTORE_H
+#define FDBSERVER_IVERSIONEDSTORE_H
+#pragma once
+
+#include "IKeyValueStore.h"
+
+// A cursor over the keys of one version of an IVersionedStore.  The key and value it returns are valid until it
+// is moved.
+class IStoreCursor {
+public:
+	virtual Future<Void> findFirstEqualOrGreater( KeyRef key ) = 0;
+	virtual Future<Void> findLastLessOrEqual( KeyRef key ) = 0;
+	virtual Future<Void> next() = 0;
+	virtual Future<Void> prev() = 0;
+
+	virtual bool isValid() = 0;
+	virtual KeyRef getKey() = 0;
+	virtual ValueRef getValue() = 0;
+
+	virtual void addref() = 0;
+	virtual void delref() = 0;
+
+protected:
+	virtual ~IStoreCursor() {}
+};
+
+// A key value store which keeps the versions of its data from getOldestVersion() to getLatestVersion() readable.
+// Writes are made at the write version, and become readable at that version once committed.  The history is
+// recorded at commit granularity: reading at a version between two commits sees the earlier one.
+class IVersionedStore : public IClosable {
+public:
+	virtual KeyValueStoreType getType() = 0;
+	virtual StorageBytes getStorageBytes() = 0;
+
+	virtual void set( KeyValueRef keyValue ) = 0;
+	virtual void clear( KeyRangeRef range ) = 0;
+
+	// Must be greater than getLatestVersion()
+	virtual void setWriteVersion( Version v ) = 0;
+	virtual Version getWriteVersion() = 0;
+	virtual Future<Void> commit() = 0;
+
+	// Versions before v will not be read again
+	virtual void setOldestVersion( Version v ) = 0;
+	virtual Version getOldestVersion() = 0;
+	virtual Version getLatestVersion() = 0;
+
+	// v must be at least getOldestVersion()
+	virtual Reference<IStoreCursor> readAtVersion( Version v ) = 0;
+
+	// Recovers the store; no other method may be called until it is ready
+	virtual Future<Void> init() = 0;
+
+protected:
+	virtual ~IVersionedStore() {}
+};
+
+#endif
@@ -0,0 +1,1375 @@
+/*
+ * KeyValueStoreLSM.actor.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "IKeyValueStore.h"
+#include "IDiskQueue.h"
+#include "fdbrpc/IAsyncFile.h"
+#include "fdbrpc/crc32c.h"
+#include "fdbclient/CommitTransaction.h"
+#include "flow/ActorCollection.h"
+#include "flow/Hash3.h"
+#include "flow/actorcompiler.h"  // This must be the last #include.
+
+// A log-structured merge tree.  Writes go to a memtable in memory and to a write-ahead log (an IDiskQueue), and commit
+// when the log does.  Once the memtable is large enough it is frozen at a commit and written out as an immutable sorted
+// run in level 0, and the log is popped.  Background compaction merges the runs of level 0 into level 1, and files of
+// each level L > 0 into the files of level L+1 they overlap, keeping each level a set of disjoint runs about
+// LSM_LEVEL_SIZE_MULTIPLIER times the size of the one above it.
+//
+// Every source (memtable, level 0 run or level) holds entries and clears.  The entries of a source are newer than its
+// own clears, and older than everything in a newer source: memtables, then level 0 runs from newest to oldest, then
+// levels 1, 2, ...  A read takes the newest entry for a key, unless a newer source has cleared it.
+//
+// The set of runs is recorded by manifest records in the log, each naming every live run; recovery replays the log
+// from its last pop, using the last manifest and the writes of memtables it does not say have been flushed.
+
+// The location of a data block within a run file, and the keys of its first and last entries
+struct LSMBlockHandleRef {
+	KeyRef firstKey, lastKey;
+	int64_t offset;
+	int size;
+
+	LSMBlockHandleRef() : offset(0), size(0) {}
+	LSMBlockHandleRef( Arena& a, KeyRef firstKey, KeyRef lastKey, int64_t offset, int size ) : firstKey(a, firstKey), lastKey(a, lastKey), offset(offset), size(size) {}
+
+	template <class Ar>
+	void serialize( Ar& ar ) {
+		ar & firstKey & lastKey & offset & size;
+	}
+};
+
+// A data block is a sequence of entries (uint32_t key length, uint32_t value length, key, value), followed by the
+// uint32_t offset of each entry, the uint32_t number of entries and a crc32c of everything before it
+struct LSMBlock {
+	static uint32_t readU32( const uint8_t* p ) { uint32_t v; memcpy( &v, p, sizeof(v) ); return v; }
+
+	static int count( StringRef block ) { return readU32( block.end() - 8 ); }
+
+	static KeyValueRef entry( StringRef block, int i ) {
+		int n = count( block );
+		const uint8_t* e = block.begin() + readU32( block.end() - 8 - 4*(n-i) );
+		uint32_t keySize = readU32( e ), valueSize = readU32( e + 4 );
+		return KeyValueRef( KeyRef( e + 8, keySize ), ValueRef( e + 8 + keySize, valueSize ) );
+	}
+
+	// The index of the first entry with a key >= key (or count(block))
+	static int lowerBound( StringRef block, KeyRef key ) {
+		int lo = 0, hi = count( block );
+		while (lo < hi) {
+			int mid = lo + (hi-lo)/2;
+			if (entry( block, mid ).key < key)
+				lo = mid+1;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+
+	static bool verify( StringRef block ) {
+		if (block.size() < 8) return false;
+		int n = count( block );
+		if (n < 0 || 8 + 4*int64_t(n) > block.size()) return false;
+		return crc32c_append( 0, block.begin(), block.size() - 4 ) == readU32( block.end() - 4 );
+	}
+};
+
+struct LSMBloomFilter {
+	static void hash( KeyRef key, uint32_t& h1, uint32_t& h2 ) {
+		h1 = 0; h2 = 0;
+		hashlittle2( key.begin(), key.size(), &h1, &h2 );
+	}
+
+	static int hashCount( int bitsPerKey ) { return std::max( 1, std::min( 30, int(bitsPerKey * 0.69) ) ); }
+
+	// An empty filter may contain anything
+	static bool mayContain( StringRef bits, int hashCount, KeyRef key ) {
+		if (!bits.size()) return true;
+		uint32_t h1, h2;
+		hash( key, h1, h2 );
+		uint64_t nbits = uint64_t(bits.size()) * 8;
+		for (int i = 0; i < hashCount; i++) {
+			uint64_t b = (h1 + uint64_t(i) * h2) % nbits;
+			if (!(bits[b/8] & (1 << (b%8)))) return false;
+		}
+		return true;
+	}
+};
+
+// Whether key is in one of clears, which are sorted and disjoint
+static bool lsmIsCleared( VectorRef<KeyRangeRef> const& clears, KeyRef key ) {
+	auto c = std::upper_bound( clears.begin(), clears.end(), key, [](KeyRef const& k, KeyRangeRef const& r) { return k < r.begin; } );
+	return c != clears.begin() && key < (c-1)->end;
+}
+
+// Adds range to a map from begin to end of disjoint, non-adjacent ranges.  The keys of range must outlive the map.
+static void lsmAddClear( std::map<KeyRef, KeyRef>& clears, KeyRangeRef range ) {
+	if (range.begin >= range.end) return;
+	KeyRef begin = range.begin, end = range.end;
+	auto it = clears.upper_bound( begin );
+	if (it != clears.begin() && std::prev(it)->second >= begin) {
+		--it;
+		begin = it->first;
+	}
+	while (it != clears.end() && it->first <= end) {
+		if (end < it->second) end = it->second;
+		it = clears.erase( it );
+	}
+	clears[begin] = end;
+}
+
+static Standalone<VectorRef<KeyRangeRef>> lsmClearsVector( std::map<KeyRef, KeyRef> const& clears ) {
+	Standalone<VectorRef<KeyRangeRef>> result;
+	for (auto& c : clears)
+		result.push_back_deep( result.arena(), KeyRangeRef( c.first, c.second ) );
+	return result;
+}
+
+// The parts of clears within [begin, end), where an empty end means no upper bound
+static Standalone<VectorRef<KeyRangeRef>> lsmClipClears( VectorRef<KeyRangeRef> const& clears, KeyRef begin, KeyRef end ) {
+	Standalone<VectorRef<KeyRangeRef>> result;
+	for (auto& c : clears) {
+		KeyRef b = std::max( c.begin, begin ), e = end.size() ? std::min( c.end, end ) : c.end;
+		if (b < e)
+			result.push_back_deep( result.arena(), KeyRangeRef( b, e ) );
+	}
+	return result;
+}
+
+// Recent writes, kept in memory until they are flushed to a run in level 0
+struct LSMMemtable : ReferenceCounted<LSMMemtable>, NonCopyable {
+	Arena arena;
+	std::map<KeyRef, ValueRef> sets;
+	std::map<KeyRef, KeyRef> clears;
+	int64_t bytes;			// Approximate memory used, which never decreases
+	int64_t generation;		// Numbers memtables, so that recovery knows which logged writes have been flushed
+
+	static const int NODE_BYTES = 64;
+
+	explicit LSMMemtable( int64_t generation ) : bytes(0), generation(generation) {}
+
+	void set( KeyValueRef kv ) {
+		ValueRef value( arena, kv.value );
+		auto it = sets.lower_bound( kv.key );
+		if (it != sets.end() && it->first == kv.key) {
+			it->second = value;
+			bytes += value.size();
+		} else {
+			sets.insert( it, std::make_pair( KeyRef( arena, kv.key ), value ) );
+			bytes += kv.key.size() + value.size() + NODE_BYTES;
+		}
+	}
+
+	void clear( KeyRangeRef range ) {
+		sets.erase( sets.lower_bound( range.begin ), sets.lower_bound( range.end ) );
+		lsmAddClear( clears, KeyRangeRef( arena, range ) );
+		bytes += range.expectedSize() + NODE_BYTES;
+	}
+
+	// Returns true if the memtable determines the value of key, which is then in value (or absent, if it was cleared)
+	bool find( KeyRef key, Optional<ValueRef>& value ) const {
+		auto it = sets.find( key );
+		if (it != sets.end()) {
+			value = it->second;
+			return true;
+		}
+		auto c = clears.upper_bound( key );
+		if (c != clears.begin() && key < std::prev(c)->second) {
+			value = Optional<ValueRef>();
+			return true;
+		}
+		return false;
+	}
+};
+
+// An immutable sorted run of entries and clears, stored in one file.  Its index, bloom filter and clears are kept in
+// memory; data blocks are read through the page cache as they are needed.
+struct LSMRun : ReferenceCounted<LSMRun>, NonCopyable {
+	int64_t number;
+	int level;
+	std::string filename;
+	Reference<IAsyncFile> file;
+	int64_t fileBytes, entries;
+	bool deleteOnDestroy;	// Set once a durable manifest no longer includes the run
+
+	Arena arena;
+	KeyRangeRef bounds;		// Contains every entry and clear
+	VectorRef<LSMBlockHandleRef> index;
+	StringRef bloom;
+	int bloomHashes;
+	VectorRef<KeyRangeRef> clears;	// Sorted and disjoint
+
+	LSMRun( int64_t number, int level, std::string const& filename ) : number(number), level(level), filename(filename), fileBytes(0), entries(0), deleteOnDestroy(false), bloomHashes(0) {}
+
+	~LSMRun() {
+		if (deleteOnDestroy) {
+			file = Reference<IAsyncFile>();
+			uncancellable( IAsyncFileSystem::filesystem()->deleteFile( filename, false ) );
+		}
+	}
+
+	bool contains( KeyRef key ) const { return bounds.begin <= key && key < bounds.end; }
+	bool isCleared( KeyRef key ) const { return lsmIsCleared( clears, key ); }
+
+	// The block which would hold key, or -1 if the bloom filter or the index shows that there is no entry for it
+	int findBlock( KeyRef key ) const {
+		if (!LSMBloomFilter::mayContain( bloom, bloomHashes, key )) return -1;
+		auto b = std::upper_bound( index.begin(), index.end(), key, [](KeyRef const& k, LSMBlockHandleRef const& h) { return k < h.firstKey; } );
+		if (b == index.begin() || (b-1)->lastKey < key) return -1;
+		return b - 1 - index.begin();
+	}
+};
+
+// Run files end with this footer: the offset, size and crc32c of the metadata, and a magic number
+static const int LSM_FOOTER_BYTES = 24;
+static const uint64_t LSM_RUN_MAGIC = 0x4c534d52554e0001LL;
+
+ACTOR static Future<Standalone<StringRef>> lsmReadBlock( Reference<LSMRun> run, int block ) {
+	state LSMBlockHandleRef h = run->index[block];
+	state Standalone<StringRef> data = makeString( h.size );
+	int bytes = wait( run->file->read( mutateString( data ), h.size, h.offset ) );
+	if (bytes != h.size || !LSMBlock::verify( data )) {
+		TraceEvent(SevError, "LSMBlockChecksumFailed").detail("Filename", run->filename).detail("Offset", h.offset).detail("Size", h.size).detail("BytesRead", bytes);
+		throw checksum_failed();
+	}
+	return data;
+}
+
+ACTOR static Future<Reference<LSMRun>> lsmOpenRun( std::string filename, int64_t number, int level ) {
+	state Reference<LSMRun> run( new LSMRun( number, level, filename ) );
+	state Reference<IAsyncFile> file = wait( IAsyncFileSystem::filesystem()->open( filename, IAsyncFile::OPEN_READWRITE | IAsyncFile::OPEN_LOCK, 0 ) );
+	run->file = file;
+	state int64_t size = wait( file->size() );
+	run->fileBytes = size;
+
+	state Standalone<StringRef> footer = makeString( LSM_FOOTER_BYTES );
+	state int64_t metaOffset = 0;
+	state int metaSize = 0;
+	state uint32_t metaCRC = 0;
+	state uint64_t magic = 0;
+	if (size >= LSM_FOOTER_BYTES) {
+		int bytes = wait( file->read( mutateString( footer ), LSM_FOOTER_BYTES, size - LSM_FOOTER_BYTES ) );
+		if (bytes == LSM_FOOTER_BYTES) {
+			const uint8_t* p = footer.begin();
+			memcpy( &metaOffset, p, 8 );
+			memcpy( &metaSize, p+8, 4 );
+			memcpy( &metaCRC, p+12, 4 );
+			memcpy( &magic, p+16, 8 );
+		}
+	}
+	if (magic != LSM_RUN_MAGIC || metaSize < 0 || metaOffset < 0 || metaOffset + metaSize + LSM_FOOTER_BYTES != size) {
+		TraceEvent(SevError, "LSMRunCorrupt").detail("Filename", filename).detail("Size", size).detail("MetaOffset", metaOffset).detail("MetaSize", metaSize);
+		throw file_corrupt();
+	}
+
+	state Standalone<StringRef> meta = makeString( metaSize );
+	int bytes = wait( file->read( mutateString( meta ), metaSize, metaOffset ) );
+	if (bytes != metaSize || crc32c_append( 0, meta.begin(), meta.size() ) != metaCRC) {
+		TraceEvent(SevError, "LSMRunChecksumFailed").detail("Filename", filename).detail("MetaOffset", metaOffset).detail("MetaSize", metaSize).detail("BytesRead", bytes);
+		throw checksum_failed();
+	}
+	// The reader allocates in its own reference to the arena, which then holds the metadata and everything read from it
+	ArenaReader rd( meta.arena(), meta, IncludeVersion() );
+	rd >> run->index >> run->bloom >> run->bloomHashes >> run->clears >> run->entries >> run->bounds;
+	run->arena = rd.arena();
+	return run;
+}
+
+// Writes a run file: data blocks of entries in key order, then the metadata (block index, bloom filter, clears and
+// bounds) and the footer.  The file is created atomically, so it only appears under its name once it is complete.
+struct LSMRunWriter : ReferenceCounted<LSMRunWriter>, NonCopyable {
+	Reference<LSMRun> run;
+	std::vector<uint8_t> block, buffer;		// The block being built, and finished blocks not yet written
+	std::vector<uint32_t> offsets;
+	std::vector<std::pair<uint32_t, uint32_t>> hashes;
+	std::vector<Future<Void>> writes;
+	int64_t offset;			// Of the start of buffer in the file
+	int64_t dataBytes;
+
+	explicit LSMRunWriter( Reference<LSMRun> run ) : run(run), offset(0), dataBytes(0) {}
+
+	void append( const void* data, int size ) {
+		block.insert( block.end(), (const uint8_t*)data, (const uint8_t*)data + size );
+	}
+
+	void add( KeyValueRef kv ) {
+		uint32_t sizes[2] = { (uint32_t)kv.key.size(), (uint32_t)kv.value.size() };
+		offsets.push_back( block.size() );
+		append( sizes, sizeof(sizes) );
+		append( kv.key.begin(), kv.key.size() );
+		append( kv.value.begin(), kv.value.size() );
+		if (SERVER_KNOBS->LSM_BLOOM_BITS_PER_KEY > 0) {
+			uint32_t h1, h2;
+			LSMBloomFilter::hash( kv.key, h1, h2 );
+			hashes.push_back( std::make_pair( h1, h2 ) );
+		}
+		run->entries++;
+		dataBytes += kv.key.size() + kv.value.size();
+		if (block.size() >= SERVER_KNOBS->LSM_BLOCK_BYTES)
+			finishBlock();
+	}
+
+	void finishBlock() {
+		if (offsets.empty()) return;
+		uint32_t n = offsets.size();
+		append( offsets.data(), n * sizeof(uint32_t) );
+		append( &n, sizeof(n) );
+		uint32_t crc = crc32c_append( 0, block.data(), block.size() );
+		append( &crc, sizeof(crc) );
+
+		StringRef b( block.data(), block.size() );
+		run->index.push_back( run->arena, LSMBlockHandleRef( run->arena, LSMBlock::entry( b, 0 ).key, LSMBlock::entry( b, n-1 ).key, offset + buffer.size(), block.size() ) );
+		buffer.insert( buffer.end(), block.begin(), block.end() );
+		block.clear();
+		offsets.clear();
+	}
+
+	void write() {
+		if (buffer.empty()) return;
+		Standalone<StringRef> data( StringRef( buffer.data(), buffer.size() ) );
+		writes.push_back( holdWhile( data, run->file->write( data.begin(), data.size(), offset ) ) );
+		offset += buffer.size();
+		buffer.clear();
+	}
+
+	bool shouldFlush() const { return buffer.size() >= SERVER_KNOBS->LSM_FILE_FLUSH_BYTES; }
+
+	// Writes out the finished blocks, bounding the dirty pages that the file holds in the page cache
+	ACTOR static Future<Void> flush( Reference<LSMRunWriter> self ) {
+		self->write();
+		state std::vector<Future<Void>> writes;
+		writes.swap( self->writes );
+		wait( waitForAll( writes ) );
+		wait( self->run->file->flush() );
+		return Void();
+	}
+
+	ACTOR static Future<Void> finish( Reference<LSMRunWriter> self, Standalone<VectorRef<KeyRangeRef>> clears ) {
+		self->finishBlock();
+		state LSMRun* run = self->run.getPtr();
+		ASSERT( run->index.size() || clears.size() );
+
+		run->clears = VectorRef<KeyRangeRef>( run->arena, clears );
+		if (self->hashes.size()) {
+			int bytes = (self->hashes.size() * SERVER_KNOBS->LSM_BLOOM_BITS_PER_KEY + 7) / 8;
+			bytes = std::max( bytes, 8 );
+			uint8_t* bits = new (run->arena) uint8_t[bytes];
+			memset( bits, 0, bytes );
+			run->bloomHashes = LSMBloomFilter::hashCount( SERVER_KNOBS->LSM_BLOOM_BITS_PER_KEY );
+			uint64_t nbits = uint64_t(bytes) * 8;
+			for (auto& h : self->hashes) {
+				for (int i = 0; i < run->bloomHashes; i++) {
+					uint64_t b = (h.first + uint64_t(i) * h.second) % nbits;
+					bits[b/8] |= 1 << (b%8);
+				}
+			}
+			run->bloom = StringRef( bits, bytes );
+			std::vector<std::pair<uint32_t, uint32_t>>().swap( self->hashes );
+		}
+
+		KeyRef begin, end;
+		if (run->index.size()) {
+			begin = run->index.front().firstKey;
+			end = keyAfter( run->index.back().lastKey, run->arena );
+		}
+		if (run->clears.size()) {
+			if (!run->index.size() || run->clears.front().begin < begin) begin = run->clears.front().begin;
+			if (!run->index.size() || end < run->clears.back().end) end = run->clears.back().end;
+		}
+		run->bounds = KeyRangeRef( begin, end );
+
+		BinaryWriter wr( IncludeVersion() );
+		wr << run->index << run->bloom << run->bloomHashes << run->clears << run->entries << run->bounds;
+		int64_t metaOffset = self->offset + self->buffer.size();
+		int metaSize = wr.getLength();
+		uint32_t metaCRC = crc32c_append( 0, (const uint8_t*)wr.getData(), metaSize );
+		self->buffer.insert( self->buffer.end(), (const uint8_t*)wr.getData(), (const uint8_t*)wr.getData() + metaSize );
+		uint8_t footer[LSM_FOOTER_BYTES];
+		memcpy( footer, &metaOffset, 8 );
+		memcpy( footer+8, &metaSize, 4 );
+		memcpy( footer+12, &metaCRC, 4 );
+		memcpy( footer+16, &LSM_RUN_MAGIC, 8 );
+		self->buffer.insert( self->buffer.end(), footer, footer + LSM_FOOTER_BYTES );
+		self->write();
+
+		wait( waitForAll( self->writes ) );
+		self->writes.clear();
+		wait( run->file->sync() );
+		run->fileBytes = self->offset;
+		return Void();
+	}
+};
+
+// Iterates over the entries of one source within a range, in either direction.  The active memtable changes with every
+// write, so its entries and clears are copied when the cursor is made; a frozen memtable is iterated in place; a sequence
+// of disjoint runs in key order (a level, or one run of level 0) is read a block at a time.
+struct LSMCursor {
+	enum State { Valid, NeedsBlock, Exhausted };
+
+	KeyRangeRef keys;
+	bool forward;
+	State state;
+	int pos;
+
+	Standalone<VectorRef<KeyValueRef>> entries;		// The active memtable's entries, in the order of iteration
+	Standalone<VectorRef<KeyRangeRef>> memtableClears;
+
+	Reference<LSMMemtable> frozen;
+	std::map<KeyRef, ValueRef>::const_iterator it;
+
+	std::vector<Reference<LSMRun>> runs;
+	int run, block;				// The block which is loaded (if Valid) or to be loaded (if NeedsBlock)
+	Standalone<StringRef> data;
+	Future<Standalone<StringRef>> loading;
+
+	// Copies the active memtable.  Its entries are never hidden by another source, so no more than rowLimit and
+	// byteLimit allow can be in the result of a read.
+	LSMCursor( KeyRangeRef keys, bool forward, LSMMemtable const& memtable, int rowLimit, int byteLimit )
+		: keys(keys), forward(forward), pos(0), run(0), block(0)
+	{
+		if (forward) {
+			for (auto i = memtable.sets.lower_bound( keys.begin ); i != memtable.sets.end() && i->first < keys.end && rowLimit && byteLimit >= 0; ++i, --rowLimit) {
+				byteLimit -= sizeof(KeyValueRef) + i->first.size() + i->second.size();
+				entries.push_back_deep( entries.arena(), KeyValueRef( i->first, i->second ) );
+			}
+		} else {
+			auto i = memtable.sets.lower_bound( keys.end );
+			while (i != memtable.sets.begin() && rowLimit && byteLimit >= 0) {
+				--i;
+				if (i->first < keys.begin) break;
+				byteLimit -= sizeof(KeyValueRef) + i->first.size() + i->second.size();
+				entries.push_back_deep( entries.arena(), KeyValueRef( i->first, i->second ) );
+				--rowLimit;
+			}
+		}
+		auto c = memtable.clears.upper_bound( keys.begin );
+		if (c != memtable.clears.begin() && keys.begin < std::prev(c)->second) --c;
+		for (; c != memtable.clears.end() && c->first < keys.end; ++c)
+			memtableClears.push_back_deep( memtableClears.arena(), KeyRangeRef( c->first, c->second ) );
+		state = entries.size() ? Valid : Exhausted;
+	}
+
+	LSMCursor( KeyRangeRef keys, bool forward, Reference<LSMMemtable> const& frozen ) : keys(keys), forward(forward), pos(0), frozen(frozen), run(0), block(0) {
+		if (forward) {
+			it = frozen->sets.lower_bound( keys.begin );
+			state = it != frozen->sets.end() && it->first < keys.end ? Valid : Exhausted;
+		} else {
+			it = frozen->sets.lower_bound( keys.end );
+			stepBack();
+		}
+	}
+
+	LSMCursor( KeyRangeRef keys, bool forward, std::vector<Reference<LSMRun>> const& runs ) : keys(keys), forward(forward), runs(runs), pos(0) {
+		if (forward) {
+			run = 0;
+			block = runs.size() ? firstBlock() : 0;
+		} else {
+			run = runs.size() - 1;
+			block = runs.size() ? lastBlock() : 0;
+		}
+		nextBlock( false );
+	}
+
+	KeyValueRef current() const {
+		if (frozen) return KeyValueRef( it->first, it->second );
+		return runs.empty() ? entries[pos] : LSMBlock::entry( data, pos );
+	}
+	KeyRef key() const { return current().key; }
+
+	bool isCleared( KeyRef key ) const {
+		if (frozen) {
+			auto c = frozen->clears.upper_bound( key );
+			return c != frozen->clears.begin() && key < std::prev(c)->second;
+		}
+		if (runs.empty()) return lsmIsCleared( memtableClears, key );
+		auto r = std::upper_bound( runs.begin(), runs.end(), key, [](KeyRef const& k, Reference<LSMRun> const& r) { return k < r->bounds.begin; } );
+		return r != runs.begin() && (*(r-1))->contains( key ) && (*(r-1))->isCleared( key );
+	}
+
+	void advance() {
+		if (frozen) {
+			if (forward) {
+				++it;
+				state = it != frozen->sets.end() && it->first < keys.end ? Valid : Exhausted;
+			} else {
+				stepBack();
+			}
+			return;
+		}
+		// The active memtable's entries are copied in the order of iteration; blocks are read in either direction
+		pos += (runs.empty() || forward) ? 1 : -1;
+		checkPosition();
+	}
+
+	void setBlock( Standalone<StringRef> const& block ) {
+		data = block;
+		pos = forward ? LSMBlock::lowerBound( data, keys.begin ) : LSMBlock::lowerBound( data, keys.end ) - 1;
+		checkPosition();
+	}
+
+private:
+	void stepBack() {
+		if (it == frozen->sets.begin()) {
+			state = Exhausted;
+		} else {
+			--it;
+			state = keys.begin <= it->first ? Valid : Exhausted;
+		}
+	}
+
+	// The first block of runs[run] with entries at or after keys.begin, and the last with entries before keys.end
+	int firstBlock() const {
+		auto& index = runs[run]->index;
+		return std::lower_bound( index.begin(), index.end(), keys.begin, [](LSMBlockHandleRef const& h, KeyRef const& k) { return h.lastKey < k; } ) - index.begin();
+	}
+	int lastBlock() const {
+		auto& index = runs[run]->index;
+		return std::lower_bound( index.begin(), index.end(), keys.end, [](LSMBlockHandleRef const& h, KeyRef const& k) { return h.firstKey < k; } ) - index.begin() - 1;
+	}
+
+	void checkPosition() {
+		if (runs.empty()) {
+			state = pos < entries.size() ? Valid : Exhausted;
+		} else if (pos < 0 || pos >= LSMBlock::count( data )) {
+			nextBlock( true );
+		} else {
+			KeyRef k = LSMBlock::entry( data, pos ).key;
+			state = (forward ? k < keys.end : keys.begin <= k) ? Valid : Exhausted;
+		}
+	}
+
+	// Keeps the current block, which holds the entry last returned by LSMMerge::next(), until the next one is loaded
+	void nextBlock( bool advance ) {
+		if (forward) {
+			if (advance) block++;
+			while (run < runs.size()) {
+				if (block < runs[run]->index.size()) {
+					state = runs[run]->index[block].firstKey < keys.end ? NeedsBlock : Exhausted;
+					return;
+				}
+				if (++run < runs.size()) block = firstBlock();
+			}
+		} else {
+			if (advance) block--;
+			while (run >= 0) {
+				if (block >= 0) {
+					state = keys.begin <= runs[run]->index[block].lastKey ? NeedsBlock : Exhausted;
+					return;
+				}
+				if (--run >= 0) block = lastBlock();
+			}
+		}
+		state = Exhausted;
+	}
+
+	friend struct LSMMerge;
+};
+
+// Merges sources, newest first, into the live entries of a range: the newest entry for each key, unless a newer source
+// has cleared it
+struct LSMMerge {
+	enum Status { Entry, NeedsLoad, End };
+
+	Standalone<KeyRangeRef> keys;
+	bool forward;
+	std::vector<LSMCursor> cursors;
+
+	LSMMerge() : forward(true) {}
+	LSMMerge( KeyRangeRef keys, bool forward ) : keys(keys), forward(forward) {}
+
+	// Returns NeedsLoad if a block must be loaded (with load()) before the next entry can be found.  kv stays valid
+	// until then.
+	Status next( KeyValueRef& kv ) {
+		loop {
+			int best = -1;
+			KeyRef bestKey;
+			for (int i = 0; i < cursors.size(); i++) {
+				if (cursors[i].state == LSMCursor::NeedsBlock) return NeedsLoad;
+				if (cursors[i].state != LSMCursor::Valid) continue;
+				KeyRef k = cursors[i].key();
+				if (best < 0 || (forward ? k < bestKey : bestKey < k)) {
+					best = i;
+					bestKey = k;
+				}
+			}
+			if (best < 0) return End;
+
+			kv = cursors[best].current();
+			bool cleared = false;
+			for (int i = 0; i < best && !cleared; i++)
+				cleared = cursors[i].isCleared( kv.key );
+			for (int i = best; i < cursors.size(); i++)
+				if (cursors[i].state == LSMCursor::Valid && cursors[i].key() == kv.key)
+					cursors[i].advance();
+			if (!cleared) return Entry;
+		}
+	}
+
+	ACTOR static Future<Void> load( LSMMerge* self ) {
+		state std::vector<Future<Void>> loads;
+		for (auto& c : self->cursors) {
+			if (c.state == LSMCursor::NeedsBlock) {
+				c.loading = lsmReadBlock( c.runs[c.run], c.block );
+				loads.push_back( success( c.loading ) );
+			}
+		}
+		wait( waitForAll( loads ) );
+		for (auto& c : self->cursors) {
+			if (c.state == LSMCursor::NeedsBlock) {
+				c.setBlock( c.loading.get() );
+				c.loading = Future<Standalone<StringRef>>();
+			}
+		}
+		return Void();
+	}
+};
+
+class KeyValueStoreLSM : public IKeyValueStore, NonCopyable {
+public:
+	KeyValueStoreLSM( std::string const& filename, UID id );
+
+	// IClosable
+	virtual Future<Void> getError() { return log->getError() || background; }
+	virtual Future<Void> onClosed() { return stopped.getFuture(); }
+	virtual void dispose() { doClose( this, true ); }
+	virtual void close() { doClose( this, false ); }
+
+	// IKeyValueStore
+	virtual KeyValueStoreType getType() { return KeyValueStoreType::SSD_LSM; }
+
+	virtual StorageBytes getStorageBytes() {
+		int64_t free, total;
+		g_network->getDiskBytes( parentDirectory( filename ), free, total );
+		int64_t used = log->getStorageBytes().used;
+		for (auto& level : levels)
+			for (auto& run : level)
+				used += run->fileBytes;
+		return StorageBytes( free, total, used, free );
+	}
+
+	virtual void set( KeyValueRef keyValue, const Arena* arena = NULL ) {
+		if (!recovering.isReady()) {
+			pendingWrites.push_back_deep( pendingWrites.arena(), MutationRef( MutationRef::SetValue, keyValue.key, keyValue.value ) );
+			return;
+		}
+		active->set( keyValue );
+		logOp( OpSet, keyValue.key, keyValue.value );
+		uncommitted = true;
+	}
+
+	virtual void clear( KeyRangeRef range, const Arena* arena = NULL ) {
+		if (!recovering.isReady()) {
+			pendingWrites.push_back_deep( pendingWrites.arena(), MutationRef( MutationRef::ClearRange, range.begin, range.end ) );
+			return;
+		}
+		active->clear( range );
+		logOp( OpClear, range.begin, range.end );
+		uncommitted = true;
+	}
+
+	virtual Future<Void> commit( bool sequential = false ) {
+		if (recovering.isError()) throw recovering.getError();
+		if (!recovering.isReady()) return waitAndCommit( this, sequential );
+		if (!uncommitted) return Void();
+
+		logOp( OpCommit );
+		uncommitted = false;
+		if (!frozen && active->bytes >= SERVER_KNOBS->LSM_MEMTABLE_BYTES)
+			freezeMemtable();
+
+		Future<Void> c = log->commit();
+		if (mustStall())
+			return stallCommit( this, c );
+		return c;
+	}
+
+	virtual Future<Optional<Value>> readValue( KeyRef key, Optional<UID> debugID = Optional<UID>() ) {
+		return readValuePrefix( key, std::numeric_limits<int>::max(), debugID );
+	}
+
+	virtual Future<Optional<Value>> readValuePrefix( KeyRef key, int maxLength, Optional<UID> debugID = Optional<UID>() ) {
+		if (recovering.isError()) throw recovering.getError();
+		if (!recovering.isReady()) return waitAndReadValuePrefix( this, key, maxLength );
+
+		Optional<ValueRef> value;
+		if (active->find( key, value ) || (frozen && frozen->find( key, value ))) {
+			if (!value.present()) return Optional<Value>();
+			return Optional<Value>( Value( value.get().substr( 0, std::min( maxLength, value.get().size() ) ) ) );
+		}
+
+		std::vector<Reference<LSMRun>> runs;
+		for (auto& run : levels[0])
+			if (run->contains( key ))
+				runs.push_back( run );
+		for (int l = 1; l < levels.size(); l++) {
+			auto r = findRun( l, key );
+			if (r != levels[l].end())
+				runs.push_back( *r );
+		}
+		if (runs.empty()) return Optional<Value>();
+		return readValueFromRuns( key, maxLength, runs );
+	}
+
+	// If rowLimit>=0, reads first rows sorted ascending, otherwise reads last rows sorted descending
+	// The total size of the returned value (less the last entry) will be less than byteLimit
+	virtual Future<Standalone<VectorRef<KeyValueRef>>> readRange( KeyRangeRef keys, int rowLimit = 1<<30, int byteLimit = 1<<30 ) {
+		if (recovering.isError()) throw recovering.getError();
+		if (!recovering.isReady()) return waitAndReadRange( this, keys, rowLimit, byteLimit );
+		if (!rowLimit || keys.begin >= keys.end) return Standalone<VectorRef<KeyValueRef>>();
+
+		bool forward = rowLimit > 0;
+		int rows = forward ? rowLimit : -rowLimit;
+		LSMMerge merge( keys, forward );
+		merge.cursors.push_back( LSMCursor( merge.keys, forward, *active, rows, byteLimit ) );
+		if (frozen)
+			merge.cursors.push_back( LSMCursor( merge.keys, forward, frozen ) );
+		addRunCursors( merge );
+		return readRangeFromMerge( merge, rows, byteLimit );
+	}
+
+private:
+	enum OpType {
+		OpSet,
+		OpClear,
+		OpCommit,
+		OpRollback,
+		OpMemtable,		// Begins the writes of a memtable (p1 is its generation)
+		OpManifest		// The live runs (p1 is an LSMManifest)
+	};
+
+	struct OpHeader {
+		int op;
+		int len1, len2;
+	};
+
+	struct LSMManifest {
+		int64_t flushedGeneration;		// Every memtable of this generation or before is in a run
+		int64_t nextFileNumber;
+		std::vector<std::pair<int64_t, int>> runs;	// File number and level
+
+		LSMManifest() : flushedGeneration(0), nextFileNumber(0) {}
+
+		template <class Ar>
+		void serialize( Ar& ar ) {
+			ar & flushedGeneration & nextFileNumber & runs;
+		}
+	};
+
+	static const int MAX_LEVELS = 7;
+
+	UID id;
+	std::string filename;
+	IDiskQueue* log;
+	IDiskQueue::location lastLogLocation;	// The end of the last logged op
+	IDiskQueue::location flushPopLocation;	// The start of the frozen memtable's successor in the log
+
+	Reference<LSMMemtable> active, frozen;
+	std::vector<std::vector<Reference<LSMRun>>> levels;		// Level 0 is newest first; others are in key order
+	std::vector<Key> compactPointers;		// Where the next compaction of each level starts
+	int64_t flushedGeneration, nextFileNumber;
+	bool uncommitted;
+	Standalone<VectorRef<MutationRef>> pendingWrites;	// Written before recovery completed
+
+	AsyncTrigger flushNeeded, runsChanged;
+	Future<Void> recovering, background;
+	PromiseStream<Future<Void>> addActor;
+	Promise<Void> stopped;
+
+	int64_t flushes, flushBytes, compactions, compactionBytesRead, compactionBytesWritten, stalls;
+
+	std::string runFilename( int64_t number ) const { return filename + format( "-%lld.run", number ); }
+
+	IDiskQueue::location logOp( OpType op, StringRef v1 = StringRef(), StringRef v2 = StringRef() ) {
+		OpHeader h = { (int)op, v1.size(), v2.size() };
+		log->push( StringRef( (const uint8_t*)&h, sizeof(h) ) );
+		log->push( v1 );
+		log->push( v2 );
+		return lastLogLocation = log->push( LiteralStringRef("\x01") );
+	}
+
+	void freezeMemtable() {
+		flushPopLocation = lastLogLocation;
+		frozen = active;
+		active = Reference<LSMMemtable>( new LSMMemtable( frozen->generation + 1 ) );
+		logOp( OpMemtable, BinaryWriter::toValue( active->generation, Unversioned() ) );
+		flushNeeded.trigger();
+	}
+
+	bool mustStall() const {
+		return (frozen && active->bytes >= SERVER_KNOBS->LSM_MEMTABLE_BYTES) || levels[0].size() >= SERVER_KNOBS->LSM_LEVEL0_STALL_RUNS;
+	}
+
+	Future<Void> writeManifest() {
+		LSMManifest manifest;
+		manifest.flushedGeneration = flushedGeneration;
+		manifest.nextFileNumber = nextFileNumber;
+		for (auto& level : levels)
+			for (auto& run : level)
+				manifest.runs.push_back( std::make_pair( run->number, run->level ) );
+		logOp( OpManifest, BinaryWriter::toValue( manifest, IncludeVersion() ) );
+		return log->commit();
+	}
+
+	std::vector<Reference<LSMRun>>::iterator findRun( int level, KeyRef key ) {
+		auto& runs = levels[level];
+		auto r = std::upper_bound( runs.begin(), runs.end(), key, [](KeyRef const& k, Reference<LSMRun> const& r) { return k < r->bounds.begin; } );
+		if (r == runs.begin() || !(*(r-1))->contains( key )) return runs.end();
+		return r-1;
+	}
+
+	std::vector<Reference<LSMRun>> overlapping( int level, KeyRangeRef range ) {
+		std::vector<Reference<LSMRun>> result;
+		for (auto& run : levels[level])
+			if (run->bounds.begin < range.end && range.begin < run->bounds.end)
+				result.push_back( run );
+		return result;
+	}
+
+	void addRunCursors( LSMMerge& merge ) {
+		for (auto& run : levels[0])
+			if (run->bounds.begin < merge.keys.end && merge.keys.begin < run->bounds.end)
+				merge.cursors.push_back( LSMCursor( merge.keys, merge.forward, std::vector<Reference<LSMRun>>( 1, run ) ) );
+		for (int l = 1; l < levels.size(); l++) {
+			auto runs = overlapping( l, merge.keys );
+			if (runs.size())
+				merge.cursors.push_back( LSMCursor( merge.keys, merge.forward, runs ) );
+		}
+	}
+
+	void insertRun( Reference<LSMRun> run ) {
+		auto& runs = levels[run->level];
+		if (run->level == 0) {
+			auto r = runs.begin();
+			while (r != runs.end() && (*r)->number > run->number) ++r;
+			runs.insert( r, run );
+		} else {
+			auto r = std::upper_bound( runs.begin(), runs.end(), run->bounds.begin, [](KeyRef const& k, Reference<LSMRun> const& r) { return k < r->bounds.begin; } );
+			ASSERT( r == runs.begin() || (*(r-1))->bounds.end <= run->bounds.begin );
+			ASSERT( r == runs.end() || run->bounds.end <= (*r)->bounds.begin );
+			runs.insert( r, run );
+		}
+	}
+
+	void removeRun( Reference<LSMRun> run ) {
+		auto& runs = levels[run->level];
+		auto r = std::find( runs.begin(), runs.end(), run );
+		ASSERT( r != runs.end() );
+		runs.erase( r );
+	}
+
+	int64_t levelBytes( int level ) const {
+		int64_t bytes = 0;
+		for (auto& run : levels[level])
+			bytes += run->fileBytes;
+		return bytes;
+	}
+
+	// The level most in need of compaction, or -1 if none is over its target size
+	int pickCompactionLevel() const {
+		double bestScore = 1;
+		int best = -1;
+		double score = levels[0].size() / double(SERVER_KNOBS->LSM_LEVEL0_COMPACTION_RUNS);
+		if (score >= bestScore) {
+			bestScore = score;
+			best = 0;
+		}
+		double target = SERVER_KNOBS->LSM_LEVEL1_BYTES;
+		for (int l = 1; l < MAX_LEVELS-1; l++) {
+			score = levelBytes( l ) / target;
+			if (score > bestScore) {
+				bestScore = score;
+				best = l;
+			}
+			target *= SERVER_KNOBS->LSM_LEVEL_SIZE_MULTIPLIER;
+		}
+		return best;
+	}
+
+	ACTOR static Future<Optional<Value>> readValueFromRuns( Key key, int maxLength, std::vector<Reference<LSMRun>> runs ) {
+		state int i;
+		for (i = 0; i < runs.size(); i++) {
+			state int block = runs[i]->findBlock( key );
+			if (block >= 0) {
+				Standalone<StringRef> data = wait( lsmReadBlock( runs[i], block ) );
+				int pos = LSMBlock::lowerBound( data, key );
+				if (pos < LSMBlock::count( data )) {
+					KeyValueRef kv = LSMBlock::entry( data, pos );
+					if (kv.key == key)
+						return Optional<Value>( Value( kv.value.substr( 0, std::min( maxLength, kv.value.size() ) ), data.arena() ) );
+				}
+			}
+			if (runs[i]->isCleared( key ))
+				return Optional<Value>();
+		}
+		return Optional<Value>();
+	}
+
+	ACTOR static Future<Standalone<VectorRef<KeyValueRef>>> readRangeFromMerge( LSMMerge merge, int rowLimit, int byteLimit ) {
+		state Standalone<VectorRef<KeyValueRef>> result;
+		state KeyValueRef kv;
+		while (rowLimit && byteLimit >= 0) {
+			LSMMerge::Status status = merge.next( kv );
+			if (status == LSMMerge::End) break;
+			if (status == LSMMerge::NeedsLoad) {
+				wait( LSMMerge::load( &merge ) );
+			} else {
+				byteLimit -= sizeof(KeyValueRef) + kv.key.size() + kv.value.size();
+				result.push_back_deep( result.arena(), kv );
+				--rowLimit;
+			}
+		}
+		return result;
+	}
+
+	ACTOR static Future<Reference<LSMRunWriter>> createRun( KeyValueStoreLSM* self, int level ) {
+		state int64_t number = self->nextFileNumber++;
+		state Reference<LSMRun> run( new LSMRun( number, level, self->runFilename( number ) ) );
+		Reference<IAsyncFile> file = wait( IAsyncFileSystem::filesystem()->open( run->filename, IAsyncFile::OPEN_ATOMIC_WRITE_AND_CREATE | IAsyncFile::OPEN_CREATE | IAsyncFile::OPEN_READWRITE | IAsyncFile::OPEN_LOCK, 0600 ) );
+		run->file = file;
+		return Reference<LSMRunWriter>( new LSMRunWriter( run ) );
+	}
+
+	ACTOR static Future<Void> flusher( KeyValueStoreLSM* self ) {
+		wait( self->recovering );
+		loop {
+			while (!self->frozen)
+				wait( self->flushNeeded.onTrigger() );
+
+			state Reference<LSMMemtable> memtable = self->frozen;
+			state IDiskQueue::location popLocation = self->flushPopLocation;
+			state double start = now();
+			state Reference<LSMRunWriter> writer = wait( createRun( self, 0 ) );
+			state std::map<KeyRef, ValueRef>::iterator it = memtable->sets.begin();
+			state int entries = 0;
+			for (; it != memtable->sets.end(); ++it) {
+				writer->add( KeyValueRef( it->first, it->second ) );
+				if (writer->shouldFlush())
+					wait( LSMRunWriter::flush( writer ) );
+				if (++entries % SERVER_KNOBS->LSM_COMPACTION_YIELD_ENTRIES == 0)
+					wait( yield() );
+			}
+			if (writer->run->entries || memtable->clears.size()) {
+				wait( LSMRunWriter::finish( writer, lsmClearsVector( memtable->clears ) ) );
+				self->insertRun( writer->run );
+			}
+
+			self->frozen.clear();
+			self->flushedGeneration = memtable->generation;
+			self->runsChanged.trigger();
+			wait( self->writeManifest() );
+			self->log->pop( popLocation );
+
+			self->flushes++;
+			self->flushBytes += writer->run->fileBytes;
+			TraceEvent("LSMFlush", self->id)
+				.detail("Generation", memtable->generation)
+				.detail("Run", writer->run->number)
+				.detail("Entries", writer->run->entries)
+				.detail("Bytes", writer->run->fileBytes)
+				.detail("Level0Runs", self->levels[0].size())
+				.detail("Elapsed", now() - start);
+			writer = Reference<LSMRunWriter>();
+			memtable = Reference<LSMMemtable>();
+		}
+	}
+
+	ACTOR static Future<Void> compact( KeyValueStoreLSM* self, int level ) {
+		state double start = now();
+		state std::vector<Reference<LSMRun>> inputs;		// From level, newest first
+		if (level == 0) {
+			inputs = self->levels[0];
+		} else {
+			// Take turns through the level's key space
+			auto& runs = self->levels[level];
+			auto r = std::lower_bound( runs.begin(), runs.end(), self->compactPointers[level], [](Reference<LSMRun> const& r, KeyRef const& k) { return r->bounds.begin < k; } );
+			inputs.push_back( r != runs.end() ? *r : runs.front() );
+		}
+		state KeyRange range = inputs[0]->bounds;
+		for (auto& run : inputs)
+			range = KeyRangeRef( std::min( range.begin, run->bounds.begin ), std::max( range.end, run->bounds.end ) );
+		state std::vector<Reference<LSMRun>> overlapping = self->overlapping( level+1, range );
+		for (auto& run : overlapping)
+			range = KeyRangeRef( std::min( range.begin, run->bounds.begin ), std::max( range.end, run->bounds.end ) );
+
+		// Clears are only needed to hide entries in older levels
+		state bool bottom = true;
+		for (int l = level+2; l < self->levels.size(); l++)
+			if (self->levels[l].size())
+				bottom = false;
+
+		state std::vector<Reference<LSMRun>> outputs;
+		state int64_t bytesRead = 0;
+		for (auto& run : inputs) bytesRead += run->fileBytes;
+		for (auto& run : overlapping) bytesRead += run->fileBytes;
+
+		if (level > 0 && overlapping.empty() && !(bottom && inputs[0]->clears.size())) {
+			// Nothing to merge with, so just move the run down a level
+			TEST( true );  // LSM run moved to the next level
+			self->removeRun( inputs[0] );
+			inputs[0]->level = level+1;
+			self->insertRun( inputs[0] );
+			self->compactPointers[level] = range.end;
+			self->runsChanged.trigger();
+			wait( self->writeManifest() );
+			return Void();
+		}
+
+		state Standalone<VectorRef<KeyRangeRef>> clears;
+		if (!bottom) {
+			std::map<KeyRef, KeyRef> allClears;
+			for (auto& run : inputs)
+				for (auto& c : run->clears)
+					lsmAddClear( allClears, c );
+			for (auto& run : overlapping)
+				for (auto& c : run->clears)
+					lsmAddClear( allClears, c );
+			clears = lsmClearsVector( allClears );
+		}
+
+		state LSMMerge merge = LSMMerge( range, true );
+		for (auto& run : inputs)
+			merge.cursors.push_back( LSMCursor( merge.keys, true, std::vector<Reference<LSMRun>>( 1, run ) ) );
+		merge.cursors.push_back( LSMCursor( merge.keys, true, overlapping ) );
+
+		// Split the output into files of about LSM_RUN_FILE_BYTES, dividing the clears between them
+		state Reference<LSMRunWriter> writer;
+		state Key outputBegin;
+		state KeyValueRef kv;
+		state int entries = 0;
+		loop {
+			LSMMerge::Status status = merge.next( kv );
+			if (status == LSMMerge::End) break;
+			if (status == LSMMerge::NeedsLoad) {
+				wait( LSMMerge::load( &merge ) );
+				continue;
+			}
+			if (writer && writer->dataBytes >= SERVER_KNOBS->LSM_RUN_FILE_BYTES) {
+				state Key splitKey = kv.key;
+				wait( LSMRunWriter::finish( writer, lsmClipClears( clears, outputBegin, splitKey ) ) );
+				outputs.push_back( writer->run );
+				writer = Reference<LSMRunWriter>();
+				outputBegin = splitKey;
+			}
+			if (!writer) {
+				Reference<LSMRunWriter> w = wait( createRun( self, level+1 ) );
+				writer = w;
+			}
+			writer->add( kv );
+			if (writer->shouldFlush())
+				wait( LSMRunWriter::flush( writer ) );
+			if (++entries % SERVER_KNOBS->LSM_COMPACTION_YIELD_ENTRIES == 0)
+				wait( yield() );
+		}
+		state Standalone<VectorRef<KeyRangeRef>> lastClears = lsmClipClears( clears, outputBegin, KeyRef() );
+		if (!writer && lastClears.size()) {
+			Reference<LSMRunWriter> w = wait( createRun( self, level+1 ) );
+			writer = w;
+		}
+		if (writer) {
+			wait( LSMRunWriter::finish( writer, lastClears ) );
+			outputs.push_back( writer->run );
+			writer = Reference<LSMRunWriter>();
+		}
+
+		for (auto& run : inputs) self->removeRun( run );
+		for (auto& run : overlapping) self->removeRun( run );
+		for (auto& run : outputs) self->insertRun( run );
+		if (level > 0) self->compactPointers[level] = range.end;
+		self->runsChanged.trigger();
+		wait( self->writeManifest() );
+		for (auto& run : inputs) run->deleteOnDestroy = true;
+		for (auto& run : overlapping) run->deleteOnDestroy = true;
+
+		state int64_t bytesWritten = 0;
+		for (auto& run : outputs) bytesWritten += run->fileBytes;
+		self->compactions++;
+		self->compactionBytesRead += bytesRead;
+		self->compactionBytesWritten += bytesWritten;
+		TraceEvent("LSMCompaction", self->id)
+			.detail("Level", level)
+			.detail("InputRuns", inputs.size())
+			.detail("OverlappingRuns", overlapping.size())
+			.detail("OutputRuns", outputs.size())
+			.detail("BytesRead", bytesRead)
+			.detail("BytesWritten", bytesWritten)
+			.detail("Bottom", bottom)
+			.detail("Elapsed", now() - start);
+		return Void();
+	}
+
+	ACTOR static Future<Void> compactor( KeyValueStoreLSM* self ) {
+		wait( self->recovering );
+		loop {
+			state int level = self->pickCompactionLevel();
+			if (level < 0) {
+				wait( self->runsChanged.onTrigger() );
+			} else {
+				wait( compact( self, level ) );
+				wait( yield() );
+			}
+		}
+	}
+
+	ACTOR static Future<Void> stallCommit( KeyValueStoreLSM* self, Future<Void> commit ) {
+		wait( commit );
+		state double start = now();
+		self->stalls++;
+		while (self->mustStall())
+			wait( self->runsChanged.onTrigger() );
+		TraceEvent(now() - start > 1 ? SevWarnAlways : SevInfo, "LSMCommitStalled", self->id)
+			.detail("Elapsed", now() - start)
+			.detail("Level0Runs", self->levels[0].size())
+			.detail("MemtableBytes", self->active->bytes)
+			.detail("Stalls", self->stalls)
+			.suppressFor(1.0);
+		return Void();
+	}
+
+	ACTOR static Future<Void> logMetrics( KeyValueStoreLSM* self ) {
+		wait( self->recovering );
+		loop {
+			wait( delay( SERVER_KNOBS->STORAGE_LOGGING_DELAY ) );
+			TraceEvent e("LSMMetrics", self->id);
+			e.detail("MemtableBytes", self->active->bytes)
+				.detail("Flushing", (bool)self->frozen)
+				.detail("Flushes", self->flushes)
+				.detail("FlushBytes", self->flushBytes)
+				.detail("Compactions", self->compactions)
+				.detail("CompactionBytesRead", self->compactionBytesRead)
+				.detail("CompactionBytesWritten", self->compactionBytesWritten)
+				.detail("Stalls", self->stalls);
+			for (int l = 0; l < self->levels.size(); l++) {
+				if (self->levels[l].empty()) continue;
+				e.detail( format( "Level%dRuns", l ).c_str(), self->levels[l].size() );
+				e.detail( format( "Level%dBytes", l ).c_str(), self->levelBytes( l ) );
+			}
+		}
+	}
+
+	ACTOR static Future<Void> recover( KeyValueStoreLSM* self ) {
+		state LSMManifest manifest;
+		state int64_t generation = 0;
+		state int64_t maxGeneration = 0;
+		state std::vector<std::pair<int64_t, MutationRef>> writes;	// With the generation of their memtable
+		state std::vector<Arena> arenas;
+		state size_t committed = 0;
+		state int zeroFillSize = 0;
+		state int commits = 0;
+		state double startt = now();
+		state OpHeader h;
+
+		TraceEvent("LSMRecoveryStarted", self->id).detail("Filename", self->filename);
+
+		try {
+			loop {
+				Standalone<StringRef> data = wait( self->log->readNext( sizeof(OpHeader) ) );
+				if (data.size() != sizeof(OpHeader)) {
+					if (data.size()) {
+						TEST(true);  // zero fill partial header in KeyValueStoreLSM
+						memset(&h, 0, sizeof(OpHeader));
+						memcpy(&h, data.begin(), data.size());
+						zeroFillSize = sizeof(OpHeader)-data.size() + h.len1 + h.len2 + 1;
+					}
+					break;
+				}
+				h = *(OpHeader*)data.begin();
+				Standalone<StringRef> data = wait( self->log->readNext( h.len1 + h.len2+1 ) );
+				if (data.size() != h.len1 + h.len2 + 1) {
+					zeroFillSize = h.len1 + h.len2 + 1 - data.size();
+					break;
+				}
+				if (!data[data.size()-1]) continue;  // zero filled
+
+				StringRef p1 = data.substr(0, h.len1);
+				StringRef p2 = data.substr(h.len1, h.len2);
+				if (h.op == OpSet || h.op == OpClear) {
+					arenas.push_back( data.arena() );
+					writes.push_back( std::make_pair( generation, MutationRef( h.op == OpSet ? MutationRef::SetValue : MutationRef::ClearRange, p1, p2 ) ) );
+				} else if (h.op == OpCommit) {
+					committed = writes.size();
+					++commits;
+				} else if (h.op == OpRollback) {
+					writes.resize( committed );
+				} else if (h.op == OpMemtable) {
+					generation = BinaryReader::fromStringRef<int64_t>( p1, Unversioned() );
+					maxGeneration = std::max( maxGeneration, generation );
+				} else if (h.op == OpManifest) {
+					manifest = BinaryReader::fromStringRef<LSMManifest>( p1, IncludeVersion() );
+				} else
+					ASSERT(false);
+				wait( yield() );
+			}
+			writes.resize( committed );
+
+			if (zeroFillSize) {
+				TEST( true );  // Fixing a partial commit at the end of the KeyValueStoreLSM log
+				for(int i=0; i<zeroFillSize; i++)
+					self->log->push( StringRef((const uint8_t*)"",1) );
+			}
+
+			// Open the runs of the manifest, and delete any other run files (left by a flush or compaction which did not finish)
+			state std::string prefix = basename( self->filename ) + "-";
+			state std::vector<std::string> orphans;
+			state std::set<int64_t> live;
+			for (auto& r : manifest.runs)
+				live.insert( r.first );
+			self->nextFileNumber = manifest.nextFileNumber;
+			for (auto& f : platform::listFiles( parentDirectory( self->filename ) )) {
+				if (!StringRef(f).startsWith( StringRef(prefix) )) continue;
+				long long number;
+				bool part = StringRef(f).endsWith( LiteralStringRef(".run.part") );
+				if (!part && !StringRef(f).endsWith( LiteralStringRef(".run") )) continue;
+				if (sscanf( f.c_str() + prefix.size(), "%lld", &number ) != 1) continue;
+				self->nextFileNumber = std::max<int64_t>( self->nextFileNumber, number+1 );
+				if (part || !live.count( number ))
+					orphans.push_back( joinPath( parentDirectory( self->filename ), f ) );
+			}
+
+			state std::vector<Future<Reference<LSMRun>>> opening;
+			for (auto& r : manifest.runs)
+				opening.push_back( lsmOpenRun( self->runFilename( r.first ), r.first, r.second ) );
+			wait( waitForAll( opening ) );
+			for (auto& f : opening)
+				self->insertRun( f.get() );
+
+			state int i;
+			for (i = 0; i < orphans.size(); i++) {
+				TraceEvent("LSMDeleteOrphan", self->id).detail("Filename", orphans[i]);
+				wait( IAsyncFileSystem::filesystem()->deleteFile( orphans[i], false ) );
+			}
+
+			// Writes that were not flushed go in the new memtable
+			self->flushedGeneration = manifest.flushedGeneration;
+			self->active = Reference<LSMMemtable>( new LSMMemtable( std::max( maxGeneration, manifest.flushedGeneration ) + 1 ) );
+			int replayed = 0;
+			for (auto& w : writes) {
+				if (w.first <= manifest.flushedGeneration) continue;
+				if (w.second.type == MutationRef::SetValue)
+					self->active->set( KeyValueRef( w.second.param1, w.second.param2 ) );
+				else
+					self->active->clear( KeyRangeRef( w.second.param1, w.second.param2 ) );
+				++replayed;
+			}
+			writes = std::vector<std::pair<int64_t, MutationRef>>();
+			arenas = std::vector<Arena>();
+
+			// Roll back anything uncommitted in the log, and begin the new memtable
+			self->lastLogLocation = self->log->getNextReadLocation();
+			self->logOp( OpRollback );
+			self->logOp( OpMemtable, BinaryWriter::toValue( self->active->generation, Unversioned() ) );
+			for (auto& m : self->pendingWrites) {
+				if (m.type == MutationRef::SetValue) {
+					self->active->set( KeyValueRef( m.param1, m.param2 ) );
+					self->logOp( OpSet, m.param1, m.param2 );
+				} else {
+					self->active->clear( KeyRangeRef( m.param1, m.param2 ) );
+					self->logOp( OpClear, m.param1, m.param2 );
+				}
+				self->uncommitted = true;
+			}
+			self->pendingWrites = Standalone<VectorRef<MutationRef>>();
+
+			TraceEvent e("LSMRecovered", self->id);
+			e.detail("Commits", commits)
+				.detail("Replayed", replayed)
+				.detail("FlushedGeneration", manifest.flushedGeneration)
+				.detail("Runs", manifest.runs.size())
+				.detail("OrphansDeleted", orphans.size())
+				.detail("TimeTaken", now()-startt);
+			for (int l = 0; l < self->levels.size(); l++)
+				if (self->levels[l].size())
+					e.detail( format( "Level%dRuns", l ).c_str(), self->levels[l].size() );
+			return Void();
+		} catch( Error &e ) {
+			bool ok = e.code() == error_code_operation_cancelled || e.code() == error_code_file_not_found || e.code() == error_code_actor_cancelled;
+			TraceEvent(ok ? SevInfo : SevError, "ErrorDuringRecovery", self->id).error(e, true);
+			throw e;
+		}
+	}
+
+	ACTOR static void doClose( KeyValueStoreLSM* self, bool deleteOnClose ) {
+		state Error error = success();
+		try {
+			TraceEvent("LSMClose", self->id).detail("Del", deleteOnClose);
+			self->recovering.cancel();
+			self->background.cancel();
+			self->levels.clear();
+			self->active.clear();
+			self->frozen.clear();
+
+			state Future<Void> logClosed = self->log->onClosed();
+			if (deleteOnClose)
+				self->log->dispose();
+			else
+				self->log->close();
+			wait( logClosed );
+
+			if (deleteOnClose) {
+				state std::string prefix = basename( self->filename ) + "-";
+				state std::vector<std::string> files = platform::listFiles( parentDirectory( self->filename ) );
+				state int i;
+				for (i = 0; i < files.size(); i++)
+					if (StringRef(files[i]).startsWith( StringRef(prefix) ) && (StringRef(files[i]).endsWith( LiteralStringRef(".run") ) || StringRef(files[i]).endsWith( LiteralStringRef(".run.part") )))
+						wait( IAsyncFileSystem::filesystem()->deleteFile( joinPath( parentDirectory( self->filename ), files[i] ), true ) );
+			}
+		} catch (Error& e) {
+			TraceEvent(SevError, "LSMCloseError", self->id).error(e, true);
+			error = e;
+		}
+
+		TraceEvent("LSMClosed", self->id);
+		if (error.code() != error_code_actor_cancelled) {
+			self->stopped.send(Void());
+			delete self;
+		}
+	}
+
+	ACTOR static Future<Optional<Value>> waitAndReadValuePrefix( KeyValueStoreLSM* self, Key key, int maxLength ) {
+		wait( self->recovering );
+		Optional<Value> value = wait( self->readValuePrefix( key, maxLength ) );
+		return value;
+	}
+	ACTOR static Future<Standalone<VectorRef<KeyValueRef>>> waitAndReadRange( KeyValueStoreLSM* self, KeyRange keys, int rowLimit, int byteLimit ) {
+		wait( self->recovering );
+		Standalone<VectorRef<KeyValueRef>> result = wait( self->readRange( keys, rowLimit, byteLimit ) );
+		return result;
+	}
+	ACTOR static Future<Void> waitAndCommit( KeyValueStoreLSM* self, bool sequential ) {
+		wait( self->recovering );
+		wait( self->commit( sequential ) );
+		return Void();
+	}
+};
+
+KeyValueStoreLSM::KeyValueStoreLSM( std::string const& filename, UID id )
+	: id(id), filename(filename), levels(MAX_LEVELS), compactPointers(MAX_LEVELS), flushedGeneration(0), nextFileNumber(0), uncommitted(false),
+	  flushes(0), flushBytes(0), compactions(0), compactionBytesRead(0), compactionBytesWritten(0), stalls(0)
+{
+	log = openDiskQueue( filename + "-wal", id );
+	recovering = recover( this );
+	background = actorCollection( addActor.getFuture() );
+	addActor.send( flusher( this ) );
+	addActor.send( compactor( this ) );
+	addActor.send( logMetrics( this ) );
+}
+
+IKeyValueStore* keyValueStoreLSM( std::string const& filename, UID logID ) {
+	TraceEvent("LSMOpening", logID).detail("Filename", filename);
+	return new KeyValueStoreLSM( filename, logID );
+}
@@ -20,7 +20,11 @@
 
 #include "IKeyValueStore.h"
 #include "IDiskQueue.h"
+#include "fdbrpc/IAsyncFile.h"
+#include "fdbrpc/crc32c.h"
 #include "flow/IndexedSet.h"
+#include "flow/IndexedBTree.h"
+#include "flow/IThreadPool.h"
 #include "flow/ActorCollection.h"
 #include "fdbclient/Notified.h"
 #include "fdbclient/SystemData.h"
@@ -28,9 +32,10 @@
 
 #define OP_DISK_OVERHEAD (sizeof(OpHeader) + 1)
 
-//Stored in the IndexedSets that hold the database.
+//Stored in the IndexedSets (or IndexedBTrees) that hold the database.
 //Each KeyValueMapPair is 32 bytes, excluding arena memory.
-//It is stored in an IndexedSet<KeyValueMapPair, uint64_t>::Node, for a total size of 72 bytes.
+//It is stored in an IndexedSet<KeyValueMapPair, uint64_t>::Node, for a total size of 72 bytes, or in the leaf of an
+//IndexedBTree with its metric and key prefix, for 48 bytes plus the leaf's unused space.
 struct KeyValueMapPair {
 	Arena arena; //8 Bytes (excluding arena memory)
 	KeyRef key; //12 Bytes
@@ -39,6 +44,7 @@ struct KeyValueMapPair {
 	void operator= ( KeyValueMapPair const& rhs ) { arena = rhs.arena; key = rhs.key; value = rhs.value; }
 	KeyValueMapPair( KeyValueMapPair const& rhs ) : arena(rhs.arena), key(rhs.key), value(rhs.value) {}
 
+	KeyValueMapPair() {}
 	KeyValueMapPair(KeyRef key, ValueRef value) : arena(key.expectedSize() + value.expectedSize()), key(arena, key), value(arena, value) { }
 
 	bool operator<(KeyValueMapPair const& r) const { return key < r.key; }
@@ -52,17 +58,163 @@ bool operator<(KeyValueMapPair const& l, CompatibleWithKey const& r) { return l.
 template <class CompatibleWithKey>
 bool operator<(CompatibleWithKey const& l, KeyValueMapPair const& r) { return l < r.key; }
 
+// The first 8 bytes of a key, big endian, for IndexedBTree to compare before comparing whole keys
+struct KeyValueMapPairPrefix {
+	uint64_t operator()( StringRef const& key ) const {
+		uint64_t prefix = 0;
+		for(int i = 0; i < 8 && i < key.size(); i++)
+			prefix |= uint64_t(key[i]) << (56 - 8*i);
+		return prefix;
+	}
+	uint64_t operator()( KeyValueMapPair const& pair ) const { return (*this)( pair.key ); }
+};
+
+// Checkpoint chunk files hold the pairs of one key range in key order, each as its uint32_t key and value sizes followed
+// by the key and value, and end with the uint32_t number of pairs and a crc32c of everything before it
+struct CheckpointChunkWriter {
+	std::vector<uint8_t> buffer;
+	uint32_t count;
+
+	CheckpointChunkWriter() : count(0) {}
+
+	void append( const void* data, int size ) {
+		buffer.insert( buffer.end(), (const uint8_t*)data, (const uint8_t*)data + size );
+	}
+
+	void add( KeyRef key, ValueRef value ) {
+		uint32_t sizes[2] = { (uint32_t)key.size(), (uint32_t)value.size() };
+		append( sizes, sizeof(sizes) );
+		append( key.begin(), key.size() );
+		append( value.begin(), value.size() );
+		count++;
+	}
+
+	int64_t size() const { return buffer.size(); }
+
+	Standalone<StringRef> finish() {
+		append( &count, sizeof(count) );
+		uint32_t crc = crc32c_append( 0, buffer.data(), buffer.size() );
+		append( &crc, sizeof(crc) );
+		Standalone<StringRef> contents( StringRef( buffer.data(), buffer.size() ) );
+		buffer.clear();
+		count = 0;
+		return contents;
+	}
+};
+
+// Decodes a checkpoint chunk file into pairs for IndexedSet::insert().  May run on a checkpoint loading thread.
+static void decodeCheckpointChunk( StringRef contents, uint64_t elementBytes, std::vector<std::pair<KeyValueMapPair, uint64_t>>& pairs ) {
+	uint32_t count, crc;
+	if (contents.size() < sizeof(count) + sizeof(crc))
+		throw checksum_failed();
+	memcpy( &crc, contents.end() - sizeof(crc), sizeof(crc) );
+	if (crc32c_append( 0, contents.begin(), contents.size() - sizeof(crc) ) != crc)
+		throw checksum_failed();
+	memcpy( &count, contents.end() - sizeof(crc) - sizeof(count), sizeof(count) );
+
+	const uint8_t* p = contents.begin();
+	const uint8_t* end = contents.end() - sizeof(crc) - sizeof(count);
+	pairs.reserve( count );
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t sizes[2];
+		if (end - p < sizeof(sizes))
+			throw file_corrupt();
+		memcpy( sizes, p, sizeof(sizes) );
+		p += sizeof(sizes);
+		if (end - p < (int64_t)sizes[0] + sizes[1])
+			throw file_corrupt();
+		KeyValueMapPair pair( KeyRef( p, sizes[0] ), ValueRef( p + sizes[0], sizes[1] ) );
+		pairs.push_back( std::make_pair( pair, pair.arena.getSize() + elementBytes ) );
+		p += sizes[0] + sizes[1];
+	}
+	if (p != end)
+		throw file_corrupt();
+}
+
+// Decodes checkpoint chunks during recovery.  Work is always posted from and joined by the network thread, so the
+// chunks are still inserted in a deterministic order.
+class CheckpointLoadWorker : public IThreadPoolReceiver {
+public:
+	virtual void init() {}
+
+	struct LoadAction : TypedAction<CheckpointLoadWorker, LoadAction> {
+		std::function<void()> work;
+		Event* done;
+		Optional<Error>* error;
+
+		LoadAction( std::function<void()> const& work, Event* done, Optional<Error>* error ) : work(work), done(done), error(error) {}
+		virtual double getTimeEstimate() { return 0; }
+	};
+
+	void action( LoadAction& a ) {
+		try {
+			a.work();
+		} catch (Error& e) {
+			*a.error = e;
+		} catch (...) {
+			*a.error = unknown_error();
+		}
+		a.done->set();
+	}
+};
+
+// Calls work(i) for each i in [0, count), split between the worker threads and the calling thread, and blocks until all
+// of them are done.  Errors thrown by any of them are rethrown here after every one has finished.
+static void runCheckpointLoadWork( Reference<IThreadPool> workers, int threadCount, int count, std::function<void(int)> const& work ) {
+	int partitionCount = std::min( threadCount, count );
+	if (!workers || partitionCount <= 1) {
+		for (int i = 0; i < count; i++)
+			work( i );
+		return;
+	}
+
+	auto partition = [&work, count, partitionCount](int p) {
+		for (int i = p; i < count; i += partitionCount)
+			work( i );
+	};
+	vector<Event> done( partitionCount-1 );
+	vector<Optional<Error>> errors( partitionCount );
+	for(int p=0; p<partitionCount-1; p++)
+		workers->post( new CheckpointLoadWorker::LoadAction( [&partition, p]{ partition(p); }, &done[p], &errors[p] ) );
+
+	try {
+		partition( partitionCount-1 );
+	} catch (Error& e) {
+		errors.back() = e;
+	}
+
+	for(int p=0; p<done.size(); p++)
+		done[p].block();
+	for(int p=0; p<errors.size(); p++)
+		if (errors[p].present())
+			throw errors[p].get();
+}
+
 extern bool noUnseed;
 
+// Container is the ordered set which holds the data; IndexedSet and IndexedBTree both work
+template <class Container>
 class KeyValueStoreMemory : public IKeyValueStore, NonCopyable {
 public:
-	KeyValueStoreMemory( IDiskQueue* log, UID id, int64_t memoryLimit, bool disableSnapshot, bool replaceContent, bool exactRecovery );
+	KeyValueStoreMemory( IDiskQueue* log, UID id, int64_t memoryLimit, bool disableSnapshot, bool replaceContent, bool exactRecovery, std::string const& checkpointBasename = std::string() );
 
 	// IClosable
-	virtual Future<Void> getError() { return log->getError(); }
-	virtual Future<Void> onClosed() { return log->onClosed(); }
-	virtual void dispose() { recovering.cancel(); log->dispose(); delete this; }
-	virtual void close() { recovering.cancel(); log->close(); delete this; }
+	virtual Future<Void> getError() { return checkpointBasename.size() ? log->getError() || snapshotting : log->getError(); }
+	virtual Future<Void> onClosed() { return checkpointBasename.size() ? stopped.getFuture() : log->onClosed(); }
+	virtual void dispose() {
+		if (checkpointBasename.size()) {
+			doClose( this, true );
+			return;
+		}
+		recovering.cancel(); log->dispose(); delete this;
+	}
+	virtual void close() {
+		if (checkpointBasename.size()) {
+			doClose( this, false );
+			return;
+		}
+		recovering.cancel(); log->close(); delete this;
+	}
 
 	// IKeyValueStore
 	virtual KeyValueStoreType getType() { return KeyValueStoreType::MEMORY; }
@@ -87,7 +239,7 @@ public:
 		int64_t availableSize = std::min(getAvailableSize(), diskQueueBytes.available / 4 - uncommittedBytes);
 		int64_t totalSize = std::min(memoryLimit, diskQueueBytes.total / 4 - uncommittedBytes);
 
-		return StorageBytes(std::max((int64_t)0, freeSize), std::max((int64_t)0, totalSize), diskQueueBytes.used,
+		return StorageBytes(std::max((int64_t)0, freeSize), std::max((int64_t)0, totalSize), diskQueueBytes.used + checkpointBytes,
 		    std::max((int64_t)0, availableSize));
 	}
 
@@ -112,6 +264,7 @@ public:
 		if(transactionIsLarge) {
 			KeyValueMapPair pair(keyValue.key, keyValue.value);
 			data.insert(pair, pair.arena.getSize() + data.getElementBytes());
+			markDirty(keyValue.key);
 		}
 		else {
 			queue.set(keyValue, arena);
@@ -128,6 +281,7 @@ public:
 
 		if(transactionIsLarge) {
 			data.erase(data.lower_bound(range.begin), data.lower_bound(range.end));
+			markDirty(range.begin, range.end);
 		}
 		else {
 			queue.clear(range, arena);
@@ -194,7 +348,11 @@ public:
 		transactionIsLarge = false;
 		firstCommitWithSnapshot = false;
 
-		addActor.send( commitAndUpdateVersions( this, c, previousSnapshotEnd ) );
+		if(checkpointBasename.size()) {
+			committedLogEnd.set(lastPushLocation.lo);
+		}
+
+		addActor.send( commitAndUpdateVersions( this, c, checkpointBasename.size() ? checkpointLocation : previousSnapshotEnd, ++commitsLogged ) );
 		return c;
 	}
 
@@ -269,7 +427,8 @@ private:
 		OpSnapshotEnd,
 		OpSnapshotAbort, // terminate an in progress snapshot in order to start a full snapshot
 		OpCommit,        // only in log, not in queue
-		OpRollback       // only in log, not in queue
+		OpRollback,      // only in log, not in queue
+		OpCheckpointFormat // only in log; marks a log which needs its checkpoint files, which older versions refuse to recover
 	};
 
 	struct OpRef {
@@ -341,7 +500,7 @@ private:
 
 	UID id;
 
-	IndexedSet< KeyValueMapPair, uint64_t > data;
+	Container data;
 
 	OpQueue queue; // mutations not yet commit()ted
 	IDiskQueue *log;
@@ -367,6 +526,69 @@ private:
 	int64_t memoryLimit; //The upper limit on the memory used by the store (excluding, possibly, some clear operations)
 	std::vector<std::pair<KeyValueMapPair, uint64_t>> dataSets;
 
+	// A chunk holds the keys from its begin up to the begin of the next chunk.  It is dirty if its keys may have changed
+	// since its file was written.
+	struct CheckpointChunk {
+		Key begin;
+		int64_t fileNumber;  // -1 if the chunk had no keys, and so has no file
+		int64_t bytes;
+		bool dirty;
+
+		CheckpointChunk() : fileNumber(-1), bytes(0), dirty(false) {}
+		CheckpointChunk( KeyRef begin, int64_t fileNumber, int64_t bytes, bool dirty ) : begin(begin), fileNumber(fileNumber), bytes(bytes), dirty(dirty) {}
+
+		template <class Ar>
+		void serialize( Ar& ar ) {
+			ar & begin & fileNumber & bytes;
+		}
+	};
+
+	// The chunk files of a checkpoint hold the data as of some point in the log, from which recovery replays it
+	struct CheckpointManifest {
+		int64_t number;
+		int64_t replayHi, replayLo;
+		int64_t nextFileNumber;
+		std::vector<CheckpointChunk> chunks;
+
+		CheckpointManifest() : number(0), replayHi(0), replayLo(0), nextFileNumber(0) {}
+
+		template <class Ar>
+		void serialize( Ar& ar ) {
+			ar & number & replayHi & replayLo & nextFileNumber & chunks;
+		}
+	};
+
+	// Storage server stores opened with MEMORY_CHECKPOINTS replace the rolling snapshot in the log with checkpoints: the chunks
+	// with keys changed since the last checkpoint are written to files, after which the log before that checkpoint is popped.
+	std::string checkpointBasename;  // Empty if the store keeps rolling snapshots in its log instead
+	std::vector<CheckpointChunk> chunks;  // In key order, beginning with the empty key
+	IDiskQueue::location lastPushLocation;  // The end of the last logged op
+	IDiskQueue::location checkpointLocation;  // Where recovery starts replaying the log after the last checkpoint
+	NotifiedVersion committedLogEnd;  // lastPushLocation.lo as of the last commit
+	int64_t commitsLogged;
+	NotifiedVersion durableCommits;
+	int64_t checkpointNumber, nextFileNumber, checkpointBytes;
+	Promise<Void> stopped;
+
+	std::string manifestFilename() const { return checkpointBasename + "checkpoint.fdm"; }
+	std::string chunkFilename( int64_t number ) const { return checkpointBasename + format( "checkpoint-%lld.fdc", number ); }
+
+	int chunkContaining( KeyRef key ) const {
+		return std::upper_bound( chunks.begin(), chunks.end(), key, [](KeyRef const& k, CheckpointChunk const& c) { return k < c.begin; } ) - chunks.begin() - 1;
+	}
+
+	void markDirty( KeyRef key ) {
+		if (chunks.size())
+			chunks[ chunkContaining(key) ].dirty = true;
+	}
+
+	// Marks the chunks which may hold keys in [begin, end), or from begin on if end is not present
+	void markDirty( KeyRef begin, Optional<KeyRef> end ) {
+		if (chunks.empty()) return;
+		for (int c = chunkContaining(begin); c < chunks.size() && (!end.present() || chunks[c].begin < end.get()); c++)
+			chunks[c].dirty = true;
+	}
+
 	int64_t commit_queue(OpQueue &ops, bool log, bool sequential = false) {
 		int64_t total = 0, count = 0;
 		IDiskQueue::location log_location = 0;
@@ -375,6 +597,7 @@ private:
 			++count;
 			total += o->p1.size() + o->p2.size() + OP_DISK_OVERHEAD;
 			if (o->op == OpSet) {
+				markDirty(o->p1);
 				KeyValueMapPair pair(o->p1, o->p2);
 				if(sequential) {
 					dataSets.push_back(std::make_pair(pair, pair.arena.getSize() + data.getElementBytes()));
@@ -388,6 +611,7 @@ private:
 					dataSets.clear();
 				}
 				data.erase( data.lower_bound(o->p1), data.lower_bound(o->p2) );
+				markDirty(o->p1, o->p2);
 			}
 			else if (o->op == OpClearToEnd) {
 				if(sequential) {
@@ -395,6 +619,7 @@ private:
 					dataSets.clear();
 				}
 				data.erase( data.lower_bound(o->p1), data.end() );
+				markDirty(o->p1, Optional<KeyRef>());
 			}
 			else ASSERT(false);
 			if ( log )
@@ -424,7 +649,8 @@ private:
 		log->push( StringRef((const uint8_t*)&h, sizeof(h)) );
 		log->push( v1 );
 		log->push( v2 );
-		return log->push( LiteralStringRef("\x01") ); // Changes here should be reflected in OP_DISK_OVERHEAD
+		lastPushLocation = log->push( LiteralStringRef("\x01") ); // Changes here should be reflected in OP_DISK_OVERHEAD
+		return lastPushLocation;
 	}
 
 	ACTOR static Future<Void> recover( KeyValueStoreMemory* self, bool exactRecovery ) {
@@ -440,7 +666,9 @@ private:
 		state int dbgSnapshotEndCount=0;
 		state int dbgMutationCount=0;
 		state int dbgCommitCount=0;
+		state int dbgSkippedCount=0;
 		state double startt = now();
+		state double checkpointLoaded = startt;
 		state UID dbgid = self->id;
 
 		state Future<Void> loggingDelay = delay(1.0);
@@ -452,6 +680,11 @@ private:
 			.detail("SnapshotEndLocation", uncommittedSnapshotEnd);
 
 		try {
+			if (self->checkpointBasename.size()) {
+				wait( loadCheckpoint(self) );
+				checkpointLoaded = now();
+			}
+
 			loop {
 				Standalone<StringRef> data = wait( self->log->readNext( sizeof(OpHeader) ) );
 				if (data.size() != sizeof(OpHeader)) {
@@ -487,7 +720,9 @@ private:
 					StringRef p1 = data.substr(0, h.len1);
 					StringRef p2 = data.substr(h.len1, h.len2);
 
-					if (h.op == OpSnapshotItem) { // snapshot data item
+					if (!(self->checkpointLocation < self->log->getNextReadLocation())) { // already in the checkpoint
+						++dbgSkippedCount;
+					} else if (h.op == OpSnapshotItem) { // snapshot data item
 						/*if (p1 < uncommittedNextKey) {
 							TraceEvent(SevError, "RecSnapshotBack", self->id)
 								.detail("NextKey", printable(uncommittedNextKey))
@@ -535,6 +770,7 @@ private:
 						uncommittedNextKey = self->recoveredSnapshotKey;
 						uncommittedPrevSnapshotEnd = self->previousSnapshotEnd;
 						uncommittedSnapshotEnd = self->currentSnapshotEnd;
+					} else if (h.op == OpCheckpointFormat) { // only there to stop older versions recovering the log without its checkpoint
 					} else
 						ASSERT(false);
 				} else {
@@ -580,6 +816,9 @@ private:
 				.detail("SnapshotEnd", dbgSnapshotEndCount)
 				.detail("Mutations", dbgMutationCount)
 				.detail("Commits", dbgCommitCount)
+				.detail("SkippedOps", dbgSkippedCount)
+				.detail("CheckpointLoadTime", checkpointLoaded-startt)
+				.detail("LogReplayTime", now()-checkpointLoaded)
 				.detail("TimeTaken", now()-startt);
 
 			self->semiCommit();
@@ -592,7 +831,7 @@ private:
 	}
 
 	//Snapshots an entire data set
-	void fullSnapshot( IndexedSet< KeyValueMapPair, uint64_t> &snapshotData ) {
+	void fullSnapshot( Container &snapshotData ) {
 		previousSnapshotEnd = log_op(OpSnapshotAbort, StringRef(), StringRef());
 		replaceContent = false;
 
@@ -685,6 +924,314 @@ private:
 		}
 	}
 
+	ACTOR static Future<Standalone<StringRef>> readCheckpointFile( std::string filename ) {
+		state Reference<IAsyncFile> file = wait( IAsyncFileSystem::filesystem()->open( filename, IAsyncFile::OPEN_READWRITE | IAsyncFile::OPEN_LOCK, 0 ) );
+		state int64_t size = wait( file->size() );
+		state Standalone<StringRef> contents = makeString( size );
+		int bytes = wait( file->read( mutateString( contents ), size, 0 ) );
+		if (bytes != size)
+			throw io_error();
+		return contents;
+	}
+
+	ACTOR static Future<Void> writeCheckpointFile( std::string filename, Standalone<StringRef> contents ) {
+		state Reference<IAsyncFile> file = wait( IAsyncFileSystem::filesystem()->open( filename, IAsyncFile::OPEN_ATOMIC_WRITE_AND_CREATE | IAsyncFile::OPEN_CREATE | IAsyncFile::OPEN_READWRITE | IAsyncFile::OPEN_LOCK, 0600 ) );
+		wait( file->write( contents.begin(), contents.size(), 0 ) );
+		wait( file->sync() );
+		return Void();
+	}
+
+	// Loads the chunks of the last checkpoint into data, decoding them on MEMORY_CHECKPOINT_LOAD_THREADS threads, and
+	// deletes any files left by a checkpoint which did not finish
+	ACTOR static Future<Void> loadCheckpoint( KeyValueStoreMemory* self ) {
+		state double startTime = now();
+		state CheckpointManifest manifest;
+		if (fileExists( self->manifestFilename() )) {
+			Standalone<StringRef> contents = wait( readCheckpointFile( self->manifestFilename() ) );
+			uint32_t crc;
+			if (contents.size() < sizeof(crc))
+				throw checksum_failed();
+			memcpy( &crc, contents.end() - sizeof(crc), sizeof(crc) );
+			if (crc32c_append( 0, contents.begin(), contents.size() - sizeof(crc) ) != crc)
+				throw checksum_failed();
+			// The keys read are only kept alive by the reader's arena, so each chunk gets its own copy
+			BinaryReader rd( contents.substr( 0, contents.size() - sizeof(crc) ), IncludeVersion() );
+			rd >> manifest;
+			for (auto& c : manifest.chunks)
+				self->chunks.push_back( CheckpointChunk( c.begin, c.fileNumber, c.bytes, false ) );
+			self->checkpointLocation = IDiskQueue::location( manifest.replayHi, manifest.replayLo );
+		} else {
+			// A new store, or one which has only its log
+			self->chunks.push_back( CheckpointChunk( KeyRef(), -1, 0, true ) );
+		}
+		self->checkpointNumber = manifest.number;
+		self->nextFileNumber = manifest.nextFileNumber;
+
+		state std::string prefix = basename( self->checkpointBasename ) + "checkpoint";
+		state std::vector<std::string> orphans;
+		state std::set<int64_t> live;
+		for (auto& c : self->chunks)
+			if (c.fileNumber >= 0)
+				live.insert( c.fileNumber );
+		for (auto& f : platform::listFiles( parentDirectory( self->checkpointBasename ) )) {
+			if (!StringRef(f).startsWith( StringRef(prefix) )) continue;
+			if (StringRef(f).endsWith( LiteralStringRef(".fdm.part") )) {
+				orphans.push_back( joinPath( parentDirectory( self->checkpointBasename ), f ) );
+				continue;
+			}
+			long long number;
+			bool part = StringRef(f).endsWith( LiteralStringRef(".fdc.part") );
+			if (!part && !StringRef(f).endsWith( LiteralStringRef(".fdc") )) continue;
+			if (sscanf( f.c_str() + prefix.size(), "-%lld", &number ) != 1) continue;
+			self->nextFileNumber = std::max<int64_t>( self->nextFileNumber, number+1 );
+			if (part || !live.count( number ))
+				orphans.push_back( joinPath( parentDirectory( self->checkpointBasename ), f ) );
+		}
+
+		state int threadCount = g_network->isSimulated() ? 0 : SERVER_KNOBS->MEMORY_CHECKPOINT_LOAD_THREADS;
+		state Reference<IThreadPool> workers;
+		if (threadCount > 1) {
+			workers = createGenericThreadPool();
+			// The network thread decodes chunks itself too
+			for (int t = 1; t < threadCount; t++)
+				workers->addThread( new CheckpointLoadWorker );
+		}
+
+		// Chunk files are read a batch ahead of the batch being decoded
+		state int batchSize = std::max( threadCount, 1 );
+		state std::vector<int> files;
+		state std::vector<Future<Standalone<StringRef>>> reads;
+		state std::vector<Future<Standalone<StringRef>>> batch;
+		state std::vector<std::vector<std::pair<KeyValueMapPair, uint64_t>>> decoded;
+		state int next = 0;
+		state int i;
+		state int64_t bytes = 0;
+		for (int c = 0; c < self->chunks.size(); c++) {
+			self->checkpointBytes += self->chunks[c].bytes;
+			if (self->chunks[c].fileNumber >= 0)
+				files.push_back( c );
+		}
+		for (; next < files.size() && reads.size() < batchSize; next++)
+			reads.push_back( readCheckpointFile( self->chunkFilename( self->chunks[files[next]].fileNumber ) ) );
+
+		while (reads.size()) {
+			wait( waitForAll( reads ) );
+			batch.swap( reads );
+			reads.clear();
+			for (; next < files.size() && reads.size() < batchSize; next++)
+				reads.push_back( readCheckpointFile( self->chunkFilename( self->chunks[files[next]].fileNumber ) ) );
+
+			decoded.clear();
+			decoded.resize( batch.size() );
+			auto batchContents = &batch;
+			auto batchPairs = &decoded;
+			uint64_t elementBytes = self->data.getElementBytes();
+			runCheckpointLoadWork( workers, threadCount, batch.size(), [batchContents, batchPairs, elementBytes](int b) {
+				decodeCheckpointChunk( (*batchContents)[b].get(), elementBytes, (*batchPairs)[b] );
+			} );
+
+			for (i = 0; i < decoded.size(); i++) {
+				bytes += batch[i].get().size();
+				self->data.insert( decoded[i] );
+				decoded[i] = std::vector<std::pair<KeyValueMapPair, uint64_t>>();
+				wait( yield() );
+			}
+			batch.clear();
+		}
+		workers = Reference<IThreadPool>();
+
+		for (i = 0; i < orphans.size(); i++) {
+			TraceEvent("KVSMemDeleteCheckpointOrphan", self->id).detail("Filename", orphans[i]);
+			wait( IAsyncFileSystem::filesystem()->deleteFile( orphans[i], false ) );
+		}
+
+		double duration = now() - startTime;
+		TraceEvent("KVSMemCheckpointLoaded", self->id)
+			.detail("Checkpoint", self->checkpointNumber)
+			.detail("Chunks", self->chunks.size())
+			.detail("Files", files.size())
+			.detail("Bytes", bytes)
+			.detail("Threads", threadCount)
+			.detail("OrphansDeleted", orphans.size())
+			.detail("ReplayLocation", self->checkpointLocation)
+			.detail("TimeTaken", duration)
+			.detail("BytesPerSecond", duration > 0 ? bytes / duration : 0);
+		return Void();
+	}
+
+	// Starts writing the pairs in writer as the file of chunk
+	void finishCheckpointChunk( CheckpointChunkWriter& writer, CheckpointChunk& chunk, std::vector<Future<Void>>& writes ) {
+		if (!writer.count) return;
+		chunk.fileNumber = nextFileNumber++;
+		Standalone<StringRef> contents = writer.finish();
+		chunk.bytes = contents.size();
+		writes.push_back( writeCheckpointFile( chunkFilename( chunk.fileNumber ), contents ) );
+	}
+
+	// Writes each run of dirty chunks to new files, splitting it into chunks of about MEMORY_CHECKPOINT_CHUNK_BYTES, and
+	// then durably replaces the last checkpoint and pops the log up to where this one began
+	ACTOR static Future<Void> writeCheckpoint( KeyValueStoreMemory* self ) {
+		state double startTime = now();
+		// Every op logged before this is reflected in the chunks as they are written, and set and clear ops replayed
+		// from here over them give the same result whether or not the chunk already reflects them
+		state IDiskQueue::location replayLocation = self->lastPushLocation;
+		// The log will no longer hold all of the data once it is popped, so before that it gets an op which recovery in
+		// versions without checkpoints rejects rather than losing the data only in the checkpoint files.  It is after the
+		// replay location, so every checkpoint leaves one in the log.
+		self->log_op( OpCheckpointFormat, StringRef(), StringRef() );
+		state int64_t bytesWritten = 0;
+		state int filesWritten = 0;
+		state std::vector<Future<Void>> writes;
+		state std::vector<int64_t> replacedFiles;
+		state std::vector<CheckpointChunk> pieces;
+		state CheckpointChunkWriter writer;
+		state int c = 0;
+		state int runEnd;
+		state Key nextKey;
+		state bool nextKeyAfter;
+
+		loop {
+			while (c < self->chunks.size() && !self->chunks[c].dirty) c++;
+			if (c == self->chunks.size()) break;
+
+			// Keys changed from now on mark the chunks of the run dirty again
+			for (runEnd = c; runEnd < self->chunks.size() && self->chunks[runEnd].dirty; runEnd++)
+				self->chunks[runEnd].dirty = false;
+
+			pieces.clear();
+			pieces.push_back( CheckpointChunk( self->chunks[c].begin, -1, 0, false ) );
+			nextKey = self->chunks[c].begin;
+			nextKeyAfter = false;
+			loop {
+				bool toEnd = runEnd == self->chunks.size();
+				auto it = nextKeyAfter ? self->data.upper_bound(nextKey) : self->data.lower_bound(nextKey);
+				int items = 0;
+				KeyRef lastKey;
+				for (; it != self->data.end() && (toEnd || it->key < self->chunks[runEnd].begin) && items < 1000; ++it, ++items) {
+					if (writer.size() >= SERVER_KNOBS->MEMORY_CHECKPOINT_CHUNK_BYTES) {
+						self->finishCheckpointChunk( writer, pieces.back(), writes );
+						bytesWritten += pieces.back().bytes;
+						pieces.push_back( CheckpointChunk( it->key, -1, 0, false ) );
+					}
+					writer.add( it->key, it->value );
+					lastKey = it->key;
+				}
+				if (items < 1000) break;
+
+				nextKey = lastKey;
+				nextKeyAfter = true;
+				if (writes.size() >= 4) {
+					wait( waitForAll( writes ) );
+					filesWritten += writes.size();
+					writes.clear();
+				}
+				wait( yield() );
+			}
+			self->finishCheckpointChunk( writer, pieces.back(), writes );
+			bytesWritten += pieces.back().bytes;
+
+			bool dirty = false;
+			for (int r = c; r < runEnd; r++) {
+				dirty = dirty || self->chunks[r].dirty;
+				if (self->chunks[r].fileNumber >= 0)
+					replacedFiles.push_back( self->chunks[r].fileNumber );
+			}
+			for (auto& p : pieces)
+				p.dirty = dirty;
+			self->chunks.erase( self->chunks.begin() + c, self->chunks.begin() + runEnd );
+			self->chunks.insert( self->chunks.begin() + c, pieces.begin(), pieces.end() );
+			c += pieces.size();
+		}
+		wait( waitForAll( writes ) );
+		filesWritten += writes.size();
+		state double writeDuration = now() - startTime;
+
+		// The chunks may reflect ops which are not committed yet, so the checkpoint can only replace the last one once a
+		// commit after all of them is durable
+		wait( self->durableCommits.whenAtLeast( self->commitsLogged + 1 ) );
+
+		state CheckpointManifest manifest;
+		manifest.number = self->checkpointNumber + 1;
+		manifest.replayHi = replayLocation.hi;
+		manifest.replayLo = replayLocation.lo;
+		manifest.nextFileNumber = self->nextFileNumber;
+		manifest.chunks = self->chunks;
+		BinaryWriter wr( IncludeVersion() );
+		wr << manifest;
+		uint32_t crc = crc32c_append( 0, (const uint8_t*)wr.getData(), wr.getLength() );
+		wr << crc;
+		wait( writeCheckpointFile( self->manifestFilename(), wr.toStringRef() ) );
+
+		self->checkpointNumber = manifest.number;
+		self->checkpointLocation = replayLocation;
+		self->log->pop( replayLocation );
+		self->checkpointBytes = 0;
+		for (auto& chunk : self->chunks)
+			self->checkpointBytes += chunk.bytes;
+
+		state int i;
+		for (i = 0; i < replacedFiles.size(); i++)
+			wait( IAsyncFileSystem::filesystem()->deleteFile( self->chunkFilename( replacedFiles[i] ), false ) );
+
+		TraceEvent("KVSMemCheckpoint", self->id)
+			.detail("Checkpoint", self->checkpointNumber)
+			.detail("Chunks", self->chunks.size())
+			.detail("FilesWritten", filesWritten)
+			.detail("FilesDeleted", replacedFiles.size())
+			.detail("BytesWritten", bytesWritten)
+			.detail("CheckpointBytes", self->checkpointBytes)
+			.detail("WriteDuration", writeDuration)
+			.detail("BytesPerSecond", writeDuration > 0 ? bytesWritten / writeDuration : 0)
+			.detail("Duration", now() - startTime)
+			.detail("ReplayLocation", replayLocation);
+		return Void();
+	}
+
+	// Takes a checkpoint whenever MEMORY_CHECKPOINT_BYTES have been logged since the last one
+	ACTOR static Future<Void> checkpoint( KeyValueStoreMemory* self ) {
+		wait(self->recovering);
+
+		loop {
+			wait( self->committedLogEnd.whenAtLeast( self->checkpointLocation.lo + SERVER_KNOBS->MEMORY_CHECKPOINT_BYTES ) );
+			wait( writeCheckpoint(self) );
+		}
+	}
+
+	ACTOR static void doClose( KeyValueStoreMemory* self, bool deleteOnClose ) {
+		state Error error = success();
+		try {
+			TraceEvent("KVSMemClose", self->id).detail("Del", deleteOnClose);
+			self->recovering.cancel();
+			self->snapshotting.cancel();
+			self->commitActors.cancel();
+
+			state Future<Void> logClosed = self->log->onClosed();
+			if (deleteOnClose)
+				self->log->dispose();
+			else
+				self->log->close();
+			wait( logClosed );
+
+			if (deleteOnClose && self->checkpointBasename.size()) {
+				state std::string prefix = basename( self->checkpointBasename ) + "checkpoint";
+				state std::vector<std::string> files = platform::listFiles( parentDirectory( self->checkpointBasename ) );
+				state int i;
+				for (i = 0; i < files.size(); i++)
+					if (StringRef(files[i]).startsWith( StringRef(prefix) ))
+						wait( IAsyncFileSystem::filesystem()->deleteFile( joinPath( parentDirectory( self->checkpointBasename ), files[i] ), true ) );
+			}
+		} catch (Error& e) {
+			TraceEvent(SevError, "KVSMemCloseError", self->id).error(e, true);
+			error = e;
+		}
+
+		TraceEvent("KVSMemClosed", self->id);
+		if (error.code() != error_code_actor_cancelled) {
+			self->stopped.send(Void());
+			delete self;
+		}
+	}
+
 	ACTOR static Future<Optional<Value>> waitAndReadValue( KeyValueStoreMemory* self, Key key ) {
 		wait( self->recovering );
 		return self->readValue(key).get();
@@ -702,28 +1249,43 @@ private:
 		wait(self->commit(sequential));
 		return Void();
 	}
-	ACTOR static Future<Void> commitAndUpdateVersions( KeyValueStoreMemory* self, Future<Void> commit, IDiskQueue::location location ) {
+	ACTOR static Future<Void> commitAndUpdateVersions( KeyValueStoreMemory* self, Future<Void> commit, IDiskQueue::location location, int64_t commitNumber ) {
 		wait( commit );
 		self->log->pop(location);
+		if (commitNumber > self->durableCommits.get())
+			self->durableCommits.set(commitNumber);
 		return Void();
 	}
 };
 
-KeyValueStoreMemory::KeyValueStoreMemory( IDiskQueue* log, UID id, int64_t memoryLimit, bool disableSnapshot, bool replaceContent, bool exactRecovery )
+template <class Container>
+KeyValueStoreMemory<Container>::KeyValueStoreMemory( IDiskQueue* log, UID id, int64_t memoryLimit, bool disableSnapshot, bool replaceContent, bool exactRecovery, std::string const& checkpointBasename )
 	: log(log), id(id), previousSnapshotEnd(-1), currentSnapshotEnd(-1), resetSnapshot(false), memoryLimit(memoryLimit), committedWriteBytes(0),
-	  committedDataSize(0), transactionSize(0), transactionIsLarge(false), disableSnapshot(disableSnapshot), replaceContent(replaceContent), snapshotCount(0), firstCommitWithSnapshot(true)
+	  committedDataSize(0), transactionSize(0), transactionIsLarge(false), disableSnapshot(disableSnapshot), replaceContent(replaceContent), snapshotCount(0), firstCommitWithSnapshot(true),
+	  checkpointBasename(checkpointBasename), commitsLogged(0), checkpointNumber(0), nextFileNumber(0), checkpointBytes(0)
 {
 	recovering = recover( this, exactRecovery );
-	snapshotting = snapshot( this );
+	snapshotting = checkpointBasename.size() ? checkpoint( this ) : snapshot( this );
 	commitActors = actorCollection( addActor.getFuture() );
 }
 
-IKeyValueStore* keyValueStoreMemory( std::string const& basename, UID logID, int64_t memoryLimit ) {
-	TraceEvent("KVSMemOpening", logID).detail("Basename", basename).detail("MemoryLimit", memoryLimit);
+typedef KeyValueStoreMemory< IndexedSet<KeyValueMapPair, uint64_t> > KeyValueStoreMemoryAVL;
+typedef KeyValueStoreMemory< IndexedBTree<KeyValueMapPair, uint64_t, KeyValueMapPairPrefix> > KeyValueStoreMemoryBTree;
+
+IKeyValueStore* keyValueStoreMemory( std::string const& basename, UID logID, int64_t memoryLimit, bool allowCheckpoints ) {
+	// A store which already has a checkpoint needs it to recover whatever the knob now says
+	bool checkpoints = allowCheckpoints && (SERVER_KNOBS->MEMORY_CHECKPOINTS || fileExists( basename + "checkpoint.fdm" ));
+	TraceEvent("KVSMemOpening", logID).detail("Basename", basename).detail("MemoryLimit", memoryLimit).detail("BTreeIndex", SERVER_KNOBS->MEMORY_BTREE_INDEX)
+		.detail("Checkpoints", checkpoints);
 	IDiskQueue *log = openDiskQueue( basename, logID );
-	return new KeyValueStoreMemory( log, logID, memoryLimit, false, false, false );
+	std::string checkpointBasename = checkpoints ? basename : std::string();
+	if (SERVER_KNOBS->MEMORY_BTREE_INDEX)
+		return new KeyValueStoreMemoryBTree( log, logID, memoryLimit, false, false, false, checkpointBasename );
+	return new KeyValueStoreMemoryAVL( log, logID, memoryLimit, false, false, false, checkpointBasename );
 }
 
 IKeyValueStore* keyValueStoreLogSystem( class IDiskQueue* queue, UID logID, int64_t memoryLimit, bool disableSnapshot, bool replaceContent, bool exactRecovery ) {
-	return new KeyValueStoreMemory( queue, logID, memoryLimit, disableSnapshot, replaceContent, exactRecovery );
+	if (SERVER_KNOBS->MEMORY_BTREE_INDEX)
+		return new KeyValueStoreMemoryBTree( queue, logID, memoryLimit, disableSnapshot, replaceContent, exactRecovery );
+	return new KeyValueStoreMemoryAVL( queue, logID, memoryLimit, disableSnapshot, replaceContent, exactRecovery );
 }
@@ -64,6 +64,16 @@ struct SpringCleaningStats {
 	SpringCleaningStats() : springCleaningCount(0), lazyDeletePages(0), vacuumedPages(0), springCleaningTime(0.0), vacuumTime(0.0), lazyDeleteTime(0.0) {}
 };
 
+struct ReadBatchStats {
+	int64_t batches;
+	int64_t keys;
+	int64_t maxKeys;
+	double time;
+	double maxTime;
+
+	ReadBatchStats() : batches(0), keys(0), maxKeys(0), time(0.0), maxTime(0.0) {}
+};
+
 struct PageChecksumCodec {
 	PageChecksumCodec(std::string const &filename) : pageSize(0), reserveSize(0), filename(filename), silent(false) {}
 
@@ -631,15 +641,32 @@ struct IntKeyCursor {
 	}
 };
 
+// Reads pages of the database file into the page cache ahead of a scan.  Errors are left for SQLite's own read of the
+// same pages to find.
+ACTOR static void readAheadPages( Reference<IAsyncFile> dbFile, int64_t offset, int length ) {
+	state Standalone<StringRef> buf = makeString( length );
+	try {
+		int _ = wait( dbFile->read( mutateString(buf), length, offset ) );
+	} catch (Error& e) {
+	}
+}
+
 struct RawCursor {
 	SQLiteDB& db;
 	BtCursor *cursor;
 	KeyInfo keyInfo;
 	bool valid;
 
+	// Read-ahead for range scans.  After the cursor has moved in one direction through SQLITE_READAHEAD_TRIGGER_LEAVES
+	// adjacent leaves, the leaves it will visit next under the same parent are read into the page cache ahead of it, in
+	// a window which doubles with each further leaf up to SQLITE_READAHEAD_MAX_PAGES.
+	uint32_t leafParent;
+	int leafIndex, sequentialLeaves, readAheadWindow;
+	int readAheadNext;  // The next child of leafParent not yet read ahead, in the direction of the scan
+
 	operator bool() const { return valid; }
 
-	RawCursor( SQLiteDB& db, int table, bool write) : cursor(0), db(db), valid(false) {
+	RawCursor( SQLiteDB& db, int table, bool write) : cursor(0), db(db), valid(false), leafParent(0), leafIndex(0), sequentialLeaves(0), readAheadWindow(0), readAheadNext(0) {
 		keyInfo.db = db.db;
 		keyInfo.enc = db.db->aDb[0].pSchema->enc;
 		keyInfo.aColl[0] = db.db->pDfltColl;
@@ -677,11 +704,66 @@ struct RawCursor {
 		int empty=1;
 		db.checkError("BtreeNext", sqlite3BtreeNext(cursor, &empty));
 		valid = !empty;
+		if (valid) readAhead(1);
 	}
 	void movePrevious() {
 		int empty=1;
 		db.checkError("BtreePrevious", sqlite3BtreePrevious(cursor, &empty));
 		valid = !empty;
+		if (valid) readAhead(-1);
+	}
+	void readAhead( int direction ) {
+		if (SERVER_KNOBS->SQLITE_READAHEAD_MAX_PAGES <= 0) return;
+
+		uint32_t parent;
+		int index;
+		int children = sqlite3BtreeLeafPosition(cursor, &parent, &index);
+		if (!children || (parent == leafParent && index == leafIndex)) return;  // Not on a leaf, or still on the same one
+
+		bool sequential = parent == leafParent ? index == leafIndex + direction : index == (direction > 0 ? 0 : children-1);
+		if (parent != leafParent) readAheadNext = index + direction;
+		leafParent = parent;
+		leafIndex = index;
+		if (!sequential) {
+			sequentialLeaves = 0;
+			readAheadWindow = 0;
+			readAheadNext = index + direction;
+			return;
+		}
+		if (++sequentialLeaves < SERVER_KNOBS->SQLITE_READAHEAD_TRIGGER_LEAVES) return;
+
+		readAheadWindow = readAheadWindow ? std::min(readAheadWindow * 2, SERVER_KNOBS->SQLITE_READAHEAD_MAX_PAGES)
+			: std::min(SERVER_KNOBS->SQLITE_READAHEAD_MIN_PAGES, SERVER_KNOBS->SQLITE_READAHEAD_MAX_PAGES);
+		int first, last;
+		if (direction > 0) {
+			first = std::max(readAheadNext, index + 1);
+			last = std::min(index + readAheadWindow, children - 1);
+			readAheadNext = std::max(readAheadNext, last + 1);
+		} else {
+			first = std::max(index - readAheadWindow, 0);
+			last = std::min(readAheadNext, index - 1);
+			readAheadNext = std::min(readAheadNext, first - 1);
+		}
+		if (first > last) return;
+
+		std::vector<uint32_t> pgnos( last - first + 1 );
+		pgnos.resize( sqlite3BtreeLeafSiblings(cursor, first, pgnos.size(), &pgnos[0]) );
+		std::sort(pgnos.begin(), pgnos.end());
+
+		// Leaves that are adjacent in the file are read together, and the page cache reads each run with one large read
+		TEST(true);  // SQLite range read read-ahead
+		int64_t pageSize = sqlite3BtreeGetPageSize(db.btree);
+		int64_t fileSize = waitForAndGet( db.dbFile->size() );
+		for(int i = 0; i < pgnos.size(); ) {
+			int j = i + 1;
+			while (j < pgnos.size() && pgnos[j] == pgnos[j-1] + 1) j++;
+			// Pages which have only been written to the WAL are not in the database file yet
+			int64_t offset = (pgnos[i] - 1) * pageSize;
+			int64_t length = std::min<int64_t>((j - i) * pageSize, fileSize - offset);
+			if (length > 0)
+				readAheadPages(db.dbFile, offset, length);
+			i = j;
+		}
 	}
 	int size() {
 		int64_t size;
@@ -1037,6 +1119,62 @@ struct RawCursor {
 
 		return Optional<Value>();
 	}
+	// Reads each of the given sorted, unique keys.  Rather than seeking from the root for every key, the cursor is stepped
+	// forward from the previous key when the next one is no more than SQLITE_READ_BATCH_MAX_STEPS rows further on.
+	void getBatch( std::vector<KeyRef> const& keys, std::vector<Optional<Value>>& results ) {
+		Arena m;
+		results.resize( keys.size() );
+		if(db.fragment_values) {
+			std::unique_ptr<DefragmentingReader> i;
+			for(int k = 0; k < keys.size(); k++) {
+				Optional<KeyRef> next;
+				if(i) {
+					next = i->peek();
+					for(int steps = 0; next.present() && next.get() < keys[k] && steps < SERVER_KNOBS->SQLITE_READ_BATCH_MAX_STEPS; steps++) {
+						i->getNext();
+						next = i->peek();
+					}
+				}
+				if(!i || (next.present() && next.get() < keys[k])) {
+					int r = moveTo(keys[k]);
+					if(r < 0)
+						moveNext();
+					i.reset( new DefragmentingReader(*this, m, true) );
+					next = i->peek();
+				}
+				// Nothing follows this key, so none of the remaining keys are present either
+				if(!next.present())
+					break;
+				if(next.get() == keys[k])
+					results[k] = Value(i->getNext().get().value, m);
+			}
+		}
+		else {
+			bool positioned = false;
+			KeyValueRef kv;
+			for(int k = 0; k < keys.size(); k++) {
+				if(positioned) {
+					for(int steps = 0; valid && kv.key < keys[k] && steps < SERVER_KNOBS->SQLITE_READ_BATCH_MAX_STEPS; steps++) {
+						moveNext();
+						if(valid)
+							kv = decodeKV( getEncodedRow( m ) );
+					}
+				}
+				if(!positioned || (valid && kv.key < keys[k])) {
+					int r = moveTo(keys[k]);
+					if(r < 0)
+						moveNext();
+					if(valid)
+						kv = decodeKV( getEncodedRow( m ) );
+					positioned = true;
+				}
+				if(!valid)
+					break;
+				if(kv.key == keys[k])
+					results[k] = Value(kv.value, m);
+			}
+		}
+	}
 	Optional<Value> getPrefix( KeyRef key, int maxLength ) {
 		if(db.fragment_values) {
 			int r = moveTo(key);
@@ -1446,6 +1584,7 @@ private:
 	ThreadSafeCounter readsComplete;
 	volatile int64_t writesComplete;
 	volatile SpringCleaningStats springCleaningStats;
+	volatile ReadBatchStats readBatchStats;
 	volatile int64_t diskBytesUsed;
 	volatile int64_t freeListPages;
 
@@ -1454,11 +1593,12 @@ private:
 	struct Reader : IThreadPoolReceiver {
 		SQLiteDB conn;
 		ThreadSafeCounter& counter;
+		volatile ReadBatchStats& readBatchStats;
 		UID dbgid;
 		Reference<ReadCursor>* ppReadCursor;
 
-		explicit Reader( std::string const& filename, bool is_btree_v2, ThreadSafeCounter& counter, UID dbgid, Reference<ReadCursor>* ppReadCursor )
-			: conn( filename, is_btree_v2, is_btree_v2 ), counter(counter), dbgid(dbgid), ppReadCursor(ppReadCursor)
+		explicit Reader( std::string const& filename, bool is_btree_v2, ThreadSafeCounter& counter, volatile ReadBatchStats& readBatchStats, UID dbgid, Reference<ReadCursor>* ppReadCursor )
+			: conn( filename, is_btree_v2, is_btree_v2 ), counter(counter), readBatchStats(readBatchStats), dbgid(dbgid), ppReadCursor(ppReadCursor)
 		{
 		}
 		~Reader() {
@@ -1497,6 +1637,71 @@ private:
 			//if (t >= 1.0) TraceEvent("ReadValueActionSlow",dbgid).detail("Elapsed", t);
 		}
 
+		// Point reads which are queued for the read threads as a single ReadValueBatchAction.  The batch keeps accepting reads
+		// until a reader claims it, so reads which arrive while every reader is busy are served together.
+		struct ReadValueBatch : ThreadSafeReferenceCounted<ReadValueBatch> {
+			ThreadSpinLock lock;
+			bool claimed;
+			std::vector<std::unique_ptr<ReadValueAction>> reads;
+
+			ReadValueBatch() : claimed(false) {}
+
+			// Takes ownership of rv and returns true unless the batch has already been claimed or is full
+			bool add( ReadValueAction* rv ) {
+				ThreadSpinLockHolder holder(lock);
+				if (claimed || reads.size() >= SERVER_KNOBS->SQLITE_READ_BATCH_MAX_SIZE)
+					return false;
+				reads.push_back( std::unique_ptr<ReadValueAction>(rv) );
+				return true;
+			}
+			void claim( std::vector<std::unique_ptr<ReadValueAction>>& out ) {
+				ThreadSpinLockHolder holder(lock);
+				claimed = true;
+				out.swap(reads);
+			}
+		};
+
+		struct ReadValueBatchAction : TypedAction<Reader, ReadValueBatchAction>, FastAllocated<ReadValueBatchAction> {
+			Reference<ReadValueBatch> batch;
+			explicit ReadValueBatchAction(Reference<ReadValueBatch> const& batch) : batch(batch) {}
+			virtual double getTimeEstimate() { return SERVER_KNOBS->READ_VALUE_TIME_ESTIMATE; }
+		};
+		void action( ReadValueBatchAction& rb ) {
+			double t = timer();
+			std::vector<std::unique_ptr<ReadValueAction>> reads;
+			rb.batch->claim( reads );
+
+			// Serve the reads in key order, so that consecutive keys can share one cursor traversal
+			std::sort( reads.begin(), reads.end(), [](std::unique_ptr<ReadValueAction> const& a, std::unique_ptr<ReadValueAction> const& b) { return a->key < b->key; } );
+			std::vector<KeyRef> keys;
+			keys.reserve( reads.size() );
+			for(auto& rv : reads) {
+				if (rv->debugID.present()) g_traceBatch.addEvent("GetValueDebug", rv->debugID.get().first(), "Reader.Before"); //.detail("TaskID", g_network->getCurrentTask());
+				if (keys.empty() || keys.back() != rv->key)
+					keys.push_back( rv->key );
+			}
+
+			std::vector<Optional<Value>> values;
+			getCursor()->get().getBatch( keys, values );
+
+			int k = 0;
+			for(auto& rv : reads) {
+				while (keys[k] != rv->key)
+					++k;
+				rv->result.send( values[k] );
+				++counter;
+
+				if (rv->debugID.present()) g_traceBatch.addEvent("GetValueDebug", rv->debugID.get().first(), "Reader.After"); //.detail("TaskID", g_network->getCurrentTask());
+			}
+
+			t = timer()-t;
+			readBatchStats.batches++;
+			readBatchStats.keys += reads.size();
+			readBatchStats.time += t;
+			if (reads.size() > readBatchStats.maxKeys) readBatchStats.maxKeys = reads.size();
+			if (t > readBatchStats.maxTime) readBatchStats.maxTime = t;
+		}
+
 		struct ReadValuePrefixAction : TypedAction<Reader, ReadValuePrefixAction>, FastAllocated<ReadValuePrefixAction> {
 			Key key;
 			int maxLength;
@@ -1530,6 +1735,8 @@ private:
 		}
 	};
 
+	Reference<Reader::ReadValueBatch> pendingReads;
+
 	struct Writer : IThreadPoolReceiver {
 		SQLiteDB conn;
 		Cursor* cursor;
@@ -1781,6 +1988,9 @@ private:
 	ACTOR static Future<Void> logPeriodically( KeyValueStoreSQLite* self ) {
 		state int64_t lastReadsComplete = 0;
 		state int64_t lastWritesComplete = 0;
+		state int64_t lastReadBatches = 0;
+		state int64_t lastReadBatchKeys = 0;
+		state double lastReadBatchTime = 0;
 		loop {
 			wait( delay(SERVER_KNOBS->DISK_METRIC_LOGGING_INTERVAL) );
 
@@ -1800,8 +2010,21 @@ private:
 				.detail("LazyDeleteTime", self->springCleaningStats.lazyDeleteTime)
 				.detail("VacuumTime", self->springCleaningStats.vacuumTime);
 
+			int64_t batches = self->readBatchStats.batches - lastReadBatches;
+			TraceEvent("ReadBatchMetrics", self->logID)
+				.detail("Batches", batches)
+				.detail("MeanBatchSize", batches ? double(self->readBatchStats.keys - lastReadBatchKeys) / batches : 0.0)
+				.detail("MaxBatchSize", self->readBatchStats.maxKeys)
+				.detail("MeanBatchLatency", batches ? (self->readBatchStats.time - lastReadBatchTime) / batches : 0.0)
+				.detail("MaxBatchLatency", self->readBatchStats.maxTime);
+
 			lastReadsComplete = self->readsComplete;
 			lastWritesComplete = self->writesComplete;
+			lastReadBatches = self->readBatchStats.batches;
+			lastReadBatchKeys = self->readBatchStats.keys;
+			lastReadBatchTime = self->readBatchStats.time;
+			self->readBatchStats.maxKeys = 0;
+			self->readBatchStats.maxTime = 0;
 		}
 	}
 
@@ -1917,7 +2140,7 @@ void KeyValueStoreSQLite::startReadThreads() {
 	int taskId = g_network->getCurrentTask();
 	g_network->setCurrentTask(TaskDiskRead);
 	for(int i=0; i<nReadThreads; i++)
-		readThreads->addThread( new Reader(filename, type==KeyValueStoreType::SSD_BTREE_V2, readsComplete, logID, &readCursors[i]) );
+		readThreads->addThread( new Reader(filename, type==KeyValueStoreType::SSD_BTREE_V2, readsComplete, readBatchStats, logID, &readCursors[i]) );
 	g_network->setCurrentTask(taskId);
 }
 
@@ -1940,7 +2163,15 @@ Future<Optional<Value>> KeyValueStoreSQLite::readValue( KeyRef key, Optional<UID
 	++readsRequested;
 	auto p = new Reader::ReadValueAction(key, debugID);
 	auto f = p->result.getFuture();
-	readThreads->post(p);
+	if (SERVER_KNOBS->SQLITE_READ_BATCH_MAX_SIZE > 1) {
+		// Join the batch which is still waiting for a reader, or queue a new one
+		if (!pendingReads || !pendingReads->add(p)) {
+			pendingReads = Reference<Reader::ReadValueBatch>( new Reader::ReadValueBatch );
+			pendingReads->add(p);
+			readThreads->post( new Reader::ReadValueBatchAction(pendingReads) );
+		}
+	} else
+		readThreads->post(p);
 	return f;
 }
 Future<Optional<Value>> KeyValueStoreSQLite::readValuePrefix( KeyRef key, int maxLength, Optional<UID> debugID ) {
@@ -64,6 +64,14 @@ ServerKnobs::ServerKnobs(bool randomize, ClientKnobs* clientKnobs) {
 	init( MAX_QUEUE_COMMIT_BYTES,                               15e6 ); if( randomize && BUGGIFY ) MAX_QUEUE_COMMIT_BYTES = 5000;
 	init( VERSIONS_PER_BATCH,                 VERSIONS_PER_SECOND/20 ); if( randomize && BUGGIFY ) VERSIONS_PER_BATCH = std::max<int64_t>(1,VERSIONS_PER_SECOND/1000);
 	init( CONCURRENT_LOG_ROUTER_READS,                             1 );
+	init( DISK_QUEUE_GROUP_COMMIT,                                 1 ); if( randomize && BUGGIFY ) DISK_QUEUE_GROUP_COMMIT = g_random->coinflip();
+	init( DISK_QUEUE_GROUP_COMMIT_BYTES,                         1e6 ); if( randomize && BUGGIFY ) DISK_QUEUE_GROUP_COMMIT_BYTES = _PAGE_SIZE * g_random->randomInt(1,4);
+	init( DISK_QUEUE_GROUP_COMMIT_MAX_DELAY,                   0.005 ); if( randomize && BUGGIFY ) DISK_QUEUE_GROUP_COMMIT_MAX_DELAY = g_random->coinflip() ? 0.0 : 0.1;
+	init( DISK_QUEUE_METRICS_INTERVAL,                           5.0 );
+	init( TLOG_SPILL_REFERENCE,                                    0 ); if( randomize && BUGGIFY ) TLOG_SPILL_REFERENCE = 1; // Generations which spill by reference persist a format older versions cannot read
+	init( TLOG_SPILL_REFERENCE_MAX_BATCHES_PER_PEEK,             100 ); if( randomize && BUGGIFY ) TLOG_SPILL_REFERENCE_MAX_BATCHES_PER_PEEK = 1;
+	init( TLOG_SPILL_REFERENCE_MAX_PEEK_READ_BYTES,             10e6 ); if( randomize && BUGGIFY ) TLOG_SPILL_REFERENCE_MAX_PEEK_READ_BYTES = 0;
+	init( TLOG_SPILL_REFERENCE_MAX_READ_GAP,                     1e6 ); if( randomize && BUGGIFY ) TLOG_SPILL_REFERENCE_MAX_READ_GAP = g_random->coinflip() ? 0 : 100e6;
 
 	// Data distribution queue
 	init( HEALTH_POLL_TIME,                                      1.0 );
@@ -170,6 +178,11 @@ ServerKnobs::ServerKnobs(bool randomize, ClientKnobs* clientKnobs) {
 	init( CHECK_FREE_PAGE_AMOUNT,                                100 ); if( randomize && BUGGIFY ) CHECK_FREE_PAGE_AMOUNT = 5;
 	init( DISK_METRIC_LOGGING_INTERVAL,                          5.0 );
 	init( SOFT_HEAP_LIMIT,                                     300e6 );
+	init( SQLITE_READ_BATCH_MAX_SIZE,                             64 ); if( randomize && BUGGIFY ) SQLITE_READ_BATCH_MAX_SIZE = g_random->randomInt(1, 10);
+	init( SQLITE_READ_BATCH_MAX_STEPS,                             4 ); if( randomize && BUGGIFY ) SQLITE_READ_BATCH_MAX_STEPS = g_random->randomInt(0, 100);
+	init( SQLITE_READAHEAD_TRIGGER_LEAVES,                         2 ); if( randomize && BUGGIFY ) SQLITE_READAHEAD_TRIGGER_LEAVES = g_random->randomInt(0, 4);
+	init( SQLITE_READAHEAD_MIN_PAGES,                              4 ); if( randomize && BUGGIFY ) SQLITE_READAHEAD_MIN_PAGES = 1;
+	init( SQLITE_READAHEAD_MAX_PAGES,                             64 ); if( randomize && BUGGIFY ) SQLITE_READAHEAD_MAX_PAGES = g_random->coinflip() ? 0 : g_random->randomInt(1, 8);
 
 	init( SQLITE_PAGE_SCAN_ERROR_LIMIT,                        10000 );
 	init( SQLITE_BTREE_PAGE_USABLE,                          4096 - 8);  // pageSize - reserveSize for page checksum
@@ -208,6 +221,28 @@ ServerKnobs::ServerKnobs(bool randomize, ClientKnobs* clientKnobs) {
 
 	// KeyValueStoreMemory
 	init( REPLACE_CONTENTS_BYTES,                                1e5 ); if( randomize && BUGGIFY ) REPLACE_CONTENTS_BYTES = 1e3;
+	init( MEMORY_CHECKPOINTS,                                      0 ); if( randomize && BUGGIFY ) MEMORY_CHECKPOINTS = 1; // Storage server memory stores checkpoint to files, which older versions cannot recover
+	init( MEMORY_CHECKPOINT_BYTES,                             500e6 ); if( randomize && BUGGIFY ) MEMORY_CHECKPOINT_BYTES = g_random->randomInt(1e4, 1e6); // Logged bytes between checkpoints
+	init( MEMORY_CHECKPOINT_CHUNK_BYTES,                        10e6 ); if( randomize && BUGGIFY ) MEMORY_CHECKPOINT_CHUNK_BYTES = g_random->randomInt(100, 1e4);
+	init( MEMORY_CHECKPOINT_LOAD_THREADS,                          4 ); // <= 1 decodes the checkpoint on the network thread
+	init( MEMORY_BTREE_INDEX,                                      0 ); if( randomize && BUGGIFY ) MEMORY_BTREE_INDEX = 1; // Keep the data in an IndexedBTree rather than an IndexedSet
+
+	// KeyValueStoreLSM
+	init( LSM_MEMTABLE_BYTES,                                   64e6 ); if( randomize && BUGGIFY ) LSM_MEMTABLE_BYTES = g_random->randomInt(1e4, 1e6);
+	init( LSM_BLOCK_BYTES,                                     16384 ); if( randomize && BUGGIFY ) LSM_BLOCK_BYTES = g_random->randomInt(64, 4096);
+	init( LSM_RUN_FILE_BYTES,                                   64e6 ); if( randomize && BUGGIFY ) LSM_RUN_FILE_BYTES = g_random->randomInt(1e4, 1e6);
+	init( LSM_BLOOM_BITS_PER_KEY,                                 10 ); if( randomize && BUGGIFY ) LSM_BLOOM_BITS_PER_KEY = g_random->randomInt(0, 4);
+	init( LSM_LEVEL0_COMPACTION_RUNS,                              4 ); if( randomize && BUGGIFY ) LSM_LEVEL0_COMPACTION_RUNS = g_random->randomInt(1, 4);
+	init( LSM_LEVEL0_STALL_RUNS,                                  12 ); if( randomize && BUGGIFY ) LSM_LEVEL0_STALL_RUNS = LSM_LEVEL0_COMPACTION_RUNS + g_random->randomInt(0, 4);
+	init( LSM_LEVEL1_BYTES,                                    256e6 ); if( randomize && BUGGIFY ) LSM_LEVEL1_BYTES = g_random->randomInt(1e4, 1e7);
+	init( LSM_LEVEL_SIZE_MULTIPLIER,                              10 ); if( randomize && BUGGIFY ) LSM_LEVEL_SIZE_MULTIPLIER = g_random->randomInt(2, 5);
+	init( LSM_FILE_FLUSH_BYTES,                                  8e6 ); if( randomize && BUGGIFY ) LSM_FILE_FLUSH_BYTES = 1e5;
+	init( LSM_COMPACTION_YIELD_ENTRIES,                         1000 );
+
+	// VersionedBTree
+	init( REDWOOD_DEFAULT_PAGE_SIZE,                            4096 ); if( randomize && BUGGIFY ) REDWOOD_DEFAULT_PAGE_SIZE = 8192;
+	init( REDWOOD_PAGE_CACHE_PAGES,                            25000 ); if( randomize && BUGGIFY ) REDWOOD_PAGE_CACHE_PAGES = g_random->randomInt(1, 100);
+	init( REDWOOD_COMMIT_CONCURRENT_READS,                        64 ); if( randomize && BUGGIFY ) REDWOOD_COMMIT_CONCURRENT_READS = g_random->randomInt(1, 4);
 
 	// Leader election
 	bool longLeaderElection = randomize && BUGGIFY;
@@ -242,6 +277,13 @@ ServerKnobs::ServerKnobs(bool randomize, ClientKnobs* clientKnobs) {
 	init( COMMIT_TRANSACTION_BATCH_BYTES_MAX,                  100000 ); if( randomize && BUGGIFY ) { COMMIT_TRANSACTION_BATCH_BYTES_MIN = COMMIT_TRANSACTION_BATCH_BYTES_MAX = 1000000; }
 	init( COMMIT_TRANSACTION_BATCH_BYTES_SCALE_BASE,           100000 );
 	init( COMMIT_TRANSACTION_BATCH_BYTES_SCALE_POWER,             0.0 );
+	init( COMMIT_BATCH_LATENCY_TARGET,                          0.050 ); if( randomize && BUGGIFY ) COMMIT_BATCH_LATENCY_TARGET = g_random->coinflip() ? 0.0 : 0.005;
+	init( COMMIT_BATCH_CONTROLLER_INTERVAL,                       1.0 ); if( randomize && BUGGIFY ) COMMIT_BATCH_CONTROLLER_INTERVAL = 0.1;
+	init( COMMIT_BATCH_CONTROLLER_STAGE_SMOOTHING,                1.0 );
+	init( COMMIT_BATCH_CONTROLLER_BYTES_MIN,                    10000 );
+	init( COMMIT_BATCH_CONTROLLER_BYTES_MAX,                  1000000 ); if( randomize && BUGGIFY ) COMMIT_BATCH_CONTROLLER_BYTES_MAX = 20000;
+	init( COMMIT_BATCH_CONTROLLER_BYTES_INCREASE,                1.25 );
+	init( COMMIT_BATCH_CONTROLLER_BYTES_DECREASE,                 0.5 );
 
 	init( TRANSACTION_BUDGET_TIME,							   0.050 ); if( randomize && BUGGIFY ) TRANSACTION_BUDGET_TIME = 0.0;
 	init( RESOLVER_COALESCE_TIME,                                1.0 );
@@ -266,6 +308,8 @@ ServerKnobs::ServerKnobs(bool randomize, ClientKnobs* clientKnobs) {
 	init( SAMPLE_EXPIRATION_TIME,                                1.0 );
 	init( SAMPLE_POLL_TIME,                                      0.1 );
 	init( RESOLVER_STATE_MEMORY_LIMIT,                           1e6 );
+	init( CONFLICT_SET_PARALLEL_THREADS,                           0 ); if( randomize && BUGGIFY ) CONFLICT_SET_PARALLEL_THREADS = g_random->randomInt(2, 9); // <= 1 resolves each batch serially on the network thread
+	init( CONFLICT_SET_PARALLEL_MIN_RANGES,                      256 ); if( randomize && BUGGIFY ) CONFLICT_SET_PARALLEL_MIN_RANGES = g_random->randomInt(1, 64);
 	init( LAST_LIMITED_RATIO,                                    0.6 );
 
 	//Cluster Controller
@@ -354,9 +398,14 @@ ServerKnobs::ServerKnobs(bool randomize, ClientKnobs* clientKnobs) {
 	init( STORAGE_LIMIT_BYTES,                                500000 );
 	init( BUGGIFY_LIMIT_BYTES,                                  1000 );
 	init( FETCH_BLOCK_BYTES,                                     2e6 );
-	init( FETCH_KEYS_PARALLELISM_BYTES,                          5e6 ); if( randomize && BUGGIFY ) FETCH_KEYS_PARALLELISM_BYTES = 4e6;
+	init( FETCH_KEYS_PARALLELISM_BYTES,                         20e6 ); if( randomize && BUGGIFY ) FETCH_KEYS_PARALLELISM_BYTES = 4e6;
+	init( FETCH_KEYS_PARALLEL_BLOCKS,                              8 ); if( randomize && BUGGIFY ) FETCH_KEYS_PARALLEL_BLOCKS = g_random->randomInt(1, 4);
+	init( FETCH_KEYS_SPLIT_TIMEOUT,                              5.0 );
+	init( FETCH_KEYS_PROGRESS_LOGGED,                             10 );
 	init( BUGGIFY_BLOCK_BYTES,                                 10000 );
+	init( STORAGE_READ_CACHE_BYTES,                             10e6 ); if( randomize && BUGGIFY ) STORAGE_READ_CACHE_BYTES = g_random->coinflip() ? 0 : g_random->randomInt(1e3, 1e5); // <= 0 disables the cache
 	init( STORAGE_COMMIT_BYTES,                             10000000 ); if( randomize && BUGGIFY ) STORAGE_COMMIT_BYTES = 2000000;
+	init( STORAGE_COMMIT_PIPELINE_BYTES,                           0 ); if( randomize && BUGGIFY ) STORAGE_COMMIT_PIPELINE_BYTES = g_random->randomInt(1, 4) * STORAGE_COMMIT_BYTES; // Bytes written to storage and not yet durable; <= 0 commits one slice at a time
 	init( STORAGE_COMMIT_INTERVAL,                               0.5 ); if( randomize && BUGGIFY ) STORAGE_COMMIT_INTERVAL = 2.0;
 	init( UPDATE_SHARD_VERSION_INTERVAL,                        0.25 ); if( randomize && BUGGIFY ) UPDATE_SHARD_VERSION_INTERVAL = 1.0;
 	init( BYTE_SAMPLING_FACTOR,                                  250 ); //cannot buggify because of differences in restarting tests
@@ -364,6 +413,7 @@ ServerKnobs::ServerKnobs(bool randomize, ClientKnobs* clientKnobs) {
 	init( MAX_STORAGE_SERVER_WATCH_BYTES,                      100e6 ); if( randomize && BUGGIFY ) MAX_STORAGE_SERVER_WATCH_BYTES = 10e3;
 	init( MAX_BYTE_SAMPLE_CLEAR_MAP_SIZE,                        1e9 ); if( randomize && BUGGIFY ) MAX_BYTE_SAMPLE_CLEAR_MAP_SIZE = 1e3;
 	init( LONG_BYTE_SAMPLE_RECOVERY_DELAY,                      60.0 );
+	init( STORAGE_SERVER_STREAMING_PEEKS,                          1 ); if( randomize && BUGGIFY ) STORAGE_SERVER_STREAMING_PEEKS = g_random->coinflip();
 
 	//Wait Failure
 	init( BUGGIFY_OUTSTANDING_WAIT_FAILURE_REQUESTS,               2 );
@@ -387,11 +437,17 @@ ServerKnobs::ServerKnobs(bool randomize, ClientKnobs* clientKnobs) {
 	// Status
 	init( STATUS_MIN_TIME_BETWEEN_REQUESTS,                      0.0 );
 	init( CONFIGURATION_ROWS_TO_FETCH,                         20000 );
+	init( COMMIT_TRACE_SAMPLE_RATE,                            0.001 ); if( randomize && BUGGIFY ) COMMIT_TRACE_SAMPLE_RATE = 0.1;
+	init( COMMIT_LATENCY_STAGES_INTERVAL,                        5.0 );
 
 	// Timekeeper
 	init( TIME_KEEPER_DELAY,                                      10 );
 	init( TIME_KEEPER_MAX_ENTRIES,                              3600 * 24 * 30 * 6); if( randomize && BUGGIFY ) { TIME_KEEPER_MAX_ENTRIES = 2; }
 
+	// Network test
+	init( NETWORK_TEST_REPLY_SIZE,                            600000 );
+	init( NETWORK_TEST_REQUESTS_IN_FLIGHT,                        30 );
+
 	if(clientKnobs)
 		clientKnobs->IS_ACCEPTABLE_DELAY = clientKnobs->IS_ACCEPTABLE_DELAY*std::min(MAX_READ_TRANSACTION_LIFE_VERSIONS, MAX_WRITE_TRANSACTION_LIFE_VERSIONS)/(5.0*VERSIONS_PER_SECOND);
 }
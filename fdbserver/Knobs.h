@@ -68,6 +68,14 @@ public:
 	int64_t MAX_QUEUE_COMMIT_BYTES;
 	int64_t VERSIONS_PER_BATCH;
 	int CONCURRENT_LOG_ROUTER_READS;
+	int DISK_QUEUE_GROUP_COMMIT; // Commits to a disk queue made while another is in flight are written and synced together
+	int64_t DISK_QUEUE_GROUP_COMMIT_BYTES; // A group commit is flushed as soon as it holds this many bytes of pages
+	double DISK_QUEUE_GROUP_COMMIT_MAX_DELAY; // A group commit waits at most the lesser of this and the recent sync latency
+	double DISK_QUEUE_METRICS_INTERVAL;
+	int TLOG_SPILL_REFERENCE; // New TLog generations spill references to their disk queue, rather than the messages themselves, to persistentData
+	int TLOG_SPILL_REFERENCE_MAX_BATCHES_PER_PEEK;
+	int64_t TLOG_SPILL_REFERENCE_MAX_PEEK_READ_BYTES;
+	int64_t TLOG_SPILL_REFERENCE_MAX_READ_GAP; // Spilled versions of a tag at most this far apart in the disk queue are read with one sequential read
 
 	// Data distribution queue
 	double HEALTH_POLL_TIME;
@@ -134,6 +142,11 @@ public:
 	int CHECK_FREE_PAGE_AMOUNT;
 	double DISK_METRIC_LOGGING_INTERVAL;
 	int64_t SOFT_HEAP_LIMIT;
+	int SQLITE_READ_BATCH_MAX_SIZE; // <= 1 sends each point read to the read threads separately
+	int SQLITE_READ_BATCH_MAX_STEPS;
+	int SQLITE_READAHEAD_TRIGGER_LEAVES;
+	int SQLITE_READAHEAD_MIN_PAGES;
+	int SQLITE_READAHEAD_MAX_PAGES; // <= 0 disables read-ahead for range reads
 
 	int SQLITE_PAGE_SCAN_ERROR_LIMIT;
 	int SQLITE_BTREE_PAGE_USABLE;
@@ -155,6 +168,28 @@ public:
 
 	// KeyValueStoreMemory
 	int64_t REPLACE_CONTENTS_BYTES;
+	int MEMORY_CHECKPOINTS;
+	int64_t MEMORY_CHECKPOINT_BYTES;
+	int64_t MEMORY_CHECKPOINT_CHUNK_BYTES;
+	int MEMORY_CHECKPOINT_LOAD_THREADS;
+	int MEMORY_BTREE_INDEX;
+
+	// KeyValueStoreLSM
+	int64_t LSM_MEMTABLE_BYTES;
+	int LSM_BLOCK_BYTES;
+	int64_t LSM_RUN_FILE_BYTES;
+	int LSM_BLOOM_BITS_PER_KEY;
+	int LSM_LEVEL0_COMPACTION_RUNS;
+	int LSM_LEVEL0_STALL_RUNS;
+	int64_t LSM_LEVEL1_BYTES;
+	int LSM_LEVEL_SIZE_MULTIPLIER;
+	int64_t LSM_FILE_FLUSH_BYTES;
+	int LSM_COMPACTION_YIELD_ENTRIES;
+
+	// VersionedBTree
+	int REDWOOD_DEFAULT_PAGE_SIZE;
+	int REDWOOD_PAGE_CACHE_PAGES;
+	int REDWOOD_COMMIT_CONCURRENT_READS;
 
 	// Leader election
 	int MAX_NOTIFICATIONS;
@@ -185,6 +220,13 @@ public:
 	int    COMMIT_TRANSACTION_BATCH_BYTES_MAX;
 	double COMMIT_TRANSACTION_BATCH_BYTES_SCALE_BASE;
 	double COMMIT_TRANSACTION_BATCH_BYTES_SCALE_POWER;
+	double COMMIT_BATCH_LATENCY_TARGET; // <= 0 sizes batches from COMMIT_TRANSACTION_BATCH_INTERVAL_* alone
+	double COMMIT_BATCH_CONTROLLER_INTERVAL;
+	double COMMIT_BATCH_CONTROLLER_STAGE_SMOOTHING;
+	int    COMMIT_BATCH_CONTROLLER_BYTES_MIN;
+	int    COMMIT_BATCH_CONTROLLER_BYTES_MAX;
+	double COMMIT_BATCH_CONTROLLER_BYTES_INCREASE;
+	double COMMIT_BATCH_CONTROLLER_BYTES_DECREASE;
 	int64_t COMMIT_BATCHES_MEM_BYTES_HARD_LIMIT;
 	double COMMIT_BATCHES_MEM_FRACTION_OF_TOTAL;
 	double COMMIT_BATCHES_MEM_TO_TOTAL_MEM_SCALE_FACTOR;
@@ -208,6 +250,8 @@ public:
 	double SAMPLE_EXPIRATION_TIME;
 	double SAMPLE_POLL_TIME;
 	int64_t RESOLVER_STATE_MEMORY_LIMIT;
+	int CONFLICT_SET_PARALLEL_THREADS;
+	int CONFLICT_SET_PARALLEL_MIN_RANGES;
 
 	//Cluster Controller
 	double CLUSTER_CONTROLLER_LOGGING_DELAY;
@@ -293,9 +337,14 @@ public:
 	int BUGGIFY_LIMIT_BYTES;
 	int FETCH_BLOCK_BYTES;
 	int FETCH_KEYS_PARALLELISM_BYTES;
+	int FETCH_KEYS_PARALLEL_BLOCKS;
+	double FETCH_KEYS_SPLIT_TIMEOUT;
+	int FETCH_KEYS_PROGRESS_LOGGED;
 	int BUGGIFY_BLOCK_BYTES;
 	int64_t STORAGE_HARD_LIMIT_BYTES;
+	int64_t STORAGE_READ_CACHE_BYTES;
 	int STORAGE_COMMIT_BYTES;
+	int64_t STORAGE_COMMIT_PIPELINE_BYTES;
 	double STORAGE_COMMIT_INTERVAL;
 	double UPDATE_SHARD_VERSION_INTERVAL;
 	int BYTE_SAMPLING_FACTOR;
@@ -303,6 +352,7 @@ public:
 	int MAX_STORAGE_SERVER_WATCH_BYTES;
 	int MAX_BYTE_SAMPLE_CLEAR_MAP_SIZE;
 	double LONG_BYTE_SAMPLE_RECOVERY_DELAY;
+	int STORAGE_SERVER_STREAMING_PEEKS;
 
 	//Wait Failure
 	int BUGGIFY_OUTSTANDING_WAIT_FAILURE_REQUESTS;
@@ -326,11 +376,17 @@ public:
 	// Status
 	double STATUS_MIN_TIME_BETWEEN_REQUESTS;
 	int CONFIGURATION_ROWS_TO_FETCH;
+	double COMMIT_TRACE_SAMPLE_RATE; // Fraction of commit versions traced through every role with CommitDebug events
+	double COMMIT_LATENCY_STAGES_INTERVAL;
 
 	// Timekeeper
 	int64_t TIME_KEEPER_DELAY;
 	int64_t TIME_KEEPER_MAX_ENTRIES;
 
+	// Network test
+	int NETWORK_TEST_REPLY_SIZE;
+	int NETWORK_TEST_REQUESTS_IN_FLIGHT;
+
 	ServerKnobs(bool randomize = false, ClientKnobs* clientKnobs = NULL);
 };
 
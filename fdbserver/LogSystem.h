@@ -617,8 +617,10 @@ struct ILogSystem {
 	virtual Reference<IPeekCursor> peek( UID dbgid, Version begin, Optional<Version> end, std::vector<Tag> tags, bool parallelGetMore = false ) = 0;
 		// Same contract as peek(), but for a set of tags
 
-	virtual Reference<IPeekCursor> peekSingle( UID dbgid, Version begin, Tag tag, vector<pair<Version,Tag>> history = vector<pair<Version,Tag>>() ) = 0;
+	virtual Reference<IPeekCursor> peekSingle( UID dbgid, Version begin, Tag tag, vector<pair<Version,Tag>> history = vector<pair<Version,Tag>>(), bool parallelGetMore = false ) = 0;
 		// Same contract as peek(), but blocks until the preferred log server(s) for the given tag are available (and is correspondingly less expensive)
+		// With parallelGetMore, keeps up to PARALLEL_GET_MORE_REQUESTS peeks outstanding at the log server, which answers each as soon as it has
+		// newer versions, so that a caught up peeker does not wait a round trip after each reply
 
 	virtual Reference<IPeekCursor> peekLogRouter( UID dbgid, Version begin, Tag tag ) = 0;
 		// Same contract as peek(), but can only peek from the logs elected in the same generation.
@@ -68,8 +68,10 @@ public:
 	virtual Future<Standalone<StringRef>> readNext( int bytes );
 	virtual IDiskQueue::location getNextReadLocation();
 	virtual IDiskQueue::location push( StringRef contents );
+	virtual IDiskQueue::location getNextPushLocation() { ASSERT(false); throw internal_error(); }
 	virtual void pop( IDiskQueue::location upTo );
 	virtual Future<Void> commit();
+	virtual Future<Standalone<StringRef>> read( IDiskQueue::location from, IDiskQueue::location to ) { ASSERT(false); throw internal_error(); }
 	virtual StorageBytes getStorageBytes() { ASSERT(false); throw internal_error(); }
 	virtual int getCommitOverhead() { return 0; } //SOMEDAY: could this be more accurate?
 
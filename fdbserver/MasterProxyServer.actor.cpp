@@ -36,10 +36,14 @@
 #include "fdbclient/KeyRangeMap.h"
 #include "ConflictSet.h"
 #include "flow/Stats.h"
+#include "fdbrpc/ContinuousSample.h"
+#include "fdbrpc/Smoother.h"
 #include "ApplyMetadataMutation.h"
 #include "RecoveryState.h"
+#include "CommitLatencyStages.h"
 #include "fdbclient/Atomic.h"
 #include "flow/TDMetric.actor.h"
+#include "flow/UnitTest.h"
 #include "flow/actorcompiler.h"  // This must be the last #include.
 
 struct ProxyStats {
@@ -54,6 +58,10 @@ struct ProxyStats {
 	Counter mutationBytes;
 	Counter mutations;
 	Counter conflictRanges;
+	Counter commitBatchIntervalIncreases, commitBatchIntervalDecreases;
+	Counter commitBatchBytesIncreases, commitBatchBytesDecreases;
+	Counter commitBatchLatencyTargetMisses;
+	LatencyCounter commitLatency;  // Of each transaction, from the start of its commit batch to its reply
 	Version lastCommitVersionAssigned;
 
 	Future<Void> logger;
@@ -62,7 +70,10 @@ struct ProxyStats {
 	  : cc("ProxyStats", id.toString()),
 		txnStartIn("TxnStartIn", cc), txnStartOut("TxnStartOut", cc), txnStartBatch("TxnStartBatch", cc), txnSystemPriorityStartIn("TxnSystemPriorityStartIn", cc), txnSystemPriorityStartOut("TxnSystemPriorityStartOut", cc), txnBatchPriorityStartIn("TxnBatchPriorityStartIn", cc), txnBatchPriorityStartOut("TxnBatchPriorityStartOut", cc),
 		txnDefaultPriorityStartIn("TxnDefaultPriorityStartIn", cc), txnDefaultPriorityStartOut("TxnDefaultPriorityStartOut", cc), txnCommitIn("TxnCommitIn", cc),	txnCommitVersionAssigned("TxnCommitVersionAssigned", cc), txnCommitResolving("TxnCommitResolving", cc), txnCommitResolved("TxnCommitResolved", cc), txnCommitOut("TxnCommitOut", cc),
-		txnCommitOutSuccess("TxnCommitOutSuccess", cc), txnConflicts("TxnConflicts", cc), commitBatchIn("CommitBatchIn", cc), commitBatchOut("CommitBatchOut", cc), mutationBytes("MutationBytes", cc), mutations("Mutations", cc), conflictRanges("ConflictRanges", cc), lastCommitVersionAssigned(0)
+		txnCommitOutSuccess("TxnCommitOutSuccess", cc), txnConflicts("TxnConflicts", cc), commitBatchIn("CommitBatchIn", cc), commitBatchOut("CommitBatchOut", cc), mutationBytes("MutationBytes", cc), mutations("Mutations", cc), conflictRanges("ConflictRanges", cc),
+		commitBatchIntervalIncreases("CommitBatchIntervalIncreases", cc), commitBatchIntervalDecreases("CommitBatchIntervalDecreases", cc),
+		commitBatchBytesIncreases("CommitBatchBytesIncreases", cc), commitBatchBytesDecreases("CommitBatchBytesDecreases", cc),
+		commitBatchLatencyTargetMisses("CommitBatchLatencyTargetMisses", cc), commitLatency("CommitLatency", cc), lastCommitVersionAssigned(0)
 	{
 		specialCounter(cc, "LastAssignedCommitVersion", [this](){return this->lastCommitVersionAssigned;});
 		specialCounter(cc, "Version", [pVersion](){return *pVersion; });
@@ -72,6 +83,89 @@ struct ProxyStats {
 	}
 };
 
+// Sizes commit batches from the latencies of the stages behind the batcher, against a p99 commit latency target
+// (COMMIT_BATCH_LATENCY_TARGET).  Once every COMMIT_BATCH_CONTROLLER_INTERVAL:
+//  - The batching interval is a fraction of the smoothed resolution and logging latency, which is the per-batch cost that
+//    batching amortizes, but no more than the target leaves after the p99 latency of the commit pipeline.  When batches
+//    average one transaction or fewer there is nothing to amortize, and the interval drops to its minimum.
+//  - The size at which a batch is sent without waiting out the interval grows while most batches reach it and latency
+//    is within the target, and shrinks when latency is over the target.
+struct CommitBatchController {
+	double interval;   // Read by the batcher
+	int desiredBytes;  // Read by the batcher
+	int minBytes, maxBytes;
+
+	Smoother resolutionLatency, loggingLatency, replyLatency;
+	ContinuousSample<double> pipelineLatency;
+	double pipelineP99;
+
+	double windowStart;
+	int64_t windowBatches, windowTransactions, windowFullBatches;
+
+	CommitBatchController()
+		: interval(SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_MIN), resolutionLatency(SERVER_KNOBS->COMMIT_BATCH_CONTROLLER_STAGE_SMOOTHING), loggingLatency(SERVER_KNOBS->COMMIT_BATCH_CONTROLLER_STAGE_SMOOTHING),
+		  replyLatency(SERVER_KNOBS->COMMIT_BATCH_CONTROLLER_STAGE_SMOOTHING), pipelineLatency(1000), pipelineP99(0),
+		  windowStart(now()), windowBatches(0), windowTransactions(0), windowFullBatches(0)
+	{
+		setInitialBytes( SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_BYTES_MIN );
+	}
+
+	void setInitialBytes( int bytes ) {
+		desiredBytes = bytes;
+		minBytes = std::min(SERVER_KNOBS->COMMIT_BATCH_CONTROLLER_BYTES_MIN, bytes);
+		maxBytes = std::max(SERVER_KNOBS->COMMIT_BATCH_CONTROLLER_BYTES_MAX, bytes);
+	}
+
+	void addBatch( ProxyStats& stats, int transactions, int bytes, double resolution, double logging, double reply, double pipeline ) {
+		resolutionLatency.setTotal( resolution );
+		loggingLatency.setTotal( logging );
+		replyLatency.setTotal( reply );
+		pipelineLatency.addSample( pipeline );
+
+		++windowBatches;
+		windowTransactions += transactions;
+		if (bytes >= desiredBytes || transactions >= SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_COUNT_MAX)
+			++windowFullBatches;
+
+		if (now() - windowStart >= SERVER_KNOBS->COMMIT_BATCH_CONTROLLER_INTERVAL)
+			update( stats );
+	}
+
+	void update( ProxyStats& stats ) {
+		double target = SERVER_KNOBS->COMMIT_BATCH_LATENCY_TARGET;
+		pipelineP99 = pipelineLatency.percentile( 0.99 );
+
+		double newInterval = SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_MIN;
+		if (windowTransactions > windowBatches) {
+			double amortized = (resolutionLatency.smoothTotal() + loggingLatency.smoothTotal()) * SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_LATENCY_FRACTION;
+			newInterval = std::max(SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_MIN,
+				std::min(SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_MAX, std::min(amortized, target - pipelineP99)));
+		}
+		if (newInterval > interval) ++stats.commitBatchIntervalIncreases;
+		if (newInterval < interval) ++stats.commitBatchIntervalDecreases;
+		interval = newInterval;
+
+		if (pipelineP99 + interval > target) {
+			++stats.commitBatchLatencyTargetMisses;
+			int newBytes = std::max<int>(minBytes, desiredBytes * SERVER_KNOBS->COMMIT_BATCH_CONTROLLER_BYTES_DECREASE);
+			if (newBytes < desiredBytes) {
+				desiredBytes = newBytes;
+				++stats.commitBatchBytesDecreases;
+			}
+		} else if (windowFullBatches * 2 > windowBatches) {
+			int newBytes = std::min<int>(maxBytes, desiredBytes * SERVER_KNOBS->COMMIT_BATCH_CONTROLLER_BYTES_INCREASE);
+			if (newBytes > desiredBytes) {
+				desiredBytes = newBytes;
+				++stats.commitBatchBytesIncreases;
+			}
+		}
+
+		pipelineLatency.clear();
+		windowStart = now();
+		windowBatches = windowTransactions = windowFullBatches = 0;
+	}
+};
+
 ACTOR template <class T>
 Future<Void> forwardValue(Promise<T> out, Future<T> in)
 {
@@ -166,10 +260,15 @@ DESCR struct SingleKeyMutation {
 	int64_t tag3;
 };
 
+// Stages of commitBatch, as recorded in ProxyCommitData::commitStages
+enum { ProxyStageGetCommitVersion, ProxyStageResolution, ProxyStagePostResolution, ProxyStageLogging, ProxyStageReply, ProxyStageTotal };
+
 struct ProxyCommitData {
 	UID dbgid;
 	int64_t commitBatchesMemBytesCount;
 	ProxyStats stats;
+	CommitBatchController batchController;
+	CommitLatencyStages commitStages;
 	MasterInterface master;
 	vector<ResolverInterface> resolvers;
 	LogSystemDiskQueueAdapter* logAdapter;
@@ -224,7 +323,8 @@ struct ProxyCommitData {
 	}
 
 	ProxyCommitData(UID dbgid, MasterInterface master, RequestStream<GetReadVersionRequest> getConsistentReadVersion, Version recoveryTransactionVersion, RequestStream<CommitTransactionRequest> commit, Reference<AsyncVar<ServerDBInfo>> db, bool firstProxy)
-		: dbgid(dbgid), stats(dbgid, &version, &committedVersion, &commitBatchesMemBytesCount), master(master),
+		: dbgid(dbgid), stats(dbgid, &version, &committedVersion, &commitBatchesMemBytesCount),
+			commitStages(dbgid, { "GetCommitVersion", "Resolution", "PostResolution", "Logging", "Reply", "Total" }), master(master),
 			logAdapter(NULL), txnStateStore(NULL),
 			committedVersion(recoveryTransactionVersion), version(0), minKnownCommittedVersion(0),
 			lastVersionTime(0), commitVersionRequestNumber(1), mostRecentProcessedRequestNumber(0),
@@ -232,16 +332,42 @@ struct ProxyCommitData {
 			localCommitBatchesStarted(0), locked(false), firstProxy(firstProxy),
 			cx(openDBOnServer(db, TaskDefaultEndpoint, true, true)), singleKeyMutationEvent(LiteralStringRef("SingleKeyMutation")),
 			commitBatchesMemBytesCount(0)
-	{}
+	{
+		specialCounter(stats.cc, "CommitBatchIntervalMicros", [this](){ return int64_t(1e6 * batchController.interval); });
+		specialCounter(stats.cc, "CommitBatchDesiredBytes", [this](){ return batchController.desiredBytes; });
+		specialCounter(stats.cc, "CommitPipelineP99Micros", [this](){ return int64_t(1e6 * batchController.pipelineP99); });
+		specialCounter(stats.cc, "CommitResolutionMicros", [this](){ return int64_t(1e6 * batchController.resolutionLatency.smoothTotal()); });
+		specialCounter(stats.cc, "CommitLoggingMicros", [this](){ return int64_t(1e6 * batchController.loggingLatency.smoothTotal()); });
+		specialCounter(stats.cc, "CommitReplyMicros", [this](){ return int64_t(1e6 * batchController.replyLatency.smoothTotal()); });
+	}
 };
 
 struct ResolutionRequestBuilder {
-	ProxyCommitData* self;
+	KeyRangeMap<Deque<std::pair<Version,int>>>& keyResolvers;
 	vector<ResolveTransactionBatchRequest> requests;
 	vector<vector<int>> transactionResolverMap;
 	vector<CommitTransactionRef*> outTr;
-
-	ResolutionRequestBuilder( ProxyCommitData* self, Version version, Version prevVersion, Version lastReceivedVersion) : self(self), requests(self->resolvers.size()) {
+	vector<int> touched;  // The resolvers with an outTr for the current transaction
+
+	// addTransaction() gathers the conflict ranges of the whole batch, in transaction order, so that build() can find
+	// their resolvers with one ordered pass over keyResolvers instead of a search of it for each range
+	struct BatchConflictRange {
+		KeyRangeRef range;
+		Version readSnapshot;
+		bool write;
+		int resolversBegin, resolversEnd;  // In rangeResolvers
+	};
+	struct BatchTransaction {
+		CommitTransactionRef* tr;
+		bool isTXNStateTransaction;
+		int conflictRangesEnd;
+	};
+	vector<BatchTransaction> transactions;
+	vector<BatchConflictRange> conflictRanges;
+	vector<int> rangeResolvers;
+
+	ResolutionRequestBuilder( KeyRangeMap<Deque<std::pair<Version,int>>>& keyResolvers, int resolverCount, Version version, Version prevVersion, Version lastReceivedVersion)
+		: keyResolvers(keyResolvers), requests(resolverCount), outTr(resolverCount, NULL) {
 		for(auto& req : requests) {
 			req.prevVersion = prevVersion;
 			req.version = version;
@@ -256,13 +382,12 @@ struct ResolutionRequestBuilder {
 			request.transactions.resize(request.arena, request.transactions.size() + 1);
 			out = &request.transactions.back();
 			out->read_snapshot = read_snapshot;
+			touched.push_back(resolver);
 		}
 		return *out;
 	}
 
 	void addTransaction(CommitTransactionRef& trIn, int transactionNumberInBatch) {
-		// SOMEDAY: There are a couple of unnecessary O( # resolvers ) steps here
-		outTr.assign(requests.size(), NULL);
 		ASSERT( transactionNumberInBatch >= 0 && transactionNumberInBatch < 32768 );
 
 		bool isTXNStateTransaction = false;
@@ -273,53 +398,219 @@ struct ResolutionRequestBuilder {
 			} else if (m.type == MutationRef::SetVersionstampedValue) {
 				transformVersionstampMutation( m, &MutationRef::param2, requests[0].version, transactionNumberInBatch );
 			}
-			if (isMetadataMutation(m)) {
+			if (isMetadataMutation(m))
 				isTXNStateTransaction = true;
-				getOutTransaction(0, trIn.read_snapshot).mutations.push_back(requests[0].arena, m);
-			}
 		}
-		for(auto& r : trIn.read_conflict_ranges) {
-			auto ranges = self->keyResolvers.intersectingRanges( r );
-			std::set<int> resolvers;
-			for(auto &ir : ranges) {
+		for(auto& r : trIn.read_conflict_ranges)
+			conflictRanges.push_back( BatchConflictRange{ r, trIn.read_snapshot, false, 0, 0 } );
+		for(auto& r : trIn.write_conflict_ranges)
+			conflictRanges.push_back( BatchConflictRange{ r, trIn.read_snapshot, true, 0, 0 } );
+		transactions.push_back( BatchTransaction{ &trIn, isTXNStateTransaction, (int)conflictRanges.size() } );
+	}
+
+	// Sets the resolvers of every conflict range in the batch.  A read conflict range goes to every resolver that has
+	// owned any part of it since the transaction's read snapshot, and a write conflict range to the current owners.
+	void assignResolvers() {
+		if (conflictRanges.empty()) return;
+
+		vector<int> order( conflictRanges.size() );
+		for(int i = 0; i < order.size(); i++)
+			order[i] = i;
+		std::sort( order.begin(), order.end(), [this](int a, int b) { return conflictRanges[a].range.begin < conflictRanges[b].range.begin; } );
+
+		vector<int> seen( requests.size(), -1 );
+		auto last = keyResolvers.ranges().end();
+		auto cur = keyResolvers.rangeContaining( conflictRanges[order[0]].range.begin );
+		rangeResolvers.reserve( conflictRanges.size() );
+		for(int c : order) {
+			BatchConflictRange& cr = conflictRanges[c];
+			// The beginnings are sorted, so the range containing each one is at or after the previous one's
+			while (cur != last && cur.end() <= cr.range.begin)
+				++cur;
+
+			cr.resolversBegin = rangeResolvers.size();
+			for(auto ir = cur; ir != last && (ir == cur || ir.begin() < cr.range.end); ++ir) {
 				auto& version_resolver = ir.value();
 				for(int i = version_resolver.size()-1; i >= 0; i--) {
-					resolvers.insert(version_resolver[i].second);
-					if( version_resolver[i].first < trIn.read_snapshot )
+					int resolver = version_resolver[i].second;
+					if (seen[resolver] != c) {
+						seen[resolver] = c;
+						rangeResolvers.push_back(resolver);
+					}
+					if( cr.write || version_resolver[i].first < cr.readSnapshot )
 						break;
 				}
 			}
-			ASSERT(resolvers.size());
-			for(int resolver : resolvers)
-				getOutTransaction( resolver, trIn.read_snapshot ).read_conflict_ranges.push_back( requests[resolver].arena, r );
+			cr.resolversEnd = rangeResolvers.size();
+			std::sort( rangeResolvers.begin() + cr.resolversBegin, rangeResolvers.end() );
 		}
-		for(auto& r : trIn.write_conflict_ranges) {
-			auto ranges = self->keyResolvers.intersectingRanges( r );
-			std::set<int> resolvers;
-			for(auto &ir : ranges)
-				resolvers.insert(ir.value().back().second);
-			ASSERT(resolvers.size());
-			for(int resolver : resolvers)
-				getOutTransaction( resolver, trIn.read_snapshot ).write_conflict_ranges.push_back( requests[resolver].arena, r );
-		}
-		if (isTXNStateTransaction)
-			for (int r = 0; r<requests.size(); r++) {
-				int transactionNumberInRequest = &getOutTransaction(r, trIn.read_snapshot) - requests[r].transactions.begin();
-				requests[r].txnStateTransactions.push_back(requests[r].arena, transactionNumberInRequest);
+	}
+
+	// Builds the requests to the resolvers from the transactions added so far
+	void build() {
+		assignResolvers();
+
+		int c = 0;
+		for(auto& t : transactions) {
+			CommitTransactionRef& trIn = *t.tr;
+			for(int r : touched)
+				outTr[r] = NULL;
+			touched.clear();
+
+			if (t.isTXNStateTransaction) {
+				for (auto & m : trIn.mutations)
+					if (isMetadataMutation(m))
+						getOutTransaction(0, trIn.read_snapshot).mutations.push_back(requests[0].arena, m);
+			}
+			for(; c < t.conflictRangesEnd; c++) {
+				BatchConflictRange& cr = conflictRanges[c];
+				ASSERT(cr.resolversBegin < cr.resolversEnd);
+				for(int i = cr.resolversBegin; i < cr.resolversEnd; i++) {
+					int resolver = rangeResolvers[i];
+					CommitTransactionRef& out = getOutTransaction( resolver, trIn.read_snapshot );
+					if (cr.write)
+						out.write_conflict_ranges.push_back( requests[resolver].arena, cr.range );
+					else
+						out.read_conflict_ranges.push_back( requests[resolver].arena, cr.range );
+				}
 			}
+			if (t.isTXNStateTransaction)
+				for (int r = 0; r<requests.size(); r++) {
+					int transactionNumberInRequest = &getOutTransaction(r, trIn.read_snapshot) - requests[r].transactions.begin();
+					requests[r].txnStateTransactions.push_back(requests[r].arena, transactionNumberInRequest);
+				}
 
-		vector<int> resolversUsed;
-		for (int r = 0; r<outTr.size(); r++)
-			if (outTr[r])
-				resolversUsed.push_back(r);
-		transactionResolverMap.push_back(std::move(resolversUsed));
+			vector<int> resolversUsed = touched;
+			std::sort(resolversUsed.begin(), resolversUsed.end());
+			transactionResolverMap.push_back(std::move(resolversUsed));
+		}
 	}
 };
 
+namespace {
+
+typedef KeyRangeMap<Deque<std::pair<Version,int>>> KeyResolverMap;
+
+// A resolver map of shards ranges of "%08d" keys, each owned by a random resolver, about half of which took it over
+// from another resolver at version 100
+void randomKeyResolvers( KeyResolverMap& keyResolvers, int resolvers, int shards ) {
+	for(int s = 0; s < shards; s++) {
+		Key begin = s ? Key(format("%08d", s * (100000000 / shards))) : Key();
+		Key end = s < shards-1 ? Key(format("%08d", (s+1) * (100000000 / shards))) : allKeys.end;
+		auto rs = keyResolvers.modify( KeyRangeRef(begin, end) );
+		for(auto r = rs.begin(); r != rs.end(); ++r) {
+			r->value() = Deque<std::pair<Version,int>>();
+			r->value().push_back( std::make_pair<Version,int>(0, g_random->randomInt(0, resolvers)) );
+			if (g_random->coinflip())
+				r->value().push_back( std::make_pair<Version,int>(100, g_random->randomInt(0, resolvers)) );
+		}
+	}
+}
+
+KeyRangeRef randomConflictRange( Arena& arena ) {
+	int begin = g_random->randomInt(0, 100000000);
+	int end = begin + (g_random->random01() < 0.9 ? 1 : g_random->randomInt(1, 10000000));
+	return KeyRangeRef( StringRef(arena, format("%08d", begin)), StringRef(arena, format("%08d", end)) );
+}
+
+CommitTransactionRef randomCommitTransaction( Arena& arena, int reads, int writes ) {
+	CommitTransactionRef tr;
+	tr.read_snapshot = g_random->randomInt(50, 150);
+	for(int i = 0; i < reads; i++)
+		tr.read_conflict_ranges.push_back( arena, randomConflictRange(arena) );
+	for(int i = 0; i < writes; i++)
+		tr.write_conflict_ranges.push_back( arena, randomConflictRange(arena) );
+	return tr;
+}
+
+// The resolvers of a conflict range as found by searching keyResolvers for it alone
+std::set<int> resolversOf( KeyResolverMap& keyResolvers, KeyRangeRef range, Version readSnapshot, bool write ) {
+	std::set<int> resolvers;
+	for(auto& ir : keyResolvers.intersectingRanges( range )) {
+		auto& version_resolver = ir.value();
+		for(int i = version_resolver.size()-1; i >= 0; i--) {
+			resolvers.insert(version_resolver[i].second);
+			if( write || version_resolver[i].first < readSnapshot )
+				break;
+		}
+	}
+	return resolvers;
+}
+
+}
+
+TEST_CASE("fdbserver/MasterProxyServer/ResolutionRequestBuilder") {
+	for(int t = 0; t < 20; t++) {
+		int resolvers = g_random->randomInt(1, 8);
+		KeyResolverMap keyResolvers;
+		randomKeyResolvers( keyResolvers, resolvers, g_random->randomInt(1, 100) );
+
+		Arena arena;
+		vector<CommitTransactionRef> trs;
+		for(int i = g_random->randomInt(0, 200); i > 0; i--)
+			trs.push_back( randomCommitTransaction(arena, g_random->randomInt(0, 5), g_random->randomInt(0, 3)) );
+
+		ResolutionRequestBuilder builder( keyResolvers, resolvers, 200, 100, 100 );
+		for(int i = 0; i < trs.size(); i++)
+			builder.addTransaction( trs[i], i );
+		builder.build();
+
+		// Every transaction must reach exactly the resolvers of its conflict ranges, with the ranges in their original order
+		vector<int> nextTransaction( resolvers );
+		ASSERT( builder.transactionResolverMap.size() == trs.size() );
+		for(int i = 0; i < trs.size(); i++) {
+			std::map<int, vector<KeyRangeRef>> reads, writes;
+			for(auto& r : trs[i].read_conflict_ranges)
+				for(int resolver : resolversOf(keyResolvers, r, trs[i].read_snapshot, false))
+					reads[resolver].push_back(r);
+			for(auto& r : trs[i].write_conflict_ranges)
+				for(int resolver : resolversOf(keyResolvers, r, trs[i].read_snapshot, true))
+					writes[resolver].push_back(r);
+
+			std::set<int> expected;
+			for(auto& r : reads) expected.insert(r.first);
+			for(auto& r : writes) expected.insert(r.first);
+			ASSERT( builder.transactionResolverMap[i] == vector<int>(expected.begin(), expected.end()) );
+
+			for(int resolver : expected) {
+				CommitTransactionRef& out = builder.requests[resolver].transactions[ nextTransaction[resolver]++ ];
+				ASSERT( out.read_snapshot == trs[i].read_snapshot );
+				ASSERT( vector<KeyRangeRef>(out.read_conflict_ranges.begin(), out.read_conflict_ranges.end()) == reads[resolver] );
+				ASSERT( vector<KeyRangeRef>(out.write_conflict_ranges.begin(), out.write_conflict_ranges.end()) == writes[resolver] );
+			}
+		}
+		for(int r = 0; r < resolvers; r++)
+			ASSERT( nextTransaction[r] == builder.requests[r].transactions.size() );
+	}
+	return Void();
+}
+
+TEST_CASE("fdbserver/MasterProxyServer/perf/ResolutionRequestBuilder") {
+	// Time to build the resolution requests for a batch, by batch size and number of resolvers
+	for(int resolvers : { 1, 4, 16 }) {
+		KeyResolverMap keyResolvers;
+		randomKeyResolvers( keyResolvers, resolvers, resolvers * 100 );
+		for(int batchSize : { 100, 1000, 10000 }) {
+			Arena arena;
+			vector<CommitTransactionRef> trs;
+			for(int i = 0; i < batchSize; i++)
+				trs.push_back( randomCommitTransaction(arena, 5, 2) );
+
+			double start = timer();
+			ResolutionRequestBuilder builder( keyResolvers, resolvers, 200, 100, 100 );
+			for(int i = 0; i < trs.size(); i++)
+				builder.addTransaction( trs[i], i );
+			builder.build();
+			double elapsed = timer() - start;
+			printf("%d resolvers, %d transactions: %0.3f ms (%0.2f us/transaction)\n", resolvers, batchSize, elapsed * 1e3, elapsed * 1e6 / batchSize);
+		}
+	}
+	return Void();
+}
+
 ACTOR Future<Void> commitBatch(
 	ProxyCommitData* self,
 	vector<CommitTransactionRequest> trs,
-	double *commitBatchTime,
 	int currentBatchMemBytesCount)
 {
 	state int64_t localBatchNumber = ++self->localCommitBatchesStarted;
@@ -375,6 +666,15 @@ ACTOR Future<Void> commitBatch(
 
 	state Version commitVersion = versionReply.version;
 	state Version prevVersion = versionReply.prevVersion;
+	state double gotCommitVersionTime = now();
+
+	if (isCommitTraceSampled(commitVersion)) {
+		// Traced under the ID the tlogs and storage servers derive from the same version
+		if (debugID.present())
+			g_traceBatch.addAttach("CommitAttachID", debugID.get().first(), commitTraceID(commitVersion).first());
+		else
+			debugID = commitTraceID(commitVersion);
+	}
 
 	for(auto it : versionReply.resolverChanges) {
 		auto rs = self->keyResolvers.modify(it.range);
@@ -387,7 +687,7 @@ ACTOR Future<Void> commitBatch(
 	if (debugID.present())
 		g_traceBatch.addEvent("CommitDebug", debugID.get().first(), "MasterProxyServer.commitBatch.GotCommitVersion");
 
-	ResolutionRequestBuilder requests( self, commitVersion, prevVersion, self->version );
+	ResolutionRequestBuilder requests( self->keyResolvers, self->resolvers.size(), commitVersion, prevVersion, self->version );
 	int conflictRangeCount = 0;
 	for (int t = 0; t<trs.size(); t++) {
 		requests.addTransaction(trs[t].transaction, t);
@@ -396,6 +696,7 @@ ACTOR Future<Void> commitBatch(
 		//for(auto& m : trs[t].transaction.mutations)
 		//	TraceEvent("MPTransactionsDump", self->dbgid).detail("Mutation", m.toString());
 	}
+	requests.build();
 	self->stats.conflictRanges += conflictRangeCount;
 
 	for (int r = 1; r<self->resolvers.size(); r++)
@@ -410,12 +711,14 @@ ACTOR Future<Void> commitBatch(
 	}
 
 	state vector<vector<int>> transactionResolverMap = std::move( requests.transactionResolverMap );
+	state double resolutionStart = now();
 
 	ASSERT(self->latestLocalCommitBatchResolving.get() == localBatchNumber-1);
 	self->latestLocalCommitBatchResolving.set(localBatchNumber);
 
 	/////// Phase 2: Resolution (waiting on the network; pipelined)
 	state vector<ResolveTransactionBatchReply> resolution = wait( getAll(replies) );
+	state double resolutionLatency = now() - resolutionStart;
 
 	if (debugID.present())
 		g_traceBatch.addEvent("CommitDebug", debugID.get().first(), "MasterProxyServer.commitBatch.AfterResolution");
@@ -814,6 +1117,7 @@ ACTOR Future<Void> commitBatch(
 		debug_advanceMaxCommittedVersion(UID(), commitVersion);
 
 	Future<Version> loggingComplete = self->logSystem->push( prevVersion, commitVersion, self->committedVersion.get(), self->minKnownCommittedVersion, toCommit, debugID );
+	state double loggingStart = now();
 
 	if (!forceRecovery) {
 		ASSERT(self->latestLocalCommitBatchLogging.get() == localBatchNumber-1);
@@ -835,6 +1139,8 @@ ACTOR Future<Void> commitBatch(
 		}
 		throw;
 	}
+	state double loggingLatency = now() - loggingStart;
+	state double replyStart = now();
 	wait(yield());
 
 	self->logSystem->pop(msg.popTo, txsTag);
@@ -875,6 +1181,7 @@ ACTOR Future<Void> commitBatch(
 			trs[t].reply.sendError(transaction_too_old());
 		else
 			trs[t].reply.sendError(not_committed());
+		self->stats.commitLatency.addMeasurement( now() - t1 );
 	}
 
 	++self->stats.commitBatchOut;
@@ -899,12 +1206,23 @@ ACTOR Future<Void> commitBatch(
 	}
 
 	// Dynamic batching for commits
-	double target_latency = (now() - t1) * SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_LATENCY_FRACTION;
-	*commitBatchTime = 
-		std::max(SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_MIN, 
-			std::min(SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_MAX, 
-				target_latency * SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_SMOOTHER_ALPHA + *commitBatchTime * (1-SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_SMOOTHER_ALPHA)));
+	if (SERVER_KNOBS->COMMIT_BATCH_LATENCY_TARGET > 0) {
+		self->batchController.addBatch( self->stats, trs.size(), currentBatchMemBytesCount, resolutionLatency, loggingLatency, now() - replyStart, now() - t1 );
+	} else {
+		double target_latency = (now() - t1) * SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_LATENCY_FRACTION;
+		self->batchController.interval =
+			std::max(SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_MIN,
+				std::min(SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_MAX,
+					target_latency * SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_SMOOTHER_ALPHA + self->batchController.interval * (1-SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_SMOOTHER_ALPHA)));
+	}
+
 
+	self->commitStages.addSample( ProxyStageGetCommitVersion, gotCommitVersionTime - t1 );
+	self->commitStages.addSample( ProxyStageResolution, resolutionLatency );
+	self->commitStages.addSample( ProxyStagePostResolution, loggingStart - resolutionStart - resolutionLatency );
+	self->commitStages.addSample( ProxyStageLogging, loggingLatency );
+	self->commitStages.addSample( ProxyStageReply, now() - replyStart );
+	self->commitStages.addSample( ProxyStageTotal, now() - t1 );
 
 	self->commitBatchesMemBytesCount -= currentBatchMemBytesCount;
 	ASSERT_ABORT(self->commitBatchesMemBytesCount >= 0);
@@ -1208,7 +1526,6 @@ ACTOR Future<Void> masterProxyServerCore(
 	state double lastCommit = 0;
 	state std::set<Sequence> txnSequences;
 	state Sequence maxSequence = std::numeric_limits<Sequence>::max();
-	state double commitBatchInterval = SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_MIN;
 
 	addActor.send( fetchVersions(&commitData) );
 	addActor.send( waitFailureServer(proxy.waitFailure.getFuture()) );
@@ -1249,7 +1566,8 @@ ACTOR Future<Void> masterProxyServerCore(
 		(int)std::min<double>(SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_BYTES_MAX, 
 			std::max<double>(SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_BYTES_MIN, 
 				SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_BYTES_SCALE_BASE * pow(db->get().client.proxies.size(), SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_BYTES_SCALE_POWER)));
-	commitBatcher = batcher(batchedCommits, proxy.commit.getFuture(), SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_FROM_IDLE, &commitBatchInterval, SERVER_KNOBS->MAX_COMMIT_BATCH_INTERVAL, SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_COUNT_MAX, commitBatchByteLimit, CLIENT_KNOBS->TRANSACTION_SIZE_LIMIT, commitData.commitBatchStartNotifications, &commitData.commitBatchesMemBytesCount, commitBatchesMemoryLimit, TaskProxyCommitBatcher, &commitData.stats.txnCommitIn);
+	commitData.batchController.setInitialBytes(commitBatchByteLimit);
+	commitBatcher = batcher(batchedCommits, proxy.commit.getFuture(), SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_INTERVAL_FROM_IDLE, &commitData.batchController.interval, SERVER_KNOBS->MAX_COMMIT_BATCH_INTERVAL, SERVER_KNOBS->COMMIT_TRANSACTION_BATCH_COUNT_MAX, &commitData.batchController.desiredBytes, CLIENT_KNOBS->TRANSACTION_SIZE_LIMIT, commitData.commitBatchStartNotifications, &commitData.commitBatchesMemBytesCount, commitBatchesMemoryLimit, TaskProxyCommitBatcher, &commitData.stats.txnCommitIn);
 	loop choose{
 		when( wait( dbInfoChange ) ) {
 			dbInfoChange = db->onChange();
@@ -1269,7 +1587,7 @@ ACTOR Future<Void> masterProxyServerCore(
 				lastCommit = now();
 
 				if (trs.size() || lastCommitComplete.isReady()) {
-					lastCommitComplete = commitBatch(&commitData, trs, &commitBatchInterval, batchBytes);
+					lastCommitComplete = commitBatch(&commitData, trs, batchBytes);
 					addActor.send(lastCommitComplete);
 				}
 			}
@@ -957,6 +957,7 @@ namespace oldTLog {
 			reply.popped = poppedVer;
 			reply.end = poppedVer;
 		} else {
+			reply.arena = messages.arena();
 			reply.messages = messages.toStringRef();
 			reply.end = endVersion;
 		}
@@ -29,6 +29,7 @@
 #include "Orderer.actor.h"
 #include "ConflictSet.h"
 #include "StorageMetrics.h"
+#include "CommitLatencyStages.h"
 #include "fdbclient/SystemData.h"
 #include "flow/actorcompiler.h"  // This must be the last #include.
 
@@ -42,9 +43,13 @@ struct ProxyRequestsInfo {
 }
 
 namespace{
+// Stages of resolveBatch, as recorded in Resolver::commitStages
+enum { ResolverStageQueueWait, ResolverStageResolve };
+
 struct Resolver : ReferenceCounted<Resolver> {
 	Resolver( UID dbgid, int proxyCount, int resolverCount )
-		: dbgid(dbgid), proxyCount(proxyCount), resolverCount(resolverCount), version(-1), conflictSet( newConflictSet() ), iopsSample( SERVER_KNOBS->IOPS_UNITS_PER_SAMPLE ), debugMinRecentStateVersion(0)
+		: dbgid(dbgid), proxyCount(proxyCount), resolverCount(resolverCount), version(-1), conflictSet( newConflictSet( SERVER_KNOBS->CONFLICT_SET_PARALLEL_THREADS ) ), iopsSample( SERVER_KNOBS->IOPS_UNITS_PER_SAMPLE ), debugMinRecentStateVersion(0),
+		  commitStages( dbgid, { "QueueWait", "Resolve" } )
 	{
 	}
 	~Resolver() {
@@ -65,6 +70,8 @@ struct Resolver : ReferenceCounted<Resolver> {
 	TransientStorageMetricSample iopsSample;
 
 	Version debugMinRecentStateVersion;
+
+	CommitLatencyStages commitStages;
 };
 }
 
@@ -73,6 +80,7 @@ ACTOR Future<Void> resolveBatch(
 	ResolveTransactionBatchRequest req)
 {
 	state Optional<UID> debugID;
+	state double startTime = now();
 
 	// The first request (prevVersion < 0) comes from the master
 	state NetworkAddress proxyAddress = req.prevVersion >= 0 ? req.reply.getEndpoint().address : NetworkAddress();
@@ -230,6 +238,10 @@ ACTOR Future<Void> resolveBatch(
 			self->checkNeededVersion.trigger();
 		}
 
+		// Waiting out the state memory limit and the batches ahead of this one counts as queueing
+		self->commitStages.addSample( ResolverStageQueueWait, commitTime - startTime );
+		self->commitStages.addSample( ResolverStageResolve, timer() - tstart );  // Nothing waits, so now() would not have moved
+
 		if(req.debugID.present())
 			g_traceBatch.addEvent("CommitDebug", debugID.get().first(), "Resolver.resolveBatch.After");
 	}
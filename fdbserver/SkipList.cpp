@@ -25,11 +25,7 @@
 #include <numeric>
 #include <string>
 
-/*
-#ifdef __GNUG__
-#include <smmintrin.h>
-#endif
-*/
+#include <emmintrin.h>
 
 #include "flow/Platform.h"
 #include "fdbrpc/fdbrpc.h"
@@ -37,10 +33,9 @@
 #include "fdbclient/FDBTypes.h"
 #include "fdbclient/KeyRangeMap.h"
 #include "fdbclient/SystemData.h"
+#include "flow/IThreadPool.h"
 #include "Knobs.h"
 
-#define PARALLEL_THREAD_COUNT 0	// FIXME: When >1, program execution (e.g. random numbers) is/was nondeterministic.  Why?
-
 using std::min;
 using std::max;
 using std::make_pair;
@@ -54,8 +49,6 @@ static inline int skfastrand() {
 	return g_seed;
 }
 
-void setAffinity(int proc);
-
 class SlowConflictSet {
 public:
 	bool is_conflict( const VectorRef<KeyRangeRef>& readRanges, Version read_snapshot );
@@ -98,7 +91,6 @@ PerfDoubleCounter
 	g_checkRead("D.CheckRead", skc),
 	g_checkBatch("D.CheckIntraBatch", skc),
 	g_merge("D.MergeWrite", skc),
-	g_merge_launch("D.Merge.Launch", skc),
 	g_merge_fork("D.Merge.Fork", skc),
 	g_merge_start_var("D.Merge.StartVariance", skc),
 	g_merge_end_var("D.Merge.EndVariance", skc),
@@ -110,6 +102,16 @@ PerfDoubleCounter
 	g_removeBefore("D.RemoveBefore", skc)
 	;
 
+static force_inline int firstSetBit( uint32_t x ) {
+#ifdef _WIN32
+	unsigned long index;
+	_BitScanForward( &index, x );
+	return index;
+#else
+	return __builtin_ctz( x );
+#endif
+}
+
 static force_inline int compare( const StringRef& a, const StringRef& b ) {
 	int c = memcmp( a.begin(), b.begin(), min(a.size(), b.size()) );
 	if (c<0) return -1;
@@ -299,18 +301,44 @@ private:
 		return level;
 	}
 
+	// Keys are compared 16 bytes at a time with SSE2, starting with a fixed width prefix stored in the first
+	// cache line of each node.  The rest of the key is only looked at when the prefixes tie.
+	enum { PrefixLength = 16 };
+
+	// The first PrefixLength bytes of a key, zero padded.  Zero padding preserves the order of keys
+	// whose prefixes differ; keys whose prefixes tie must be compared by length and suffix.
+	struct KeyPrefix {
+		uint8_t bytes[PrefixLength];
+
+		void init( const StringRef& key ) {
+			memset( bytes, 0, PrefixLength );
+			memcpy( bytes, key.begin(), std::min<int>(key.size(), PrefixLength) );
+		}
+
+		// Returns the index of the first byte that differs from other, or -1 if there is none
+		force_inline int mismatch( const KeyPrefix& other ) const {
+			__m128i a = _mm_loadu_si128( (const __m128i*)bytes );
+			__m128i b = _mm_loadu_si128( (const __m128i*)other.bytes );
+			int differ = ~_mm_movemask_epi8( _mm_cmpeq_epi8(a, b) ) & 0xffff;
+			return differ ? firstSetBit(differ) : -1;
+		}
+	};
+
 	/*
 	struct Node {
 		int nPointers, valueLength;
+		KeyPrefix prefix;
 		Node *pointers[nPointers];
 		Version maxVersions[nPointers];
-		char value[valueLength];
+		char suffix[max(valueLength-PrefixLength, 0)];
 	};
 	*/
 
 	struct Node {
 		int level() { return nPointers-1; }
-		uint8_t* value() { return end() + nPointers*(sizeof(Node*)+sizeof(Version)); }
+		const KeyPrefix& prefix() { return keyPrefix; }
+		uint8_t* suffix() { return end() + nPointers*(sizeof(Node*)+sizeof(Version)); }
+		int suffixLength() { return std::max<int>(valueLength - PrefixLength, 0); }
 		int length() { return valueLength; }
 		Node* getNext(int i) { return *((Node**)end() + i); }
 		void setNext(int i, Node* n) { 
@@ -326,7 +354,7 @@ private:
 
 		// Return a node with initialized value but uninitialized pointers
 		static Node* create( const StringRef& value, int level ) {
-			int nodeSize = sizeof(Node) + value.size() + (level+1)*(sizeof(Node*)+sizeof(Version));
+			int nodeSize = sizeof(Node) + std::max<int>(value.size() - PrefixLength, 0) + (level+1)*(sizeof(Node*)+sizeof(Version));
 
 			Node* n;
 			if (nodeSize <= 64) {
@@ -343,10 +371,35 @@ private:
 			n->nPointers = level+1;
 
 			n->valueLength = value.size();
-			memcpy(n->value(), value.begin(), value.size());
+			n->keyPrefix.init( value );
+			memcpy(n->suffix(), value.begin() + PrefixLength, n->suffixLength());
 			return n;
 		}
 
+		// Returns true if this node's key is less than key, whose prefix is keyPrefix
+		force_inline bool lessThan( const StringRef& key, const KeyPrefix& keyPrefix ) {
+			int i = this->keyPrefix.mismatch( keyPrefix );
+			if (i >= 0)
+				return this->keyPrefix.bytes[i] < keyPrefix.bytes[i];
+			if (valueLength <= PrefixLength || key.size() <= PrefixLength)
+				return valueLength < key.size();
+			return less( suffix(), suffixLength(), key.begin() + PrefixLength, key.size() - PrefixLength );
+		}
+
+		bool equals( const StringRef& key ) {
+			return valueLength == key.size() &&
+				!memcmp( keyPrefix.bytes, key.begin(), std::min<int>(valueLength, PrefixLength) ) &&
+				!memcmp( suffix(), key.begin() + PrefixLength, suffixLength() );
+		}
+
+		Key getKey() {
+			Key key = makeString( valueLength );
+			uint8_t* s = mutateString( key );
+			memcpy( s, keyPrefix.bytes, std::min<int>(valueLength, PrefixLength) );
+			memcpy( s + PrefixLength, suffix(), suffixLength() );
+			return key;
+		}
+
 		// pre: level>0, all lower level nodes between this and getNext(level) have correct maxversions
 		void calcVersionForLevel(int level){
 			Node *end = getNext(level);
@@ -370,15 +423,26 @@ private:
 			}
 		}
 	private:
-		int getNodeSize() { return sizeof(Node) + valueLength + nPointers*(sizeof(Node*)+sizeof(Version)); }
+		int getNodeSize() { return sizeof(Node) + suffixLength() + nPointers*(sizeof(Node*)+sizeof(Version)); }
 		uint8_t* end() { return (uint8_t*)(this+1); }
 		int nPointers,
 			valueLength;
+		KeyPrefix keyPrefix;
 	};
 
 	static force_inline bool less( const uint8_t* a, int aLen, const uint8_t* b, int bLen ) {
 		int len = min(aLen, bLen);
-		for(int i=0; i<len; i++)
+		int i = 0;
+		for(; i+16 <= len; i+=16) {
+			__m128i x = _mm_loadu_si128( (const __m128i*)(a+i) );
+			__m128i y = _mm_loadu_si128( (const __m128i*)(b+i) );
+			int differ = ~_mm_movemask_epi8( _mm_cmpeq_epi8(x, y) ) & 0xffff;
+			if (differ) {
+				int j = i + firstSetBit(differ);
+				return a[j] < b[j];
+			}
+		}
+		for(; i<len; i++)
 			if (a[i] < b[i])
 				return true;
 			else if (a[i] > b[i])
@@ -406,17 +470,24 @@ public:
 		Node* x;
 		Node *alreadyChecked;
 		StringRef value;
+		KeyPrefix valuePrefix;
 
 		Finger() : level(MaxLevels), x(NULL), alreadyChecked(NULL) {}
 
 		Finger( Node* header, const StringRef& ptr ) :
-			value(ptr), level(MaxLevels),
+			level(MaxLevels),
 			alreadyChecked(NULL), x(header)
 		{
+			setValue(ptr);
 		}
 
-		void init(const StringRef& value, Node *header){
+		void setValue(const StringRef& value) {
 			this->value = value;
+			valuePrefix.init(value);
+		}
+
+		void init(const StringRef& value, Node *header){
+			setValue(value);
 			x = header;
 			alreadyChecked = NULL;
 			level = MaxLevels;
@@ -439,7 +510,7 @@ public:
 		force_inline bool advance() {
 			Node* next = x->getNext(level-1);
 			
-			if (next == alreadyChecked || !less(next->value(), next->length(), value.begin(), value.size())) {
+			if (next == alreadyChecked || !next->lessThan(value, valuePrefix)) {
 				alreadyChecked = next;
 				level--;
 				finger[level] = x;
@@ -462,15 +533,15 @@ public:
 		force_inline Node* found() const {
 			// valid after finished returns true
 			Node *n = finger[0]->getNext(0);	// or alreadyChecked, but that is more easily invalidated
-			if (n && n->length() == value.size() && !memcmp(n->value(), value.begin(), value.size()))
+			if (n && n->equals(value))
 				return n;
 			else 
 				return NULL;
 		}
 
-		StringRef getValue() const {
+		Key getValue() const {
 			Node* n = finger[0]->getNext(0);
-			return n ? StringRef( n->value(), n->length() ) : StringRef();
+			return n ? n->getKey() : Key();
 		}
 	};
 
@@ -591,10 +662,12 @@ public:
 		// vtune: 11 parts
 		results[0].init( values[0], header );
 		const StringRef& endValue = values[count-1];
+		KeyPrefix endPrefix;
+		endPrefix.init( endValue );
 		while ( results[0].level > 1 ) {
 			results[0].nextLevel();
 			Node* ac = results[0].alreadyChecked;
-			if (ac && less(ac->value(), ac->length(), endValue.begin(), endValue.size()))
+			if (ac && ac->lessThan(endValue, endPrefix))
 				break;
 		}
 
@@ -609,7 +682,7 @@ public:
 			results[i].level = startLevel;
 			results[i].x = x;
 			results[i].alreadyChecked = NULL;
-			results[i].value = values[i];
+			results[i].setValue( values[i] );
 			for(int j=startLevel; j<MaxLevels; j++)
 				results[i].finger[j] = results[0].finger[j];
 		}
@@ -822,7 +895,7 @@ private:
 							return noConflict();
 						s = nextS;
 						if (start.finished()) {
-							if (nextS->length() == start.value.size() && !memcmp(nextS->value(), start.value.begin(), start.value.size()))
+							if (nextS->equals(start.value))
 								return noConflict();
 							else
 								return conflict();
@@ -866,45 +939,32 @@ private:
 	}
 };
 
-struct Action { 
-	virtual void operator()() = 0;		// self-destructs
-};
-typedef Action* PAction;
+// Runs one partition of a ConflictBatch phase on a ConflictSet worker thread.  Work is always posted
+// from and joined by the resolver's network thread, so detectConflicts() stays synchronous.
+class ConflictSetWorker : public IThreadPoolReceiver {
+public:
+	virtual void init() {}
+
+	struct PartitionAction : TypedAction<ConflictSetWorker, PartitionAction> {
+		std::function<void()> work;
+		Event* done;
+		Optional<Error>* error;
 
-template <class F>
-PAction action( F && f ) {
-	struct FAction : Action, F, FastAllocated<FAction> {
-		FAction( F&& f ) : F(std::move(f)) {}
-		virtual void operator()() { F::operator()(); delete this; }
+		PartitionAction( std::function<void()> const& work, Event* done, Optional<Error>* error ) : work(work), done(done), error(error) {}
+		virtual double getTimeEstimate() { return 0; }
 	};
-	return new FAction( std::move(f) );
-};
 
-void workerThread( PAction* nextAction, Event* nextActionReady, int index, Event* whenFinished ) {
-	ASSERT(false);
-	/*
-	inThread<Void>( [nextAction,nextActionReady,index,whenFinished]()->Void {
-		g_seed = index*123; fastrand();
-		setAffinity( index );
-		while (true) {
-			try {
-				nextActionReady->block();   // auto-reset
-				Action* action = *nextAction;
-				*nextAction = 0;
-				if (!action) break;
-
-				(*action)();
-			} catch (Error& e) {
-				fprintf(stderr, "Error in worker thread: %s\n", e.what());
-			} catch (...) {
-				fprintf(stderr, "Error in worker thread: %s\n", unknown_error().what());
-			}
+	void action( PartitionAction& a ) {
+		try {
+			a.work();
+		} catch (Error& e) {
+			*a.error = e;
+		} catch (...) {
+			*a.error = unknown_error();
 		}
-		//cout << "Worker thread finished" << endl;
-		whenFinished->set();
-		return Void();
-	});*/
-}
+		a.done->set();
+	}
+};
 
 StringRef setK( Arena& arena, int i ) {
 	char t[ sizeof(i) ];
@@ -924,36 +984,57 @@ StringRef setK( Arena& arena, int i ) {
 #include "ConflictSet.h"
 
 struct ConflictSet {
-	ConflictSet() : oldestVersion(0) {
-		static_assert(PARALLEL_THREAD_COUNT == 0, "workerThread() not implemented");
-		static_assert(PARALLEL_THREAD_COUNT == 0 || FASTALLOC_THREAD_SAFE, "Thread safe fast allocator required for multithreaded conflict set");
-		for (int i = 0; i < PARALLEL_THREAD_COUNT; i++) {
-			worker_nextAction.push_back( NULL );
-			worker_ready.push_back( new Event );
-			worker_finished.push_back( new Event );
+	explicit ConflictSet( int threadCount ) : oldestVersion(0), threadCount(std::max(threadCount, 1)), minParallelRanges(SERVER_KNOBS->CONFLICT_SET_PARALLEL_MIN_RANGES) {
+		// Simulation has to be deterministic, so there the partitions run one after another on the calling thread
+		if (this->threadCount > 1 && !(g_network && g_network->isSimulated())) {
+			workers = createGenericThreadPool();
+			// The calling thread works on one partition itself
+			for(int t=1; t<this->threadCount; t++)
+				workers->addThread( new ConflictSetWorker );
 		}
-		for(int t=0; t<worker_nextAction.size(); t++)
-			workerThread( &worker_nextAction[t], worker_ready[t], (t)*2, worker_finished[t] );
 	}
-	~ConflictSet() {
-		for(int i=0; i<worker_nextAction.size(); i++) {
-			worker_nextAction[i] = 0;
-			worker_ready[i]->set();
+
+	// True if a phase over rangeCount ranges should be split across the worker threads
+	bool isParallel( int rangeCount ) const {
+		return threadCount > 1 && rangeCount >= minParallelRanges;
+	}
+
+	// Calls work(p) for each p in [0, partitionCount), all but the last on worker threads, and blocks until all
+	// of them are done.  Errors thrown by any partition are rethrown here after every partition has finished.
+	void runPartitions( int partitionCount, std::function<void(int)> const& work ) {
+		ASSERT( partitionCount <= threadCount );
+		if (!workers) {
+			for(int p=0; p<partitionCount; p++)
+				work( p );
+			return;
+		}
+		vector<Event> done( partitionCount-1 );
+		vector<Optional<Error>> errors( partitionCount );
+		for(int p=0; p<partitionCount-1; p++)
+			workers->post( new ConflictSetWorker::PartitionAction( [&work, p]{ work(p); }, &done[p], &errors[p] ) );
+
+		try {
+			work( partitionCount-1 );
+		} catch (Error& e) {
+			errors.back() = e;
 		}
-		// Wait for workers to terminate; otherwise can get crashes at shutdown time
-		for(int i=0; i<worker_finished.size(); i++)
-			worker_finished[i]->block();
+
+		for(int p=0; p<done.size(); p++)
+			done[p].block();
+		for(int p=0; p<errors.size(); p++)
+			if (errors[p].present())
+				throw errors[p].get();
 	}
 
 	SkipList versionHistory;
 	Key removalKey;
 	Version oldestVersion;
-	vector<PAction> worker_nextAction;
-	vector<Event*> worker_ready;
-	vector<Event*> worker_finished;
+	int threadCount;
+	int minParallelRanges;
+	Reference<IThreadPool> workers;
 };
 
-ConflictSet* newConflictSet() { return new ConflictSet; }
+ConflictSet* newConflictSet( int threadCount ) { return new ConflictSet( threadCount ); }
 void clearConflictSet( ConflictSet* cs, Version v ) {
 	SkipList(v).swap( cs->versionHistory );
 }
@@ -1211,22 +1292,25 @@ void ConflictBatch::checkReadConflictRanges() {
 	if (!combinedReadConflictRanges.size()) 
 		return;
 
-	if (PARALLEL_THREAD_COUNT) {
-		Event done[PARALLEL_THREAD_COUNT?PARALLEL_THREAD_COUNT:1];
-		for(int t=0; t<PARALLEL_THREAD_COUNT; t++) {
-			cs->worker_nextAction[t] = action( [&,t] {
-#pragma GCC diagnostic push
-DISABLE_ZERO_DIVISION_FLAG
-				auto begin = &combinedReadConflictRanges[0] + t*combinedReadConflictRanges.size()/PARALLEL_THREAD_COUNT;
-				auto end = &combinedReadConflictRanges[0] + (t+1)*combinedReadConflictRanges.size()/PARALLEL_THREAD_COUNT;
-#pragma GCC diagnostic pop
-				cs->versionHistory.detectConflicts( begin, end-begin, transactionConflictStatus );
-				done[t].set();
-			});
-			cs->worker_ready[t]->set();
-		}
-		for(int i=0; i<PARALLEL_THREAD_COUNT; i++)
-			done[i].block();
+	int rangeCount = combinedReadConflictRanges.size();
+	if (cs->isParallel(rangeCount)) {
+		// versionHistory is only read in this phase, so the read ranges can be split evenly.  Each partition
+		// records conflicts in its own status array so that the threads share no written memory.
+		int partitionCount = cs->threadCount;
+		std::unique_ptr<bool[]> partitionStatus( new bool[ partitionCount*transactionCount ] );
+		memset(partitionStatus.get(), 0, partitionCount*transactionCount*sizeof(bool));
+
+		cs->runPartitions( partitionCount, [this, rangeCount, partitionCount, &partitionStatus](int p) {
+			int begin = int64_t(p)*rangeCount/partitionCount;
+			int end = int64_t(p+1)*rangeCount/partitionCount;
+			cs->versionHistory.detectConflicts( &combinedReadConflictRanges[0] + begin, end-begin, partitionStatus.get() + p*transactionCount );
+		});
+
+		for(int p=0; p<partitionCount; p++) {
+			bool* status = partitionStatus.get() + p*transactionCount;
+			for(int t=0; t<transactionCount; t++)
+				transactionConflictStatus[t] |= status[t];
+		}
 	} else {
 		cs->versionHistory.detectConflicts( &combinedReadConflictRanges[0], combinedReadConflictRanges.size(), transactionConflictStatus );
 	}
@@ -1261,39 +1345,40 @@ void ConflictBatch::mergeWriteConflictRanges(Version now) {
 	if (!combinedWriteConflictRanges.size()) 
 		return;
 
-	if (PARALLEL_THREAD_COUNT) {
-		vector<SkipList> parts;
-		for (int i = 0; i < PARALLEL_THREAD_COUNT; i++)
-			parts.push_back(SkipList());
+	int rangeCount = combinedWriteConflictRanges.size();
+	if (cs->isParallel(rangeCount)) {
+		// Partition the key space at the beginning of evenly spaced write ranges.  A range that starts exactly where
+		// the previous one ends can't be a split point, since the partition to its left would insert an entry at
+		// the split key (see SkipList::partition).
+		vector<int> splitIndices;
+		for(int s=1; s<cs->threadCount; s++) {
+			int i = std::max<int>( int64_t(s)*rangeCount/cs->threadCount, splitIndices.size() ? splitIndices.back()+1 : 1 );
+			while (i < rangeCount && combinedWriteConflictRanges[i-1].second == combinedWriteConflictRanges[i].first)
+				i++;
+			if (i >= rangeCount)
+				break;
+			splitIndices.push_back(i);
+		}
 
-		vector<StringRef> splits( parts.size()-1 );
+		vector<SkipList> parts( splitIndices.size()+1 );
+		vector<StringRef> splits( splitIndices.size() );
 		for(int s=0; s<splits.size(); s++)
-			splits[s] = combinedWriteConflictRanges[ (s+1)*combinedWriteConflictRanges.size()/parts.size() ].first;
+			splits[s] = combinedWriteConflictRanges[ splitIndices[s] ].first;
 
 		cs->versionHistory.partition( splits.size() ? &splits[0] : NULL, splits.size(), &parts[0] );
-		vector<double> tstart(PARALLEL_THREAD_COUNT), tend(PARALLEL_THREAD_COUNT);
-		Event done[PARALLEL_THREAD_COUNT ? PARALLEL_THREAD_COUNT : 1];
+		vector<double> tstart(parts.size()), tend(parts.size());
 		double before = timer();
-		for(int t=0; t<parts.size(); t++) {
-			cs->worker_nextAction[t] = action( [&,t] {
-				tstart[t] = timer();
-				auto begin = combinedWriteConflictRanges.begin() + (t*combinedWriteConflictRanges.size()/parts.size());
-				auto end = combinedWriteConflictRanges.begin() + ((t+1)*combinedWriteConflictRanges.size()/parts.size());
-
-				addConflictRanges(now, begin, end, &parts[t]);
-
-				tend[t] = timer();
-				done[t].set();
-			});
-			cs->worker_ready[t]->set();
-		}
-		double launch = timer();
-		for(int i=0; i<PARALLEL_THREAD_COUNT; i++)
-			done[i].block();
+		cs->runPartitions( parts.size(), [&](int p) {
+			tstart[p] = timer();
+			auto begin = combinedWriteConflictRanges.begin() + (p ? splitIndices[p-1] : 0);
+			auto end = p < splitIndices.size() ? combinedWriteConflictRanges.begin() + splitIndices[p] : combinedWriteConflictRanges.end();
+
+			addConflictRanges(now, begin, end, &parts[p]);
+
+			tend[p] = timer();
+		});
 		double after = timer();
 
-		g_merge_launch += launch-before;
-		//g_merge_start_var += *std::max_element(tstart.begin(), tstart.end()) - before;
 		g_merge_fork += *std::min_element(tstart.begin(), tstart.end()) - before;
 		g_merge_start_var += *std::max_element(tstart.begin(), tstart.end()) - *std::min_element(tstart.begin(), tstart.end());
 		g_merge_end_var += *std::max_element(tend.begin(), tend.end()) - *std::min_element(tend.begin(), tend.end());
@@ -1409,52 +1494,18 @@ void miniConflictSetTest() {
 	printf("miniConflictSetTest complete\n");
 }
 
-void skipListTest() {
-	printf("Skip list test\n");
-
-	//sse4Test();
-
-	//A test case that breaks the old operator<
-	//KeyInfo a( LiteralStringRef("hello"), true, false, true, -1 );
-	//KeyInfo b( LiteralStringRef("hello\0"), false, false, false, 0 );
-
-	miniConflictSetTest();
-
-
-	setAffinity(0);
-	//showNumaStatus();
-
-	double start;
+// Resolves every batch of testData with a ConflictSet using threadCount threads, recording the non-conflicting
+// transactions of each batch.  Each transaction reads one range and writes the next.  Returns the elapsed time.
+static double conflictSetTest( int threadCount, VectorRef< VectorRef<KeyRangeRef> > testData, vector<vector<int>>& nonConflict, int& tcount, int& cranges ) {
+	const int readCount = 1, writeCount = 1;
+	for(int c=0; c<skc.size(); c++)
+		skc[c]->clear();
+	tcount = cranges = 0;
 
-	ConflictSet* cs = newConflictSet();
+	ConflictSet* cs = newConflictSet( threadCount );
+	nonConflict.assign( testData.size(), vector<int>() );
 
-	Arena testDataArena;
-	VectorRef< VectorRef<KeyRangeRef> > testData;
-	testData.resize(testDataArena, 500);
-	vector<vector<uint8_t>> success( testData.size() );
-	vector<vector<uint8_t>> success2( testData.size() );
-	for(int i=0; i<testData.size(); i++) {
-		testData[i].resize(testDataArena, 5000);
-		success[i].assign( testData[i].size(), false );
-		success2[i].assign( testData[i].size(), false );
-		for(int j=0; j<testData[i].size(); j++) {
-			int key = g_random->randomInt(0, 20000000);
-			int key2 = key + 1 + g_random->randomInt(0, 10);
-			testData[i][j] = KeyRangeRef(
-				setK( testDataArena, key ),
-				setK( testDataArena, key2 ) );
-		}
-	}
-	printf("Test data generated (%d)\n", g_random->randomInt(0,100000));
-	printf("  %d threads, %d batches, %d/batch\n", PARALLEL_THREAD_COUNT, testData.size(), testData[0].size());
-
-	printf("Running\n");
-
-	int readCount = 1, writeCount = 1;
-	int cranges = 0, tcount = 0;
-
-	start = timer();
-	vector<vector<int>> nonConflict( testData.size() );
+	double start = timer();
 	for(int i=0; i<testData.size(); i++) {
 		Arena buf;
 		vector<CommitTransactionRef> trs;
@@ -1487,53 +1538,115 @@ void skipListTest() {
 		g_detectConflicts += timer()-t;
 	}
 	double elapsed = timer()-start;
-	printf("New conflict set: %0.3f sec\n", elapsed);
-	printf("                  %0.3f Mtransactions/sec\n", tcount/elapsed/1e6);
-	printf("                  %0.3f Mkeys/sec\n", cranges*2/elapsed/1e6);
-
-	elapsed = g_detectConflicts.getValue();
-	printf("Detect only:      %0.3f sec\n", elapsed);
-	printf("                  %0.3f Mtransactions/sec\n", tcount/elapsed/1e6);
-	printf("                  %0.3f Mkeys/sec\n", cranges*2/elapsed/1e6);
 
-	elapsed = g_checkRead.getValue() + g_merge.getValue();
-	printf("Skiplist only:    %0.3f sec\n", elapsed);
-	printf("                  %0.3f Mtransactions/sec\n", tcount/elapsed/1e6);
-	printf("                  %0.3f Mkeys/sec\n", cranges*2/elapsed/1e6);
+	printf("%d entries in version history\n", cs->versionHistory.count());
+	destroyConflictSet( cs );
+	return elapsed;
+}
 
-	printf("Performance counters:\n");
-	for(int c=0; c<skc.size(); c++) {
-		printf("%20s: %s\n", skc[c]->getMetric().name().c_str(), skc[c]->getMetric().formatted().c_str());
+// Resolves the same batches as conflictSetTest() with SlowConflictSet
+static void slowConflictSetTest( VectorRef< VectorRef<KeyRangeRef> > testData, vector<vector<int>>& nonConflict ) {
+	SlowConflictSet scs;
+	nonConflict.assign( testData.size(), vector<int>() );
+	for(int i=0; i<testData.size(); i++) {
+		for(int j=0; j+2<=testData[i].size(); j+=2) {
+			if (!scs.is_conflict( VectorRef<KeyRangeRef>( &testData[i][j], 1 ), i )) {
+				nonConflict[i].push_back( j/2 );
+				scs.add( VectorRef<KeyRangeRef>( &testData[i][j+1], 1 ), VectorRef<KeyValueRef>(), i + 50 );
+			}
+		}
 	}
+}
 
-	//showNumaStatus();
+static int countMismatches( vector<vector<int>> const& a, vector<vector<int>> const& b ) {
+	int mismatches = 0;
+	for(int i=0; i<a.size(); i++)
+		if (a[i] != b[i])
+			mismatches++;
+	return mismatches;
+}
 
-	printf("%d entries in version history\n", cs->versionHistory.count());
+void skipListTest() {
+	printf("Skip list test\n");
 
-	/*start = timer();
-	vector<vector<int>> nonConflict2( testData.size() );
-	SlowConflictSet scs;
-	Standalone<VectorRef<KeyRangeRef>> ranges;
-	ranges.resize( ranges.arena(), 1 );
+	//sse4Test();
+
+	//A test case that breaks the old operator<
+	//KeyInfo a( LiteralStringRef("hello"), true, false, true, -1 );
+	//KeyInfo b( LiteralStringRef("hello\0"), false, false, false, 0 );
 
+	miniConflictSetTest();
+
+	//showNumaStatus();
+
+	Arena testDataArena;
+	VectorRef< VectorRef<KeyRangeRef> > testData;
+	testData.resize(testDataArena, 500);
 	for(int i=0; i<testData.size(); i++) {
+		testData[i].resize(testDataArena, 5000);
 		for(int j=0; j<testData[i].size(); j++) {
-			ranges[0] = testData[i][j];
-			if (!scs.is_conflict( ranges, i )) {
-				nonConflict2[i].push_back( j );
-				scs.add( ranges, VectorRef<KeyValueRef>(), i + 50 );
-			}
+			int key = g_random->randomInt(0, 20000000);
+			int key2 = key + 1 + g_random->randomInt(0, 10);
+			testData[i][j] = KeyRangeRef(
+				setK( testDataArena, key ),
+				setK( testDataArena, key2 ) );
 		}
 	}
+	printf("Test data generated (%d)\n", g_random->randomInt(0,100000));
+	printf("  %d batches, %d/batch\n", testData.size(), testData[0].size());
+
+	vector<vector<int>> serialNonConflict;
+	const int threadCounts[] = { 1, 2, 4, 8 };
+	for(int threadCount : threadCounts) {
+		printf("Running with %d threads\n", threadCount);
+
+		int tcount, cranges;
+		vector<vector<int>> nonConflict;
+		double elapsed = conflictSetTest( threadCount, testData, nonConflict, tcount, cranges );
+		printf("New conflict set: %0.3f sec\n", elapsed);
+		printf("                  %0.3f Mtransactions/sec\n", tcount/elapsed/1e6);
+		printf("                  %0.3f Mkeys/sec\n", cranges*2/elapsed/1e6);
+
+		elapsed = g_detectConflicts.getValue();
+		printf("Detect only:      %0.3f sec\n", elapsed);
+		printf("                  %0.3f Mtransactions/sec\n", tcount/elapsed/1e6);
+		printf("                  %0.3f Mkeys/sec\n", cranges*2/elapsed/1e6);
+
+		elapsed = g_checkRead.getValue() + g_merge.getValue();
+		printf("Skiplist only:    %0.3f sec\n", elapsed);
+		printf("                  %0.3f Mtransactions/sec\n", tcount/elapsed/1e6);
+		printf("                  %0.3f Mkeys/sec\n", cranges*2/elapsed/1e6);
+		printf("                  %0.1f ns/key\n", elapsed*1e9/(cranges*2));
+
+		printf("Performance counters:\n");
+		for(int c=0; c<skc.size(); c++) {
+			printf("%20s: %s\n", skc[c]->getMetric().name().c_str(), skc[c]->getMetric().formatted().c_str());
+		}
+
+		if (serialNonConflict.empty()) {
+			serialNonConflict = std::move(nonConflict);
+		} else {
+			int mismatches = countMismatches( nonConflict, serialNonConflict );
+			if (mismatches)
+				printf("ERROR: %d batches resolved differently than with 1 thread!\n", mismatches);
+			ASSERT( mismatches == 0 );
+		}
+	}
+
+	//showNumaStatus();
+
+	double start = timer();
+	vector<vector<int>> slowNonConflict;
+	slowConflictSetTest( testData, slowNonConflict );
 	printf("Old conflict set: %0.3f sec\n", timer()-start);
 
 	int aminusb=0, bminusa=0, atotal=0;
 	for(int i=0; i<testData.size(); i++) {
 		vector<bool> a( testData[i].size() ), b( testData[i].size() );
-		for(int j=0; j<nonConflict[i].size(); j++)
-			a[ nonConflict[i][j] ] = true;
-		for(int j=0; j<nonConflict2[i].size(); j++)
-			b[ nonConflict2[i][j] ] = true;
+		for(int j=0; j<serialNonConflict[i].size(); j++)
+			a[ serialNonConflict[i][j] ] = true;
+		for(int j=0; j<slowNonConflict[i].size(); j++)
+			b[ slowNonConflict[i][j] ] = true;
 		for(int j=0; j<a.size(); j++) {
 			if (a[j]) atotal++;
 			if (a[j] && !b[j]) aminusb++;
@@ -1545,7 +1658,5 @@ void skipListTest() {
 		printf("ERROR: %d transactions unnecessarily rejected!\n", bminusa);
 	if (aminusb)
 		printf("ERROR: %d transactions incorrectly accepted!\n", aminusb);
-		*/
-	//for(int i=0; i<testData.size(); i++)
-	//	printf("%d %d %d %d\n", i, nonConflict[i].size(), nonConflict2[i].size()-nonConflict[i].size(), nonConflict[i] != nonConflict2[i]);
+	ASSERT( bminusa == 0 && aminusb == 0 );
 }
@@ -29,6 +29,7 @@
 #include "CoordinationInterface.h"
 #include "DataDistribution.h"
 #include "flow/UnitTest.h"
+#include "flow/LatencyHistogram.h"
 #include "QuietDatabase.h"
 #include "RecoveryState.h"
 #include "fdbclient/JsonBuilder.h"
@@ -181,6 +182,8 @@ class StatusCounter {
 			return *this;
 		}
 
+		double getHz() const { return _hz; }
+
 		JsonBuilderObject getStatus() const {
 			JsonBuilderObject statusObject;
 			statusObject["hz"] = _hz;
@@ -392,6 +395,16 @@ struct MachineMemoryInfo {
 	void invalidate() { memoryUsage = -1; }
 };
 
+// The latencies of a LatencyCounter over the last interval, as logged with its role's metrics
+static JsonBuilderObject getLatencyStatistics(TraceEventFields const& metrics, std::string const& name) {
+	JsonBuilderObject obj;
+	obj.setKeyRawNumber("count", metrics.getValue(name + "Count"));
+	obj.setKeyRawNumber("p50_seconds", metrics.getValue(name + "P50"));
+	obj.setKeyRawNumber("p99_seconds", metrics.getValue(name + "P99"));
+	obj.setKeyRawNumber("p999_seconds", metrics.getValue(name + "P999"));
+	return obj;
+}
+
 struct RolesInfo {
 	std::multimap<NetworkAddress, JsonBuilderObject> roles;
 	JsonBuilderObject& addRole( NetworkAddress address, std::string const& role, UID id) {
@@ -436,6 +449,35 @@ struct RolesInfo {
 
 			obj["data_lag"] = dataLag;
 
+			std::string fetchesLogged;
+			if (metrics.tryGetValue("FetchesLogged", fetchesLogged)) {
+				JsonBuilderArray fetches;
+				for (int i = 0; i < parseInt(fetchesLogged); i++) {
+					std::string prefix = format("Fetch%d", i);
+					JsonBuilderObject fetch;
+					fetch["begin"] = metrics.getValue(prefix + "Begin");
+					fetch["end"] = metrics.getValue(prefix + "End");
+					fetch.setKeyRawNumber("fetched_bytes", metrics.getValue(prefix + "Bytes"));
+					fetch.setKeyRawNumber("elapsed_seconds", metrics.getValue(prefix + "Seconds"));
+					fetch.setKeyRawNumber("bytes_per_second", metrics.getValue(prefix + "Rate"));
+					fetches.push_back(fetch);
+				}
+				obj["fetching_shards"] = fetches;
+				obj.setKeyRawNumber("fetches_active", metrics.getValue("FetchesActive"));
+			}
+
+			StatusCounter readCacheHits(metrics.getValue("ReadCacheHits"));
+			StatusCounter readCacheMisses(metrics.getValue("ReadCacheMisses"));
+			double readCacheHz = readCacheHits.getHz() + readCacheMisses.getHz();
+			JsonBuilderObject readCache;
+			readCache["hits"] = readCacheHits.getStatus();
+			readCache["misses"] = readCacheMisses.getStatus();
+			readCache["hit_rate"] = readCacheHz > 0 ? readCacheHits.getHz() / readCacheHz : 0.0;
+			readCache.setKeyRawNumber("bytes", metrics.getValue("ReadCacheBytes"));
+			obj["read_cache"] = readCache;
+
+			obj["read_latency_statistics"] = getLatencyStatistics(metrics, "ReadLatency");
+
 		} catch (Error& e) {
 			if(e.code() != error_code_attribute_not_found)
 				throw e;
@@ -462,6 +504,7 @@ struct RolesInfo {
 			obj["durable_bytes"] = StatusCounter(metrics.getValue("BytesDurable")).getStatus();
 			metricVersion = parseInt64(metrics.getValue("Version"));
 			obj["data_version"] = metricVersion;
+			obj["peek_latency_statistics"] = getLatencyStatistics(metrics, "PeekLatency");
 		} catch (Error& e) {
 			if(e.code() != error_code_attribute_not_found)
 				throw e;
@@ -1220,8 +1263,18 @@ static Future<vector<std::pair<iface, TraceEventFields>>> getServerMetrics(vecto
 }
 
 ACTOR static Future<vector<std::pair<StorageServerInterface, TraceEventFields>>> getStorageServersAndMetrics(Database cx, std::unordered_map<NetworkAddress, WorkerInterface> address_workers) {
-	vector<StorageServerInterface> servers = wait(timeoutError(getStorageServers(cx, true), 5.0));
-	vector<std::pair<StorageServerInterface, TraceEventFields>> results = wait(getServerMetrics(servers, address_workers, "/StorageMetrics"));
+	state vector<StorageServerInterface> servers = wait(timeoutError(getStorageServers(cx, true), 5.0));
+	state Future<vector<std::pair<StorageServerInterface, TraceEventFields>>> fetches = getServerMetrics(servers, address_workers, "/FetchKeysProgress");
+	state vector<std::pair<StorageServerInterface, TraceEventFields>> results = wait(getServerMetrics(servers, address_workers, "/StorageMetrics"));
+	wait(success(fetches));
+
+	// Add the progress of each server's fetchKeys to its metrics
+	for (int i = 0; i < results.size(); i++) {
+		for (auto& field : fetches.get()[i].second) {
+			if (StringRef(field.first).startsWith(LiteralStringRef("Fetch")))
+				results[i].second.addField(field.first, field.second);
+		}
+	}
 	return results;
 }
 
@@ -1231,6 +1284,82 @@ ACTOR static Future<vector<std::pair<TLogInterface, TraceEventFields>>> getTLogs
 	return results;
 }
 
+// Merges the CommitLatencyStages events of every instance of a role by merging the histogram of each stage
+static JsonBuilderObject commitLatencyStagesForRole(std::vector<TraceEventFields> const& events) {
+	std::map<std::string, LatencyHistogram> stages;
+	for(auto& event : events) {
+		try {
+			for(auto& field : event) {
+				if(!StringRef(field.first).endsWith(LiteralStringRef("Histogram")))
+					continue;
+				std::string stage = field.first.substr(0, field.first.size() - 9);
+				stages[stage].merge(LatencyHistogram::fromTraceString(field.second));
+			}
+		} catch (Error& e) {
+			if(e.code() != error_code_attribute_not_found)
+				throw e;
+		}
+	}
+
+	JsonBuilderObject obj;
+	for(auto& s : stages) {
+		// GetCommitVersion -> get_commit_version
+		std::string name;
+		for(char c : s.first) {
+			if(isupper(c)) {
+				if(!name.empty()) name += '_';
+				name += tolower(c);
+			} else {
+				name += c;
+			}
+		}
+		JsonBuilderObject stage;
+		stage["count"] = (int64_t)s.second.count();
+		stage["median_seconds"] = s.second.median();
+		stage["p99_seconds"] = s.second.percentile(0.99);
+		stage["max_seconds"] = s.second.max();
+		obj[name] = stage;
+	}
+	return obj;
+}
+
+ACTOR template <class iface>
+static Future<std::vector<TraceEventFields>> getCommitLatencyStages(vector<iface> servers, std::unordered_map<NetworkAddress, WorkerInterface> address_workers) {
+	vector<std::pair<iface, TraceEventFields>> results = wait(getServerMetrics(servers, address_workers, "/CommitLatencyStages"));
+	std::vector<TraceEventFields> events;
+	for(auto& r : results)
+		events.push_back(r.second);
+	return events;
+}
+
+// Latency of each stage of the commit path, from the proxy to the storage servers, over the last COMMIT_LATENCY_STAGES_INTERVAL
+ACTOR static Future<JsonBuilderObject> commitLatencyStagesFetcher(Reference<AsyncVar<struct ServerDBInfo>> db, std::unordered_map<NetworkAddress, WorkerInterface> address_workers,
+	vector<std::pair<StorageServerInterface, TraceEventFields>> storageServers, std::set<std::string> *incomplete_reasons)
+{
+	state JsonBuilderObject statusObj;
+	try {
+		vector<StorageServerInterface> storageInterfaces;
+		for(auto& ss : storageServers)
+			storageInterfaces.push_back(ss.first);
+
+		state Future<std::vector<TraceEventFields>> proxies = getCommitLatencyStages(db->get().client.proxies, address_workers);
+		state Future<std::vector<TraceEventFields>> resolvers = getCommitLatencyStages(db->get().resolvers, address_workers);
+		state Future<std::vector<TraceEventFields>> logs = getCommitLatencyStages(db->get().logSystemConfig.allPresentLogs(), address_workers);
+		state Future<std::vector<TraceEventFields>> storage = getCommitLatencyStages(storageInterfaces, address_workers);
+		wait(timeoutError(success(proxies) && success(resolvers) && success(logs) && success(storage), 2.0));
+
+		statusObj["proxy"] = commitLatencyStagesForRole(proxies.get());
+		statusObj["resolver"] = commitLatencyStagesForRole(resolvers.get());
+		statusObj["log"] = commitLatencyStagesForRole(logs.get());
+		statusObj["storage"] = commitLatencyStagesForRole(storage.get());
+	} catch (Error& e) {
+		if(e.code() == error_code_actor_cancelled)
+			throw;
+		incomplete_reasons->insert("Unable to retrieve commit latency stages.");
+	}
+	return statusObj;
+}
+
 static int getExtraTLogEligibleMachines(vector<std::pair<WorkerInterface, ProcessClass>> workers, DatabaseConfiguration configuration) {
 	std::set<StringRef> allMachines;
 	std::map<Key,std::set<StringRef>> dcId_machine;
@@ -1313,6 +1442,22 @@ ACTOR static Future<JsonBuilderObject> workloadStatusFetcher(Reference<AsyncVar<
 		transactions["committed"] = txnCommitOutSuccess.getStatus();
 
 		statusObj["transactions"] = transactions;
+
+		// The latency of every commit on any proxy, from the merged histograms of the proxies
+		try {
+			LatencyHistogram latency;
+			for (auto &ps : proxyStats)
+				latency.merge(LatencyHistogram::fromTraceString(ps.getValue("CommitLatencyHistogram")));
+			JsonBuilderObject commitLatency;
+			commitLatency["count"] = (int64_t)latency.count();
+			commitLatency["p50_seconds"] = latency.percentile(0.5);
+			commitLatency["p99_seconds"] = latency.percentile(0.99);
+			commitLatency["p999_seconds"] = latency.percentile(0.999);
+			statusObj["commit_latency_statistics"] = commitLatency;
+		} catch (Error& e) {
+			if (e.code() != error_code_attribute_not_found)
+				throw e;
+		}
 	}
 	catch (Error& e) {
 		if (e.code() == error_code_actor_cancelled)
@@ -1868,6 +2013,10 @@ ACTOR Future<StatusReply> clusterGetStatus(
 			}
 			else
 				messages.push_back(JsonBuilder::makeMessage("log_servers_error", "Timed out trying to retrieve log servers."));
+
+			JsonBuilderObject commitLatencyStages = wait(commitLatencyStagesFetcher(db, address_workers, storageServers, &status_incomplete_reasons));
+			if (!commitLatencyStages.empty())
+				statusObj["commit_latency_stages"] = commitLatencyStages;
 		}
 		else {
 			// Set layers status to { _valid: false, error: "configurationMissing"}
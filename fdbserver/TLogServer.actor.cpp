@@ -37,6 +37,7 @@
 #include "LogSystem.h"
 #include "WaitFailure.h"
 #include "RecoveryState.h"
+#include "CommitLatencyStages.h"
 #include "flow/actorcompiler.h"  // This must be the last #include.
 
 using std::pair;
@@ -121,6 +122,7 @@ public:
 	void push( T const& qe, Reference<LogData> logData );
 	void pop( Version upTo, Reference<LogData> logData );
 	Future<Void> commit() { return queue->commit(); }
+	Future<Standalone<StringRef>> read( IDiskQueue::location from, IDiskQueue::location to ) { return queue->read( from, to ); }
 
 	// Implements IClosable
 	virtual Future<Void> getError() { return queue->getError(); }
@@ -132,13 +134,15 @@ private:
 	IDiskQueue* queue;
 	UID dbgid;
 
-	void updateVersionSizes( const TLogQueueEntry& result, TLogData* tLog );
+	void updateVersionSizes( const TLogQueueEntry& result, TLogData* tLog, IDiskQueue::location start, IDiskQueue::location end );
 
 	ACTOR static Future<TLogQueueEntry> readNext( TLogQueue* self, TLogData* tLog ) {
 		state TLogQueueEntry result;
 		state int zeroFillSize = 0;
 
 		loop {
+			// Before the first read this is not yet known, and is before the first unpopped byte
+			state IDiskQueue::location start = self->queue->getNextReadLocation();
 			Standalone<StringRef> h = wait( self->queue->readNext( sizeof(uint32_t) ) );
 			if (h.size() != sizeof(uint32_t)) {
 				if (h.size()) {
@@ -165,7 +169,7 @@ private:
 				Arena a = e.arena();
 				ArenaReader ar( a, e.substr(0, payloadSize), IncludeVersion() );
 				ar >> result;
-				self->updateVersionSizes(result, tLog);
+				self->updateVersionSizes(result, tLog, start, self->queue->getNextReadLocation());
 				return result;
 			}
 		}
@@ -182,8 +186,11 @@ private:
 
 // Immutable keys
 static const KeyValueRef persistFormat( LiteralStringRef( "Format" ), LiteralStringRef("FoundationDB/LogServer/2/4") );
-static const KeyRangeRef persistFormatReadableRange( LiteralStringRef("FoundationDB/LogServer/2/3"), LiteralStringRef("FoundationDB/LogServer/2/5") );
+// Written instead once any generation spills by reference, since versions which only read 2/4 would lose its spilled messages
+static const KeyValueRef persistSpillByReferenceFormat( LiteralStringRef( "Format" ), LiteralStringRef("FoundationDB/LogServer/2/5") );
+static const KeyRangeRef persistFormatReadableRange( LiteralStringRef("FoundationDB/LogServer/2/3"), LiteralStringRef("FoundationDB/LogServer/2/6") );
 static const KeyRangeRef persistRecoveryCountKeys = KeyRangeRef( LiteralStringRef( "DbRecoveryCount/" ), LiteralStringRef( "DbRecoveryCount0" ) );
+static const KeyRangeRef persistSpillByReferenceKeys = KeyRangeRef( LiteralStringRef( "SpillByReference/" ), LiteralStringRef( "SpillByReference0" ) );
 
 // Updated on updatePersistentData()
 static const KeyRangeRef persistCurrentVersionKeys = KeyRangeRef( LiteralStringRef( "version/" ), LiteralStringRef( "version0" ) );
@@ -192,6 +199,7 @@ static const KeyRangeRef persistLocalityKeys = KeyRangeRef( LiteralStringRef( "L
 static const KeyRangeRef persistLogRouterTagsKeys = KeyRangeRef( LiteralStringRef( "LogRouterTags/" ), LiteralStringRef( "LogRouterTags0" ) );
 static const KeyRange persistTagMessagesKeys = prefixRange(LiteralStringRef("TagMsg/"));
 static const KeyRange persistTagPoppedKeys = prefixRange(LiteralStringRef("TagPop/"));
+static const KeyRange persistTagMessageRefsKeys = prefixRange(LiteralStringRef("TagMsgRef/"));
 
 static Key persistTagMessagesKey( UID id, Tag tag, Version version ) {
 	BinaryWriter wr( Unversioned() );
@@ -202,6 +210,15 @@ static Key persistTagMessagesKey( UID id, Tag tag, Version version ) {
 	return wr.toStringRef();
 }
 
+static Key persistTagMessageRefsKey( UID id, Tag tag, Version version ) {
+	BinaryWriter wr( Unversioned() );
+	wr.serializeBytes(persistTagMessageRefsKeys.begin);
+	wr << id;
+	wr << tag;
+	wr << bigEndian64( version );
+	return wr.toStringRef();
+}
+
 static Key persistTagPoppedKey( UID id, Tag tag ) {
 	BinaryWriter wr(Unversioned());
 	wr.serializeBytes( persistTagPoppedKeys.begin );
@@ -233,6 +250,23 @@ static Version decodeTagMessagesKey( StringRef key ) {
 	return bigEndian64( BinaryReader::fromStringRef<Version>( stripTagMessagesKey(key), Unversioned() ) );
 }
 
+// When a log generation spills by reference, each of a tag's persistTagMessageRefsKeys holds these for a batch of versions, and is keyed
+// by the last version in the batch.  The messages themselves stay in the disk queue until the tag is popped past them.
+struct SpilledData {
+	Version version;
+	IDiskQueue::location start, end;  // Of the version's entry in the disk queue, which holds the messages of all tags
+	uint32_t mutationBytes;  // Of the tag's messages in the entry
+
+	SpilledData() : version(invalidVersion), mutationBytes(0) {}
+	SpilledData( Version version, IDiskQueue::location start, IDiskQueue::location end, uint32_t mutationBytes )
+		: version(version), start(start), end(end), mutationBytes(mutationBytes) {}
+
+	template <class Ar>
+	void serialize(Ar& ar) {
+		ar & version & start & end & mutationBytes;
+	}
+};
+
 struct TLogData : NonCopyable {
 	AsyncTrigger newLogData;
 	Deque<UID> queueOrder;
@@ -273,34 +307,40 @@ struct TLogData : NonCopyable {
 	PromiseStream<Future<Void>> sharedActors;
 	Promise<Void> terminated;
 	FlowLock concurrentLogRouterReads;
+	bool spillByReferenceFormat;  // persistentData has, or will have once committed, persistSpillByReferenceFormat
 
 	TLogData(UID dbgid, IKeyValueStore* persistentData, IDiskQueue * persistentQueue, Reference<AsyncVar<ServerDBInfo>> const& dbInfo)
 			: dbgid(dbgid), instanceID(g_random->randomUniqueID().first()),
 			  persistentData(persistentData), rawPersistentQueue(persistentQueue), persistentQueue(new TLogQueue(persistentQueue, dbgid)),
 			  dbInfo(dbInfo), queueCommitBegin(0), queueCommitEnd(0), prevVersion(0),
 			  diskQueueCommitBytes(0), largeDiskQueueCommitBytes(false), bytesInput(0), bytesDurable(0), overheadBytesInput(0), overheadBytesDurable(0),
-			  updatePersist(Void()), concurrentLogRouterReads(SERVER_KNOBS->CONCURRENT_LOG_ROUTER_READS)
+			  updatePersist(Void()), concurrentLogRouterReads(SERVER_KNOBS->CONCURRENT_LOG_ROUTER_READS), spillByReferenceFormat(false)
 		{
 		}
 };
 
+// Stages of tLogCommit, as recorded in LogData::commitStages
+enum { TLogStageWaitForVersion, TLogStageDurable, TLogStageTotal };
+
 struct LogData : NonCopyable, public ReferenceCounted<LogData> {
 	struct TagData : NonCopyable, public ReferenceCounted<TagData> {
 		std::deque<std::pair<Version, LengthPrefixedStringRef>> versionMessages;
 		bool nothingPersistent;				// true means tag is *known* to have no messages in persistentData.  false means nothing.
 		bool poppedRecently;					// `popped` has changed since last updatePersistentData
 		Version popped;				// see popped version tracking contract below
+		Version persistentPopped;		// `popped` as last written to persistentData by updatePersistentPopped
 		bool unpoppedRecovered;
 		Tag tag;
 
-		TagData( Tag tag, Version popped, bool nothingPersistent, bool poppedRecently, bool unpoppedRecovered ) : tag(tag), nothingPersistent(nothingPersistent), popped(popped), poppedRecently(poppedRecently), unpoppedRecovered(unpoppedRecovered) {}
+		TagData( Tag tag, Version popped, bool nothingPersistent, bool poppedRecently, bool unpoppedRecovered ) : tag(tag), nothingPersistent(nothingPersistent), popped(popped), persistentPopped(popped), poppedRecently(poppedRecently), unpoppedRecovered(unpoppedRecovered) {}
 
-		TagData(TagData&& r) noexcept(true) : versionMessages(std::move(r.versionMessages)), nothingPersistent(r.nothingPersistent), poppedRecently(r.poppedRecently), popped(r.popped), tag(r.tag), unpoppedRecovered(r.unpoppedRecovered) {}
+		TagData(TagData&& r) noexcept(true) : versionMessages(std::move(r.versionMessages)), nothingPersistent(r.nothingPersistent), poppedRecently(r.poppedRecently), popped(r.popped), persistentPopped(r.persistentPopped), tag(r.tag), unpoppedRecovered(r.unpoppedRecovered) {}
 		void operator= (TagData&& r) noexcept(true) {
 			versionMessages = std::move(r.versionMessages);
 			nothingPersistent = r.nothingPersistent;
 			poppedRecently = r.poppedRecently;
 			popped = r.popped;
+			persistentPopped = r.persistentPopped;
 			tag = r.tag;
 			unpoppedRecovered = r.unpoppedRecovered;
 		}
@@ -340,7 +380,7 @@ struct LogData : NonCopyable, public ReferenceCounted<LogData> {
 		}
 	};
 
-	Map<Version, IDiskQueue::location> versionLocation;  // For the version of each entry that was push()ed, the end location of the serialized bytes
+	Map<Version, std::pair<IDiskQueue::location, IDiskQueue::location>> versionLocation;  // For the version of each entry that was push()ed, the start and end locations of the serialized bytes
 
 	/*
 	Popped version tracking contract needed by log system to implement ILogCursor::popped():
@@ -360,6 +400,7 @@ struct LogData : NonCopyable, public ReferenceCounted<LogData> {
 	AsyncTrigger stopCommit;
 	bool stopped, initialized;
 	DBRecoveryCount recoveryCount;
+	bool spillByReference;  // Spill SpilledData references to persistentData and leave the messages in the queue, rather than spilling the messages
 
 	VersionMetricHandle persistentDataVersion, persistentDataDurableVersion;  // The last version number in the portion of the log (written|durable) to persistentData
 	NotifiedVersion version, queueCommittedVersion;
@@ -392,11 +433,28 @@ struct LogData : NonCopyable, public ReferenceCounted<LogData> {
 		return newTagData;
 	}
 
+	// When spilling by reference, the first version whose queue entry a tag's spilled references may still point to.  Spilled references
+	// are cleared as tags are durably popped, so the entries before this version are no longer needed.
+	Version firstReferencedVersion() {
+		Version first = std::numeric_limits<Version>::max();
+		if(!spillByReference) return first;
+		for(auto& tags : tag_data) {
+			for(auto& tagData : tags) {
+				if(tagData && !tagData->nothingPersistent) {
+					first = std::min(first, tagData->persistentPopped);
+				}
+			}
+		}
+		return first;
+	}
+
 	Map<Version, std::pair<int,int>> version_sizes;
 
 	CounterCollection cc;
 	Counter bytesInput;
 	Counter bytesDurable;
+	LatencyCounter peekLatency;  // Of peeks, from when the tlog has the versions asked for to the reply
+	CommitLatencyStages commitStages;
 
 	UID logId;
 	Version newPersistentDataVersion;
@@ -417,10 +475,11 @@ struct LogData : NonCopyable, public ReferenceCounted<LogData> {
 	Future<Void> terminated;
 
 	explicit LogData(TLogData* tLogData, TLogInterface interf, Tag remoteTag, bool isPrimary, int logRouterTags, UID recruitmentID, std::vector<Tag> tags) : tLogData(tLogData), knownCommittedVersion(1), logId(interf.id()),
-			cc("TLog", interf.id().toString()), bytesInput("BytesInput", cc), bytesDurable("BytesDurable", cc), remoteTag(remoteTag), isPrimary(isPrimary), logRouterTags(logRouterTags), recruitmentID(recruitmentID),
+			cc("TLog", interf.id().toString()), bytesInput("BytesInput", cc), bytesDurable("BytesDurable", cc), peekLatency("PeekLatency", cc),
+			commitStages(interf.id(), { "WaitForVersion", "Durable", "Total" }), remoteTag(remoteTag), isPrimary(isPrimary), logRouterTags(logRouterTags), recruitmentID(recruitmentID),
 			logSystem(new AsyncVar<Reference<ILogSystem>>()), logRouterPoppedVersion(0), durableKnownCommittedVersion(0), minKnownCommittedVersion(0), allTags(tags.begin(), tags.end()), terminated(tLogData->terminated.getFuture()),
 			// These are initialized differently on init() or recovery
-			recoveryCount(), stopped(false), initialized(false), queueCommittingVersion(0), newPersistentDataVersion(invalidVersion), unrecoveredBefore(1), recoveredAt(1), unpoppedRecoveredTags(0),
+			recoveryCount(), stopped(false), initialized(false), spillByReference(SERVER_KNOBS->TLOG_SPILL_REFERENCE != 0), queueCommittingVersion(0), newPersistentDataVersion(invalidVersion), unrecoveredBefore(1), recoveredAt(1), unpoppedRecoveredTags(0),
 			logRouterPopToVersion(0), locality(tagLocalityInvalid)
 	{
 		startRole(Role::TRANSACTION_LOG, interf.id(), UID());
@@ -460,8 +519,11 @@ struct LogData : NonCopyable, public ReferenceCounted<LogData> {
 			tLogData->persistentData->clear( singleKeyRange(logIdKey.withPrefix(persistLocalityKeys.begin)) );
 			tLogData->persistentData->clear( singleKeyRange(logIdKey.withPrefix(persistLogRouterTagsKeys.begin)) );
 			tLogData->persistentData->clear( singleKeyRange(logIdKey.withPrefix(persistRecoveryCountKeys.begin)) );
+			tLogData->persistentData->clear( singleKeyRange(logIdKey.withPrefix(persistSpillByReferenceKeys.begin)) );
 			Key msgKey = logIdKey.withPrefix(persistTagMessagesKeys.begin);
 			tLogData->persistentData->clear( KeyRangeRef( msgKey, strinc(msgKey) ) );
+			Key msgRefKey = logIdKey.withPrefix(persistTagMessageRefsKeys.begin);
+			tLogData->persistentData->clear( KeyRangeRef( msgRefKey, strinc(msgRefKey) ) );
 			Key poppedKey = logIdKey.withPrefix(persistTagPoppedKeys.begin);
 			tLogData->persistentData->clear( KeyRangeRef( poppedKey, strinc(poppedKey) ) );
 		}
@@ -478,12 +540,15 @@ void TLogQueue::push( T const& qe, Reference<LogData> logData ) {
 	wr << qe;
 	wr << uint8_t(1);
 	*(uint32_t*)wr.getData() = wr.getLength() - sizeof(uint32_t) - sizeof(uint8_t);
-	auto loc = queue->push( wr.toStringRef() );
-	//TraceEvent("TLogQueueVersionWritten", dbgid).detail("Size", wr.getLength() - sizeof(uint32_t) - sizeof(uint8_t)).detail("Loc", loc);
-	logData->versionLocation[qe.version] = loc;
+	auto startloc = queue->getNextPushLocation();
+	auto endloc = queue->push( wr.toStringRef() );
+	//TraceEvent("TLogQueueVersionWritten", dbgid).detail("Size", wr.getLength() - sizeof(uint32_t) - sizeof(uint8_t)).detail("Loc", endloc);
+	logData->versionLocation[qe.version] = std::make_pair(startloc, endloc);
 }
 void TLogQueue::pop( Version upTo, Reference<LogData> logData ) {
-	// Keep only the given and all subsequent version numbers
+	// Keep only the given and all subsequent version numbers, and the entries that spilled references point to
+	upTo = std::min( upTo, logData->firstReferencedVersion() );
+
 	// Find the first version >= upTo
 	auto v = logData->versionLocation.lower_bound(upTo);
 	if (v == logData->versionLocation.begin()) return;
@@ -495,13 +560,24 @@ void TLogQueue::pop( Version upTo, Reference<LogData> logData ) {
 		v.decrementNonEnd();
 	}
 
-	queue->pop( v->value );
+	// Other generations sharing the queue may also have spilled references into it
+	IDiskQueue::location loc = v->value.second;
+	for(auto& it : logData->tLogData->id_data) {
+		if(it.second == logData) continue;
+		auto referenced = it.second->versionLocation.lower_bound( it.second->firstReferencedVersion() );
+		if(referenced != it.second->versionLocation.end() && referenced->value.first < loc) {
+			TEST(true);  // TLog queue pop held back by another generation's spilled references
+			loc = referenced->value.first;
+		}
+	}
+
+	queue->pop( loc );
 	logData->versionLocation.erase( logData->versionLocation.begin(), v );  // ... and then we erase that previous version and all prior versions
 }
-void TLogQueue::updateVersionSizes( const TLogQueueEntry& result, TLogData* tLog ) {
+void TLogQueue::updateVersionSizes( const TLogQueueEntry& result, TLogData* tLog, IDiskQueue::location start, IDiskQueue::location end ) {
 	auto it = tLog->id_data.find(result.id);
 	if(it != tLog->id_data.end()) {
-		it->second->versionLocation[result.version] = queue->getNextReadLocation();
+		it->second->versionLocation[result.version] = std::make_pair(start, end);
 	}
 }
 
@@ -538,12 +614,20 @@ void updatePersistentPopped( TLogData* self, Reference<LogData> logData, Referen
 	if (!data->poppedRecently) return;
 	self->persistentData->set(KeyValueRef( persistTagPoppedKey(logData->logId, data->tag), persistTagPoppedValue(data->popped) ));
 	data->poppedRecently = false;
+	data->persistentPopped = data->popped;
 
 	if (data->nothingPersistent) return;
 
-	self->persistentData->clear( KeyRangeRef(
-		persistTagMessagesKey( logData->logId, data->tag, Version(0) ),
-		persistTagMessagesKey( logData->logId, data->tag, data->popped ) ) );
+	if (logData->spillByReference) {
+		// A batch of references is keyed by its last version, so this leaves any batch that reaches past the popped version
+		self->persistentData->clear( KeyRangeRef(
+			persistTagMessageRefsKey( logData->logId, data->tag, Version(0) ),
+			persistTagMessageRefsKey( logData->logId, data->tag, data->popped ) ) );
+	} else {
+		self->persistentData->clear( KeyRangeRef(
+			persistTagMessagesKey( logData->logId, data->tag, Version(0) ),
+			persistTagMessagesKey( logData->logId, data->tag, data->popped ) ) );
+	}
 	if (data->popped > logData->persistentDataVersion)
 		data->nothingPersistent = true;
 }
@@ -558,6 +642,7 @@ ACTOR Future<Void> updatePersistentData( TLogData* self, Reference<LogData> logD
 	//TraceEvent("UpdatePersistentData", self->dbgid).detail("Seq", newPersistentDataSeq);
 
 	state bool anyData = false;
+	state std::vector<SpilledData> refs;
 
 	// For all existing tags
 	state int tagLocality = 0;
@@ -568,6 +653,7 @@ ACTOR Future<Void> updatePersistentData( TLogData* self, Reference<LogData> logD
 			state Reference<LogData::TagData> tagData = logData->tag_data[tagLocality][tagId];
 			if(tagData) {
 				state Version currentVersion = 0;
+				refs.clear();
 				// Clear recently popped versions from persistentData if necessary
 				updatePersistentPopped( self, logData, tagData );
 				// Transfer unpopped messages with version numbers less than newPersistentDataVersion to persistentData
@@ -576,12 +662,24 @@ ACTOR Future<Void> updatePersistentData( TLogData* self, Reference<LogData> logD
 					currentVersion = msg->first;
 					anyData = true;
 					tagData->nothingPersistent = false;
-					BinaryWriter wr( Unversioned() );
 
-					for(; msg != tagData->versionMessages.end() && msg->first == currentVersion; ++msg)
-						wr << msg->second.toStringRef();
+					if(logData->spillByReference) {
+						// The messages are already durable in the queue, so only where to find them goes to persistentData
+						uint32_t mutationBytes = 0;
+						for(; msg != tagData->versionMessages.end() && msg->first == currentVersion; ++msg)
+							mutationBytes += msg->second.expectedSize() + sizeof(uint32_t);
+
+						auto loc = logData->versionLocation.find( currentVersion );
+						ASSERT( loc != logData->versionLocation.end() );
+						refs.push_back( SpilledData( currentVersion, loc->value.first, loc->value.second, mutationBytes ) );
+					} else {
+						BinaryWriter wr( Unversioned() );
+
+						for(; msg != tagData->versionMessages.end() && msg->first == currentVersion; ++msg)
+							wr << msg->second.toStringRef();
 
-					self->persistentData->set( KeyValueRef( persistTagMessagesKey( logData->logId, tagData->tag, currentVersion ), wr.toStringRef() ) );
+						self->persistentData->set( KeyValueRef( persistTagMessagesKey( logData->logId, tagData->tag, currentVersion ), wr.toStringRef() ) );
+					}
 
 					Future<Void> f = yield(TaskUpdateStorage);
 					if(!f.isReady()) {
@@ -589,6 +687,9 @@ ACTOR Future<Void> updatePersistentData( TLogData* self, Reference<LogData> logD
 						msg = std::upper_bound(tagData->versionMessages.begin(), tagData->versionMessages.end(), std::make_pair(currentVersion, LengthPrefixedStringRef()), CompareFirst<std::pair<Version, LengthPrefixedStringRef>>());
 					}
 				}
+				if(refs.size()) {
+					self->persistentData->set( KeyValueRef( persistTagMessageRefsKey( logData->logId, tagData->tag, currentVersion ), BinaryWriter::toValue( refs, IncludeVersion() ) ) );
+				}
 
 				wait(yield(TaskUpdateStorage));
 			}
@@ -636,7 +737,7 @@ ACTOR Future<Void> updatePersistentData( TLogData* self, Reference<LogData> logD
 	ASSERT(self->bytesDurable <= self->bytesInput);
 
 	if( self->queueCommitEnd.get() > 0 )
-		self->persistentQueue->pop( newPersistentDataVersion+1, logData ); // SOMEDAY: this can cause a slow task (~0.5ms), presumably from erasing too many versions. Should we limit the number of versions cleared at a time?
+		self->persistentQueue->pop( newPersistentDataVersion+1, logData ); // Held back by any spilled references.  SOMEDAY: this can cause a slow task (~0.5ms), presumably from erasing too many versions. Should we limit the number of versions cleared at a time?
 
 	return Void();
 }
@@ -926,6 +1027,102 @@ void peekMessagesFromMemory( Reference<LogData> self, TLogPeekRequest const& req
 	}
 }
 
+// Appends the messages of a queue entry which commitMessages() would have assigned to tag
+void peekMessagesFromEntry( Reference<LogData> self, Tag tag, StringRef entryMessages, BinaryWriter& messages ) {
+	while(entryMessages.size()) {
+		BinaryReader rd( entryMessages, Unversioned() );
+		int32_t messageLength;
+		uint32_t sub;
+		uint16_t tagCount;
+		rd >> messageLength >> sub >> tagCount;
+		int32_t rawLength = messageLength + sizeof(messageLength);
+		for(int i = 0; i < tagCount; i++) {
+			Tag t;
+			rd >> t;
+			if(t.locality == tagLocalityLogRouter) {
+				if(!self->logRouterTags) {
+					continue;
+				}
+				t.id = t.id % self->logRouterTags;
+			}
+			if(t == tag) {
+				messages.serializeBytes( entryMessages.begin(), rawLength );
+			}
+		}
+		entryMessages = entryMessages.substr( rawLength );
+	}
+}
+
+// Reads the spilled versions of a tag from the disk queue.  Versions whose entries are near each other in the queue are read with a single
+// sequential read, and the unreferenced entries between them are skipped.  Returns false if the tag is popped while reading.
+ACTOR Future<bool> peekMessagesFromQueue( TLogData* self, Reference<LogData> logData, TLogPeekRequest req, std::vector<SpilledData> refs, BinaryWriter* messages ) {
+	state std::vector<Future<Standalone<StringRef>>> reads;
+	for(int i = 0; i < refs.size(); ) {
+		int j = i+1;
+		while(j < refs.size() && refs[j].start.lo - refs[j-1].end.lo <= SERVER_KNOBS->TLOG_SPILL_REFERENCE_MAX_READ_GAP) {
+			j++;
+		}
+		reads.push_back( self->persistentQueue->read( refs[i].start, refs[j-1].end ) );
+		i = j;
+	}
+	wait( waitForAll(reads) );
+
+	// If the queue was popped during the reads, some of what was read may be missing
+	if(poppedVersion(logData, req.tag) > req.begin) {
+		TEST(true);  // TLog peek of spilled messages was popped while reading
+		return false;
+	}
+
+	// Locations count page headers, which read() leaves out, so each read is walked entry by entry (see TLogQueue for the framing)
+	int r = 0;
+	for(auto& read : reads) {
+		StringRef data = read.get();
+		while(data.size()) {
+			uint32_t payloadSize = *(uint32_t*)data.begin();
+			ASSERT( data.size() >= sizeof(uint32_t) + payloadSize + 1 );
+			if(data[sizeof(uint32_t) + payloadSize] && r < refs.size()) {
+				TLogQueueEntryRef entry;
+				ArenaReader rd( read.get().arena(), data.substr(sizeof(uint32_t), payloadSize), IncludeVersion() );
+				rd >> entry;
+				if(entry.id == logData->logId && entry.version == refs[r].version) {
+					*messages << int32_t(-1) << entry.version;
+					peekMessagesFromEntry( logData, req.tag, entry.messages, *messages );
+					r++;
+				}
+			}
+			data = data.substr( sizeof(uint32_t) + payloadSize + 1 );
+		}
+	}
+	ASSERT( r == refs.size() );
+	return true;
+}
+
+void replyPopped( TLogData* self, TLogPeekRequest& req, Reference<LogData> logData, Version poppedVer, UID peekId, int sequence ) {
+	TLogPeekReply rep;
+	rep.maxKnownVersion = logData->version.get();
+	rep.minKnownCommittedVersion = logData->minKnownCommittedVersion;
+	rep.popped = poppedVer;
+	rep.end = poppedVer;
+
+	if(req.sequence.present()) {
+		auto& trackerData = self->peekTracker[peekId];
+		trackerData.lastUpdate = now();
+		auto& sequenceData = trackerData.sequence_version[sequence+1];
+		if(sequenceData.isSet()) {
+			if(sequenceData.getFuture().get() != rep.end) {
+				TEST(true); //tlog peek second attempt ended at a different version
+				req.reply.sendError(timed_out());
+				return;
+			}
+		} else {
+			sequenceData.send(rep.end);
+		}
+		rep.begin = req.begin;
+	}
+
+	req.reply.send( rep );
+}
+
 ACTOR Future<Void> tLogPeekMessages( TLogData* self, TLogPeekRequest req, Reference<LogData> logData ) {
 	state BinaryWriter messages(Unversioned());
 	state BinaryWriter messages2(Unversioned());
@@ -965,6 +1162,7 @@ ACTOR Future<Void> tLogPeekMessages( TLogData* self, TLogPeekRequest req, Refere
 		wait( delay(SERVER_KNOBS->TLOG_PEEK_DELAY, g_network->getCurrentTask()) );
 	}
 
+	state double peekStart = now();
 	if( req.tag.locality == tagLocalityLogRouter ) {
 		wait( self->concurrentLogRouterReads.take() );
 		state FlowLock::Releaser globalReleaser(self->concurrentLogRouterReads);
@@ -973,29 +1171,7 @@ ACTOR Future<Void> tLogPeekMessages( TLogData* self, TLogPeekRequest req, Refere
 
 	Version poppedVer = poppedVersion(logData, req.tag);
 	if(poppedVer > req.begin) {
-		TLogPeekReply rep;
-		rep.maxKnownVersion = logData->version.get();
-		rep.minKnownCommittedVersion = logData->minKnownCommittedVersion;
-		rep.popped = poppedVer;
-		rep.end = poppedVer;
-
-		if(req.sequence.present()) {
-			auto& trackerData = self->peekTracker[peekId];
-			trackerData.lastUpdate = now();
-			auto& sequenceData = trackerData.sequence_version[sequence+1];
-			if(sequenceData.isSet()) {
-				if(sequenceData.getFuture().get() != rep.end) {
-					TEST(true); //tlog peek second attempt ended at a different version
-					req.reply.sendError(timed_out());
-					return Void();
-				}
-			} else {
-				sequenceData.send(rep.end);
-			}
-			rep.begin = req.begin;
-		}
-
-		req.reply.send( rep );
+		replyPopped( self, req, logData, poppedVer, peekId, sequence );
 		return Void();
 	}
 
@@ -1011,23 +1187,65 @@ ACTOR Future<Void> tLogPeekMessages( TLogData* self, TLogPeekRequest req, Refere
 
 		peekMessagesFromMemory( logData, req, messages2, endVersion );
 
-		Standalone<VectorRef<KeyValueRef>> kvs = wait(
-			self->persistentData->readRange(KeyRangeRef(
-				persistTagMessagesKey(logData->logId, req.tag, req.begin),
-				persistTagMessagesKey(logData->logId, req.tag, logData->persistentDataDurableVersion + 1)), SERVER_KNOBS->DESIRED_TOTAL_BYTES, SERVER_KNOBS->DESIRED_TOTAL_BYTES));
+		if(logData->spillByReference) {
+			Standalone<VectorRef<KeyValueRef>> kvrefs = wait(
+				self->persistentData->readRange(KeyRangeRef(
+					persistTagMessageRefsKey(logData->logId, req.tag, req.begin),
+					persistTagMessageRefsKey(logData->logId, req.tag, logData->persistentDataDurableVersion + 1)), SERVER_KNOBS->TLOG_SPILL_REFERENCE_MAX_BATCHES_PER_PEEK));
+
+			// Every batch read has a version >= req.begin, since it is keyed by its last version
+			state std::vector<SpilledData> refs;
+			state bool limited = kvrefs.size() == SERVER_KNOBS->TLOG_SPILL_REFERENCE_MAX_BATCHES_PER_PEEK;
+			bool earlyEnd = false;
+			int64_t mutationBytes = 0;
+			int64_t readBytes = 0;
+			for (auto &kv : kvrefs) {
+				std::vector<SpilledData> batch = BinaryReader::fromStringRef<std::vector<SpilledData>>( kv.value, IncludeVersion() );
+				for (auto &sd : batch) {
+					if (sd.version < req.begin) continue;
+					if (refs.size() && (mutationBytes >= SERVER_KNOBS->DESIRED_TOTAL_BYTES || readBytes >= SERVER_KNOBS->TLOG_SPILL_REFERENCE_MAX_PEEK_READ_BYTES)) {
+						earlyEnd = true;
+						break;
+					}
+					refs.push_back( sd );
+					mutationBytes += sd.mutationBytes;
+					readBytes += sd.end.lo - sd.start.lo;
+				}
+				if (earlyEnd) break;
+			}
+			limited = limited || earlyEnd;
 
-		//TraceEvent("TLogPeekResults", self->dbgid).detail("ForAddress", req.reply.getEndpoint().address).detail("Tag1Results", s1).detail("Tag2Results", s2).detail("Tag1ResultsLim", kv1.size()).detail("Tag2ResultsLim", kv2.size()).detail("Tag1ResultsLast", kv1.size() ? printable(kv1[0].key) : "").detail("Tag2ResultsLast", kv2.size() ? printable(kv2[0].key) : "").detail("Limited", limited).detail("NextEpoch", next_pos.epoch).detail("NextSeq", next_pos.sequence).detail("NowEpoch", self->epoch()).detail("NowSeq", self->sequence.getNextSequence());
+			if (refs.size()) {
+				bool complete = wait( peekMessagesFromQueue( self, logData, req, refs, &messages ) );
+				if (!complete) {
+					replyPopped( self, req, logData, poppedVersion(logData, req.tag), peekId, sequence );
+					return Void();
+				}
+			}
 
-		for (auto &kv : kvs) {
-			auto ver = decodeTagMessagesKey(kv.key);
-			messages << int32_t(-1) << ver;
-			messages.serializeBytes(kv.value);
-		}
+			if (limited)
+				endVersion = refs.back().version + 1;
+			else
+				messages.serializeBytes( messages2.toStringRef() );
+		} else {
+			Standalone<VectorRef<KeyValueRef>> kvs = wait(
+				self->persistentData->readRange(KeyRangeRef(
+					persistTagMessagesKey(logData->logId, req.tag, req.begin),
+					persistTagMessagesKey(logData->logId, req.tag, logData->persistentDataDurableVersion + 1)), SERVER_KNOBS->DESIRED_TOTAL_BYTES, SERVER_KNOBS->DESIRED_TOTAL_BYTES));
+
+			//TraceEvent("TLogPeekResults", self->dbgid).detail("ForAddress", req.reply.getEndpoint().address).detail("Tag1Results", s1).detail("Tag2Results", s2).detail("Tag1ResultsLim", kv1.size()).detail("Tag2ResultsLim", kv2.size()).detail("Tag1ResultsLast", kv1.size() ? printable(kv1[0].key) : "").detail("Tag2ResultsLast", kv2.size() ? printable(kv2[0].key) : "").detail("Limited", limited).detail("NextEpoch", next_pos.epoch).detail("NextSeq", next_pos.sequence).detail("NowEpoch", self->epoch()).detail("NowSeq", self->sequence.getNextSequence());
 
-		if (kvs.expectedSize() >= SERVER_KNOBS->DESIRED_TOTAL_BYTES)
-			endVersion = decodeTagMessagesKey(kvs.end()[-1].key) + 1;
-		else
-			messages.serializeBytes( messages2.toStringRef() );
+			for (auto &kv : kvs) {
+				auto ver = decodeTagMessagesKey(kv.key);
+				messages << int32_t(-1) << ver;
+				messages.serializeBytes(kv.value);
+			}
+
+			if (kvs.expectedSize() >= SERVER_KNOBS->DESIRED_TOTAL_BYTES)
+				endVersion = decodeTagMessagesKey(kvs.end()[-1].key) + 1;
+			else
+				messages.serializeBytes( messages2.toStringRef() );
+		}
 	} else {
 		peekMessagesFromMemory( logData, req, messages, endVersion );
 		//TraceEvent("TLogPeekResults", self->dbgid).detail("ForAddress", req.reply.getEndpoint().address).detail("MessageBytes", messages.getLength()).detail("NextEpoch", next_pos.epoch).detail("NextSeq", next_pos.sequence).detail("NowSeq", self->sequence.getNextSequence());
@@ -1036,6 +1254,7 @@ ACTOR Future<Void> tLogPeekMessages( TLogData* self, TLogPeekRequest req, Refere
 	TLogPeekReply reply;
 	reply.maxKnownVersion = logData->version.get();
 	reply.minKnownCommittedVersion = logData->minKnownCommittedVersion;
+	reply.arena = messages.arena();
 	reply.messages = messages.toStringRef();
 	reply.end = endVersion;
 
@@ -1057,6 +1276,7 @@ ACTOR Future<Void> tLogPeekMessages( TLogData* self, TLogPeekRequest req, Refere
 		reply.begin = req.begin;
 	}
 
+	logData->peekLatency.addMeasurement( now() - peekStart );
 	req.reply.send( reply );
 	return Void();
 }
@@ -1148,6 +1368,8 @@ ACTOR Future<Void> tLogCommit(
 		Reference<LogData> logData,
 		PromiseStream<Void> warningCollectorInput ) {
 	state Optional<UID> tlogDebugID;
+	state double startTime = now();
+	state double committedTime = 0;
 	if(req.debugID.present())
 	{
 		tlogDebugID = g_nondeterministic_random->randomUniqueID();
@@ -1206,6 +1428,7 @@ ACTOR Future<Void> tLogCommit(
 		// Notifies the commitQueue actor to commit persistentQueue, and also unblocks tLogPeekMessages actors
 		self->prevVersion = logData->version.get();
 		logData->version.set( req.version );
+		committedTime = now();
 
 		if(req.debugID.present())
 			g_traceBatch.addEvent("CommitDebug", tlogDebugID.get().first(), "TLog.tLogCommit.AfterTLogCommit");
@@ -1220,6 +1443,12 @@ ACTOR Future<Void> tLogCommit(
 		return Void();
 	}
 
+	if(committedTime > 0) {  // Duplicate requests are not counted
+		logData->commitStages.addSample( TLogStageWaitForVersion, committedTime - startTime );
+		logData->commitStages.addSample( TLogStageDurable, now() - committedTime );
+		logData->commitStages.addSample( TLogStageTotal, now() - startTime );
+	}
+
 	if(req.debugID.present())
 		g_traceBatch.addEvent("CommitDebug", tlogDebugID.get().first(), "TLog.tLogCommit.After");
 
@@ -1230,12 +1459,16 @@ ACTOR Future<Void> tLogCommit(
 ACTOR Future<Void> initPersistentState( TLogData* self, Reference<LogData> logData ) {
 	// PERSIST: Initial setup of persistentData for a brand new tLog for a new database
 	IKeyValueStore *storage = self->persistentData;
-	storage->set( persistFormat );
+	// The format stays readable by older versions until a generation spills by reference
+	self->spillByReferenceFormat = self->spillByReferenceFormat || logData->spillByReference;
+	storage->set( self->spillByReferenceFormat ? persistSpillByReferenceFormat : persistFormat );
 	storage->set( KeyValueRef( BinaryWriter::toValue(logData->logId,Unversioned()).withPrefix(persistCurrentVersionKeys.begin), BinaryWriter::toValue(logData->version.get(), Unversioned()) ) );
 	storage->set( KeyValueRef( BinaryWriter::toValue(logData->logId,Unversioned()).withPrefix(persistKnownCommittedVersionKeys.begin), BinaryWriter::toValue(logData->knownCommittedVersion, Unversioned()) ) );
 	storage->set( KeyValueRef( BinaryWriter::toValue(logData->logId,Unversioned()).withPrefix(persistLocalityKeys.begin), BinaryWriter::toValue(logData->locality, Unversioned()) ) );
 	storage->set( KeyValueRef( BinaryWriter::toValue(logData->logId,Unversioned()).withPrefix(persistLogRouterTagsKeys.begin), BinaryWriter::toValue(logData->logRouterTags, Unversioned()) ) );
 	storage->set( KeyValueRef( BinaryWriter::toValue(logData->logId,Unversioned()).withPrefix(persistRecoveryCountKeys.begin), BinaryWriter::toValue(logData->recoveryCount, Unversioned()) ) );
+	if(logData->spillByReference)
+		storage->set( KeyValueRef( BinaryWriter::toValue(logData->logId,Unversioned()).withPrefix(persistSpillByReferenceKeys.begin), BinaryWriter::toValue(logData->spillByReference, Unversioned()) ) );
 
 	for(auto tag : logData->allTags) {
 		ASSERT(!logData->getTagData(tag));
@@ -1647,11 +1880,12 @@ ACTOR Future<Void> restorePersistentState( TLogData* self, LocalityData locality
 	state Future<Standalone<VectorRef<KeyValueRef>>> fLocality = storage->readRange(persistLocalityKeys);
 	state Future<Standalone<VectorRef<KeyValueRef>>> fLogRouterTags = storage->readRange(persistLogRouterTagsKeys);
 	state Future<Standalone<VectorRef<KeyValueRef>>> fRecoverCounts = storage->readRange(persistRecoveryCountKeys);
+	state Future<Standalone<VectorRef<KeyValueRef>>> fSpillByReference = storage->readRange(persistSpillByReferenceKeys);
 
 	// FIXME: metadata in queue?
 
 	wait( waitForAll( (vector<Future<Optional<Value>>>(), fFormat ) ) );
-	wait( waitForAll( (vector<Future<Standalone<VectorRef<KeyValueRef>>>>(), fVers, fKnownCommitted, fLocality, fLogRouterTags, fRecoverCounts) ) );
+	wait( waitForAll( (vector<Future<Standalone<VectorRef<KeyValueRef>>>>(), fVers, fKnownCommitted, fLocality, fLogRouterTags, fRecoverCounts, fSpillByReference) ) );
 
 	if (fFormat.get().present() && !persistFormatReadableRange.contains( fFormat.get().get() )) {
 		//FIXME: remove when we no longer need to test upgrades from 4.X releases
@@ -1679,6 +1913,7 @@ ACTOR Future<Void> restorePersistentState( TLogData* self, LocalityData locality
 
 	state std::vector<Future<ErrorOr<Void>>> removed;
 
+	self->spillByReferenceFormat = fFormat.get().get() == persistSpillByReferenceFormat.value;
 	if(fFormat.get().get() == LiteralStringRef("FoundationDB/LogServer/2/3")) {
 		//FIXME: need for upgrades from 5.X to 6.0, remove once this upgrade path is no longer needed
 		if(recovered.canBeSet()) recovered.send(Void());
@@ -1708,6 +1943,12 @@ ACTOR Future<Void> restorePersistentState( TLogData* self, LocalityData locality
 		id_knownCommitted[ BinaryReader::fromStringRef<UID>(it.key.removePrefix(persistKnownCommittedVersionKeys.begin), Unversioned())] = BinaryReader::fromStringRef<Version>( it.value, Unversioned() );
 	}
 
+	// Generations without a key spill messages, either because they are from before spilling by reference or because it was off
+	state std::map<UID, bool> id_spillByReference;
+	for(auto it : fSpillByReference.get()) {
+		id_spillByReference[ BinaryReader::fromStringRef<UID>(it.key.removePrefix(persistSpillByReferenceKeys.begin), Unversioned())] = BinaryReader::fromStringRef<bool>( it.value, Unversioned() );
+	}
+
 	state int idx = 0;
 	state Promise<Void> registerWithMaster;
 	state std::map<UID, TLogInterface> id_interf;
@@ -1730,6 +1971,7 @@ ACTOR Future<Void> restorePersistentState( TLogData* self, LocalityData locality
 		//We do not need the remoteTag, because we will not be loading any additional data
 		logData = Reference<LogData>( new LogData(self, recruited, Tag(), true, id_logRouterTags[id1], UID(), std::vector<Tag>()) );
 		logData->locality = id_locality[id1];
+		logData->spillByReference = id_spillByReference[id1];
 		logData->stopped = true;
 		self->id_data[id1] = logData;
 		id_interf[id1] = recruited;
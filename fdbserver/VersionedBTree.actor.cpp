@@ -0,0 +1,1609 @@
+/*
+ * VersionedBTree.actor.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "IPager.h"
+#include "IVersionedStore.h"
+#include "IKeyValueStore.h"
+#include "fdbrpc/IAsyncFile.h"
+#include "fdbrpc/crc32c.h"
+#include "flow/UnitTest.h"
+#include "flow/actorcompiler.h"  // This must be the last #include.
+
+// A copy-on-write B+tree which keeps a window of versions readable (the "Redwood" engine).
+//
+// COWPager stores pages in a single file.  A page is never written while a readable version may use it: each commit
+// writes the nodes it changes to newly allocated pages, so every commit has its own root, and the pages it replaces
+// are freed at its version.  They are reused once every version before that one has been forgotten.
+//
+// VersionedBTree keeps the roots of the versions in its window, and buffers the sets and clears made at the write
+// version until a commit applies them, rewriting each changed leaf and its ancestors once.  A read at a version walks
+// down from the root of the last commit at or before it.
+
+// The part of each page in which a pager keeps a crc32c of the rest of the page
+static const int pageChecksumBytes = sizeof(uint32_t);
+
+// The two alternately written headers of a pager file, at its beginning
+static const int pagerHeaderBytes = 4096;
+
+class COWPage : public IPage, public FastAllocated<COWPage>, NonCopyable {
+public:
+	COWPage( int pageSize ) : pageSize(pageSize), buffer(new uint8_t[pageSize]), referenceCount(1) {
+		memset( buffer, 0, pageSize );
+	}
+	virtual ~COWPage() { delete[] buffer; }
+
+	virtual uint8_t const* begin() const { return buffer + pageChecksumBytes; }
+	virtual uint8_t* mutate() { return buffer + pageChecksumBytes; }
+	virtual int size() const { return pageSize - pageChecksumBytes; }
+
+	virtual void addref() const { ++referenceCount; }
+	virtual void delref() const { if (!--referenceCount) delete this; }
+
+	uint32_t calculateChecksum() const { return crc32c_append( 0xfdbeefdb, buffer + pageChecksumBytes, pageSize - pageChecksumBytes ); }
+	void updateChecksum() { *(uint32_t*)buffer = calculateChecksum(); }
+	bool verifyChecksum() const { return *(uint32_t const*)buffer == calculateChecksum(); }
+
+	const int pageSize;
+	uint8_t* const buffer;
+
+private:
+	mutable int referenceCount;
+};
+
+#pragma pack(push, 1)
+// A page which no version at or after this one uses
+struct FreePage {
+	Version version;
+	LogicalPageID pageID;
+};
+
+struct FIFOQueueState {
+	LogicalPageID headPageID;
+	LogicalPageID tailPageID;		// Where the tail page will be written once it is full
+	LogicalPageID tailSlots[2];		// Alternately hold the items of the tail page as of each commit
+	uint32_t headIndex;				// Of the first item in the head page
+	uint32_t tailCount;				// Items in the tail page
+	uint8_t tailSlot;				// The slot holding them
+	int64_t numPages;
+	int64_t numEntries;
+};
+#pragma pack(pop)
+
+// The pages a FIFOQueue is kept in are allocated and written through this interface of its pager
+class IQueuePager {
+public:
+	virtual Reference<IPage> newPageBuffer() = 0;
+	virtual LogicalPageID extendFile() = 0;
+	virtual void writePage( LogicalPageID pageID, Reference<IPage> page ) = 0;
+	virtual Future<Reference<const IPage>> readPage( LogicalPageID pageID ) = 0;
+	virtual void freeQueuePage( LogicalPageID pageID ) = 0;
+};
+
+// A queue of FreePages, used by COWPager for its free lists.  Items are kept in a linked list of pages, each holding
+// the ID of the next page and then the items.  A page is only written once, when it is full, to the page ID that was
+// reserved for it when it became the tail; until then its items are written by each commit to one of two slot pages,
+// alternately, so that the items an earlier commit made durable are never overwritten.  Pages taken by the queue come
+// from the end of the file, and pages it has consumed are freed once that is durable.
+class FIFOQueue {
+public:
+	FIFOQueue() : pager(nullptr), headPageID(invalidLogicalPageID), headNext(invalidLogicalPageID), tailPageID(invalidLogicalPageID),
+		headIndex(0), tailSlot(0), tailDirty(false), numPages(0), numEntries(0), loading(Void())
+	{
+		tailSlots[0] = tailSlots[1] = invalidLogicalPageID;
+	}
+
+	void create( IQueuePager* p, int pageSize ) {
+		pager = p;
+		itemsPerPage = itemsPerPageFor( pageSize );
+		headPageID = tailPageID = pager->extendFile();
+		tailSlots[0] = pager->extendFile();
+		tailSlots[1] = pager->extendFile();
+		headIndex = 0;
+		tailSlot = 0;
+		numPages = 1;
+		numEntries = 0;
+		tailItems.clear();
+		tailDirty = true;
+	}
+
+	Future<Void> recover( IQueuePager* p, int pageSize, FIFOQueueState const& state ) {
+		pager = p;
+		itemsPerPage = itemsPerPageFor( pageSize );
+		headPageID = state.headPageID;
+		tailPageID = state.tailPageID;
+		tailSlots[0] = state.tailSlots[0];
+		tailSlots[1] = state.tailSlots[1];
+		headIndex = state.headIndex;
+		tailSlot = state.tailSlot;
+		numPages = state.numPages;
+		numEntries = state.numEntries;
+		loading = recover_impl( this, state.tailCount );
+		return loading;
+	}
+
+	FIFOQueueState getState() const {
+		FIFOQueueState s;
+		s.headPageID = headPageID;
+		s.tailPageID = tailPageID;
+		s.tailSlots[0] = tailSlots[0];
+		s.tailSlots[1] = tailSlots[1];
+		s.headIndex = headIndex;
+		s.tailCount = tailItems.size();
+		s.tailSlot = tailSlot;
+		s.numPages = numPages;
+		s.numEntries = numEntries;
+		return s;
+	}
+
+	int64_t size() const { return numEntries; }
+
+	void pushBack( FreePage const& item ) {
+		if (tailItems.size() == itemsPerPage) {
+			LogicalPageID newTailPageID = pager->extendFile();
+			pager->writePage( tailPageID, makePage( newTailPageID, tailItems ) );
+			if (headPageID == tailPageID) {
+				headItems = tailItems;
+				headNext = newTailPageID;
+			}
+			tailPageID = newTailPageID;
+			tailItems.clear();
+			++numPages;
+		}
+		tailItems.push_back( item );
+		tailDirty = true;
+		++numEntries;
+	}
+
+	Future<Optional<FreePage>> peekFront() { return front( this, false ); }
+	Future<Optional<FreePage>> popFront() { return front( this, true ); }
+
+	// Writes the items of the tail page to the slot the previous commit did not use
+	void flush() {
+		if (!tailDirty) return;
+		tailSlot = 1 - tailSlot;
+		pager->writePage( tailSlots[tailSlot], makePage( invalidLogicalPageID, tailItems ) );
+		tailDirty = false;
+	}
+
+private:
+	IQueuePager* pager;
+	int itemsPerPage;
+	LogicalPageID headPageID, headNext, tailPageID;
+	LogicalPageID tailSlots[2];
+	uint32_t headIndex;
+	uint8_t tailSlot;
+	bool tailDirty;
+	int64_t numPages, numEntries;
+	std::vector<FreePage> headItems;		// When the head page is not the tail page
+	std::vector<FreePage> tailItems;
+	Future<Void> loading;
+
+	static int itemsPerPageFor( int usablePageSize ) { return (usablePageSize - sizeof(LogicalPageID)) / sizeof(FreePage); }
+
+	Reference<IPage> makePage( LogicalPageID next, std::vector<FreePage> const& items ) {
+		Reference<IPage> page = pager->newPageBuffer();
+		uint8_t* p = page->mutate();
+		memcpy( p, &next, sizeof(LogicalPageID) );
+		if (items.size())
+			memcpy( p + sizeof(LogicalPageID), &items[0], items.size() * sizeof(FreePage) );
+		return page;
+	}
+
+	static void readItems( Reference<const IPage> const& page, int count, LogicalPageID* next, std::vector<FreePage>& items ) {
+		memcpy( next, page->begin(), sizeof(LogicalPageID) );
+		FreePage const* begin = (FreePage const*)( page->begin() + sizeof(LogicalPageID) );
+		items.assign( begin, begin + count );
+	}
+
+	FreePage const& headItem() const { return headPageID == tailPageID ? tailItems[headIndex] : headItems[headIndex]; }
+
+	ACTOR static Future<Void> recover_impl( FIFOQueue* self, uint32_t tailCount ) {
+		if (tailCount) {
+			Reference<const IPage> tail = wait( self->pager->readPage( self->tailSlots[self->tailSlot] ) );
+			LogicalPageID unused;
+			readItems( tail, tailCount, &unused, self->tailItems );
+		}
+		if (self->headPageID != self->tailPageID)
+			wait( loadHead( self ) );
+		return Void();
+	}
+
+	ACTOR static Future<Void> loadHead( FIFOQueue* self ) {
+		Reference<const IPage> head = wait( self->pager->readPage( self->headPageID ) );
+		readItems( head, self->itemsPerPage, &self->headNext, self->headItems );
+		return Void();
+	}
+
+	ACTOR static Future<Optional<FreePage>> front( FIFOQueue* self, bool pop ) {
+		loop {
+			wait( self->loading );
+			// Another pop may have moved on to a head page which is still loading
+			if (!self->loading.isReady()) continue;
+			if (!self->numEntries) return Optional<FreePage>();
+			if (self->headPageID == self->tailPageID || self->headIndex < self->itemsPerPage) break;
+
+			// The head page has been consumed
+			self->pager->freeQueuePage( self->headPageID );
+			self->headPageID = self->headNext;
+			self->headIndex = 0;
+			--self->numPages;
+			if (self->headPageID != self->tailPageID)
+				self->loading = loadHead( self );
+		}
+		FreePage item = self->headItem();
+		if (pop) {
+			++self->headIndex;
+			--self->numEntries;
+		}
+		return item;
+	}
+};
+
+#pragma pack(push, 1)
+struct COWPagerHeader {
+	enum { MAGIC = 0x5245445744424657ULL, FORMAT_VERSION = 1 };
+
+	uint64_t magic;
+	uint32_t formatVersion;
+	uint32_t pageSize;
+	uint64_t commitNumber;			// The header with the highest valid commit number is the durable one
+	int64_t pageCount;
+	Version committedVersion;
+	Version oldestVersion;
+	FIFOQueueState freeList;
+	FIFOQueueState delayedFreeList;	// Pages freed at versions which may still be read
+	uint32_t metaKeySize;
+	// Followed by the meta key
+};
+#pragma pack(pop)
+
+// An IPager over an IAsyncFile, which begins with two alternately written headers followed by the pages.  The
+// AsyncFileCached beneath it caches the file, and a small cache of pages whose checksums have been verified is kept
+// above it.  Commit writes every page, syncs, and then writes and syncs the next header.
+class COWPager : public IPager, public IQueuePager, NonCopyable {
+public:
+	COWPager( int desiredPageSize, std::string const& filename, UID id )
+		: desiredPageSize(desiredPageSize), filename(filename), id(id), pageSize(0), pageCount(0), commitNumber(0),
+		  committedVersion(0), oldestVersion(0), durableOldestVersion(0), commitFuture(Void()),
+		  pageReads(0), pageCacheHits(0), pageWrites(0)
+	{
+	}
+
+	// IClosable
+	virtual Future<Void> getError() { return errorPromise.getFuture(); }
+	virtual Future<Void> onClosed() { return closedPromise.getFuture(); }
+	virtual void dispose() { shutdown( this, true ); }
+	virtual void close() { shutdown( this, false ); }
+
+	// IPager
+	virtual Reference<IPage> newPageBuffer() { return Reference<IPage>( new COWPage( pageSize ) ); }
+	virtual int getUsablePageSize() { return pageSize - pageChecksumBytes; }
+
+	virtual Future<LogicalPageID> newPageID() {
+		if (freeList.size())
+			return newPageIDFromFreeList( this );
+		return extendFile();
+	}
+
+	virtual void updatePage( LogicalPageID pageID, Reference<IPage> data ) {
+		writePage( pageID, data );
+		cachePage( pageID, Reference<const IPage>( data ) );
+	}
+
+	virtual void freePage( LogicalPageID pageID, Version v ) {
+		FreePage p = { v, pageID };
+		delayedFreeList.pushBack( p );
+	}
+
+	virtual Future<Reference<const IPage>> readPage( LogicalPageID pageID ) {
+		++pageReads;
+		auto c = pageCache.find( pageID );
+		if (c != pageCache.end() && !c->second.page.isError()) {
+			++pageCacheHits;
+			cacheLRU.splice( cacheLRU.begin(), cacheLRU, c->second.lru );
+			return c->second.page;
+		}
+		Future<Reference<const IPage>> page = readPhysicalPage( this, pageID );
+		cachePage( pageID, page );
+		return page;
+	}
+
+	virtual void setOldestVersion( Version v ) {
+		ASSERT( v >= oldestVersion );
+		oldestVersion = v;
+	}
+	virtual Version getOldestVersion() { return oldestVersion; }
+	virtual Version getLatestVersion() { return committedVersion; }
+
+	virtual Key getMetaKey() { return metaKey; }
+	virtual void setMetaKey( KeyRef k ) {
+		ASSERT( k.size() <= getMaxMetaKeySize() );
+		metaKey = k;
+	}
+	virtual int getMaxMetaKeySize() { return pagerHeaderBytes - pageChecksumBytes - sizeof(COWPagerHeader); }
+
+	virtual Future<Void> commit( Version v ) {
+		ASSERT( v >= committedVersion );
+		commitFuture = commit_impl( this, v, commitFuture );
+		return commitFuture;
+	}
+
+	virtual StorageBytes getStorageBytes() {
+		int64_t free, total;
+		g_network->getDiskBytes( parentDirectory( filename ), free, total );
+		int64_t used = 2 * pagerHeaderBytes + pageCount * pageSize;
+		return StorageBytes( free, total, used, free + freeList.size() * pageSize );
+	}
+
+	virtual Future<Void> init() {
+		commitFuture = recover( this );
+		return commitFuture;
+	}
+
+	// IQueuePager
+	virtual LogicalPageID extendFile() { return pageCount++; }
+
+	virtual void writePage( LogicalPageID pageID, Reference<IPage> data ) {
+		++pageWrites;
+		COWPage* page = (COWPage*)data.getPtr();
+		page->updateChecksum();
+		pendingWrites.push_back( holdWhile( data, file->write( page->buffer, pageSize, pageOffset( pageID ) ) ) );
+	}
+
+	// The page is no longer part of a free list once the next commit is durable, and no version ever used it
+	virtual void freeQueuePage( LogicalPageID pageID ) {
+		FreePage p = { committedVersion + 1, pageID };
+		delayedFreeList.pushBack( p );
+	}
+
+private:
+	struct CachedPage {
+		Future<Reference<const IPage>> page;
+		std::list<LogicalPageID>::iterator lru;
+	};
+
+	const int desiredPageSize;
+	const std::string filename;
+	const UID id;
+	Reference<IAsyncFile> file;
+	int pageSize;
+	int64_t pageCount;
+	uint64_t commitNumber;
+	Version committedVersion;
+	Version oldestVersion;
+	Version durableOldestVersion;	// The oldest version of the durable header
+	Key metaKey;
+	FIFOQueue freeList, delayedFreeList;
+	std::vector<Future<Void>> pendingWrites;
+	std::unordered_map<LogicalPageID, CachedPage> pageCache;
+	std::list<LogicalPageID> cacheLRU;	// Most recently used first
+
+	Future<Void> commitFuture;
+	Promise<Void> errorPromise;
+	Promise<Void> closedPromise;
+
+	int64_t pageReads, pageCacheHits, pageWrites;
+
+	int64_t pageOffset( LogicalPageID pageID ) const { return 2 * pagerHeaderBytes + (int64_t)pageID * pageSize; }
+
+	void cachePage( LogicalPageID pageID, Future<Reference<const IPage>> page ) {
+		auto c = pageCache.find( pageID );
+		if (c != pageCache.end()) {
+			c->second.page = page;
+			cacheLRU.splice( cacheLRU.begin(), cacheLRU, c->second.lru );
+			return;
+		}
+		cacheLRU.push_front( pageID );
+		CachedPage& e = pageCache[pageID];
+		e.page = page;
+		e.lru = cacheLRU.begin();
+		while (pageCache.size() > SERVER_KNOBS->REDWOOD_PAGE_CACHE_PAGES) {
+			pageCache.erase( cacheLRU.back() );
+			cacheLRU.pop_back();
+		}
+	}
+
+	void setError( Error const& e ) {
+		if (errorPromise.canBeSet())
+			errorPromise.sendError( e );
+	}
+
+	ACTOR static Future<Reference<const IPage>> readPhysicalPage( COWPager* self, LogicalPageID pageID ) {
+		state Reference<COWPage> page( new COWPage( self->pageSize ) );
+		int bytes = wait( self->file->read( page->buffer, self->pageSize, self->pageOffset( pageID ) ) );
+		if (bytes != self->pageSize || !page->verifyChecksum()) {
+			TraceEvent(SevError, "RedwoodChecksumFailed", self->id).detail("Filename", self->filename).detail("PageID", pageID).detail("Bytes", bytes);
+			throw checksum_failed();
+		}
+		return Reference<const IPage>( page );
+	}
+
+	ACTOR static Future<LogicalPageID> newPageIDFromFreeList( COWPager* self ) {
+		Optional<FreePage> p = wait( self->freeList.popFront() );
+		if (p.present())
+			return p.get().pageID;
+		return self->extendFile();
+	}
+
+	Reference<COWPage> makeHeader( uint64_t commitNumber, Version committedVersion, Version oldestVersion ) {
+		Reference<COWPage> page( new COWPage( pagerHeaderBytes ) );
+		COWPagerHeader* h = (COWPagerHeader*)page->mutate();
+		h->magic = COWPagerHeader::MAGIC;
+		h->formatVersion = COWPagerHeader::FORMAT_VERSION;
+		h->pageSize = pageSize;
+		h->commitNumber = commitNumber;
+		h->pageCount = pageCount;
+		h->committedVersion = committedVersion;
+		h->oldestVersion = oldestVersion;
+		h->freeList = freeList.getState();
+		h->delayedFreeList = delayedFreeList.getState();
+		h->metaKeySize = metaKey.size();
+		memcpy( page->mutate() + sizeof(COWPagerHeader), metaKey.begin(), metaKey.size() );
+		page->updateChecksum();
+		return page;
+	}
+
+	ACTOR static Future<Void> recover( COWPager* self ) {
+		state double startt = now();
+		try {
+			try {
+				Reference<IAsyncFile> f = wait( IAsyncFileSystem::filesystem()->open( self->filename, IAsyncFile::OPEN_READWRITE | IAsyncFile::OPEN_LOCK, 0 ) );
+				self->file = f;
+			} catch (Error& e) {
+				if (e.code() != error_code_file_not_found) throw;
+			}
+
+			if (!self->file) {
+				// A new file, which does not appear under its name until it has been synced
+				Reference<IAsyncFile> f = wait( IAsyncFileSystem::filesystem()->open( self->filename, IAsyncFile::OPEN_ATOMIC_WRITE_AND_CREATE | IAsyncFile::OPEN_CREATE | IAsyncFile::OPEN_READWRITE | IAsyncFile::OPEN_LOCK, 0600 ) );
+				self->file = f;
+				self->pageSize = self->desiredPageSize;
+				self->freeList.create( self, self->getUsablePageSize() );
+				self->delayedFreeList.create( self, self->getUsablePageSize() );
+				Reference<COWPage> header = self->makeHeader( 0, 0, 0 );
+				wait( self->file->write( header->buffer, pagerHeaderBytes, 0 ) );
+				wait( self->file->sync() );
+				TraceEvent("RedwoodPagerCreated", self->id).detail("Filename", self->filename).detail("PageSize", self->pageSize);
+				return Void();
+			}
+
+			state std::vector<Reference<COWPage>> headers;
+			state std::vector<Future<int>> reads;
+			for (int i = 0; i < 2; i++) {
+				headers.push_back( Reference<COWPage>( new COWPage( pagerHeaderBytes ) ) );
+				reads.push_back( self->file->read( headers[i]->buffer, pagerHeaderBytes, i * pagerHeaderBytes ) );
+			}
+			wait( waitForAll( reads ) );
+
+			COWPagerHeader const* best = nullptr;
+			for (int i = 0; i < 2; i++) {
+				COWPagerHeader const* h = (COWPagerHeader const*)headers[i]->begin();
+				if (reads[i].get() != pagerHeaderBytes || !headers[i]->verifyChecksum() || h->magic != COWPagerHeader::MAGIC)
+					continue;
+				if (!best || h->commitNumber > best->commitNumber)
+					best = h;
+			}
+			if (!best) {
+				TraceEvent(SevError, "RedwoodHeaderCorrupt", self->id).detail("Filename", self->filename);
+				throw file_corrupt();
+			}
+			if (best->formatVersion != COWPagerHeader::FORMAT_VERSION) {
+				TraceEvent(SevError, "RedwoodUnknownFormat", self->id).detail("Filename", self->filename).detail("FormatVersion", best->formatVersion);
+				throw file_corrupt();
+			}
+
+			self->pageSize = best->pageSize;
+			self->pageCount = best->pageCount;
+			self->commitNumber = best->commitNumber;
+			self->committedVersion = best->committedVersion;
+			self->oldestVersion = self->durableOldestVersion = best->oldestVersion;
+			self->metaKey = KeyRef( (uint8_t const*)best + sizeof(COWPagerHeader), best->metaKeySize );
+			state FIFOQueueState freeListState = best->freeList;
+			state FIFOQueueState delayedFreeListState = best->delayedFreeList;
+			wait( self->freeList.recover( self, self->getUsablePageSize(), freeListState ) && self->delayedFreeList.recover( self, self->getUsablePageSize(), delayedFreeListState ) );
+
+			TraceEvent("RedwoodPagerRecovered", self->id)
+				.detail("Filename", self->filename)
+				.detail("PageSize", self->pageSize)
+				.detail("Pages", self->pageCount)
+				.detail("FreePages", self->freeList.size())
+				.detail("DelayedFreePages", self->delayedFreeList.size())
+				.detail("CommittedVersion", self->committedVersion)
+				.detail("OldestVersion", self->oldestVersion)
+				.detail("TimeTaken", now()-startt);
+			return Void();
+		} catch (Error& e) {
+			bool ok = e.code() == error_code_actor_cancelled || e.code() == error_code_file_not_found;
+			TraceEvent(ok ? SevInfo : SevError, "RedwoodPagerRecoveryError", self->id).error(e, true);
+			self->setError( e );
+			throw;
+		}
+	}
+
+	ACTOR static Future<Void> commit_impl( COWPager* self, Version v, Future<Void> previous ) {
+		wait( previous );
+		try {
+			// Pages freed at or before the durable oldest version are no longer used by any version that can be read
+			loop {
+				Optional<FreePage> front = wait( self->delayedFreeList.peekFront() );
+				if (!front.present() || front.get().version > self->durableOldestVersion) break;
+				Optional<FreePage> p = wait( self->delayedFreeList.popFront() );
+				self->freeList.pushBack( p.get() );
+			}
+			self->freeList.flush();
+			self->delayedFreeList.flush();
+
+			state std::vector<Future<Void>> writes;
+			writes.swap( self->pendingWrites );
+			wait( waitForAll( writes ) );
+			wait( self->file->sync() );
+
+			state Version oldest = std::min( self->oldestVersion, v );
+			state Reference<COWPage> header = self->makeHeader( self->commitNumber + 1, v, oldest );
+			wait( self->file->write( header->buffer, pagerHeaderBytes, ((self->commitNumber + 1) % 2) * pagerHeaderBytes ) );
+			wait( self->file->sync() );
+
+			++self->commitNumber;
+			self->committedVersion = v;
+			self->durableOldestVersion = oldest;
+			return Void();
+		} catch (Error& e) {
+			if (e.code() != error_code_actor_cancelled) {
+				TraceEvent(SevError, "RedwoodPagerCommitError", self->id).error(e, true);
+				self->setError( e );
+			}
+			throw;
+		}
+	}
+
+	ACTOR static void shutdown( COWPager* self, bool dispose ) {
+		TraceEvent("RedwoodPagerShutdown", self->id).detail("Filename", self->filename).detail("Dispose", dispose)
+			.detail("PageReads", self->pageReads).detail("PageCacheHits", self->pageCacheHits).detail("PageWrites", self->pageWrites);
+		self->commitFuture.cancel();
+		self->pendingWrites.clear();
+		self->pageCache.clear();
+		self->file = Reference<IAsyncFile>();
+		if (dispose) {
+			try {
+				wait( IAsyncFileSystem::filesystem()->deleteFile( self->filename, true ) );
+			} catch (Error& e) {
+				TraceEvent(SevError, "RedwoodPagerDeleteError", self->id).error(e, true);
+			}
+		}
+		self->closedPromise.send( Void() );
+		delete self;
+	}
+};
+
+#pragma pack(push, 1)
+// A node occupies one page or more.  Its first page holds the uint32_t number of further pages and their IDs, and
+// then the node, which continues through the further pages.
+struct BTreeNodeHeader {
+	enum { FORMAT_VERSION = 1 };
+
+	uint8_t formatVersion;
+	uint8_t level;			// 1 for leaves
+	uint16_t reserved;
+	uint32_t count;
+	uint32_t bytes;			// Of the node, including this header
+};
+#pragma pack(pop)
+
+// A view of a node: its header, the uint32_t offset of each entry, then the entries as (uint32_t key length, uint32_t
+// value length, key, value) in key order.  In an internal node the value of an entry is the list of the pages of a
+// child, which holds the keys from the entry's key to the next entry's key; the first child also holds the keys
+// before its entry's key which belong in the node.
+struct BTreeNodeRef {
+	StringRef data;
+
+	BTreeNodeRef() {}
+	explicit BTreeNodeRef( StringRef data ) : data(data) {}
+
+	BTreeNodeHeader const& header() const { return *(BTreeNodeHeader const*)data.begin(); }
+	int count() const { return header().count; }
+	int level() const { return header().level; }
+	bool isLeaf() const { return level() == 1; }
+
+	uint8_t const* entry( int i ) const { return data.begin() + ((uint32_t const*)(data.begin() + sizeof(BTreeNodeHeader)))[i]; }
+	KeyRef key( int i ) const { uint8_t const* e = entry( i ); return KeyRef( e + 2*sizeof(uint32_t), *(uint32_t const*)e ); }
+	ValueRef value( int i ) const {
+		uint8_t const* e = entry( i );
+		return ValueRef( e + 2*sizeof(uint32_t) + *(uint32_t const*)e, *(uint32_t const*)(e + sizeof(uint32_t)) );
+	}
+
+	// The first entry whose key is at least k, or count()
+	int lowerBound( KeyRef k ) const {
+		int lo = 0, hi = count();
+		while (lo < hi) {
+			int mid = lo + (hi - lo) / 2;
+			if (key( mid ) < k) lo = mid + 1;
+			else hi = mid;
+		}
+		return lo;
+	}
+
+	// The first entry whose key is greater than k, or count()
+	int upperBound( KeyRef k ) const {
+		int lo = 0, hi = count();
+		while (lo < hi) {
+			int mid = lo + (hi - lo) / 2;
+			if (k < key( mid )) hi = mid;
+			else lo = mid + 1;
+		}
+		return lo;
+	}
+
+	// The child of an internal node which holds k
+	int childIndex( KeyRef k ) const { return std::max( upperBound( k ) - 1, 0 ); }
+
+	static int entryBytes( KeyValueRef const& kv ) { return 3*sizeof(uint32_t) + kv.key.size() + kv.value.size(); }
+
+	static Standalone<StringRef> build( int level, KeyValueRef const* begin, KeyValueRef const* end ) {
+		int bytes = sizeof(BTreeNodeHeader);
+		for (auto e = begin; e != end; ++e)
+			bytes += entryBytes( *e );
+
+		Standalone<StringRef> node = makeString( bytes );
+		uint8_t* p = mutateString( node );
+		BTreeNodeHeader* h = (BTreeNodeHeader*)p;
+		h->formatVersion = BTreeNodeHeader::FORMAT_VERSION;
+		h->level = level;
+		h->reserved = 0;
+		h->count = end - begin;
+		h->bytes = bytes;
+		uint32_t* offsets = (uint32_t*)(p + sizeof(BTreeNodeHeader));
+		uint32_t offset = sizeof(BTreeNodeHeader) + (end - begin) * sizeof(uint32_t);
+		for (auto e = begin; e != end; ++e) {
+			*offsets++ = offset;
+			uint32_t lengths[2] = { (uint32_t)e->key.size(), (uint32_t)e->value.size() };
+			memcpy( p + offset, lengths, sizeof(lengths) );
+			offset += sizeof(lengths);
+			memcpy( p + offset, e->key.begin(), e->key.size() );
+			offset += e->key.size();
+			memcpy( p + offset, e->value.begin(), e->value.size() );
+			offset += e->value.size();
+		}
+		ASSERT( offset == bytes );
+		return node;
+	}
+};
+
+// The pages of a child, as stored in the entry for it
+static std::vector<LogicalPageID> childPages( ValueRef v ) {
+	std::vector<LogicalPageID> pages( v.size() / sizeof(LogicalPageID) );
+	if (pages.size())
+		memcpy( &pages[0], v.begin(), v.size() );
+	return pages;
+}
+
+static LogicalPageID firstChildPage( ValueRef v ) {
+	LogicalPageID p;
+	memcpy( &p, v.begin(), sizeof(LogicalPageID) );
+	return p;
+}
+
+struct BTreeNode : ReferenceCounted<BTreeNode>, FastAllocated<BTreeNode>, NonCopyable {
+	std::vector<LogicalPageID> pageIDs;
+	Reference<const IPage> page;		// The first page
+	Standalone<StringRef> bytes;		// The node's bytes gathered from its pages, when it has more than one
+	BTreeNodeRef node;
+};
+
+ACTOR static Future<Reference<BTreeNode>> readBTreeNode( IPager* pager, LogicalPageID pageID ) {
+	state Reference<BTreeNode> node( new BTreeNode );
+	Reference<const IPage> page = wait( pager->readPage( pageID ) );
+	node->page = page;
+
+	StringRef p = page->asStringRef();
+	uint32_t extensionCount = *(uint32_t const*)p.begin();
+	state int headerBytes = sizeof(uint32_t) + extensionCount * sizeof(LogicalPageID);
+	if (extensionCount > p.size() || headerBytes + sizeof(BTreeNodeHeader) > p.size()) {
+		TraceEvent(SevError, "RedwoodNodeCorrupt").detail("PageID", pageID).detail("ExtensionCount", extensionCount);
+		throw file_corrupt();
+	}
+	node->pageIDs.push_back( pageID );
+	for (int i = 0; i < extensionCount; i++)
+		node->pageIDs.push_back( ((LogicalPageID const*)(p.begin() + sizeof(uint32_t)))[i] );
+	state int bytes = ((BTreeNodeHeader const*)(p.begin() + headerBytes))->bytes;
+	if (bytes < (int)sizeof(BTreeNodeHeader) || bytes > p.size() - headerBytes + extensionCount * p.size()) {
+		TraceEvent(SevError, "RedwoodNodeCorrupt").detail("PageID", pageID).detail("Bytes", bytes);
+		throw file_corrupt();
+	}
+
+	if (!extensionCount) {
+		node->node = BTreeNodeRef( p.substr( headerBytes, bytes ) );
+		return node;
+	}
+
+	state std::vector<Future<Reference<const IPage>>> extensions;
+	for (int i = 1; i < node->pageIDs.size(); i++)
+		extensions.push_back( pager->readPage( node->pageIDs[i] ) );
+	wait( waitForAll( extensions ) );
+
+	node->bytes = makeString( bytes );
+	uint8_t* out = mutateString( node->bytes );
+	int first = std::min<int>( bytes, node->page->size() - headerBytes );
+	memcpy( out, node->page->begin() + headerBytes, first );
+	int offset = first;
+	for (auto& e : extensions) {
+		int n = std::min<int>( bytes - offset, e.get()->size() );
+		memcpy( out + offset, e.get()->begin(), n );
+		offset += n;
+	}
+	node->node = BTreeNodeRef( node->bytes );
+	return node;
+}
+
+// The versions of the roots in use by cursors, which their pages must outlive
+struct VersionedBTreeReaders : ReferenceCounted<VersionedBTreeReaders>, NonCopyable {
+	std::multiset<Version> versions;
+};
+
+class VersionedBTreeCursor : public IStoreCursor, public ReferenceCounted<VersionedBTreeCursor>, public FastAllocated<VersionedBTreeCursor>, NonCopyable {
+public:
+	VersionedBTreeCursor( IPager* pager, LogicalPageID root, Version rootVersion, Reference<VersionedBTreeReaders> readers )
+		: pager(pager), root(root), rootVersion(rootVersion), readers(readers)
+	{
+		readers->versions.insert( rootVersion );
+	}
+	virtual ~VersionedBTreeCursor() {
+		readers->versions.erase( readers->versions.find( rootVersion ) );
+	}
+
+	virtual Future<Void> findFirstEqualOrGreater( KeyRef key ) { return seek( this, key, false ); }
+	virtual Future<Void> findLastLessOrEqual( KeyRef key ) { return seek( this, key, true ); }
+	virtual Future<Void> next() { return move( this, true ); }
+	virtual Future<Void> prev() { return move( this, false ); }
+
+	virtual bool isValid() { return !path.empty(); }
+	virtual KeyRef getKey() { return path.back().node->node.key( path.back().index ); }
+	virtual ValueRef getValue() { return path.back().node->node.value( path.back().index ); }
+
+	virtual void addref() { ReferenceCounted<VersionedBTreeCursor>::addref(); }
+	virtual void delref() { ReferenceCounted<VersionedBTreeCursor>::delref(); }
+
+private:
+	struct PathEntry {
+		Reference<BTreeNode> node;
+		int index;
+
+		PathEntry( Reference<BTreeNode> const& node, int index ) : node(node), index(index) {}
+	};
+
+	IPager* pager;
+	LogicalPageID root;
+	Version rootVersion;
+	Reference<VersionedBTreeReaders> readers;
+	std::vector<PathEntry> path;	// From the root to the current leaf; empty if the cursor is not valid
+
+	ACTOR static Future<Void> seek( VersionedBTreeCursor* self, Key key, bool lessOrEqual ) {
+		self->path.clear();
+		state Reference<BTreeNode> node = wait( readBTreeNode( self->pager, self->root ) );
+		loop {
+			BTreeNodeRef const& n = node->node;
+			if (n.isLeaf()) {
+				self->path.push_back( PathEntry( node, lessOrEqual ? n.upperBound( key ) - 1 : n.lowerBound( key ) ) );
+				break;
+			}
+			int index = n.childIndex( key );
+			self->path.push_back( PathEntry( node, index ) );
+			Reference<BTreeNode> child = wait( readBTreeNode( self->pager, firstChildPage( n.value( index ) ) ) );
+			node = child;
+		}
+		// The key may be beyond the last (or before the first) key of its leaf
+		wait( settle( self, !lessOrEqual ) );
+		return Void();
+	}
+
+	ACTOR static Future<Void> move( VersionedBTreeCursor* self, bool forward ) {
+		if (self->path.empty()) return Void();
+		self->path.back().index += forward ? 1 : -1;
+		wait( settle( self, forward ) );
+		return Void();
+	}
+
+	// If the current leaf position is past either end of the leaf, moves to the nearest key in the given direction
+	ACTOR static Future<Void> settle( VersionedBTreeCursor* self, bool forward ) {
+		loop {
+			if (self->path.empty()) return Void();
+			if (self->path.back().index >= 0 && self->path.back().index < self->path.back().node->node.count()) return Void();
+
+			// Climb to the nearest ancestor with another child in that direction
+			self->path.pop_back();
+			while (self->path.size()) {
+				PathEntry& e = self->path.back();
+				e.index += forward ? 1 : -1;
+				if (e.index >= 0 && e.index < e.node->node.count()) break;
+				self->path.pop_back();
+			}
+			if (self->path.empty()) return Void();
+
+			// Descend to the first (or last) leaf of that child
+			loop {
+				if (self->path.back().node->node.isLeaf()) break;
+				Reference<BTreeNode> child = wait( readBTreeNode( self->pager, firstChildPage( self->path.back().node->node.value( self->path.back().index ) ) ) );
+				self->path.push_back( PathEntry( child, forward ? 0 : child->node.count() - 1 ) );
+			}
+		}
+	}
+};
+
+class VersionedBTree : public IVersionedStore, NonCopyable {
+public:
+	// Takes ownership of the pager
+	VersionedBTree( IPager* pager, std::string const& name, UID id )
+		: pager(pager), name(name), id(id), mutations(new MutationBuffer), writeVersion(invalidVersion), oldestVersion(0), latestVersion(0),
+		  readers(new VersionedBTreeReaders), commitReadLock(SERVER_KNOBS->REDWOOD_COMMIT_CONCURRENT_READS), commitFuture(Void()),
+		  commits(0), nodesWritten(0)
+	{
+	}
+
+	// IClosable
+	virtual Future<Void> getError() { return pager->getError(); }
+	virtual Future<Void> onClosed() { return closedPromise.getFuture(); }
+	virtual void dispose() { shutdown( this, true ); }
+	virtual void close() { shutdown( this, false ); }
+
+	// IVersionedStore
+	virtual KeyValueStoreType getType() { return KeyValueStoreType::SSD_REDWOOD_V1; }
+	virtual StorageBytes getStorageBytes() { return pager->getStorageBytes(); }
+
+	virtual void set( KeyValueRef keyValue ) { mutations->set( keyValue ); }
+	virtual void clear( KeyRangeRef range ) { mutations->clear( range ); }
+
+	virtual void setWriteVersion( Version v ) {
+		ASSERT( v > latestVersion );
+		writeVersion = v;
+	}
+	virtual Version getWriteVersion() { return writeVersion; }
+
+	virtual Future<Void> commit() {
+		ASSERT( writeVersion > latestVersion );
+		Reference<MutationBuffer> m = mutations;
+		mutations = Reference<MutationBuffer>( new MutationBuffer );
+		commitFuture = commit_impl( this, m, writeVersion, commitFuture );
+		return commitFuture;
+	}
+
+	virtual void setOldestVersion( Version v ) {
+		ASSERT( v <= latestVersion );
+		oldestVersion = std::max( oldestVersion, v );
+	}
+	virtual Version getOldestVersion() { return oldestVersion; }
+	virtual Version getLatestVersion() { return latestVersion; }
+
+	virtual Reference<IStoreCursor> readAtVersion( Version v ) {
+		ASSERT( v >= oldestVersion );
+		// The roots of commits which are not yet durable are not readable
+		auto r = roots.upper_bound( std::min( v, latestVersion ) );
+		ASSERT( r != roots.begin() );
+		--r;
+		return Reference<IStoreCursor>( new VersionedBTreeCursor( pager, r->second, r->first, readers ) );
+	}
+
+	virtual Future<Void> init() {
+		commitFuture = init_impl( this );
+		return commitFuture;
+	}
+
+private:
+	// The sets and clears made since the last commit
+	struct MutationBuffer : ReferenceCounted<MutationBuffer>, NonCopyable {
+		Arena arena;
+		std::map<KeyRef, Optional<ValueRef>> points;	// Sets, and clears of single keys; newer than any clear of a range holding them
+		std::map<KeyRef, KeyRef> clears;				// Disjoint ranges, by begin
+
+		void set( KeyValueRef kv ) {
+			auto p = points.find( kv.key );
+			if (p == points.end())
+				points[ KeyRef( arena, kv.key ) ] = ValueRef( arena, kv.value );
+			else
+				p->second = ValueRef( arena, kv.value );
+		}
+
+		void clear( KeyRangeRef range ) {
+			if (range.singleKeyRange()) {
+				auto p = points.find( range.begin );
+				if (p == points.end())
+					points[ KeyRef( arena, range.begin ) ] = Optional<ValueRef>();
+				else
+					p->second = Optional<ValueRef>();
+				return;
+			}
+			if (range.empty()) return;
+			points.erase( points.lower_bound( range.begin ), points.lower_bound( range.end ) );
+
+			KeyRef begin = range.begin, end = range.end;
+			auto c = clears.upper_bound( begin );
+			if (c != clears.begin() && std::prev( c )->second >= begin) {
+				--c;
+				begin = c->first;
+			}
+			while (c != clears.end() && c->first <= end) {
+				end = std::max( end, c->second );
+				c = clears.erase( c );
+			}
+			clears[ KeyRef( arena, begin ) ] = KeyRef( arena, end );
+		}
+
+		// An empty upper bound is unbounded
+		static bool below( KeyRef k, KeyRef upper ) { return !upper.size() || k < upper; }
+
+		bool isCleared( KeyRef k ) const {
+			auto c = clears.upper_bound( k );
+			return c != clears.begin() && k < std::prev( c )->second;
+		}
+
+		bool intersects( KeyRef lower, KeyRef upper ) const {
+			auto p = points.lower_bound( lower );
+			if (p != points.end() && below( p->first, upper )) return true;
+			auto c = clears.upper_bound( lower );
+			if (c != clears.begin() && lower < std::prev( c )->second) return true;
+			return c != clears.end() && below( c->first, upper );
+		}
+
+		// True if a clear covers all of [lower, upper) and nothing was set in it afterwards
+		bool clearsAll( KeyRef lower, KeyRef upper ) const {
+			if (!upper.size()) return false;
+			auto c = clears.upper_bound( lower );
+			if (c == clears.begin() || std::prev( c )->second < upper) return false;
+			auto p = points.lower_bound( lower );
+			return p == points.end() || !(p->first < upper);
+		}
+
+		// The entries of a leaf holding the keys in [lower, upper), with these mutations applied
+		Standalone<VectorRef<KeyValueRef>> apply( BTreeNodeRef const& leaf, KeyRef lower, KeyRef upper ) const {
+			Standalone<VectorRef<KeyValueRef>> result;
+			int i = 0;
+			auto p = points.lower_bound( lower );
+			auto pEnd = upper.size() ? points.lower_bound( upper ) : points.end();
+			while (i < leaf.count() || p != pEnd) {
+				if (p != pEnd && (i == leaf.count() || p->first <= leaf.key( i ))) {
+					if (p->second.present())
+						result.push_back( result.arena(), KeyValueRef( p->first, p->second.get() ) );
+					if (i < leaf.count() && leaf.key( i ) == p->first)
+						++i;
+					++p;
+				} else {
+					if (!isCleared( leaf.key( i ) ))
+						result.push_back( result.arena(), KeyValueRef( leaf.key( i ), leaf.value( i ) ) );
+					++i;
+				}
+			}
+			return result;
+		}
+	};
+
+	// A node written by a commit, and the lowest key its parent should route to it
+	struct ChildLink {
+		Key lowerBound;
+		std::vector<LogicalPageID> pages;
+
+		ChildLink() {}
+		ChildLink( KeyRef lowerBound, std::vector<LogicalPageID> const& pages ) : lowerBound(lowerBound), pages(pages) {}
+
+		ValueRef pagesRef() const { return ValueRef( (uint8_t const*)&pages[0], pages.size() * sizeof(LogicalPageID) ); }
+	};
+
+	// Persisted as the pager's meta key
+	struct MetaKey {
+		std::vector<std::pair<Version, LogicalPageID>> roots;
+
+		template <class Ar>
+		void serialize( Ar& ar ) {
+			ar & roots;
+		}
+	};
+
+	IPager* pager;
+	std::string name;
+	UID id;
+	Reference<MutationBuffer> mutations;
+	std::map<Version, LogicalPageID> roots;		// Of the commits in the window, from the oldest readable one
+	Version writeVersion, oldestVersion, latestVersion;
+	Reference<VersionedBTreeReaders> readers;
+	FlowLock commitReadLock;
+	Future<Void> commitFuture;
+	Promise<Void> closedPromise;
+
+	int64_t commits, nodesWritten;
+
+	// The most roots which fit in the meta key
+	int maxRoots() { return (pager->getMaxMetaKeySize() - sizeof(uint64_t) - sizeof(uint32_t)) / (sizeof(Version) + sizeof(LogicalPageID)); }
+
+	Key makeMetaKey() const {
+		MetaKey meta;
+		meta.roots.assign( roots.begin(), roots.end() );
+		return BinaryWriter::toValue( meta, IncludeVersion() );
+	}
+
+	void freeNode( Reference<BTreeNode> const& node, Version v ) {
+		for (auto p : node->pageIDs)
+			pager->freePage( p, v );
+	}
+
+	ACTOR static Future<Reference<BTreeNode>> readNodeForCommit( VersionedBTree* self, LogicalPageID pageID ) {
+		wait( self->commitReadLock.take() );
+		state FlowLock::Releaser releaser( self->commitReadLock );
+		Reference<BTreeNode> node = wait( readBTreeNode( self->pager, pageID ) );
+		return node;
+	}
+
+	// The index of the first entry of each node that the entries of a level should be split into, and then the number
+	// of entries.  Nodes are split evenly between as many pages as the entries need, but an internal node has at least
+	// two children and a leaf holds at least one entry, spilling into further pages if it must.
+	static std::vector<int> splitPoints( int level, VectorRef<KeyValueRef> entries, int usablePageSize ) {
+		int capacity = usablePageSize - sizeof(uint32_t) - sizeof(BTreeNodeHeader);
+		int64_t total = 0;
+		for (auto& e : entries)
+			total += BTreeNodeRef::entryBytes( e );
+		int64_t nodeCount = std::max<int64_t>( 1, (total + capacity - 1) / capacity );
+		int64_t target = (total + nodeCount - 1) / nodeCount;
+		int minEntries = level == 1 ? 1 : 2;
+
+		std::vector<int> starts( 1, 0 );
+		int i = 0;
+		while (true) {
+			int64_t bytes = 0;
+			int start = i;
+			while (i < entries.size() && (i - start < minEntries || bytes + BTreeNodeRef::entryBytes( entries[i] ) <= target))
+				bytes += BTreeNodeRef::entryBytes( entries[i++] );
+			if (i == entries.size()) break;
+			starts.push_back( i );
+		}
+		if (starts.size() > 1 && entries.size() - starts.back() < minEntries)
+			starts.pop_back();
+		starts.push_back( entries.size() );
+		return starts;
+	}
+
+	// Writes the entries as one or more nodes of the given level, with the lower bound of the first node given
+	ACTOR static Future<std::vector<ChildLink>> writeNodes( VersionedBTree* self, int level, Standalone<VectorRef<KeyValueRef>> entries, Key lowerBound ) {
+		state std::vector<int> starts = splitPoints( level, entries, self->pager->getUsablePageSize() );
+		state std::vector<Future<std::vector<LogicalPageID>>> nodes;
+		for (int n = 0; n + 1 < starts.size(); n++)
+			nodes.push_back( writeNode( self, BTreeNodeRef::build( level, entries.begin() + starts[n], entries.begin() + starts[n+1] ) ) );
+		wait( waitForAll( nodes ) );
+
+		std::vector<ChildLink> result;
+		for (int n = 0; n < nodes.size(); n++)
+			result.push_back( ChildLink( n ? entries[starts[n]].key : lowerBound, nodes[n].get() ) );
+		return result;
+	}
+
+	ACTOR static Future<std::vector<LogicalPageID>> writeNode( VersionedBTree* self, Standalone<StringRef> node ) {
+		state int usable = self->pager->getUsablePageSize();
+		state int extensionCount = 0;
+		while ((extensionCount + 1) * usable - (int)sizeof(uint32_t) - extensionCount * (int)sizeof(LogicalPageID) < node.size())
+			++extensionCount;
+
+		state std::vector<Future<LogicalPageID>> ids;
+		for (int i = 0; i <= extensionCount; i++)
+			ids.push_back( self->pager->newPageID() );
+		wait( waitForAll( ids ) );
+
+		std::vector<LogicalPageID> pages;
+		for (auto& id : ids)
+			pages.push_back( id.get() );
+
+		Reference<IPage> first = self->pager->newPageBuffer();
+		uint8_t* p = first->mutate();
+		*(uint32_t*)p = extensionCount;
+		if (extensionCount)
+			memcpy( p + sizeof(uint32_t), &pages[1], extensionCount * sizeof(LogicalPageID) );
+		int headerBytes = sizeof(uint32_t) + extensionCount * sizeof(LogicalPageID);
+		int offset = std::min( node.size(), usable - headerBytes );
+		memcpy( p + headerBytes, node.begin(), offset );
+		self->pager->updatePage( pages[0], first );
+		for (int i = 1; i < pages.size(); i++) {
+			Reference<IPage> page = self->pager->newPageBuffer();
+			int n = std::min( node.size() - offset, usable );
+			memcpy( page->mutate(), node.begin() + offset, n );
+			offset += n;
+			self->pager->updatePage( pages[i], page );
+		}
+		ASSERT( offset == node.size() );
+		++self->nodesWritten;
+		return pages;
+	}
+
+	// Frees every page of a subtree, without reading its leaves
+	ACTOR static Future<Void> freeSubtree( VersionedBTree* self, std::vector<LogicalPageID> pages, int level, Version v ) {
+		if (level == 1) {
+			for (auto p : pages)
+				self->pager->freePage( p, v );
+			return Void();
+		}
+		state Reference<BTreeNode> node = wait( readNodeForCommit( self, pages[0] ) );
+		state std::vector<Future<Void>> children;
+		for (int i = 0; i < node->node.count(); i++)
+			children.push_back( freeSubtree( self, childPages( node->node.value( i ) ), level - 1, v ) );
+		wait( waitForAll( children ) );
+		self->freeNode( node, v );
+		return Void();
+	}
+
+	// Applies the mutations in [lowerBound, upperBound) to the subtree, returning the nodes which replace it
+	ACTOR static Future<std::vector<ChildLink>> commitSubtree( VersionedBTree* self, MutationBuffer* mutations, std::vector<LogicalPageID> pages, int level, KeyRef lowerBound, KeyRef upperBound, Version v ) {
+		if (!mutations->intersects( lowerBound, upperBound ))
+			return std::vector<ChildLink>( 1, ChildLink( lowerBound, pages ) );
+		if (mutations->clearsAll( lowerBound, upperBound )) {
+			wait( freeSubtree( self, pages, level, v ) );
+			return std::vector<ChildLink>();
+		}
+
+		state Reference<BTreeNode> node = wait( readNodeForCommit( self, pages[0] ) );
+		state Standalone<VectorRef<KeyValueRef>> entries;
+		state std::vector<Future<std::vector<ChildLink>>> children;
+		if (node->node.isLeaf()) {
+			entries = mutations->apply( node->node, lowerBound, upperBound );
+		} else {
+			BTreeNodeRef const& n = node->node;
+			for (int i = 0; i < n.count(); i++)
+				children.push_back( commitSubtree( self, mutations, childPages( n.value( i ) ), level - 1, i ? n.key( i ) : lowerBound, i + 1 < n.count() ? n.key( i + 1 ) : upperBound, v ) );
+			wait( waitForAll( children ) );
+
+			bool changed = false;
+			for (int i = 0; i < children.size(); i++) {
+				auto const& links = children[i].get();
+				if (links.size() != 1 || links[0].pages != childPages( node->node.value( i ) ))
+					changed = true;
+				for (auto& link : links)
+					entries.push_back_deep( entries.arena(), KeyValueRef( link.lowerBound, link.pagesRef() ) );
+			}
+			if (!changed)
+				return std::vector<ChildLink>( 1, ChildLink( lowerBound, pages ) );
+		}
+
+		self->freeNode( node, v );
+		if (entries.empty())
+			return std::vector<ChildLink>();
+		std::vector<ChildLink> result = wait( writeNodes( self, node->node.level(), entries, lowerBound ) );
+		return result;
+	}
+
+	ACTOR static Future<Void> commit_impl( VersionedBTree* self, Reference<MutationBuffer> mutations, Version v, Future<Void> previous ) {
+		wait( previous );
+
+		state LogicalPageID oldRoot = self->roots.rbegin()->second;
+		state Reference<BTreeNode> root = wait( readNodeForCommit( self, oldRoot ) );
+		state int level = root->node.level();
+		state std::vector<ChildLink> links = wait( commitSubtree( self, mutations.getPtr(), root->pageIDs, level, KeyRef(), KeyRef(), v ) );
+		state Standalone<VectorRef<KeyValueRef>> entries;
+		if (links.empty()) {
+			std::vector<ChildLink> emptyRoot = wait( writeNodes( self, 1, Standalone<VectorRef<KeyValueRef>>(), Key() ) );
+			links = emptyRoot;
+			level = 1;
+		}
+		while (links.size() > 1) {
+			entries = Standalone<VectorRef<KeyValueRef>>();
+			for (auto& link : links)
+				entries.push_back_deep( entries.arena(), KeyValueRef( link.lowerBound, link.pagesRef() ) );
+			std::vector<ChildLink> parents = wait( writeNodes( self, ++level, entries, Key() ) );
+			links = parents;
+		}
+
+		// A root with only one child is replaced by the child
+		state LogicalPageID newRoot = links[0].pages[0];
+		loop {
+			Reference<BTreeNode> node = wait( readNodeForCommit( self, newRoot ) );
+			if (node->node.isLeaf() || node->node.count() > 1) break;
+			self->freeNode( node, v );
+			newRoot = firstChildPage( node->node.value( 0 ) );
+		}
+
+		if (newRoot != oldRoot)
+			self->roots[v] = newRoot;
+
+		// Forget the roots which versions from the oldest one on no longer need, and any which do not fit in the meta key
+		while (self->roots.size() > 1 && std::next( self->roots.begin() )->first <= self->oldestVersion)
+			self->roots.erase( self->roots.begin() );
+		if (self->roots.size() > self->maxRoots()) {
+			TraceEvent(SevWarnAlways, "RedwoodVersionHistoryTruncated", self->id).suppressFor(1.0).detail("Roots", self->roots.size()).detail("OldestVersion", self->oldestVersion);
+			while (self->roots.size() > self->maxRoots())
+				self->roots.erase( self->roots.begin() );
+			self->oldestVersion = std::max( self->oldestVersion, self->roots.begin()->first );
+		}
+
+		// Pages replaced since the oldest root, or the oldest root in use by a cursor, must not be reused
+		Version oldestRoot = self->roots.begin()->first;
+		if (self->readers->versions.size())
+			oldestRoot = std::min( oldestRoot, *self->readers->versions.begin() );
+		self->pager->setOldestVersion( std::max( oldestRoot, self->pager->getOldestVersion() ) );
+		self->pager->setMetaKey( self->makeMetaKey() );
+		wait( self->pager->commit( v ) );
+
+		self->latestVersion = v;
+		++self->commits;
+		return Void();
+	}
+
+	ACTOR static Future<Void> init_impl( VersionedBTree* self ) {
+		wait( self->pager->init() );
+		Key meta = self->pager->getMetaKey();
+		if (meta.size()) {
+			MetaKey m = BinaryReader::fromStringRef<MetaKey>( meta, IncludeVersion() );
+			self->roots.insert( m.roots.begin(), m.roots.end() );
+			self->latestVersion = self->pager->getLatestVersion();
+			self->oldestVersion = std::max( self->pager->getOldestVersion(), self->roots.begin()->first );
+		} else {
+			// A new tree, whose root is an empty leaf
+			std::vector<ChildLink> links = wait( writeNodes( self, 1, Standalone<VectorRef<KeyValueRef>>(), Key() ) );
+			self->roots[0] = links[0].pages[0];
+			self->pager->setMetaKey( self->makeMetaKey() );
+			wait( self->pager->commit( 0 ) );
+		}
+		TraceEvent("RedwoodRecovered", self->id)
+			.detail("Name", self->name)
+			.detail("LatestVersion", self->latestVersion)
+			.detail("OldestVersion", self->oldestVersion)
+			.detail("Roots", self->roots.size());
+		return Void();
+	}
+
+	ACTOR static void shutdown( VersionedBTree* self, bool dispose ) {
+		TraceEvent("RedwoodShutdown", self->id).detail("Name", self->name).detail("Dispose", dispose)
+			.detail("Commits", self->commits).detail("NodesWritten", self->nodesWritten);
+		self->commitFuture.cancel();
+		state Future<Void> closed = self->pager->onClosed();
+		if (dispose)
+			self->pager->dispose();
+		else
+			self->pager->close();
+		wait( closed );
+		self->closedPromise.send( Void() );
+		delete self;
+	}
+};
+
+// An IKeyValueStore over a VersionedBTree which keeps only its latest version, reading at the last commit
+class KeyValueStoreRedwoodUnversioned : public IKeyValueStore, NonCopyable {
+public:
+	KeyValueStoreRedwoodUnversioned( std::string const& filename, UID logID )
+		: tree( new VersionedBTree( new COWPager( SERVER_KNOBS->REDWOOD_DEFAULT_PAGE_SIZE, filename, logID ), filename, logID ) ), writeVersion(0)
+	{
+		recovering = recover( this );
+	}
+
+	// IClosable
+	virtual Future<Void> getError() { return tree->getError(); }
+	virtual Future<Void> onClosed() { return closed.getFuture(); }
+	virtual void dispose() { doClose( this, true ); }
+	virtual void close() { doClose( this, false ); }
+
+	// IKeyValueStore
+	virtual KeyValueStoreType getType() { return KeyValueStoreType::SSD_REDWOOD_V1; }
+	virtual StorageBytes getStorageBytes() { return tree->getStorageBytes(); }
+
+	virtual void set( KeyValueRef keyValue, const Arena* arena = NULL ) { tree->set( keyValue ); }
+	virtual void clear( KeyRangeRef range, const Arena* arena = NULL ) { tree->clear( range ); }
+
+	virtual Future<Void> commit( bool sequential = false ) {
+		if (!recovering.isReady() || recovering.isError()) return waitAndCommit( this );
+
+		tree->setWriteVersion( ++writeVersion );
+		return forgetOldVersions( this, tree->commit(), writeVersion );
+	}
+
+	virtual Future<Optional<Value>> readValue( KeyRef key, Optional<UID> debugID = Optional<UID>() ) {
+		return readValue_impl( this, key, std::numeric_limits<int>::max() );
+	}
+
+	virtual Future<Optional<Value>> readValuePrefix( KeyRef key, int maxLength, Optional<UID> debugID = Optional<UID>() ) {
+		return readValue_impl( this, key, maxLength );
+	}
+
+	// If rowLimit>=0, reads first rows sorted ascending, otherwise reads last rows sorted descending
+	// The total size of the returned value (less the last entry) will be less than byteLimit
+	virtual Future<Standalone<VectorRef<KeyValueRef>>> readRange( KeyRangeRef keys, int rowLimit = 1<<30, int byteLimit = 1<<30 ) {
+		return readRange_impl( this, keys, rowLimit, byteLimit );
+	}
+
+private:
+	VersionedBTree* tree;
+	Version writeVersion;		// Each commit is one version
+	Future<Void> recovering;
+	Promise<Void> closed;
+
+	ACTOR static Future<Void> recover( KeyValueStoreRedwoodUnversioned* self ) {
+		wait( self->tree->init() );
+		self->writeVersion = self->tree->getLatestVersion();
+		return Void();
+	}
+
+	// Once the commit is durable no earlier version needs to be read
+	ACTOR static Future<Void> forgetOldVersions( KeyValueStoreRedwoodUnversioned* self, Future<Void> commit, Version v ) {
+		wait( commit );
+		self->tree->setOldestVersion( v );
+		return Void();
+	}
+
+	ACTOR static Future<Void> waitAndCommit( KeyValueStoreRedwoodUnversioned* self ) {
+		wait( self->recovering );
+		wait( self->commit() );
+		return Void();
+	}
+
+	ACTOR static Future<Optional<Value>> readValue_impl( KeyValueStoreRedwoodUnversioned* self, Key key, int maxLength ) {
+		wait( self->recovering );
+		state Reference<IStoreCursor> cur = self->tree->readAtVersion( self->tree->getLatestVersion() );
+		wait( cur->findFirstEqualOrGreater( key ) );
+		if (cur->isValid() && cur->getKey() == key)
+			return Value( cur->getValue().substr( 0, std::min( maxLength, cur->getValue().size() ) ) );
+		return Optional<Value>();
+	}
+
+	ACTOR static Future<Standalone<VectorRef<KeyValueRef>>> readRange_impl( KeyValueStoreRedwoodUnversioned* self, KeyRange keys, int rowLimit, int byteLimit ) {
+		wait( self->recovering );
+		state Standalone<VectorRef<KeyValueRef>> result;
+		if (!rowLimit || keys.begin >= keys.end) return result;
+
+		state int accumulatedBytes = 0;
+		state Reference<IStoreCursor> cur = self->tree->readAtVersion( self->tree->getLatestVersion() );
+		if (rowLimit > 0) {
+			wait( cur->findFirstEqualOrGreater( keys.begin ) );
+			while (cur->isValid() && cur->getKey() < keys.end) {
+				KeyValueRef kv( KeyRef( result.arena(), cur->getKey() ), ValueRef( result.arena(), cur->getValue() ) );
+				accumulatedBytes += sizeof(KeyValueRef) + kv.expectedSize();
+				result.push_back( result.arena(), kv );
+				if (--rowLimit == 0 || accumulatedBytes >= byteLimit) break;
+				wait( cur->next() );
+			}
+		} else {
+			wait( cur->findLastLessOrEqual( keys.end ) );
+			if (cur->isValid() && cur->getKey() == keys.end)
+				wait( cur->prev() );
+			while (cur->isValid() && cur->getKey() >= keys.begin) {
+				KeyValueRef kv( KeyRef( result.arena(), cur->getKey() ), ValueRef( result.arena(), cur->getValue() ) );
+				accumulatedBytes += sizeof(KeyValueRef) + kv.expectedSize();
+				result.push_back( result.arena(), kv );
+				if (++rowLimit == 0 || accumulatedBytes >= byteLimit) break;
+				wait( cur->prev() );
+			}
+		}
+		return result;
+	}
+
+	ACTOR static void doClose( KeyValueStoreRedwoodUnversioned* self, bool deleteOnClose ) {
+		self->recovering.cancel();
+		state Future<Void> treeClosed = self->tree->onClosed();
+		if (deleteOnClose)
+			self->tree->dispose();
+		else
+			self->tree->close();
+		wait( treeClosed );
+		self->closed.send( Void() );
+		delete self;
+	}
+};
+
+IKeyValueStore* keyValueStoreRedwoodV1( std::string const& filename, UID logID ) {
+	TraceEvent("RedwoodOpening", logID).detail("Filename", filename);
+	return new KeyValueStoreRedwoodUnversioned( filename, logID );
+}
+
+ACTOR static Future<Void> deleteTestFile( std::string filename ) {
+	if (fileExists( filename ))
+		wait( IAsyncFileSystem::filesystem()->deleteFile( filename, true ) );
+	return Void();
+}
+
+ACTOR static Future<VersionedBTree*> openTestBTree( std::string filename, int pageSize ) {
+	state VersionedBTree* btree = new VersionedBTree( new COWPager( pageSize, filename, UID() ), filename, UID() );
+	wait( btree->init() );
+	return btree;
+}
+
+ACTOR static Future<Void> closeTestBTree( VersionedBTree* btree ) {
+	state Future<Void> closed = btree->onClosed();
+	btree->close();
+	wait( closed );
+	return Void();
+}
+
+static std::string randomTestKey( int keySpace ) {
+	std::string k = format( "%06d", g_random->randomInt( 0, keySpace ) );
+	if (g_random->random01() < 0.1)
+		k += std::string( g_random->randomInt( 0, 2000 ), 'k' );
+	return k;
+}
+
+static std::string randomTestValue() {
+	int size = g_random->random01() < 0.05 ? g_random->randomInt( 0, 20000 ) : g_random->randomInt( 0, 100 );
+	return std::string( size, (char)g_random->randomInt( 'a', 'z' + 1 ) );
+}
+
+// Checks every key of a version, and some ranges, against the model
+ACTOR static Future<Void> verifyTestVersion( VersionedBTree* btree, Version v, std::map<std::string, std::string> const* model ) {
+	state Reference<IStoreCursor> cur = btree->readAtVersion( v );
+	state std::map<std::string, std::string>::const_iterator i = model->begin();
+	wait( cur->findFirstEqualOrGreater( StringRef() ) );
+	while (cur->isValid()) {
+		ASSERT( i != model->end() && cur->getKey() == StringRef( i->first ) && cur->getValue() == StringRef( i->second ) );
+		++i;
+		wait( cur->next() );
+	}
+	ASSERT( i == model->end() );
+
+	state std::map<std::string, std::string>::const_reverse_iterator r = model->rbegin();
+	wait( cur->findLastLessOrEqual( LiteralStringRef("\xff\xff\xff") ) );
+	while (cur->isValid()) {
+		ASSERT( r != model->rend() && cur->getKey() == StringRef( r->first ) && cur->getValue() == StringRef( r->second ) );
+		++r;
+		wait( cur->prev() );
+	}
+	ASSERT( r == model->rend() );
+
+	state int n;
+	state std::string k;
+	for (n = 0; n < 20; n++) {
+		k = randomTestKey( 3000 );
+		wait( cur->findFirstEqualOrGreater( StringRef( k ) ) );
+		auto ge = model->lower_bound( k );
+		ASSERT( cur->isValid() == (ge != model->end()) );
+		if (cur->isValid()) ASSERT( cur->getKey() == StringRef( ge->first ) );
+
+		wait( cur->findLastLessOrEqual( StringRef( k ) ) );
+		auto le = model->upper_bound( k );
+		ASSERT( cur->isValid() == (le != model->begin()) );
+		if (cur->isValid()) ASSERT( cur->getKey() == StringRef( std::prev( le )->first ) );
+	}
+	return Void();
+}
+
+TEST_CASE("/redwood/correctness/btree") {
+	state std::string filename = "unittest_pageFile.redwood";
+	state int pageSize = g_random->coinflip() ? 4096 : 8192;
+	wait( deleteTestFile( filename ) );
+	state VersionedBTree* btree = wait( openTestBTree( filename, pageSize ) );
+
+	// The contents as of each readable commit, and as written since the last one
+	state std::map<Version, std::map<std::string, std::string>> committed;
+	state std::map<std::string, std::string> written;
+	committed[0] = written;
+
+	state int keySpace = g_random->randomInt( 10, 3000 );
+	state int commits = g_random->randomInt( 20, 200 );
+	state Version v = 0;
+	state Version oldest;
+	state Version readVersion;
+	state int c;
+	state int ops;
+	state int op;
+	for (c = 0; c < commits; c++) {
+		ops = g_random->randomInt( 0, 300 );
+		for (op = 0; op < ops; op++) {
+			double r = g_random->random01();
+			if (r < 0.8) {
+				std::string k = randomTestKey( keySpace ), val = randomTestValue();
+				btree->set( KeyValueRef( StringRef( k ), StringRef( val ) ) );
+				written[k] = val;
+			} else if (r < 0.9) {
+				std::string k = randomTestKey( keySpace );
+				btree->clear( singleKeyRange( StringRef( k ) ) );
+				written.erase( k );
+			} else {
+				std::string b = randomTestKey( keySpace ), e = randomTestKey( keySpace );
+				if (g_random->random01() < 0.05) e = "\xff";
+				if (e < b) std::swap( b, e );
+				btree->clear( KeyRangeRef( StringRef( b ), StringRef( e ) ) );
+				written.erase( written.lower_bound( b ), written.lower_bound( e ) );
+			}
+		}
+
+		v += g_random->randomInt( 1, 5 );
+		btree->setWriteVersion( v );
+		wait( btree->commit() );
+		committed[v] = written;
+		ASSERT( btree->getLatestVersion() == v );
+
+		if (g_random->random01() < 0.3) {
+			auto forget = committed.upper_bound( g_random->randomInt64( btree->getOldestVersion(), v + 1 ) );
+			btree->setOldestVersion( std::prev( forget )->first );
+		}
+		while (committed.size() > 1 && std::next( committed.begin() )->first <= btree->getOldestVersion())
+			committed.erase( committed.begin() );
+
+		// Reopen, losing anything written since the last commit
+		if (g_random->random01() < 0.1) {
+			if (g_random->coinflip()) {
+				std::string k = randomTestKey( keySpace );
+				btree->set( KeyValueRef( StringRef( k ), LiteralStringRef("uncommitted") ) );
+			}
+			oldest = btree->getOldestVersion();
+			wait( closeTestBTree( btree ) );
+			VersionedBTree* reopened = wait( openTestBTree( filename, pageSize ) );
+			btree = reopened;
+			ASSERT( btree->getLatestVersion() == v );
+			// The oldest version set since the last commit is not durable
+			ASSERT( btree->getOldestVersion() <= oldest );
+			btree->setOldestVersion( oldest );
+			while (committed.size() > 1 && std::next( committed.begin() )->first <= btree->getOldestVersion())
+				committed.erase( committed.begin() );
+		}
+
+		// Read the latest version, and another readable one
+		wait( verifyTestVersion( btree, v, &committed.rbegin()->second ) );
+		readVersion = g_random->randomInt64( btree->getOldestVersion(), v + 1 );
+		wait( verifyTestVersion( btree, readVersion, &std::prev( committed.upper_bound( readVersion ) )->second ) );
+	}
+
+	wait( closeTestBTree( btree ) );
+	wait( deleteTestFile( filename ) );
+	return Void();
+}
+
+TEST_CASE("!/redwood/performance/set") {
+	state std::string filename = "unittest_pageFile.redwood";
+	wait( deleteTestFile( filename ) );
+	state VersionedBTree* btree = wait( openTestBTree( filename, SERVER_KNOBS->REDWOOD_DEFAULT_PAGE_SIZE ) );
+
+	state int64_t records = 1000000;
+	state int recordsPerCommit = 10000;
+	state int keyBytes = 16;
+	state int valueBytes = 96;
+	state std::string value = std::string( valueBytes, 'v' );
+	state int64_t kvBytes = 0;
+	state Version v = btree->getLatestVersion();
+	state double start = timer();
+	state int64_t i;
+	for (i = 0; i < records; i++) {
+		std::string k = format( "%0*llx", keyBytes, (long long)g_random->randomUniqueID().first() ).substr( 0, keyBytes );
+		btree->set( KeyValueRef( StringRef( k ), StringRef( value ) ) );
+		kvBytes += keyBytes + valueBytes;
+		if ((i + 1) % recordsPerCommit == 0) {
+			btree->setWriteVersion( ++v );
+			wait( btree->commit() );
+			btree->setOldestVersion( v );
+		}
+	}
+	btree->setWriteVersion( ++v );
+	wait( btree->commit() );
+	state double elapsed = timer() - start;
+	printf( "Inserted %lld records of %d bytes in %.2f seconds: %.0f records/s, %.2f MB/s\n", (long long)records, keyBytes + valueBytes, elapsed, records / elapsed, kvBytes / elapsed / 1e6 );
+
+	start = timer();
+	state Reference<IStoreCursor> cur = btree->readAtVersion( v );
+	for (i = 0; i < 100000; i++) {
+		std::string k = format( "%0*llx", keyBytes, (long long)g_random->randomUniqueID().first() ).substr( 0, keyBytes );
+		wait( cur->findFirstEqualOrGreater( StringRef( k ) ) );
+	}
+	elapsed = timer() - start;
+	printf( "Point reads: %.0f reads/s\n", 100000 / elapsed );
+
+	start = timer();
+	state int64_t scanned = 0;
+	wait( cur->findFirstEqualOrGreater( StringRef() ) );
+	while (cur->isValid()) {
+		++scanned;
+		wait( cur->next() );
+	}
+	elapsed = timer() - start;
+	ASSERT( scanned == records );
+	printf( "Scanned %lld records: %.0f records/s\n", (long long)scanned, scanned / elapsed );
+
+	StorageBytes sb = btree->getStorageBytes();
+	printf( "File size: %.2f MB for %.2f MB of records\n", sb.used / 1e6, kvBytes / 1e6 );
+
+	cur = Reference<IStoreCursor>();
+	wait( closeTestBTree( btree ) );
+	wait( deleteTestFile( filename ) );
+	return Void();
+}
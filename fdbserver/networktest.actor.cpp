@@ -19,6 +19,7 @@
  */
 
 #include "NetworkTest.h"
+#include "Knobs.h"
 #include "flow/actorcompiler.h"  // This must be the last #include.
 
 UID WLTOKEN_NETWORKTEST( -1, 2 );
@@ -33,46 +34,67 @@ NetworkTestInterface::NetworkTestInterface( INetwork* local )
 	test.makeWellKnownEndpoint( WLTOKEN_NETWORKTEST, TaskDefaultEndpoint );
 }
 
+// Reports message and byte rates, and the CPU time of this process per GB, which is what FlowTransport's send and receive
+// paths cost when the network is not the bottleneck
+static void logThroughput( const char* what, int messages, int64_t bytes, double elapsed, double cpuSeconds ) {
+	auto spd = messages / elapsed;
+	fprintf( stderr, "%s per second: %f (%f us), %f MB/s, %f CPU seconds per GB\n", what, spd, 1e6/spd, bytes / elapsed / 1e6,
+		bytes ? cpuSeconds / (bytes / 1e9) : 0.0 );
+}
+
 ACTOR Future<Void> networkTestServer() {
 	state NetworkTestInterface interf( g_network );
 	state Future<Void> logging = delay( 1.0 );
 	state double lastTime = now();
+	state double lastCPU = getProcessorTimeProcess();
 	state int sent = 0;
+	state int64_t bytesSent = 0;
+	state Value replyValue;
 
 	loop {
 		choose {
 			when( NetworkTestRequest req = waitNext( interf.test.getFuture() ) ) {
-				req.reply.send( NetworkTestReply( Value( std::string( req.replySize, '.' ) ) ) );
+				// Every reply shares one value, so that this measures sending it rather than building it
+				if (replyValue.size() != req.replySize) {
+					replyValue = makeString( req.replySize );
+					memset( mutateString(replyValue), '.', req.replySize );
+				}
+				req.reply.send( NetworkTestReply( replyValue ) );
 				sent++;
+				bytesSent += req.replySize;
 			}
 			when( wait( logging ) ) {
-				auto spd = sent / (now() - lastTime);
-				fprintf( stderr, "responses per second: %f (%f us)\n", spd, 1e6/spd );
+				double cpu = getProcessorTimeProcess();
+				logThroughput( "responses", sent, bytesSent, now() - lastTime, cpu - lastCPU );
 				lastTime = now();
+				lastCPU = cpu;
 				sent = 0;
+				bytesSent = 0;
 				logging = delay( 1.0 );
 			}
 		}
 	}
 }
 
-ACTOR Future<Void> testClient( std::vector<NetworkTestInterface> interfs, int* sent ) {
-	state double lastTime = now();
-
+ACTOR Future<Void> testClient( std::vector<NetworkTestInterface> interfs, int* sent, int64_t* bytesReceived ) {
 	loop {
-		NetworkTestReply rep = wait(  retryBrokenPromise(interfs[g_random->randomInt(0, interfs.size())].test, NetworkTestRequest( LiteralStringRef("."), 600000 ) ) );
+		NetworkTestReply rep = wait(  retryBrokenPromise(interfs[g_random->randomInt(0, interfs.size())].test, NetworkTestRequest( LiteralStringRef("."), SERVER_KNOBS->NETWORK_TEST_REPLY_SIZE ) ) );
 		(*sent)++;
+		(*bytesReceived) += rep.value.size();
 	}
 }
 
-ACTOR Future<Void> logger( int* sent ) {
+ACTOR Future<Void> logger( int* sent, int64_t* bytesReceived ) {
 	state double lastTime = now();
+	state double lastCPU = getProcessorTimeProcess();
 	loop {
 		wait( delay(1.0) );
-		auto spd = *sent / (now() - lastTime);
-		fprintf( stderr, "messages per second: %f\n", spd);
+		double cpu = getProcessorTimeProcess();
+		logThroughput( "messages", *sent, *bytesReceived, now() - lastTime, cpu - lastCPU );
 		lastTime = now();
+		lastCPU = cpu;
 		*sent = 0;
+		*bytesReceived = 0;
 	}
 }
 
@@ -144,15 +166,16 @@ ACTOR Future<Void> networkTestClient( std:: string testServers ) {
 	state std::vector<NetworkTestInterface> interfs;
 	state std::vector<NetworkAddress> servers = NetworkAddress::parseList(testServers);
 	state int sent = 0;
+	state int64_t bytesReceived = 0;
 
 	for( int i = 0; i < servers.size(); i++ ) {
 		interfs.push_back( NetworkTestInterface( servers[i] ) );
 	}
 
 	state std::vector<Future<Void>> clients;
-	for( int i = 0; i < 30; i++ )
-		clients.push_back( testClient( interfs, &sent ) );
-	clients.push_back( logger( &sent ) );
+	for( int i = 0; i < SERVER_KNOBS->NETWORK_TEST_REQUESTS_IN_FLIGHT; i++ )
+		clients.push_back( testClient( interfs, &sent, &bytesReceived ) );
+	clients.push_back( logger( &sent, &bytesReceived ) );
 
 	wait( waitForAll( clients ) );
 	return Void();
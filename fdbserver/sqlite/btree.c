@@ -7168,6 +7168,41 @@ SQLITE_PRIVATE int sqlite3BtreeLazyDelete(BtCursor* cursor, int* stackBegin, int
   return SQLITE_OK;
 }
 
+/*
+** For read-ahead during range scans.  If the cursor is on a leaf page that has a parent, sets *pParent to the parent's
+** page number and *piChild to the index of the leaf among the parent's children, and returns the number of children the
+** parent has.  Otherwise returns 0.
+*/
+SQLITE_PRIVATE int sqlite3BtreeLeafPosition(BtCursor *pCur, u32 *pParent, int *piChild){
+  MemPage *pParentPage;
+  if( pCur->eState!=CURSOR_VALID || pCur->iPage<1 || !pCur->apPage[pCur->iPage]->leaf ) return 0;
+  pParentPage = pCur->apPage[pCur->iPage-1];
+  *pParent = pParentPage->pgno;
+  *piChild = pCur->aiIdx[pCur->iPage-1];
+  return pParentPage->nCell+1;
+}
+
+/*
+** Sets aPgno[] to the page numbers of up to n children of the parent of the leaf the cursor is on (see
+** sqlite3BtreeLeafPosition), starting with child iFirst.  These are the leaves a scan from the cursor visits next.
+** Returns the number of page numbers set.
+*/
+SQLITE_PRIVATE int sqlite3BtreeLeafSiblings(BtCursor *pCur, int iFirst, int n, u32 *aPgno){
+  MemPage *pParentPage;
+  int i;
+  if( pCur->eState!=CURSOR_VALID || pCur->iPage<1 || !pCur->apPage[pCur->iPage]->leaf ) return 0;
+  pParentPage = pCur->apPage[pCur->iPage-1];
+  assert( pParentPage->nOverflow==0 );
+  for(i=0; i<n && iFirst+i>=0 && iFirst+i<=pParentPage->nCell; i++){
+    if( iFirst+i==pParentPage->nCell ){
+      aPgno[i] = get4byte(&pParentPage->aData[pParentPage->hdrOffset+8]);
+    }else{
+      aPgno[i] = get4byte(findCell(pParentPage, iFirst+i));
+    }
+  }
+  return i;
+}
+
 int deleteCellRange( MemPage* page, int beginCell, int endCell, int* stackBegin, int* stackEnd) {
   unsigned char *pCell;
   int rc, cell;
@@ -47,6 +47,7 @@
 #include "LogSystem.h"
 #include "RecoveryState.h"
 #include "LogProtocolMessage.h"
+#include "CommitLatencyStages.h"
 #include "flow/TDMetric.actor.h"
 #include "flow/actorcompiler.h"  // This must be the last #include.
 
@@ -143,6 +144,70 @@ struct ShardInfo : ReferenceCounted<ShardInfo>, NonCopyable {
 	}
 };
 
+// The values in storage of recently read keys, so that reads of hot keys which are not in versionedData need not go to
+// the IKeyValueStore.  Every entry is storage[key] (absent if the key is not in storage): an entry is erased when
+// applyMutation changes its key and again when the change is written to storage, and a value read from storage is
+// added only once the reader has checked that it is still current (see getValueQ).  Entries are evicted in CLOCK order
+// once they use more than STORAGE_READ_CACHE_BYTES.
+struct StorageReadCache {
+	struct Entry {
+		Optional<Value> value;
+		bool referenced;
+
+		Entry() : referenced(false) {}
+		explicit Entry( Optional<Value> const& value ) : value(value), referenced(false) {}
+	};
+	typedef Map<Key, Entry, MapPair<Key, Entry>, int64_t> EntryMap;	// metric is the bytes used by the entry
+
+	StorageReadCache() : hand(entries.end()) {}
+
+	// Returns the cached value of key, or NULL if key is not cached
+	Optional<Value> const* get( KeyRef key ) {
+		auto i = entries.find(key);
+		if (i == entries.end()) return NULL;
+		i->value.referenced = true;
+		return &i->value.value;
+	}
+
+	void insert( KeyRef key, Optional<Value> const& value ) {
+		int64_t limit = SERVER_KNOBS->STORAGE_READ_CACHE_BYTES;
+		int64_t bytes = key.expectedSize() + (value.present() ? value.get().expectedSize() : 0) + EntryMap::getElementBytes();
+		if (bytes > limit) return;
+
+		entries.insert( mapPair(Key(key), Entry(value)), true, bytes );
+		while (getBytes() > limit) {
+			if (hand == entries.end()) hand = entries.begin();
+			auto i = hand;
+			++hand;
+			if (i->value.referenced)
+				i->value.referenced = false;
+			else
+				entries.erase(i);
+		}
+	}
+
+	void erase( KeyRef key ) {
+		auto i = entries.find(key);
+		if (i == entries.end()) return;
+		if (i == hand) ++hand;
+		entries.erase(i);
+	}
+
+	void erase( KeyRangeRef keys ) {
+		auto b = entries.lower_bound(keys.begin);
+		if (b == entries.end() || !(b->key < keys.end)) return;
+		auto e = entries.lower_bound(keys.end);
+		if (hand != entries.end() && !(hand->key < keys.begin) && hand->key < keys.end) hand = e;
+		entries.erase(b, e);
+	}
+
+	int64_t getBytes() const { return entries.sumTo(entries.end()); }
+
+private:
+	EntryMap entries;
+	EntryMap::iterator hand;	// the next entry to consider for eviction
+};
+
 struct StorageServerDisk {
 	explicit StorageServerDisk( struct StorageServer* data, IKeyValueStore* storage ) : data(data), storage(storage) {}
 
@@ -168,6 +233,8 @@ struct StorageServerDisk {
 	KeyValueStoreType getKeyValueStoreType() { return storage->getType(); }
 	StorageBytes getStorageBytes() { return storage->getStorageBytes(); }
 
+	StorageReadCache readCache;
+
 private:
 	struct StorageServer* data;
 	IKeyValueStore* storage;
@@ -233,6 +300,9 @@ struct FetchInjectionInfo {
 	vector<VerUpdateRef> changes;
 };
 
+// Stages of a version through update() and updateStorage(), as recorded in StorageServer::commitStages
+enum { StorageStageApply, StorageStageDurable };
+
 struct StorageServer {
 	typedef VersionedMap<KeyRef, ValueOrClearToRef> VersionedData;
 
@@ -372,6 +442,10 @@ public:
 	AsyncVar<bool> noRecentUpdates;
 	double lastUpdate;
 
+	CommitLatencyStages commitStages;
+	Deque<std::pair<Version, double>> appliedVersions;  // Versions made readable by update() but not yet durable, and when they became readable
+	Deque<Version> tracedVersions;  // Sampled commit versions (isCommitTraceSampled) not yet durable
+
 	Int64MetricHandle readQueueSizeMetric;
 
 	std::string folder;
@@ -383,6 +457,15 @@ public:
 	FlowLock fetchKeysParallelismLock;
 	vector< Promise<FetchInjectionInfo*> > readyFetchKeys;
 
+	struct FetchKeysProgress {
+		KeyRange keys;
+		double startTime;
+		int64_t bytesFetched;
+		FetchKeysProgress() : startTime(0), bytesFetched(0) {}
+		FetchKeysProgress( KeyRange const& keys ) : keys(keys), startTime(now()), bytesFetched(0) {}
+	};
+	std::map<UID, FetchKeysProgress> fetchKeysProgress;  // fetchKeys in the Fetching phase, by the pair ID of their trace interval
+
 	int64_t instanceID;
 
 	Promise<Void> otherError;
@@ -403,18 +486,21 @@ public:
 
 	struct Counters {
 		CounterCollection cc;
-		Counter allQueries, getKeyQueries, getValueQueries, getRangeQueries, finishedQueries, rowsQueried, bytesQueried, watchQueries;
+		Counter allQueries, getKeyQueries, getValueQueries, getValuesQueries, getRangeQueries, finishedQueries, rowsQueried, bytesQueried, watchQueries;
 		Counter bytesInput, bytesDurable, bytesFetched,
 			mutationBytes;  // Like bytesInput but without MVCC accounting
 		Counter mutations, setMutations, clearRangeMutations, atomicMutations;
 		Counter updateBatches, updateVersions;
 		Counter loops;
 		Counter fetchWaitingMS, fetchWaitingCount, fetchExecutingMS, fetchExecutingCount;
+		Counter readCacheHits, readCacheMisses;
+		LatencyCounter readLatency;  // Of getValue, getValues, getKey and getKeyValues requests
 
 		Counters(StorageServer* self)
 			: cc("StorageServer", self->thisServerID.toString()),
 			getKeyQueries("GetKeyQueries", cc),
 			getValueQueries("GetValueQueries",cc),
+			getValuesQueries("GetValuesQueries",cc),
 			getRangeQueries("GetRangeQueries", cc),
 			allQueries("QueryQueue", cc),
 			finishedQueries("FinishedQueries", cc),
@@ -435,7 +521,10 @@ public:
 			fetchWaitingMS("FetchWaitingMS", cc),
 			fetchWaitingCount("FetchWaitingCount", cc),
 			fetchExecutingMS("FetchExecutingMS", cc),
-			fetchExecutingCount("FetchExecutingCount", cc)
+			fetchExecutingCount("FetchExecutingCount", cc),
+			readCacheHits("ReadCacheHits", cc),
+			readCacheMisses("ReadCacheMisses", cc),
+			readLatency("ReadLatency", cc)
 		{
 			specialCounter(cc, "LastTLogVersion", [self](){ return self->lastTLogVersion; });
 			specialCounter(cc, "Version", [self](){ return self->version.get(); });
@@ -452,6 +541,7 @@ public:
 			specialCounter(cc, "BytesStored", [self](){ return self->metrics.byteSample.getEstimate(allKeys); });
 			specialCounter(cc, "ActiveWatches", [self](){ return self->numWatches; });
 			specialCounter(cc, "WatchBytes", [self](){ return self->watchBytes; });
+			specialCounter(cc, "ReadCacheBytes", [self](){ return self->storage.readCache.getBytes(); });
 
 			specialCounter(cc, "KvstoreBytesUsed", [self](){ return self->storage.getStorageBytes().used; });
 			specialCounter(cc, "KvstoreBytesFree", [self](){ return self->storage.getStorageBytes().free; });
@@ -472,7 +562,8 @@ public:
 			logProtocol(0), counters(this), tag(invalidTag), maxQueryQueue(0), thisServerID(ssi.id()),
 			readQueueSizeMetric(LiteralStringRef("StorageServer.ReadQueueSize")),
 			behind(false), byteSampleClears(false, LiteralStringRef("\xff\xff\xff")), noRecentUpdates(false),
-			lastUpdate(now()), poppedAllAfter(std::numeric_limits<Version>::max())
+			lastUpdate(now()), poppedAllAfter(std::numeric_limits<Version>::max()),
+			commitStages(ssi.id(), { "Apply", "Durable" })
 	{
 		version.initMetric(LiteralStringRef("StorageServer.Version"), counters.cc.id);
 		oldestVersion.initMetric(LiteralStringRef("StorageServer.OldestVersion"), counters.cc.id);
@@ -701,7 +792,7 @@ ACTOR Future<Version> waitForVersionNoTooOld( StorageServer* data, Version versi
 }
 
 ACTOR Future<Void> getValueQ( StorageServer* data, GetValueRequest req ) {
-	state double startTime = timer();
+	state double startTime = now();
 	try {
 		// Active load balancing runs at a very high priority (to obtain accurate queue lengths)
 		// so we need to downgrade here
@@ -733,19 +824,29 @@ ACTOR Future<Void> getValueQ( StorageServer* data, GetValueRequest req ) {
 			v = (Value)i->getValue();
 			path = 1;
 		} else if (!i || !i->isClearTo() || i->getEndKey() <= req.key) {
-			path = 2;
-			Optional<Value> vv = wait( data->storage.readValue( req.key, req.debugID ) );
-			// Validate that while we were reading the data we didn't lose the version or shard
-			if (version < data->storageVersion()) {
-				TEST(true); // transaction_too_old after readValue
-				throw transaction_too_old();
+			Optional<Value> const* cached = data->storage.readCache.get( req.key );
+			if (cached) {
+				++data->counters.readCacheHits;
+				v = *cached;
+				path = 3;
+			} else {
+				++data->counters.readCacheMisses;
+				path = 2;
+				Optional<Value> vv = wait( data->storage.readValue( req.key, req.debugID ) );
+				// Validate that while we were reading the data we didn't lose the version or shard
+				if (version < data->storageVersion()) {
+					TEST(true); // transaction_too_old after readValue
+					throw transaction_too_old();
+				}
+				data->checkChangeCounter(changeCounter, req.key);
+				// Any write to storage[req.key] since the read began would have advanced storageVersion past version
+				data->storage.readCache.insert( req.key, vv );
+				v = vv;
 			}
-			data->checkChangeCounter(changeCounter, req.key);
-			v = vv;
 		}
 
 		debugMutation("ShardGetValue", version, MutationRef(MutationRef::DebugKey, req.key, v.present()?v.get():LiteralStringRef("<null>")));
-		debugMutation("ShardGetPath", version, MutationRef(MutationRef::DebugKey, req.key, path==0?LiteralStringRef("0"):path==1?LiteralStringRef("1"):LiteralStringRef("2")));
+		debugMutation("ShardGetPath", version, MutationRef(MutationRef::DebugKey, req.key, path==0?LiteralStringRef("0"):path==1?LiteralStringRef("1"):path==2?LiteralStringRef("2"):LiteralStringRef("3")));
 
 		/*
 		StorageMetrics m;
@@ -772,10 +873,106 @@ ACTOR Future<Void> getValueQ( StorageServer* data, GetValueRequest req ) {
 
 	++data->counters.finishedQueries;
 	--data->readQueueSizeMetric;
+	data->counters.readLatency.addMeasurement( now() - startTime );
 
 	return Void();
 };
 
+// Reads a batch of keys at a single version.  The version wait, shard checks and versioned data lookups are done once
+// for the whole batch, and every key that has to go to disk is read concurrently so the storage engine can service them together.
+ACTOR Future<Void> getValuesQ( StorageServer* data, GetValuesRequest req ) {
+	state double startTime = now();
+	try {
+		++data->counters.getValuesQueries;
+		++data->counters.allQueries;
+		++data->readQueueSizeMetric;
+		data->maxQueryQueue = std::max<int>( data->maxQueryQueue, data->counters.allQueries.getValue() - data->counters.finishedQueries.getValue());
+
+		wait( delay(0, TaskDefaultEndpoint) );
+
+		if( req.debugID.present() )
+			g_traceBatch.addEvent("GetValueDebug", req.debugID.get().first(), "getValuesQ.DoRead"); //.detail("TaskID", g_network->getCurrentTask());
+
+		state Version version = wait( waitForVersion( data, req.version ) );
+		if( req.debugID.present() )
+			g_traceBatch.addEvent("GetValueDebug", req.debugID.get().first(), "getValuesQ.AfterVersion"); //.detail("TaskID", g_network->getCurrentTask());
+
+		state uint64_t changeCounter = data->shardChangeCounter;
+
+		for(auto& key : req.keys) {
+			if (!data->shards[key]->isReadable()) {
+				//TraceEvent("WrongShardServer", data->thisServerID).detail("Key", printable(key)).detail("Version", version).detail("In", "getValuesQ");
+				throw wrong_shard_server();
+			}
+		}
+
+		state std::vector<Future<Optional<Value>>> values;
+		state std::vector<int> diskReads;  // indices of the values read from storage
+		values.reserve( req.keys.size() );
+		{
+			auto view = data->data().at(version);
+			for(auto& key : req.keys) {
+				auto i = view.lastLessOrEqual(key);
+				if (i && i->isValue() && i.key() == key) {
+					values.push_back( Optional<Value>( (Value)i->getValue() ) );
+				} else if (!i || !i->isClearTo() || i->getEndKey() <= key) {
+					Optional<Value> const* cached = data->storage.readCache.get( key );
+					if (cached) {
+						++data->counters.readCacheHits;
+						values.push_back( *cached );
+					} else {
+						++data->counters.readCacheMisses;
+						diskReads.push_back( values.size() );
+						values.push_back( data->storage.readValue( key, req.debugID ) );
+					}
+				} else {
+					values.push_back( Optional<Value>() );
+				}
+			}
+		}
+
+		wait( waitForAll( values ) );
+
+		if (diskReads.size()) {
+			// Validate that while we were reading the data we didn't lose the version or shard
+			if (version < data->storageVersion()) {
+				TEST(true); // transaction_too_old after readValue in getValuesQ
+				throw transaction_too_old();
+			}
+			for(auto& key : req.keys)
+				data->checkChangeCounter(changeCounter, key);
+			for(int k : diskReads)
+				data->storage.readCache.insert( req.keys[k], values[k].get() );
+		}
+
+		GetValuesReply reply;
+		for(int k = 0; k < req.keys.size(); k++) {
+			Optional<Value> const& v = values[k].get();
+			debugMutation("ShardGetValue", version, MutationRef(MutationRef::DebugKey, req.keys[k], v.present()?(ValueRef)v.get():LiteralStringRef("<null>")));
+			if (v.present()) {
+				reply.data.push_back_deep( reply.arena, KeyValueRef( req.keys[k], v.get() ) );
+				++data->counters.rowsQueried;
+				data->counters.bytesQueried += v.get().size();
+			}
+		}
+
+		if( req.debugID.present() )
+			g_traceBatch.addEvent("GetValueDebug", req.debugID.get().first(), "getValuesQ.AfterRead"); //.detail("TaskID", g_network->getCurrentTask());
+
+		reply.penalty = data->getPenalty();
+		req.reply.send(reply);
+	} catch (Error& e) {
+		if (e.code() == error_code_internal_error || e.code() == error_code_actor_cancelled) throw;
+		req.reply.sendError(e);
+	}
+
+	++data->counters.finishedQueries;
+	--data->readQueueSizeMetric;
+	data->counters.readLatency.addMeasurement( now() - startTime );
+
+	return Void();
+}
+
 ACTOR Future<Void> watchValue_impl( StorageServer* data, WatchValueRequest req ) {
 	try {
 		++data->counters.watchQueries;
@@ -1207,6 +1404,7 @@ ACTOR Future<Void> getKeyValues( StorageServer* data, GetKeyValuesRequest req )
 // Throws a wrong_shard_server if the keys in the request or result depend on data outside this server OR if a large selector offset prevents
 // all data from being read in one range read
 {
+	state double startTime = now();
 	++data->counters.getRangeQueries;
 	++data->counters.allQueries;
 	++data->readQueueSizeMetric;
@@ -1305,11 +1503,13 @@ ACTOR Future<Void> getKeyValues( StorageServer* data, GetKeyValuesRequest req )
 
 	++data->counters.finishedQueries;
 	--data->readQueueSizeMetric;
+	data->counters.readLatency.addMeasurement( now() - startTime );
 
 	return Void();
 }
 
 ACTOR Future<Void> getKey( StorageServer* data, GetKeyRequest req ) {
+	state double startTime = now();
 	++data->counters.getKeyQueries;
 	++data->counters.allQueries;
 	++data->readQueueSizeMetric;
@@ -1351,6 +1551,7 @@ ACTOR Future<Void> getKey( StorageServer* data, GetKeyRequest req ) {
 
 	++data->counters.finishedQueries;
 	--data->readQueueSizeMetric;
+	data->counters.readLatency.addMeasurement( now() - startTime );
 
 	return Void();
 }
@@ -1461,6 +1662,15 @@ bool changeDurableVersion( StorageServer* data, Version desiredDurableVersion )
 	data->durableVersion.set( nextDurableVersion );
 	if (checkFatalError.isReady()) checkFatalError.get();
 
+	while (!data->appliedVersions.empty() && data->appliedVersions.front().first <= nextDurableVersion) {
+		data->commitStages.addSample( StorageStageDurable, now() - data->appliedVersions.front().second );
+		data->appliedVersions.pop_front();
+	}
+	while (!data->tracedVersions.empty() && data->tracedVersions.front() <= nextDurableVersion) {
+		g_traceBatch.addEvent("CommitDebug", commitTraceID(data->tracedVersions.front()).first(), "StorageServer.updateStorage.Durable");
+		data->tracedVersions.pop_front();
+	}
+
 	//TraceEvent("ForgotVersionsBefore", data->thisServerID).detail("Version", nextDurableVersion);
 	validate(data);
 
@@ -1607,12 +1817,14 @@ void applyMutation( StorageServer *self, MutationRef const& m, Arena& arena, Sto
 			}
 		}
 		data.insert( m.param1, ValueOrClearToRef::value(m.param2) );
+		self->storage.readCache.erase( m.param1 );
 		self->watches.trigger( m.param1 );
 	} else if (m.type == MutationRef::ClearRange) {
 		data.erase( m.param1, m.param2 );
 		ASSERT( m.param2 > m.param1 );
 		ASSERT( !isClearContaining( data.atLatest(), m.param1 ) );
 		data.insert( m.param1, ValueOrClearToRef::clearTo(m.param2) );
+		self->storage.readCache.erase( KeyRangeRef(m.param1, m.param2) );
 		self->watches.triggerRange( m.param1, m.param2 );
 	}
 
@@ -1743,6 +1955,31 @@ ACTOR Future<Standalone<RangeResultRef>> tryGetRange( Database cx, Version versi
 	}
 }
 
+// Splits keys into sub-ranges of about half a fetch block according to the source servers' byte samples, so that fetchKeys
+// can fetch several of them at once.  Returns just the ends of keys if that isn't worthwhile or the split can't be had quickly.
+ACTOR Future<Standalone<VectorRef<KeyRef>>> getFetchKeysSplitPoints( StorageServer* data, KeyRange keys, int fetchBlockBytes ) {
+	if (SERVER_KNOBS->FETCH_KEYS_PARALLEL_BLOCKS > 1) {
+		try {
+			state Transaction tr( data->cx );
+			StorageMetrics limit;
+			limit.bytes = std::max( fetchBlockBytes / 2, 1 );
+			limit.bytesPerKSecond = limit.infinity;
+			limit.iosPerKSecond = limit.infinity;
+			Standalone<VectorRef<KeyRef>> splitPoints = wait( timeoutError( tr.splitStorageMetrics( keys, limit, StorageMetrics() ), SERVER_KNOBS->FETCH_KEYS_SPLIT_TIMEOUT ) );
+			if (splitPoints.size() >= 2 && splitPoints.front() == keys.begin && splitPoints.back() == keys.end)
+				return splitPoints;
+		} catch (Error& e) {
+			if (e.code() == error_code_actor_cancelled) throw;
+			TraceEvent("FetchKeysSplitFailed", data->thisServerID).error(e, true).suppressFor(1.0);
+		}
+	}
+
+	Standalone<VectorRef<KeyRef>> whole;
+	whole.push_back_deep( whole.arena(), keys.begin );
+	whole.push_back_deep( whole.arena(), keys.end );
+	return whole;
+}
+
 template <class T>
 void addMutation( T& target, Version version, MutationRef const& mutation ) {
 	target.addMutation( version, mutation );
@@ -1830,11 +2067,13 @@ ACTOR Future<Void> fetchKeys( StorageServer *data, AddingShard* shard ) {
 		state Version fetchVersion = data->version.get();
 
 		TraceEvent(SevDebug, "FetchKeysUnblocked", data->thisServerID).detail("FKID", interval.pairID).detail("Version", fetchVersion);
+		data->fetchKeysProgress[interval.pairID] = StorageServer::FetchKeysProgress( keys );
 
 		// Get the history
 		state int debug_getRangeRetries = 0;
 		state int debug_nextRetryToLog = 1;
 		state bool isTooOld = false;
+		state std::vector<Future<Standalone<RangeResultRef>>> blocks;
 
 		//FIXME: The client cache does not notice when servers are added to a team. To read from a local storage server we must refresh the cache manually.
 		data->cx->invalidateCache(keys);
@@ -1843,72 +2082,115 @@ ACTOR Future<Void> fetchKeys( StorageServer *data, AddingShard* shard ) {
 			try {
 				TEST(true);		// Fetching keys for transferred shard
 
-				state Standalone<RangeResultRef> this_block = wait( tryGetRange( data->cx, fetchVersion, keys, GetRangeLimits( CLIENT_KNOBS->ROW_LIMIT_UNLIMITED, fetchBlockBytes ), &isTooOld ) );
-
-				int expectedSize = (int)this_block.expectedSize() + (8-(int)sizeof(KeyValueRef))*this_block.size();
-
-				TraceEvent(SevDebug, "FetchKeysBlock", data->thisServerID).detail("FKID", interval.pairID)
-					.detail("BlockRows", this_block.size()).detail("BlockBytes", expectedSize)
-					.detail("KeyBegin", printable(keys.begin)).detail("KeyEnd", printable(keys.end))
-					.detail("Last", this_block.size() ? printable(this_block.end()[-1].key) : std::string())
-					.detail("Version", fetchVersion).detail("More", this_block.more);
-				debugKeyRange("fetchRange", fetchVersion, keys);
-				for(auto k = this_block.begin(); k != this_block.end(); ++k) debugMutation("fetch", fetchVersion, MutationRef(MutationRef::SetValue, k->key, k->value));
-
-				data->counters.bytesFetched += expectedSize;
-				if( fetchBlockBytes > expectedSize ) {
-					holdingFKPL.release( fetchBlockBytes - expectedSize );
+				state Standalone<VectorRef<KeyRef>> splitPoints = wait( getFetchKeysSplitPoints( data, keys, fetchBlockBytes ) );
+
+				// Fetch consecutive sub-ranges of keys at once, as many as the fetch budget allows without making any other
+				// fetchKeys wait.  Each request is load balanced across the source servers on its own.
+				blocks.push_back( tryGetRange( data->cx, fetchVersion, KeyRangeRef(splitPoints[0], splitPoints[1]), GetRangeLimits( CLIENT_KNOBS->ROW_LIMIT_UNLIMITED, fetchBlockBytes ), &isTooOld ) );
+				while (blocks.size() < splitPoints.size()-1 && blocks.size() < SERVER_KNOBS->FETCH_KEYS_PARALLEL_BLOCKS &&
+						!data->fetchKeysParallelismLock.waiters() && data->fetchKeysParallelismLock.available() >= fetchBlockBytes) {
+					wait( data->fetchKeysParallelismLock.take( TaskDefaultYield, fetchBlockBytes ) );
+					holdingFKPL.remaining += fetchBlockBytes;
+					int b = blocks.size();
+					blocks.push_back( tryGetRange( data->cx, fetchVersion, KeyRangeRef(splitPoints[b], splitPoints[b+1]), GetRangeLimits( CLIENT_KNOBS->ROW_LIMIT_UNLIMITED, fetchBlockBytes ), &isTooOld ) );
 				}
+				TEST(blocks.size() > 1);  // fetchKeys fetching several blocks at once
+
+				// Write each block to storage once those before it are written, while the later ones are still arriving.  Keys
+				// after a block that is incomplete are left to a new AddingShard.
+				state Key nfk = keys.end;
+				state int64_t fetchedBytes = 0;
+				state int blockIndex = 0;
+				for(; blockIndex < blocks.size(); blockIndex++) {
+					state Standalone<RangeResultRef> this_block;
+					try {
+						Standalone<RangeResultRef> block = wait( blocks[blockIndex] );
+						this_block = block;
+					} catch (Error& e) {
+						if (blockIndex == 0 || (e.code() != error_code_transaction_too_old && e.code() != error_code_future_version))
+							throw;
+						TEST(true);  // fetchKeys keeps the blocks before one that failed
+						nfk = splitPoints[blockIndex];
+						break;
+					}
+					state KeyRangeRef blockKeys( splitPoints[blockIndex], splitPoints[blockIndex+1] );
+
+					int expectedSize = (int)this_block.expectedSize() + (8-(int)sizeof(KeyValueRef))*this_block.size();
+
+					TraceEvent(SevDebug, "FetchKeysBlock", data->thisServerID).detail("FKID", interval.pairID)
+						.detail("BlockRows", this_block.size()).detail("BlockBytes", expectedSize)
+						.detail("KeyBegin", printable(blockKeys.begin)).detail("KeyEnd", printable(blockKeys.end))
+						.detail("Last", this_block.size() ? printable(this_block.end()[-1].key) : std::string())
+						.detail("Version", fetchVersion).detail("More", this_block.more);
+					debugKeyRange("fetchRange", fetchVersion, blockKeys);
+					for(auto k = this_block.begin(); k != this_block.end(); ++k) debugMutation("fetch", fetchVersion, MutationRef(MutationRef::SetValue, k->key, k->value));
+
+					data->counters.bytesFetched += expectedSize;
+					data->fetchKeysProgress[interval.pairID].bytesFetched += expectedSize;
+					fetchedBytes += expectedSize;
+
+					// Wait for permission to proceed
+					//wait( data->fetchKeysStorageWriteLock.take() );
+					//state FlowLock::Releaser holdingFKSWL( data->fetchKeysStorageWriteLock );
+
+					// Write this_block to storage
+					state KeyValueRef *kvItr = this_block.begin();
+					for(; kvItr != this_block.end(); ++kvItr) {
+						data->storage.writeKeyValue( *kvItr );
+						wait(yield());
+					}
 
-				// Wait for permission to proceed
-				//wait( data->fetchKeysStorageWriteLock.take() );
-				//state FlowLock::Releaser holdingFKSWL( data->fetchKeysStorageWriteLock );
+					kvItr = this_block.begin();
+					for(; kvItr != this_block.end(); ++kvItr) {
+						data->byteSampleApplySet( *kvItr, invalidVersion );
+						wait(yield());
+					}
 
-				// Write this_block to storage
-				state KeyValueRef *kvItr = this_block.begin();
-				for(; kvItr != this_block.end(); ++kvItr) {
-					data->storage.writeKeyValue( *kvItr );
-					wait(yield());
+					if (this_block.more) {
+						nfk = this_block.readThrough.present() ? this_block.readThrough.get() : keyAfter( this_block.end()[-1].key );
+						break;
+					}
+					this_block = Standalone<RangeResultRef>();
 				}
 
-				kvItr = this_block.begin();
-				for(; kvItr != this_block.end(); ++kvItr) {
-					data->byteSampleApplySet( *kvItr, invalidVersion );
-					wait(yield());
+				// Cancel the fetches of any blocks after nfk, and keep only the budget for what was written
+				blocks.clear();
+				if (holdingFKPL.remaining > fetchedBytes) {
+					holdingFKPL.release( holdingFKPL.remaining - fetchedBytes );
 				}
 
-				if (this_block.more) {
-					Key nfk = this_block.readThrough.present() ? this_block.readThrough.get() : keyAfter( this_block.end()[-1].key );
-					if (nfk != keys.end) {
-						std::deque< Standalone<VerUpdateRef> > updatesToSplit = std::move( shard->updates );
-
-						// This actor finishes committing the keys [keys.begin,nfk) that we already fetched.
-						// The remaining unfetched keys [nfk,keys.end) will become a separate AddingShard with its own fetchKeys.
-						shard->server->addShard( ShardInfo::addingSplitLeft( KeyRangeRef(keys.begin, nfk), shard ) );
-						shard->server->addShard( ShardInfo::newAdding( data, KeyRangeRef(nfk, keys.end) ) );
-						shard = data->shards.rangeContaining( keys.begin ).value()->adding;
-						auto otherShard = data->shards.rangeContaining( nfk ).value()->adding;
-						keys = shard->keys;
-
-						// Split our prior updates.  The ones that apply to our new, restricted key range will go back into shard->updates,
-						// and the ones delivered to the new shard will be discarded because it is in WaitPrevious phase (hasn't chosen a fetchVersion yet).
-						// What we are doing here is expensive and could get more expensive if we started having many more blocks per shard. May need optimization in the future.
-						for(auto u = updatesToSplit.begin(); u != updatesToSplit.end(); ++u)
-							splitMutations( data->shards, *u );
-
-						TEST( true );
-						TEST( shard->updates.size() );
-						ASSERT( otherShard->updates.empty() );
-					}
+				if (nfk != keys.end) {
+					std::deque< Standalone<VerUpdateRef> > updatesToSplit = std::move( shard->updates );
+
+					// This actor finishes committing the keys [keys.begin,nfk) that we already fetched.
+					// The remaining unfetched keys [nfk,keys.end) will become a separate AddingShard with its own fetchKeys.
+					shard->server->addShard( ShardInfo::addingSplitLeft( KeyRangeRef(keys.begin, nfk), shard ) );
+					shard->server->addShard( ShardInfo::newAdding( data, KeyRangeRef(nfk, keys.end) ) );
+					shard = data->shards.rangeContaining( keys.begin ).value()->adding;
+					auto otherShard = data->shards.rangeContaining( nfk ).value()->adding;
+					keys = shard->keys;
+					data->fetchKeysProgress[interval.pairID].keys = keys;
+
+					// Split our prior updates.  The ones that apply to our new, restricted key range will go back into shard->updates,
+					// and the ones delivered to the new shard will be discarded because it is in WaitPrevious phase (hasn't chosen a fetchVersion yet).
+					// What we are doing here is expensive and could get more expensive if we started having many more blocks per shard. May need optimization in the future.
+					for(auto u = updatesToSplit.begin(); u != updatesToSplit.end(); ++u)
+						splitMutations( data->shards, *u );
+
+					TEST( true );
+					TEST( shard->updates.size() );
+					ASSERT( otherShard->updates.empty() );
 				}
 
-				this_block = Standalone<RangeResultRef>();
-
 				if (BUGGIFY) wait( delay( 1 ) );
 
 				break;
 			} catch (Error& e) {
 				TraceEvent("FKBlockFail", data->thisServerID).error(e,true).suppressFor(1.0).detail("FKID", interval.pairID);
+				blocks.clear();
+				if (holdingFKPL.remaining > fetchBlockBytes) {
+					holdingFKPL.release( holdingFKPL.remaining - fetchBlockBytes );
+				}
 				if (e.code() == error_code_transaction_too_old){
 					TEST(true); // A storage server has forgotten the history data we are fetching
 					Version lastFV = fetchVersion;
@@ -1939,6 +2221,7 @@ ACTOR Future<Void> fetchKeys( StorageServer *data, AddingShard* shard ) {
 
 		//FIXME: remove when we no longer support upgrades from 5.X
 		data->cx->enableLocalityLoadBalance = true;
+		data->fetchKeysProgress.erase( interval.pairID );
 
 		// We have completed the fetch and write of the data, now we wait for MVCC window to pass.
 		//  As we have finished this work, we will allow more work to start...
@@ -2021,6 +2304,7 @@ ACTOR Future<Void> fetchKeys( StorageServer *data, AddingShard* shard ) {
 		TraceEvent(SevDebug, interval.end(), data->thisServerID);
 	} catch (Error &e){
 		TraceEvent(SevDebug, interval.end(), data->thisServerID).error(e, true).detail("Version", data->version.get());
+		data->fetchKeysProgress.erase( interval.pairID );
 
 		if (e.code() == error_code_actor_cancelled && !data->shuttingDown && shard->phase >= AddingShard::Fetching) {
 			if (shard->phase < AddingShard::Waiting) {
@@ -2401,6 +2685,7 @@ ACTOR Future<Void> update( StorageServer* data, bool* pReceivedUpdate )
 		*pReceivedUpdate = true;
 
 		start = now();
+		state double receivedTime = start;
 		wait( data->durableVersionLock.take(TaskTLogPeekReply,1) );
 		state FlowLock::Releaser holdingDVL( data->durableVersionLock );
 		if(now() - start > 0.1)
@@ -2488,6 +2773,7 @@ ACTOR Future<Void> update( StorageServer* data, bool* pReceivedUpdate )
 		}
 
 		Version ver = invalidVersion;
+		int tracedBefore = data->tracedVersions.size();
 		cloneCursor2->setProtocolVersion(data->logProtocol);
 		//TraceEvent("SSUpdatePeeked", data->thisServerID).detail("FromEpoch", data->updateEpoch).detail("FromSeq", data->updateSequence).detail("ToEpoch", results.end_epoch).detail("ToSeq", results.end_seq).detail("MsgSize", results.messages.size());
 		for (;cloneCursor2->hasMessage(); cloneCursor2->nextMessage()) {
@@ -2498,6 +2784,8 @@ ACTOR Future<Void> update( StorageServer* data, bool* pReceivedUpdate )
 			if (cloneCursor2->version().version > ver && cloneCursor2->version().version > data->version.get()) {
 				++data->counters.updateVersions;
 				ver = cloneCursor2->version().version;
+				if (isCommitTraceSampled(ver))
+					data->tracedVersions.push_back(ver);
 			}
 
 			if (LogProtocolMessage::isNextIn(rd)) {
@@ -2572,6 +2860,11 @@ ACTOR Future<Void> update( StorageServer* data, bool* pReceivedUpdate )
 			data->version.set( ver );		// Triggers replies to waiting gets for new version(s)
 			if (data->otherError.getFuture().isReady()) data->otherError.getFuture().get();
 
+			data->commitStages.addSample( StorageStageApply, now() - receivedTime );
+			data->appliedVersions.push_back( std::make_pair(ver, now()) );
+			for (int i = tracedBefore; i < data->tracedVersions.size(); i++)
+				g_traceBatch.addEvent("CommitDebug", commitTraceID(data->tracedVersions[i]).first(), "StorageServer.update.Readable");
+
 			//TraceEvent("StorageServerUpdated", data->thisServerID).detail("Ver", ver).detail("DataVersion", data->version.get())
 			//	.detail("LastTLogVersion", data->lastTLogVersion).detail("NewOldest", updater.newOldestVersion).detail("DesiredOldest",data->desiredOldestVersion.get())
 			//	.detail("MaxReadTransactionLifeVersions", SERVER_KNOBS->MAX_READ_TRANSACTION_LIFE_VERSIONS);
@@ -2603,12 +2896,52 @@ ACTOR Future<Void> update( StorageServer* data, bool* pReceivedUpdate )
 	}
 }
 
+// Waits for the commit of the versions up to newDurableVersion, after any previous commit has finished, and then makes them the durable version
+ACTOR Future<Void> finishStorageCommit( StorageServer* data, Future<Void> durable, Version newDurableVersion, Future<Void> previous ) {
+	wait( previous );
+	wait( durable );
+
+	debug_advanceMinCommittedVersion( data->thisServerID, newDurableVersion );
+
+	// Taking and releasing the durableVersionLock ensures that no eager reads both begin before the commit was effective and
+	// are applied after we change the durable version.
+	wait( data->durableVersionLock.take() );
+	data->durableVersionLock.release();
+
+	wait( delay(0, TaskUpdateStorage) );
+
+	data->popVersion( data->durableVersion.get() + 1 );
+
+	while (!changeDurableVersion( data, newDurableVersion )) {
+		wait( yield(TaskUpdateStorage) );
+	}
+
+	//TraceEvent("StorageServerDurable", data->thisServerID).detail("Version", newDurableVersion);
+
+	return Void();
+}
+
+// Moves versions from versionedData to storage, STORAGE_COMMIT_BYTES at a time, committing each slice.  When
+// STORAGE_COMMIT_PIPELINE_BYTES allows it, the next slice is written to storage while earlier commits are still in
+// flight, so that the storage engine is not left idle between commits.  Commits still finish, and the durable version
+// still advances, in order.
 ACTOR Future<Void> updateStorage(StorageServer* data) {
+	state Deque<std::pair<Future<Void>, int64_t>> committing;  // unfinished commits and the bytes each wrote
+	state int64_t bytesCommitting = 0;
+	state Future<Void> lastCommit = Void();
 	loop {
-		ASSERT( data->durableVersion.get() == data->storageVersion() );
+		ASSERT( data->durableVersion.get() <= data->storageVersion() );
+		ASSERT( !committing.empty() || data->durableVersion.get() == data->storageVersion() );
 		wait( data->desiredOldestVersion.whenAtLeast( data->storageVersion()+1 ) );
 		wait( delay(0, TaskUpdateStorage) );
 
+		while (!committing.empty() && (committing.front().first.isReady() ||
+				bytesCommitting + SERVER_KNOBS->STORAGE_COMMIT_BYTES > SERVER_KNOBS->STORAGE_COMMIT_PIPELINE_BYTES)) {
+			wait( committing.front().first );
+			bytesCommitting -= committing.front().second;
+			committing.pop_front();
+		}
+
 		state Version startOldestVersion = data->storageVersion();
 		state Version newOldestVersion = data->storageVersion();
 		state Version desiredVersion = data->desiredOldestVersion.get();
@@ -2628,31 +2961,22 @@ ACTOR Future<Void> updateStorage(StorageServer* data) {
 			data->storage.makeVersionDurable( newOldestVersion );
 
 		debug_advanceMaxCommittedVersion( data->thisServerID, newOldestVersion );
-		state Future<Void> durable = data->storage.commit();
 		state Future<Void> durableDelay = Void();
 
 		if (bytesLeft > 0)
 			durableDelay = delay(SERVER_KNOBS->STORAGE_COMMIT_INTERVAL);
 
-		wait( durable );
-
-		debug_advanceMinCommittedVersion( data->thisServerID, newOldestVersion );
-
-		// Taking and releasing the durableVersionLock ensures that no eager reads both begin before the commit was effective and
-		// are applied after we change the durable version.
-		wait( data->durableVersionLock.take() );
-		data->durableVersionLock.release();
-
-		wait( delay(0, TaskUpdateStorage) );
+		lastCommit = finishStorageCommit( data, data->storage.commit(), newOldestVersion, lastCommit );
+		int64_t bytesWritten = SERVER_KNOBS->STORAGE_COMMIT_BYTES - bytesLeft;
+		committing.push_back( std::make_pair( lastCommit, bytesWritten ) );
+		bytesCommitting += bytesWritten;
 
-		data->popVersion( data->durableVersion.get() + 1 );
-
-		while (!changeDurableVersion( data, newOldestVersion )) {
-			wait( yield(TaskUpdateStorage) );
+		if (SERVER_KNOBS->STORAGE_COMMIT_PIPELINE_BYTES <= 0) {
+			wait( lastCommit );
+			bytesCommitting = 0;
+			committing.clear();
 		}
 
-		//TraceEvent("StorageServerDurable", data->thisServerID).detail("Version", newOldestVersion);
-
 		wait( durableDelay );
 	}
 }
@@ -2721,18 +3045,22 @@ void setAssignedStatus( StorageServer* self, KeyRangeRef keys, bool nowAssigned
 }
 
 void StorageServerDisk::clearRange( KeyRangeRef keys ) {
+	readCache.erase(keys);
 	storage->clear(keys);
 }
 
 void StorageServerDisk::writeKeyValue( KeyValueRef kv ) {
+	readCache.erase(kv.key);
 	storage->set( kv );
 }
 
 void StorageServerDisk::writeMutation( MutationRef mutation ) {
 	// FIXME: debugMutation(debugContext, debugVersion, *m);
 	if (mutation.type == MutationRef::SetValue) {
+		readCache.erase( mutation.param1 );
 		storage->set( KeyValueRef(mutation.param1, mutation.param2) );
 	} else if (mutation.type == MutationRef::ClearRange) {
+		readCache.erase( KeyRangeRef(mutation.param1, mutation.param2) );
 		storage->clear( KeyRangeRef(mutation.param1, mutation.param2) );
 	} else
 		ASSERT(false);
@@ -2742,8 +3070,10 @@ void StorageServerDisk::writeMutations( MutationListRef mutations, Version debug
 	for(auto m = mutations.begin(); m; ++m) {
 		debugMutation(debugContext, debugVersion, *m);
 		if (m->type == MutationRef::SetValue) {
+			readCache.erase( m->param1 );
 			storage->set( KeyValueRef(m->param1, m->param2) );
 		} else if (m->type == MutationRef::ClearRange) {
+			readCache.erase( KeyRangeRef(m->param1, m->param2) );
 			storage->clear( KeyRangeRef(m->param1, m->param2) );
 		}
 	}
@@ -3110,6 +3440,33 @@ Future<Void> StorageServerMetrics::waitMetrics(WaitMetricsRequest req, Future<Vo
 /////////////////////////////// Core //////////////////////////////////////
 #pragma region Core
 
+// Logs the fetchKeys in progress, oldest first, for status to report their throughput
+ACTOR Future<Void> traceFetchKeysProgress( StorageServer* self ) {
+	loop {
+		wait( delay( SERVER_KNOBS->STORAGE_LOGGING_DELAY ) );
+
+		std::vector<StorageServer::FetchKeysProgress const*> fetches;
+		for(auto& f : self->fetchKeysProgress)
+			fetches.push_back( &f.second );
+		std::sort( fetches.begin(), fetches.end(), [](StorageServer::FetchKeysProgress const* a, StorageServer::FetchKeysProgress const* b) { return a->startTime < b->startTime; } );
+
+		TraceEvent ev("FetchKeysProgress", self->thisServerID);
+		ev.detail("FetchesActive", (int)fetches.size());
+		int logged = std::min<int>( fetches.size(), SERVER_KNOBS->FETCH_KEYS_PROGRESS_LOGGED );
+		for(int i = 0; i < logged; i++) {
+			std::string prefix = format("Fetch%d", i);
+			double elapsed = std::max( now() - fetches[i]->startTime, 1e-3 );
+			ev.detail(prefix + "Begin", printable(fetches[i]->keys.begin))
+				.detail(prefix + "End", printable(fetches[i]->keys.end))
+				.detail(prefix + "Bytes", fetches[i]->bytesFetched)
+				.detail(prefix + "Seconds", elapsed)
+				.detail(prefix + "Rate", fetches[i]->bytesFetched / elapsed);
+		}
+		ev.detail("FetchesLogged", logged);
+		ev.trackLatest( (self->thisServerID.toString() + "/FetchKeysProgress").c_str() );
+	}
+}
+
 ACTOR Future<Void> metricsCore( StorageServer* self, StorageServerInterface ssi ) {
 	state Future<Void> doPollMetrics = Void();
 	state ActorCollection actors(false);
@@ -3117,6 +3474,7 @@ ACTOR Future<Void> metricsCore( StorageServer* self, StorageServerInterface ssi
 	wait( self->byteSampleRecovery );
 
 	actors.add(traceCounters("StorageMetrics", self->thisServerID, SERVER_KNOBS->STORAGE_LOGGING_DELAY, &self->counters.cc, self->thisServerID.toString() + "/StorageMetrics"));
+	actors.add(traceFetchKeysProgress(self));
 
 	loop {
 		choose {
@@ -3206,7 +3564,9 @@ ACTOR Future<Void> storageServerCore( StorageServer* self, StorageServerInterfac
 						if(self->db->get().logSystemConfig.recoveredAt.present()) {
 							self->poppedAllAfter = self->db->get().logSystemConfig.recoveredAt.get();
 						}
-						self->logCursor = self->logSystem->peekSingle( self->thisServerID, self->version.get() + 1, self->tag, self->history );
+						// Streaming peeks keep the next peeks waiting at the tlog, so new versions reach us as soon as they are committed. The window
+						// of outstanding peeks bounds how far the tlog can get ahead of update(), which stops asking for more when the e-brake is on.
+						self->logCursor = self->logSystem->peekSingle( self->thisServerID, self->version.get() + 1, self->tag, self->history, SERVER_KNOBS->STORAGE_SERVER_STREAMING_PEEKS != 0 );
 						self->popVersion( self->durableVersion.get() + 1, true );
 					}
 					// If update() is waiting for results from the tlog, it might never get them, so needs to be cancelled.  But if it is waiting later,
@@ -3226,6 +3586,13 @@ ACTOR Future<Void> storageServerCore( StorageServer* self, StorageServerInterfac
 				else
 					actors.add( getValueQ( self, req ) );
 			}
+			when( GetValuesRequest req = waitNext(ssi.getValues.getFuture()) ) {
+				// Warning: This code is executed at extremely high priority (TaskLoadBalancedEndpoint), so downgrade before doing real work
+				if( req.debugID.present() )
+					g_traceBatch.addEvent("GetValueDebug", req.debugID.get().first(), "storageServer.recieved"); //.detail("TaskID", g_network->getCurrentTask());
+
+				actors.add( getValuesQ( self, req ) );
+			}
 			when( WatchValueRequest req = waitNext(ssi.watchValue.getFuture()) ) {
 				// TODO: fast load balancing?
 				// SOMEDAY: combine watches for the same key/value into a single watch
@@ -181,6 +181,8 @@ StringRef fileLogQueuePrefix = LiteralStringRef("logqueue-");
 std::pair<KeyValueStoreType, std::string> bTreeV1Suffix  = std::make_pair( KeyValueStoreType::SSD_BTREE_V1, ".fdb" );
 std::pair<KeyValueStoreType, std::string> bTreeV2Suffix = std::make_pair(KeyValueStoreType::SSD_BTREE_V2,   ".sqlite");
 std::pair<KeyValueStoreType, std::string> memorySuffix = std::make_pair( KeyValueStoreType::MEMORY,         "-0.fdq" );
+std::pair<KeyValueStoreType, std::string> lsmSuffix = std::make_pair( KeyValueStoreType::SSD_LSM,            ".lsm-wal0.fdq" );
+std::pair<KeyValueStoreType, std::string> redwoodSuffix = std::make_pair( KeyValueStoreType::SSD_REDWOOD_V1, ".redwood" );
 
 std::string validationFilename = "_validate";
 
@@ -191,6 +193,10 @@ std::string filenameFromSample( KeyValueStoreType storeType, std::string folder,
 		return joinPath(folder, sample_filename);
 	else if( storeType == KeyValueStoreType::MEMORY )
 		return joinPath( folder, sample_filename.substr(0, sample_filename.size() - 5) );
+	else if( storeType == KeyValueStoreType::SSD_LSM )
+		return joinPath( folder, sample_filename.substr(0, sample_filename.size() - 9) );
+	else if( storeType == KeyValueStoreType::SSD_REDWOOD_V1 )
+		return joinPath( folder, sample_filename );
 
 	UNREACHABLE();
 }
@@ -202,6 +208,10 @@ std::string filenameFromId( KeyValueStoreType storeType, std::string folder, std
 		return joinPath(folder, prefix + id.toString() + ".sqlite");
 	else if( storeType == KeyValueStoreType::MEMORY )
 		return joinPath( folder, prefix + id.toString() + "-" );
+	else if( storeType == KeyValueStoreType::SSD_LSM )
+		return joinPath( folder, prefix + id.toString() + ".lsm" );
+	else if( storeType == KeyValueStoreType::SSD_REDWOOD_V1 )
+		return joinPath( folder, prefix + id.toString() + ".redwood" );
 
 	UNREACHABLE();
 }
@@ -210,7 +220,7 @@ struct DiskStore {
 	enum COMPONENT { TLogData, Storage };
 
 	UID storeID;
-	std::string filename; // For KVStoreMemory just the base filename to be passed to IDiskQueue
+	std::string filename; // For KVStoreMemory just the base filename to be passed to IDiskQueue; for KeyValueStoreLSM the name its files begin with
 	COMPONENT storedComponent;
 	KeyValueStoreType storeType;
 };
@@ -248,6 +258,10 @@ std::vector< DiskStore > getDiskStores( std::string folder ) {
 	result.insert( result.end(), result1.begin(), result1.end() );
 	auto result2 = getDiskStores( folder, memorySuffix.second, memorySuffix.first );
 	result.insert( result.end(), result2.begin(), result2.end() );
+	auto result3 = getDiskStores( folder, lsmSuffix.second, lsmSuffix.first );
+	result.insert( result.end(), result3.begin(), result3.end() );
+	auto result4 = getDiskStores( folder, redwoodSuffix.second, redwoodSuffix.first );
+	result.insert( result.end(), result4.begin(), result4.end() );
 	return result;
 }
 
@@ -359,7 +373,7 @@ ACTOR Future<Void> storageServerRollbackRebooter( Future<Void> prevStorageServer
 		ssi.uniqueID = id;
 		ssi.locality = locality;
 		ssi.initEndpoints();
-		auto* kv = openKVStore( storeType, filename, ssi.uniqueID, memoryLimit );
+		auto* kv = openKVStore( storeType, filename, ssi.uniqueID, memoryLimit, false, false, true );
 		Future<Void> kvClosed = kv->onClosed();
 		filesClosed->add( kvClosed );
 		prevStorageServer = storageServer( kv, ssi, db, folder, Promise<Void>() );
@@ -555,7 +569,7 @@ ACTOR Future<Void> workerServer( Reference<ClusterConnectionFile> connFile, Refe
 			DiskStore s = stores[f];
 			// FIXME: Error handling
 			if( s.storedComponent == DiskStore::Storage ) {
-				IKeyValueStore* kv = openKVStore(s.storeType, s.filename, s.storeID, memoryLimit, false, validateDataFiles);
+				IKeyValueStore* kv = openKVStore(s.storeType, s.filename, s.storeID, memoryLimit, false, validateDataFiles, true);
 				Future<Void> kvClosed = kv->onClosed();
 				filesClosed.add( kvClosed );
 
@@ -734,7 +748,7 @@ ACTOR Future<Void> workerServer( Reference<ClusterConnectionFile> connFile, Refe
 					//printf("Recruited as storageServer\n");
 
 					std::string filename = filenameFromId( req.storeType, folder, fileStoragePrefix.toString(), recruited.id() );
-					IKeyValueStore* data = openKVStore( req.storeType, filename, recruited.id(), memoryLimit );
+					IKeyValueStore* data = openKVStore( req.storeType, filename, recruited.id(), memoryLimit, false, false, true );
 					Future<Void> kvClosed = data->onClosed();
 					filesClosed.add( kvClosed );
 					ReplyPromise<InitializeStorageReply> storageReady = req.reply;
@@ -837,6 +851,12 @@ ACTOR Future<Void> workerServer( Reference<ClusterConnectionFile> connFile, Refe
 						else if (d.storeType == KeyValueStoreType::SSD_BTREE_V2) {
 							included = fileExists(d.filename + ".sqlite-wal");
 						}
+						else if (d.storeType == KeyValueStoreType::SSD_LSM) {
+							included = fileExists(d.filename + "-wal1.fdq");
+						}
+						else if (d.storeType == KeyValueStoreType::SSD_REDWOOD_V1) {
+							included = fileExists(d.filename);
+						}
 						else {
 							ASSERT(d.storeType == KeyValueStoreType::MEMORY);
 							included = fileExists(d.filename + "1.fdq");
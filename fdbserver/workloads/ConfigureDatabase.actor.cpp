@@ -26,7 +26,7 @@
 #include "flow/actorcompiler.h"  // This must be the last #include.
 
 // "ssd" is an alias to the preferred type which skews the random distribution toward it but that's okay.
-static const char* storeTypes[] = { "ssd", "ssd-1", "ssd-2", "memory" };
+static const char* storeTypes[] = { "ssd", "ssd-1", "ssd-2", "ssd-lsm", "ssd-redwood-experimental", "memory" };
 static const char* redundancies[] = { "single", "double", "triple" };
 
 struct ConfigureDatabaseWorkload : TestWorkload {
@@ -0,0 +1,137 @@
+/*
+ * DiskQueueCommit.actor.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "workloads.h"
+#include "fdbrpc/IAsyncFile.h"
+#include "fdbrpc/ContinuousSample.h"
+#include "fdbserver/IDiskQueue.h"
+#include "flow/actorcompiler.h"  // This must be the last #include.
+
+// Measures how many concurrent commits a disk queue completes per second, against the latency of a single
+// write and fsync on the same device.  Without any grouping of commits, commits/sec is at most about 1/fsync latency.
+struct DiskQueueCommitWorkload : TestWorkload {
+	bool enabled;
+	double testDuration;
+	int committers, bytesPerCommit, fsyncSamples;
+	std::string filename;
+
+	PerfIntCounter commits;
+	ContinuousSample<double> commitLatency, fsyncLatency;
+
+	DiskQueueCommitWorkload(WorkloadContext const& wcx)
+		: TestWorkload(wcx), commits("Commits"), commitLatency(2000), fsyncLatency(2000)
+	{
+		enabled = !clientId; // only do this on the "first" client
+		testDuration = getOption( options, LiteralStringRef("testDuration"), 10.0 );
+		committers = getOption( options, LiteralStringRef("committers"), 64 );
+		bytesPerCommit = getOption( options, LiteralStringRef("bytesPerCommit"), 1000 );
+		fsyncSamples = getOption( options, LiteralStringRef("fsyncSamples"), 200 );
+		filename = getOption( options, LiteralStringRef("filename"), LiteralStringRef("diskqueuecommit") ).toString();
+	}
+
+	virtual std::string description() { return "DiskQueueCommit"; }
+	virtual Future<Void> setup( Database const& cx ) { return Void(); }
+	virtual Future<Void> start( Database const& cx ) {
+		if (enabled)
+			return _start(this);
+		return Void();
+	}
+	virtual Future<bool> check( Database const& cx ) { return true; }
+
+	virtual void getMetrics( vector<PerfMetric>& m ) {
+		if (!enabled) return;
+		double commitsPerSecond = commits.getValue() / testDuration;
+		m.push_back( commits.getMetric() );
+		m.push_back( PerfMetric( "Commits/sec", commitsPerSecond, false ) );
+		m.push_back( PerfMetric( "Mean Fsync Latency (ms)", 1000 * fsyncLatency.mean(), true ) );
+		m.push_back( PerfMetric( "Median Fsync Latency (ms)", 1000 * fsyncLatency.median(), true ) );
+		// How many commits each fsync's worth of time carried; 1.0 is the most a queue that syncs each commit on its own can do
+		m.push_back( PerfMetric( "Commits per Fsync Latency", commitsPerSecond * fsyncLatency.mean(), false ) );
+		m.push_back( PerfMetric( "Mean Commit Latency (ms)", 1000 * commitLatency.mean(), true ) );
+		m.push_back( PerfMetric( "Median Commit Latency (ms)", 1000 * commitLatency.median(), true ) );
+		m.push_back( PerfMetric( "99% Commit Latency (ms)", 1000 * commitLatency.percentile( 0.99 ), true ) );
+		m.push_back( PerfMetric( "Max Commit Latency (ms)", 1000 * commitLatency.max(), true ) );
+	}
+
+	ACTOR static Future<Void> measureFsync( DiskQueueCommitWorkload* self ) {
+		state Reference<IAsyncFile> file = wait( IAsyncFileSystem::filesystem()->open( self->filename + ".sync", IAsyncFile::OPEN_CREATE | IAsyncFile::OPEN_READWRITE | IAsyncFile::OPEN_UNBUFFERED | IAsyncFile::OPEN_UNCACHED | IAsyncFile::OPEN_LOCK, 0600 ) );
+		state vector<uint8_t> pagedata(4096 * 2);
+		state uint8_t* page = (uint8_t*)((intptr_t(&pagedata[0]) | intptr_t(4095)) + 1);
+		state int i;
+		for(i=0; i<self->fsyncSamples; i++) {
+			state double begin = now();
+			memset( page, i, 4096 );
+			wait( file->write( page, 4096, 4096 * (i%16) ) );
+			wait( file->sync() );
+			self->fsyncLatency.addSample( now() - begin );
+		}
+		file = Reference<IAsyncFile>();
+		wait( IAsyncFileSystem::filesystem()->deleteFile( self->filename + ".sync", true ) );
+		return Void();
+	}
+
+	ACTOR static Future<Void> committer( DiskQueueCommitWorkload* self, IDiskQueue* queue, double end ) {
+		state Standalone<StringRef> data = makeString( self->bytesPerCommit );
+		memset( mutateString(data), 'x', data.size() );
+		while (now() < end) {
+			state double begin = now();
+			state IDiskQueue::location pushed = queue->push( data );
+			wait( queue->commit() );
+			self->commitLatency.addSample( now() - begin );
+			++self->commits;
+			// Keep the queue files small; everything up to this commit is durable
+			queue->pop( pushed );
+		}
+		return Void();
+	}
+
+	ACTOR static Future<Void> _start( DiskQueueCommitWorkload* self ) {
+		wait( measureFsync(self) );
+		TraceEvent("DiskQueueCommitFsync").detail("Mean", self->fsyncLatency.mean()).detail("Median", self->fsyncLatency.median());
+
+		state IDiskQueue* queue = openDiskQueue( self->filename, g_random->randomUniqueID() );
+		state Error err;
+		try {
+			loop {
+				Standalone<StringRef> r = wait( queue->readNext( 1<<20 ) );
+				if (r.size() < 1<<20) break;
+			}
+
+			state double end = now() + self->testDuration;
+			state vector<Future<Void>> actors;
+			for(int c=0; c<self->committers; c++)
+				actors.push_back( committer(self, queue, end) );
+			choose {
+				when( wait( waitForAll(actors) ) ) {}
+				when( wait( queue->getError() ) ) { ASSERT(false); }
+			}
+		} catch (Error& e) {
+			err = e;
+		}
+
+		Future<Void> closed = queue->onClosed();
+		queue->dispose();
+		wait( closed );
+		if (err.code() != invalid_error_code) throw err;
+		return Void();
+	}
+};
+
+WorkloadFactory<DiskQueueCommitWorkload> DiskQueueCommitWorkloadFactory("DiskQueueCommit");
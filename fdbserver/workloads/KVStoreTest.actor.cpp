@@ -198,15 +198,17 @@ struct KVStoreTestWorkload : TestWorkload {
 	double testDuration, operationsPerSecond;
 	double commitFraction, setFraction;
 	int nodeCount, keyBytes, valueBytes;
-	bool doSetup, doClear, doCount;
+	bool doSetup, doClear, doCount, doScan;
+	int scanRowLimit, scanByteLimit;
 	std::string filename;
 	PerfIntCounter reads, sets, commits;
-	Histogram<float> readLatency, commitLatency;
-	double setupTook;
+	Histogram<float> readLatency, commitLatency, scanLatency;
+	double setupTook, scanTook;
+	int64_t scanRows, scanBytes;
 	std::string storeType;
 
 	KVStoreTestWorkload( WorkloadContext const& wcx )
-		: TestWorkload(wcx), reads("Reads"), sets("Sets"), commits("Commits"), setupTook(0)
+		: TestWorkload(wcx), reads("Reads"), sets("Sets"), commits("Commits"), setupTook(0), scanTook(0), scanRows(0), scanBytes(0)
 	{
 		enabled = !clientId; // only do this on the "first" client
 		testDuration = getOption( options, LiteralStringRef("testDuration"), 10.0 );
@@ -219,6 +221,10 @@ struct KVStoreTestWorkload : TestWorkload {
 		doSetup = getOption( options, LiteralStringRef("setup"), false );
 		doClear = getOption( options, LiteralStringRef("clear"), false );
 		doCount = getOption( options, LiteralStringRef("count"), false );
+		doScan = getOption( options, LiteralStringRef("scan"), false );
+		// Each scan request is limited like a storage server's getKeyValues
+		scanRowLimit = getOption( options, LiteralStringRef("scanRowLimit"), 1<<30 );
+		scanByteLimit = getOption( options, LiteralStringRef("scanByteLimit"), 1000000 );
 		filename = getOption( options, LiteralStringRef("filename"), Value() ).toString();
 		saturation = getOption( options, LiteralStringRef("saturation"), false );
 		storeType = getOption( options, LiteralStringRef("storeType"), LiteralStringRef("ssd") ).toString();
@@ -246,6 +252,12 @@ struct KVStoreTestWorkload : TestWorkload {
 		m.push_back(commits.getMetric());
 		metricsFromHistogram(m, "Read Latency (ms)", readLatency);
 		metricsFromHistogram(m, "Commit Latency (ms)", commitLatency);
+		if (scanTook) {
+			m.push_back( PerfMetric("Scan Rows", scanRows, false) );
+			m.push_back( PerfMetric("Scan Rows/sec", scanRows / scanTook, false) );
+			m.push_back( PerfMetric("Scan MB/sec", scanBytes / scanTook / 1e6, false) );
+			metricsFromHistogram(m, "Scan Request Latency (ms)", scanLatency);
+		}
 	}
 };
 
@@ -278,6 +290,24 @@ ACTOR Future<Void> testKVStoreMain( KVStoreTestWorkload* workload, KVTest* ptest
 		printf("Counted: %lld in %0.1fs\n", count, elapsed);
 	}
 
+	if (workload->doScan) {
+		// Scan throughput: one full scan of the store in requests of at most scanRowLimit rows and scanByteLimit bytes
+		state Key begin;
+		state double scanBegin = timer();
+		loop {
+			state double requestBegin = timer();
+			Standalone<VectorRef<KeyValueRef>> kv = wait( test.store->readRange( KeyRangeRef(begin, LiteralStringRef("\xff\xff\xff\xff")), workload->scanRowLimit, workload->scanByteLimit ) );
+			workload->scanLatency.addSample( timer() - requestBegin );
+			if (!kv.size()) break;
+			workload->scanRows += kv.size();
+			workload->scanBytes += kv.expectedSize();
+			begin = keyAfter( kv[ kv.size()-1 ].key );
+		}
+		workload->scanTook = timer()-scanBegin;
+		TraceEvent("KVStoreScan").detail("Rows", workload->scanRows).detail("Bytes", workload->scanBytes).detail("Took", workload->scanTook);
+		printf("Scanned: %lld rows, %0.1f MB/s in %0.1fs\n", workload->scanRows, workload->scanBytes / workload->scanTook / 1e6, workload->scanTook);
+	}
+
 	if (workload->doSetup) {
 		wr << Version(0);
 		wr.serializeBytes(extraValue, extraBytes);
@@ -381,6 +411,10 @@ ACTOR Future<Void> testKVStore(KVStoreTestWorkload* workload) {
 		test.store = keyValueStoreSQLite( fn, id, KeyValueStoreType::SSD_BTREE_V2);
 	else if (workload->storeType == "memory")
 		test.store = keyValueStoreMemory( fn, id, 500e6 );
+	else if (workload->storeType == "ssd-lsm")
+		test.store = keyValueStoreLSM( fn, id );
+	else if (workload->storeType == "ssd-redwood-experimental")
+		test.store = keyValueStoreRedwoodV1( fn, id );
 	else
 		ASSERT(false);
 
@@ -65,7 +65,8 @@ struct UnitTestWorkload : TestWorkload {
 		state int allTestCount = 0;
 
 		for (auto t = g_unittests.tests; t != NULL; t = t->next) {
-			if (StringRef(t->name).startsWith(self->testPattern)) {
+			// Tests named with a leading '!' (such as benchmarks) only run when the pattern names them
+			if (StringRef(t->name).startsWith(self->testPattern) && (t->name[0] != '!' || self->testPattern.size())) {
 				++self->testsAvailable;
 				tests.push_back(t);
 			}
@@ -0,0 +1,125 @@
+/*
+ * VisibilityLatency.actor.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fdbrpc/ContinuousSample.h"
+#include "fdbclient/NativeAPI.h"
+#include "fdbserver/TesterInterface.h"
+#include "workloads.h"
+#include "flow/actorcompiler.h"  // This must be the last #include.
+
+// Measures how long after a commit returns its mutations are readable on a storage server.  Each writer commits a key and then reads it back
+// at exactly the commit version, which the storage server answers only once it has pulled that version from the tlogs.  Reading the key again
+// at the same version measures the read round trip alone, so the difference between the two is the time the storage server lagged the commit.
+struct VisibilityLatencyWorkload : TestWorkload {
+	bool enabled;
+	double testDuration;
+	int actorCount;
+	Key keyPrefix;
+
+	PerfIntCounter commits, retries;
+	ContinuousSample<double> visibleLatency, readLatency;
+
+	VisibilityLatencyWorkload(WorkloadContext const& wcx)
+		: TestWorkload(wcx), commits("Commits"), retries("Retries"), visibleLatency(2000), readLatency(2000)
+	{
+		enabled = !clientId; // only do this on the "first" client
+		testDuration = getOption( options, LiteralStringRef("testDuration"), 10.0 );
+		actorCount = getOption( options, LiteralStringRef("actorCount"), 10 );
+		keyPrefix = getOption( options, LiteralStringRef("keyPrefix"), LiteralStringRef("VisibilityLatency/") );
+	}
+
+	virtual std::string description() { return "VisibilityLatency"; }
+	virtual Future<Void> setup( Database const& cx ) { return Void(); }
+	virtual Future<Void> start( Database const& cx ) {
+		if (enabled)
+			return _start(cx, this);
+		return Void();
+	}
+	virtual Future<bool> check( Database const& cx ) { return true; }
+
+	virtual void getMetrics( vector<PerfMetric>& m ) {
+		if (!enabled) return;
+		m.push_back( commits.getMetric() );
+		m.push_back( retries.getMetric() );
+		m.push_back( PerfMetric( "Mean Commit To Readable Latency (ms)", 1000 * visibleLatency.mean(), true ) );
+		m.push_back( PerfMetric( "Median Commit To Readable Latency (ms)", 1000 * visibleLatency.median(), true ) );
+		m.push_back( PerfMetric( "99% Commit To Readable Latency (ms)", 1000 * visibleLatency.percentile( 0.99 ), true ) );
+		m.push_back( PerfMetric( "Max Commit To Readable Latency (ms)", 1000 * visibleLatency.max(), true ) );
+		m.push_back( PerfMetric( "Mean Read Latency (ms)", 1000 * readLatency.mean(), true ) );
+		m.push_back( PerfMetric( "Median Read Latency (ms)", 1000 * readLatency.median(), true ) );
+		// The part of the commit to readable latency spent waiting for the storage server to have the commit version
+		m.push_back( PerfMetric( "Mean Storage Lag Behind Commit (ms)", 1000 * std::max(0.0, visibleLatency.mean() - readLatency.mean()), true ) );
+	}
+
+	ACTOR static Future<double> readAt( Database cx, Key key, Version version ) {
+		state Transaction tr( cx );
+		loop {
+			state double begin = now();
+			try {
+				tr.setVersion( version );
+				Optional<Value> val = wait( tr.get( key ) );
+				ASSERT( val.present() );
+				return now() - begin;
+			} catch (Error& e) {
+				// A storage server far enough behind the commit throws future_version, which is retried at the same version
+				wait( tr.onError(e) );
+			}
+		}
+	}
+
+	ACTOR static Future<Void> writer( Database cx, VisibilityLatencyWorkload* self, int index, double end ) {
+		state Key key = self->keyPrefix.withSuffix( format("%08d", index) );
+		state int64_t count = 0;
+		while (now() < end) {
+			state Transaction tr( cx );
+			loop {
+				try {
+					tr.set( key, BinaryWriter::toValue( ++count, Unversioned() ) );
+					wait( tr.commit() );
+					break;
+				} catch (Error& e) {
+					wait( tr.onError(e) );
+					++self->retries;
+				}
+			}
+			++self->commits;
+			state Version committed = tr.getCommittedVersion();
+
+			double visible = wait( readAt( cx, key, committed ) );
+			self->visibleLatency.addSample( visible );
+			double read = wait( readAt( cx, key, committed ) );
+			self->readLatency.addSample( read );
+		}
+		return Void();
+	}
+
+	ACTOR static Future<Void> _start( Database cx, VisibilityLatencyWorkload* self ) {
+		state double end = now() + self->testDuration;
+		state vector<Future<Void>> actors;
+		for(int c=0; c<self->actorCount; c++)
+			actors.push_back( writer(cx, self, c, end) );
+		wait( waitForAll(actors) );
+		TraceEvent("VisibilityLatency").detail("Mean", self->visibleLatency.mean()).detail("Median", self->visibleLatency.median())
+			.detail("P99", self->visibleLatency.percentile(0.99)).detail("ReadMean", self->readLatency.mean());
+		return Void();
+	}
+};
+
+WorkloadFactory<VisibilityLatencyWorkload> VisibilityLatencyWorkloadFactory("VisibilityLatency");
@@ -100,6 +100,8 @@ public:
 	inline size_t getSize() const;
 
 	inline bool hasFree( size_t size, const void *address );
+	// True if the given bytes are known to be kept alive by this arena (searching a limited number of its blocks)
+	inline bool keepsAlive( const void* begin, size_t size ) const;
 
 	friend void* operator new ( size_t size, Arena& p );
 	friend void* operator new[] ( size_t size, Arena& p );
@@ -150,6 +152,19 @@ struct ArenaBlock : NonCopyable, ThreadSafeReferenceCounted<ArenaBlock>
 		}
 		return s;
 	}
+	bool contains( const uint8_t* begin, size_t size, int& blocksToSearch ) const {
+		if (blocksToSearch-- <= 0) return false;
+		if (begin >= (const uint8_t*)getData() && begin + size <= (const uint8_t*)getNextData()) return true;
+		if (isTiny()) return false;
+
+		int o = nextBlockOffset;
+		while (o) {
+			ArenaBlockRef* r = (ArenaBlockRef*)((char*)getData() + o);
+			if (r->next->contains(begin, size, blocksToSearch)) return true;
+			o = r->nextBlockOffset;
+		}
+		return false;
+	}
 	// just for debugging:
 	void getUniqueBlocks(std::set<ArenaBlock*>& a) {
 		a.insert(this);
@@ -303,6 +318,10 @@ inline void Arena::dependsOn( const Arena& p ) {
 }
 inline size_t Arena::getSize() const { return impl ? impl->totalSize() : 0; }
 inline bool Arena::hasFree( size_t size, const void *address ) { return impl && impl->unused() >= size && impl->getNextData() == address; }
+inline bool Arena::keepsAlive( const void* begin, size_t size ) const {
+	int blocksToSearch = 64;
+	return impl && impl->contains( (const uint8_t*)begin, size, blocksToSearch );
+}
 inline void* operator new ( size_t size, Arena& p ) {
 	UNSTOPPABLE_ASSERT( size < std::numeric_limits<int>::max() );
 	return ArenaBlock::allocate( p.impl, (int)size );
@@ -375,7 +394,8 @@ public:
 		//T tmp;
 		//ar >> tmp;
 		//*this = tmp;
-		ar & (*(T*)this) & arena();
+		// The arena goes first so that a PacketWriter can send large contents by reference to it
+		ar & arena() & (*(T*)this);
 	}
 
 	/*static Standalone<T> fakeStandalone( const T& t ) {
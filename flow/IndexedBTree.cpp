@@ -0,0 +1,230 @@
+/*
+ * IndexedBTree.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// At the moment, this file just contains tests.  IndexedBTree<> is a template
+// and so all the important implementation is in the header file
+
+#include "IndexedBTree.h"
+#include "IndexedSet.h"
+#include "IRandom.h"
+#include <set>
+#include <string>
+#include "UnitTest.h"
+
+namespace {
+
+// The first 8 bytes of a string, big endian, as the memory storage engine does for its keys
+struct StringPrefix {
+	uint64_t operator()( std::string const& s ) const {
+		uint64_t prefix = 0;
+		for(int i = 0; i < 8 && i < s.size(); i++)
+			prefix |= uint64_t(uint8_t(s[i])) << (56 - 8*i);
+		return prefix;
+	}
+};
+
+// Keys which share long prefixes, so that comparisons often fall through the prefix to the whole key
+std::string randomKey( int range ) {
+	return format("/keyspace/%010d", g_random->randomInt(0, range));
+}
+
+}
+
+TEST_CASE("flow/IndexedBTree/random ops") {
+	for (int t = 0; t<100; t++) {
+		IndexedBTree<int, int> bt;
+		std::set<int> ss;
+		int rr = g_random->randomInt(0, 600) * g_random->randomInt(0, 600);
+		for (int n = 0; n<rr; n++) {
+			double r = g_random->random01();
+			int k = g_random->randomInt(0, 1000000);
+			if (r < 0.5) {
+				bt.insert(k, 3);
+				ss.insert(k);
+			} else if (r < 0.8) {
+				auto i = bt.lower_bound(k);
+				auto si = ss.lower_bound(k);
+				if (si != ss.end()) ss.erase(si);
+				bt.erase(i);
+			} else if (r < 0.81) {
+				int e = k + g_random->randomInt(0, 100000);
+				bt.erase(bt.lower_bound(k), bt.lower_bound(e));
+				ss.erase(ss.lower_bound(k), ss.lower_bound(e));
+			}
+		}
+
+		ASSERT(bt.testonly_assertValid() == ss.size());
+		ASSERT(bt.sumTo(bt.end()) == ss.size()*3);
+
+		auto it = bt.begin();
+		for (int s : ss) {
+			ASSERT(it != bt.end() && *it == s);
+			++it;
+		}
+		ASSERT(it == bt.end());
+
+		for (int q = 0; q<1000; q++) {
+			int k = g_random->randomInt(0, 1000000);
+			auto i = bt.lower_bound(k);
+			auto si = ss.lower_bound(k);
+			ASSERT((i == bt.end()) == (si == ss.end()));
+			if (si != ss.end()) ASSERT(*i == *si);
+			int before = std::distance(ss.begin(), si);
+			ASSERT(bt.sumTo(i) == before*3);
+			ASSERT(bt.index(before*3) == i);
+
+			auto ui = bt.upper_bound(k);
+			auto sui = ss.upper_bound(k);
+			ASSERT((ui == bt.end()) == (sui == ss.end()));
+			if (sui != ss.end()) ASSERT(*ui == *sui);
+
+			auto li = bt.lastLessOrEqual(k);
+			ASSERT(li == bt.previous(ui));
+			if (li != bt.end()) ASSERT(*li <= k);
+		}
+	}
+	return Void();
+}
+
+TEST_CASE("flow/IndexedBTree/all numbers") {
+	IndexedBTree<int, int64_t> bt;
+
+	std::vector<int> allNumbers;
+	for (int i = 0; i<1000000; i++)
+		allNumbers.push_back(i);
+	std::random_shuffle(allNumbers.begin(), allNumbers.end());
+
+	for (int i = 0; i<allNumbers.size(); i++)
+		bt.insert(allNumbers[i], allNumbers[i]);
+
+	ASSERT(bt.testonly_assertValid() == allNumbers.size());
+	ASSERT(bt.sumTo(bt.end()) == allNumbers.size()*(allNumbers.size() - 1) / 2);
+
+	for (int i = 0; i<100000; i++) {
+		int b = g_random->randomInt(1, (int)allNumbers.size());
+		int64_t ntotal = int64_t(b)*(b - 1) / 2;
+		auto ii = bt.index(ntotal);
+		ASSERT(ii != bt.end() && *ii == b);
+	}
+
+	for (int i = 0; i<100000; i++) {
+		int a = g_random->randomInt(0, (int)allNumbers.size());
+		int b = g_random->randomInt(0, (int)allNumbers.size());
+		if (a>b) std::swap(a, b);
+		ASSERT(bt.sumRange(a, b) == int64_t(b - a)*(a + b - 1) / 2);
+	}
+
+	bt.erase(300000, 700001);
+	ASSERT(bt.testonly_assertValid() == 600000 - 1);
+	ASSERT(bt.find(300000) == bt.end() && bt.find(700000) == bt.end());
+	ASSERT(*bt.lower_bound(300000) == 700001 && *bt.previous(bt.lower_bound(300000)) == 299999);
+
+	return Void();
+}
+
+TEST_CASE("flow/IndexedBTree/strings") {
+	IndexedBTree<std::string, int, StringPrefix> bt;
+	std::set<std::string> ss;
+	for (int i = 0; i<200000; i++) {
+		std::string k = randomKey(100000);
+		if (g_random->random01() < 0.7) {
+			bt.insert(k, (int)k.size(), g_random->random01() < 0.5);
+			ss.insert(k);
+		} else {
+			bt.erase(k);
+			ss.erase(k);
+		}
+	}
+	// Keys that differ within their first 8 bytes, and keys that are prefixes of each other
+	for (std::string k : { "", "/", "/keyspac", "/keyspace", "/keyspace/", "0", "\xff" }) {
+		bt.insert(k, (int)k.size());
+		ss.insert(k);
+	}
+
+	ASSERT(bt.testonly_assertValid() == ss.size());
+	auto it = bt.begin();
+	for (auto& s : ss) {
+		ASSERT(*it == s);
+		++it;
+	}
+	for (int q = 0; q<10000; q++) {
+		std::string k = randomKey(100000).substr(0, g_random->randomInt(0, 21));
+		auto i = bt.lower_bound(k);
+		auto si = ss.lower_bound(k);
+		ASSERT((i == bt.end()) == (si == ss.end()));
+		if (si != ss.end()) ASSERT(*i == *si);
+	}
+	return Void();
+}
+
+TEST_CASE("flow/perf/IndexedBTree") {
+	// Memory per element and the speed of inserts, point lookups and scans, against IndexedSet
+	const int N = 1000000;
+	std::vector<std::string> keys;
+	for (int i = 0; i<N; i++)
+		keys.push_back(randomKey(1<<30));
+
+	IndexedSet<std::string, int64_t> is;
+	IndexedBTree<std::string, int64_t, StringPrefix> bt;
+
+	double start = timer();
+	for (auto& k : keys) is.insert(k, 1);
+	double isInsert = timer() - start;
+	start = timer();
+	for (auto& k : keys) bt.insert(k, 1);
+	double btInsert = timer() - start;
+	ASSERT(is.sumTo(is.end()) == bt.sumTo(bt.end()));
+
+	int64_t count = bt.testonly_assertValid();
+	printf("IndexedSet: %d bytes/element; IndexedBTree: %0.1f bytes/element (%d estimated)\n",
+		is.getElementBytes(), double(bt.testonly_nodeBytes()) / count, bt.getElementBytes());
+	printf("Insert: IndexedSet %0.1f Kops/sec, IndexedBTree %0.1f Kops/sec\n", N / 1000.0 / isInsert, N / 1000.0 / btInsert);
+
+	std::random_shuffle(keys.begin(), keys.end());
+	int64_t found = 0;
+	start = timer();
+	for (auto& k : keys) found += is.find(k) != is.end();
+	double isFind = timer() - start;
+	start = timer();
+	for (auto& k : keys) found += bt.find(k) != bt.end();
+	double btFind = timer() - start;
+	ASSERT(found == 2*N);
+	printf("Find: IndexedSet %0.1f Kops/sec, IndexedBTree %0.1f Kops/sec\n", N / 1000.0 / isFind, N / 1000.0 / btFind);
+
+	// Scans of 1000 elements from random starting points, as in a storage server's range reads
+	const int scans = 1000;
+	int64_t scanned = 0;
+	start = timer();
+	for (int s = 0; s<scans; s++) {
+		auto i = is.lower_bound(keys[s]);
+		for (int j = 0; j<1000 && i != is.end(); j++, ++i) scanned += i->size();
+	}
+	double isScan = timer() - start;
+	start = timer();
+	for (int s = 0; s<scans; s++) {
+		auto i = bt.lower_bound(keys[s]);
+		for (int j = 0; j<1000 && i != bt.end(); j++, ++i) scanned -= i->size();
+	}
+	double btScan = timer() - start;
+	ASSERT(scanned == 0);
+	printf("Scan: IndexedSet %0.1f M elements/sec, IndexedBTree %0.1f M elements/sec\n", scans / 1000.0 / isScan, scans / 1000.0 / btScan);
+
+	return Void();
+}
@@ -0,0 +1,884 @@
+/*
+ * IndexedBTree.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLOW_INDEXEDBTREE_H
+#define FLOW_INDEXEDBTREE_H
+#pragma once
+
+#include "Platform.h"
+#include "Error.h"
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+// IndexedBTree<T, Metric, Prefix> is a B+tree with the interface of IndexedSet<T, Metric> (see IndexedSet.h), for
+// large sets where the memory used per element and the cost of a cache miss per tree level matter.  Elements are
+// stored by value, many to a leaf, in cache line aligned nodes.  The differences from IndexedSet are:
+//   - Any insert or erase invalidates every iterator, as with std::vector
+//   - T must be default constructible; unused slots in nodes hold T()
+//   - eraseAsync() and addMetric() are not provided
+//   - sumTo() and index() are O(lg N) but visit every slot of the nodes on the path
+// Prefix, if given, is a functor mapping an element or any search key type to a uint64_t such that a<b implies
+//     Prefix()(a) <= Prefix()(b) (for example the first 8 bytes of a string key, big endian).  Nodes keep the prefix
+//     of each element and separator next to each other, so a search compares whole keys only when the prefixes tie.
+
+struct NoKeyPrefix {
+	template <class Key>
+	uint64_t operator()( Key const& ) const { return 0; }
+};
+
+template <class T, class Metric, class Prefix = NoKeyPrefix>
+struct IndexedBTree {
+	typedef T value_type;
+	typedef T key_type;
+
+	enum { LeafCapacity = 32, InternalCapacity = 32 };
+
+private:
+	struct Internal;
+
+	struct Node {
+		Internal* parent;
+		int count;				// elements in a leaf, or children of an internal node
+		bool leaf;
+
+		explicit Node( bool leaf ) : parent(NULL), count(0), leaf(leaf) {}
+	};
+
+	struct Leaf : Node {
+		Leaf *prev, *next;
+		alignas(64) uint64_t prefix[LeafCapacity];
+		Metric metric[LeafCapacity];
+		T data[LeafCapacity];
+
+		Leaf() : Node(true), prev(NULL), next(NULL) {}
+	};
+
+	struct Internal : Node {
+		alignas(64) uint64_t prefix[InternalCapacity];	// prefix of separator[i], for i > 0
+		Metric total[InternalCapacity];					// sum of the metrics of the elements under child[i]
+		Node* child[InternalCapacity];
+		T separator[InternalCapacity];					// a copy of the first element under child[i], for i > 0
+
+		Internal() : Node(false) {}
+	};
+
+public:
+	struct iterator {
+		typename IndexedBTree::Leaf* leaf;
+		int index;
+
+		iterator() : leaf(NULL), index(0) {}
+		iterator( typename IndexedBTree::Leaf* leaf, int index ) : leaf(leaf), index(index) {}
+		T& operator*() { return leaf->data[index]; }
+		T* operator->() { return &leaf->data[index]; }
+		void operator++() {
+			if (++index == leaf->count) {
+				leaf = leaf->next;
+				index = 0;
+			}
+		}
+		void decrementNonEnd() {
+			if (index) {
+				index--;
+			} else {
+				leaf = leaf->prev;
+				index = leaf->count - 1;
+			}
+		}
+		bool operator == ( const iterator& r ) const { return leaf == r.leaf && index == r.index; }
+		bool operator != ( const iterator& r ) const { return !(*this == r); }
+	};
+
+	IndexedBTree() : root(NULL) {}
+	~IndexedBTree() { clear(); }
+	IndexedBTree(IndexedBTree&& r) noexcept(true) : root(r.root) { r.root = NULL; }
+	IndexedBTree& operator=(IndexedBTree&& r) noexcept(true) { clear(); root = r.root; r.root = NULL; return *this; }
+
+	iterator begin() const;
+	iterator end() const { return iterator(); }
+	iterator previous(iterator i) const;
+	iterator lastItem() const;
+
+	bool empty() const { return !root; }
+	void clear() { if (root) freeTree(root); root = NULL; }
+	void swap( IndexedBTree& r ) { std::swap( root, r.root ); }
+
+	// Place data in the set with the given metric.  If an item equal to data is already in the set and,
+	//   replaceExisting == true, it will be overwritten (and its metric will be replaced)
+	template <class T_, class Metric_>
+	iterator insert(T_ &&data, Metric_ &&metric, bool replaceExisting = true) {
+		bool inserted;
+		return insert( std::forward<T_>(data), std::forward<Metric_>(metric), replaceExisting, inserted );
+	}
+
+	// Insert all items from data into set, returning the number inserted or replaced.  See insert() above.
+	int insert(const std::vector<std::pair<T,Metric>>& data, bool replaceExisting = true);
+
+	// Remove the data item, if any, which is equal to key
+	template <class Key>
+	void erase(const Key &key) { erase( find(key) ); }
+
+	// Erase the indicated item.  No effect if item == end().
+	void erase(iterator item);
+
+	// Erase all data items x for which begin<=x<end
+	template <class Key>
+	void erase(const Key& begin, const Key& end) { erase( lower_bound(begin), lower_bound(end) ); }
+
+	// Erase the items in the indicated range.
+	void erase(iterator begin, iterator end);
+
+	// Returns the number of items equal to key (either 0 or 1)
+	template <class Key>
+	int count(const Key &key) const { return find(key) != end(); }
+
+	// Returns x such that key==*x, or end()
+	template <class Key>
+	iterator find(const Key &key) const;
+
+	// Returns the smallest x such that *x>=key, or end()
+	template <class Key>
+	iterator lower_bound(const Key &key) const;
+
+	// Returns the smallest x such that *x>key, or end()
+	template <class Key>
+	iterator upper_bound(const Key &key) const;
+
+	// Returns the largest x such that *x<=key, or end()
+	template <class Key>
+	iterator lastLessOrEqual( const Key &key ) const { return previous( upper_bound(key) ); }
+
+	// Returns smallest x such that sumTo(x+1) > metric, or end()
+	template <class M>
+	iterator index( M const& metric ) const;
+
+	// Return the metric inserted with item x
+	Metric getMetric(iterator x) const { return x.leaf->metric[x.index]; }
+
+	// Return the sum of getMetric(x) for begin()<=x<to
+	Metric sumTo(iterator to) const;
+
+	// Return the sum of getMetric(x) for begin<=x<end
+	Metric sumRange(iterator begin, iterator end) const { return sumTo(end) - sumTo(begin); }
+
+	// Return the sum of getMetric(x) for all x s.t. begin <= *x && *x < end
+	template <class Key>
+	Metric sumRange(const Key& begin, const Key& end) const { return sumRange(lower_bound(begin), lower_bound(end)); }
+
+	// Return the amount of memory used by an entry in the IndexedBTree, assuming leaves are three quarters full
+	static int getElementBytes() { return sizeof(Leaf) * 4 / (LeafCapacity * 3); }
+
+private:
+	IndexedBTree( const IndexedBTree& );
+	IndexedBTree& operator=( const IndexedBTree& );
+
+	Node* root;
+
+	template <class T_, class Metric_>
+	iterator insert(T_ &&data, Metric_ &&metric, bool replaceExisting, bool& inserted);
+
+	static Leaf* newLeaf() { return new (aligned_alloc(64, sizeof(Leaf))) Leaf(); }
+	static Internal* newInternal() { return new (aligned_alloc(64, sizeof(Internal))) Internal(); }
+	static void freeNode( Node* n ) {
+		if (n->leaf)
+			static_cast<Leaf*>(n)->~Leaf();
+		else
+			static_cast<Internal*>(n)->~Internal();
+		aligned_free(n);
+	}
+	static void freeTree( Node* n ) {
+		if (!n->leaf) {
+			Internal* in = static_cast<Internal*>(n);
+			for(int i=0; i<in->count; i++)
+				freeTree(in->child[i]);
+		}
+		freeNode(n);
+	}
+
+	// Whether key < item, and whether item < key, given their prefixes
+	template <class Key>
+	static bool keyLess( Key const& key, uint64_t keyPrefix, T const& item, uint64_t itemPrefix ) {
+		return keyPrefix != itemPrefix ? keyPrefix < itemPrefix : key < item;
+	}
+	template <class Key>
+	static bool itemLess( T const& item, uint64_t itemPrefix, Key const& key, uint64_t keyPrefix ) {
+		return itemPrefix != keyPrefix ? itemPrefix < keyPrefix : item < key;
+	}
+
+	// The child of n whose range holds key
+	template <class Key>
+	static int childFor( Internal* n, Key const& key, uint64_t p ) {
+		int lo = 1, hi = n->count;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (keyLess(key, p, n->separator[mid], n->prefix[mid]))
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		return lo - 1;
+	}
+
+	template <class Key>
+	Leaf* findLeaf( Key const& key, uint64_t p ) const {
+		Node* n = root;
+		while (!n->leaf)
+			n = static_cast<Internal*>(n)->child[ childFor(static_cast<Internal*>(n), key, p) ];
+		return static_cast<Leaf*>(n);
+	}
+
+	// The first slot of l whose element is not less than key (lowerBound), or is greater than key (upperBound)
+	template <class Key>
+	static int lowerBound( Leaf* l, Key const& key, uint64_t p ) {
+		int lo = 0, hi = l->count;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (itemLess(l->data[mid], l->prefix[mid], key, p))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+	template <class Key>
+	static int upperBound( Leaf* l, Key const& key, uint64_t p ) {
+		int lo = 0, hi = l->count;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (keyLess(key, p, l->data[mid], l->prefix[mid]))
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		return lo;
+	}
+
+	// An iterator to slot i of l, which may be one past its last element
+	static iterator at( Leaf* l, int i ) {
+		if (i == l->count)
+			return iterator(l->next, 0);
+		return iterator(l, i);
+	}
+
+	static int indexInParent( Node* n ) {
+		int i = 0;
+		while (n->parent->child[i] != n)
+			i++;
+		return i;
+	}
+
+	static Metric nodeTotal( Node* n ) {
+		Metric m = Metric();
+		if (n->leaf) {
+			Leaf* l = static_cast<Leaf*>(n);
+			for(int i=0; i<l->count; i++)
+				m = m + l->metric[i];
+		} else {
+			Internal* in = static_cast<Internal*>(n);
+			for(int i=0; i<in->count; i++)
+				m = m + in->total[i];
+		}
+		return m;
+	}
+
+	static void addToAncestors( Node* n, Metric const& m, bool subtract ) {
+		for(Internal* p = n->parent; p; n = p, p = p->parent) {
+			int i = indexInParent(n);
+			p->total[i] = subtract ? p->total[i] - m : p->total[i] + m;
+		}
+	}
+
+	// Called when the first element of l has changed, to keep the separator which refers to it current
+	static void updateSeparator( Leaf* l ) {
+		Node* n = l;
+		for(Internal* p = n->parent; p; n = p, p = p->parent) {
+			int i = indexInParent(n);
+			if (i) {
+				p->separator[i] = l->data[0];
+				p->prefix[i] = l->prefix[0];
+				return;
+			}
+		}
+	}
+
+	Node* split( Node* n, bool appending );
+	void removeEntry( Internal* p, int i );
+	void merge( Internal* p, int i );
+	void borrow( Internal* p, int i, int from );
+	void rebalance( Node* n );
+	void eraseSlots( Leaf* l, int begin, int end );
+
+public: // but testonly
+	// Checks every invariant of the tree and returns the number of elements
+	int testonly_assertValid() const;
+	// The bytes allocated for nodes
+	int64_t testonly_nodeBytes() const;
+
+private:
+	int assertValid( Node* n, int depth, int& leafDepth, Metric& total, Leaf*& prevLeaf, T const* lowerLimit ) const;
+	static int64_t nodeBytes( Node* n );
+};
+
+/////////////////////// implementation //////////////////////////
+
+template <class T, class Metric, class Prefix>
+typename IndexedBTree<T,Metric,Prefix>::iterator IndexedBTree<T,Metric,Prefix>::begin() const {
+	if (!root)
+		return end();
+	Node* n = root;
+	while (!n->leaf)
+		n = static_cast<Internal*>(n)->child[0];
+	return iterator(static_cast<Leaf*>(n), 0);
+}
+
+template <class T, class Metric, class Prefix>
+typename IndexedBTree<T,Metric,Prefix>::iterator IndexedBTree<T,Metric,Prefix>::lastItem() const {
+	if (!root)
+		return end();
+	Node* n = root;
+	while (!n->leaf)
+		n = static_cast<Internal*>(n)->child[ n->count-1 ];
+	return iterator(static_cast<Leaf*>(n), n->count-1);
+}
+
+template <class T, class Metric, class Prefix>
+typename IndexedBTree<T,Metric,Prefix>::iterator IndexedBTree<T,Metric,Prefix>::previous(iterator i) const {
+	if (i == end())
+		return lastItem();
+	if (!i.index && !i.leaf->prev)
+		return end();
+	i.decrementNonEnd();
+	return i;
+}
+
+template <class T, class Metric, class Prefix> template <class Key>
+typename IndexedBTree<T,Metric,Prefix>::iterator IndexedBTree<T,Metric,Prefix>::find(const Key &key) const {
+	iterator i = lower_bound(key);
+	if (i != end() && key < *i)
+		return end();
+	return i;
+}
+
+template <class T, class Metric, class Prefix> template <class Key>
+typename IndexedBTree<T,Metric,Prefix>::iterator IndexedBTree<T,Metric,Prefix>::lower_bound(const Key &key) const {
+	if (!root)
+		return end();
+	uint64_t p = Prefix()(key);
+	Leaf* l = findLeaf(key, p);
+	return at(l, lowerBound(l, key, p));
+}
+
+template <class T, class Metric, class Prefix> template <class Key>
+typename IndexedBTree<T,Metric,Prefix>::iterator IndexedBTree<T,Metric,Prefix>::upper_bound(const Key &key) const {
+	if (!root)
+		return end();
+	uint64_t p = Prefix()(key);
+	Leaf* l = findLeaf(key, p);
+	return at(l, upperBound(l, key, p));
+}
+
+template <class T, class Metric, class Prefix> template <class M>
+typename IndexedBTree<T,Metric,Prefix>::iterator IndexedBTree<T,Metric,Prefix>::index( M const& metric ) const {
+	if (!root)
+		return end();
+	M m = metric;
+	Node* n = root;
+	while (!n->leaf) {
+		Internal* in = static_cast<Internal*>(n);
+		int i = 0;
+		for(; i<in->count; i++) {
+			if (m < in->total[i])
+				break;
+			m = m - in->total[i];
+		}
+		if (i == in->count)
+			return end();
+		n = in->child[i];
+	}
+	Leaf* l = static_cast<Leaf*>(n);
+	for(int i=0; i<l->count; i++) {
+		if (m < l->metric[i])
+			return iterator(l, i);
+		m = m - l->metric[i];
+	}
+	return end();
+}
+
+template <class T, class Metric, class Prefix>
+Metric IndexedBTree<T,Metric,Prefix>::sumTo(iterator to) const {
+	if (to == end())
+		return root ? nodeTotal(root) : Metric();
+
+	Metric m = Metric();
+	for(int i=0; i<to.index; i++)
+		m = m + to.leaf->metric[i];
+	Node* n = to.leaf;
+	for(Internal* p = n->parent; p; n = p, p = p->parent) {
+		int i = indexInParent(n);
+		for(int j=0; j<i; j++)
+			m = m + p->total[j];
+	}
+	return m;
+}
+
+template <class T, class Metric, class Prefix> template <class T_, class Metric_>
+typename IndexedBTree<T,Metric,Prefix>::iterator IndexedBTree<T,Metric,Prefix>::insert(T_ &&data, Metric_ &&metric, bool replaceExisting, bool& inserted) {
+	uint64_t p = Prefix()(data);
+	Metric m = std::forward<Metric_>(metric);
+	if (!root)
+		root = newLeaf();
+
+	Leaf* l = findLeaf(data, p);
+	int i = lowerBound(l, data, p);
+	if (i < l->count && !(data < l->data[i])) {
+		inserted = replaceExisting;
+		if (replaceExisting) {
+			l->data[i] = std::forward<T_>(data);
+			addToAncestors(l, l->metric[i], true);
+			addToAncestors(l, m, false);
+			l->metric[i] = m;
+			if (!i)
+				updateSeparator(l);
+		}
+		return iterator(l, i);
+	}
+
+	inserted = true;
+	if (l->count == LeafCapacity) {
+		// Filling leaves completely when appending makes sequential loads dense
+		Leaf* r = static_cast<Leaf*>( split(l, !l->next && i == l->count) );
+		if (i > l->count) {
+			i -= l->count;
+			l = r;
+		}
+	}
+
+	std::move_backward(l->data + i, l->data + l->count, l->data + l->count + 1);
+	std::move_backward(l->metric + i, l->metric + l->count, l->metric + l->count + 1);
+	std::move_backward(l->prefix + i, l->prefix + l->count, l->prefix + l->count + 1);
+	l->data[i] = std::forward<T_>(data);
+	l->metric[i] = m;
+	l->prefix[i] = p;
+	l->count++;
+	addToAncestors(l, m, false);
+	if (!i)
+		updateSeparator(l);
+	return iterator(l, i);
+}
+
+template <class T, class Metric, class Prefix>
+int IndexedBTree<T,Metric,Prefix>::insert(const std::vector<std::pair<T,Metric>>& data, bool replaceExisting) {
+	int count = 0;
+	for(auto& d : data) {
+		bool inserted;
+		insert( d.first, d.second, replaceExisting, inserted );
+		count += inserted;
+	}
+	return count;
+}
+
+// Moves the upper part of n to a new right sibling, which is returned
+template <class T, class Metric, class Prefix>
+typename IndexedBTree<T,Metric,Prefix>::Node* IndexedBTree<T,Metric,Prefix>::split( Node* n, bool appending ) {
+	Internal* p = n->parent;
+	if (!p) {
+		p = newInternal();
+		p->count = 1;
+		p->child[0] = n;
+		p->total[0] = nodeTotal(n);
+		p->prefix[0] = 0;
+		n->parent = p;
+		root = p;
+	} else if (p->count == InternalCapacity) {
+		split( p, appending && p->child[p->count-1] == n );
+		p = n->parent;
+	}
+
+	int keep = appending ? n->count - 1 : n->count / 2;
+	Node* r;
+	T separator;
+	uint64_t separatorPrefix;
+	if (n->leaf) {
+		Leaf* l = static_cast<Leaf*>(n);
+		Leaf* s = newLeaf();
+		s->count = l->count - keep;
+		for(int i=0; i<s->count; i++) {
+			s->data[i] = std::move(l->data[keep+i]);
+			l->data[keep+i] = T();
+			s->metric[i] = l->metric[keep+i];
+			s->prefix[i] = l->prefix[keep+i];
+		}
+		l->count = keep;
+		s->next = l->next;
+		if (s->next)
+			s->next->prev = s;
+		s->prev = l;
+		l->next = s;
+		separator = s->data[0];
+		separatorPrefix = s->prefix[0];
+		r = s;
+	} else {
+		Internal* in = static_cast<Internal*>(n);
+		Internal* s = newInternal();
+		s->count = in->count - keep;
+		for(int i=0; i<s->count; i++) {
+			s->child[i] = in->child[keep+i];
+			s->child[i]->parent = s;
+			s->total[i] = in->total[keep+i];
+			s->separator[i] = std::move(in->separator[keep+i]);
+			in->separator[keep+i] = T();
+			s->prefix[i] = in->prefix[keep+i];
+		}
+		in->count = keep;
+		// The first separator of the new node moves up into the parent
+		separator = std::move(s->separator[0]);
+		separatorPrefix = s->prefix[0];
+		s->separator[0] = T();
+		s->prefix[0] = 0;
+		r = s;
+	}
+
+	int i = indexInParent(n) + 1;
+	for(int j = p->count; j > i; j--) {
+		p->child[j] = p->child[j-1];
+		p->total[j] = p->total[j-1];
+		p->separator[j] = std::move(p->separator[j-1]);
+		p->prefix[j] = p->prefix[j-1];
+	}
+	p->count++;
+	p->child[i] = r;
+	r->parent = p;
+	p->separator[i] = std::move(separator);
+	p->prefix[i] = separatorPrefix;
+	p->total[i] = nodeTotal(r);
+	p->total[i-1] = nodeTotal(n);
+	return r;
+}
+
+template <class T, class Metric, class Prefix>
+void IndexedBTree<T,Metric,Prefix>::removeEntry( Internal* p, int i ) {
+	for(int j = i; j < p->count-1; j++) {
+		p->child[j] = p->child[j+1];
+		p->total[j] = p->total[j+1];
+		p->separator[j] = std::move(p->separator[j+1]);
+		p->prefix[j] = p->prefix[j+1];
+	}
+	p->count--;
+	p->separator[p->count] = T();
+}
+
+// Merges child i+1 of p into child i
+template <class T, class Metric, class Prefix>
+void IndexedBTree<T,Metric,Prefix>::merge( Internal* p, int i ) {
+	Node* a = p->child[i];
+	Node* b = p->child[i+1];
+	bool wasEmpty = !a->count;
+	if (a->leaf) {
+		Leaf* l = static_cast<Leaf*>(a);
+		Leaf* r = static_cast<Leaf*>(b);
+		for(int j=0; j<r->count; j++) {
+			l->data[l->count+j] = std::move(r->data[j]);
+			l->metric[l->count+j] = r->metric[j];
+			l->prefix[l->count+j] = r->prefix[j];
+		}
+		l->count += r->count;
+		l->next = r->next;
+		if (l->next)
+			l->next->prev = l;
+	} else {
+		Internal* l = static_cast<Internal*>(a);
+		Internal* r = static_cast<Internal*>(b);
+		l->separator[l->count] = std::move(p->separator[i+1]);
+		l->prefix[l->count] = p->prefix[i+1];
+		for(int j=0; j<r->count; j++) {
+			l->child[l->count+j] = r->child[j];
+			l->child[l->count+j]->parent = l;
+			l->total[l->count+j] = r->total[j];
+			if (j) {
+				l->separator[l->count+j] = std::move(r->separator[j]);
+				l->prefix[l->count+j] = r->prefix[j];
+			}
+		}
+		l->count += r->count;
+	}
+	b->count = 0;
+	p->total[i] = p->total[i] + p->total[i+1];
+	removeEntry(p, i+1);
+	freeNode(b);
+	if (wasEmpty)
+		updateSeparator( static_cast<Leaf*>(a) );
+}
+
+// Moves elements or children into child i of p from its sibling i+from (from is -1 or 1) until they are about even
+template <class T, class Metric, class Prefix>
+void IndexedBTree<T,Metric,Prefix>::borrow( Internal* p, int i, int from ) {
+	Node* n = p->child[i];
+	Node* s = p->child[i+from];
+	int k = (s->count - n->count) / 2;
+	Metric moved = Metric();
+
+	if (n->leaf) {
+		Leaf* l = static_cast<Leaf*>(n);
+		Leaf* sl = static_cast<Leaf*>(s);
+		if (from < 0) {
+			std::move_backward(l->data, l->data + l->count, l->data + l->count + k);
+			std::move_backward(l->metric, l->metric + l->count, l->metric + l->count + k);
+			std::move_backward(l->prefix, l->prefix + l->count, l->prefix + l->count + k);
+			for(int j=0; j<k; j++) {
+				int src = sl->count - k + j;
+				l->data[j] = std::move(sl->data[src]);
+				sl->data[src] = T();
+				l->metric[j] = sl->metric[src];
+				l->prefix[j] = sl->prefix[src];
+				moved = moved + l->metric[j];
+			}
+		} else {
+			for(int j=0; j<k; j++) {
+				l->data[l->count+j] = std::move(sl->data[j]);
+				l->metric[l->count+j] = sl->metric[j];
+				l->prefix[l->count+j] = sl->prefix[j];
+				moved = moved + sl->metric[j];
+			}
+			std::move(sl->data + k, sl->data + sl->count, sl->data);
+			std::move(sl->metric + k, sl->metric + sl->count, sl->metric);
+			std::move(sl->prefix + k, sl->prefix + sl->count, sl->prefix);
+			for(int j = sl->count - k; j < sl->count; j++)
+				sl->data[j] = T();
+		}
+		l->count += k;
+		sl->count -= k;
+		updateSeparator( from < 0 ? l : sl );
+	} else {
+		Internal* in = static_cast<Internal*>(n);
+		Internal* si = static_cast<Internal*>(s);
+		// Rotate one child at a time through the separator in p
+		for(int step=0; step<k; step++) {
+			if (from < 0) {
+				for(int j = in->count; j > 0; j--) {
+					in->child[j] = in->child[j-1];
+					in->total[j] = in->total[j-1];
+					in->separator[j] = std::move(in->separator[j-1]);
+					in->prefix[j] = in->prefix[j-1];
+				}
+				int last = si->count - 1;
+				in->separator[1] = std::move(p->separator[i]);
+				in->prefix[1] = p->prefix[i];
+				in->child[0] = si->child[last];
+				in->total[0] = si->total[last];
+				in->separator[0] = T();
+				in->prefix[0] = 0;
+				p->separator[i] = std::move(si->separator[last]);
+				p->prefix[i] = si->prefix[last];
+				si->separator[last] = T();
+				in->child[0]->parent = in;
+				moved = moved + in->total[0];
+			} else {
+				int last = in->count;
+				in->child[last] = si->child[0];
+				in->total[last] = si->total[0];
+				in->separator[last] = std::move(p->separator[i+1]);
+				in->prefix[last] = p->prefix[i+1];
+				p->separator[i+1] = std::move(si->separator[1]);
+				p->prefix[i+1] = si->prefix[1];
+				for(int j=0; j < si->count-1; j++) {
+					si->child[j] = si->child[j+1];
+					si->total[j] = si->total[j+1];
+					si->separator[j] = std::move(si->separator[j+1]);
+					si->prefix[j] = si->prefix[j+1];
+				}
+				si->separator[0] = T();
+				si->prefix[0] = 0;
+				si->separator[si->count-1] = T();
+				in->child[last]->parent = in;
+				moved = moved + in->total[last];
+			}
+			in->count++;
+			si->count--;
+		}
+	}
+
+	p->total[i+from] = p->total[i+from] - moved;
+	p->total[i] = p->total[i] + moved;
+}
+
+// Restores the minimum occupancy of n and its ancestors after elements are removed from n
+template <class T, class Metric, class Prefix>
+void IndexedBTree<T,Metric,Prefix>::rebalance( Node* n ) {
+	while (true) {
+		Internal* p = n->parent;
+		if (!p) {
+			if (n->leaf && !n->count) {
+				freeNode(n);
+				root = NULL;
+			} else if (!n->leaf && n->count == 1) {
+				root = static_cast<Internal*>(n)->child[0];
+				root->parent = NULL;
+				n->count = 0;
+				freeNode(n);
+				n = root;
+				continue;
+			}
+			return;
+		}
+
+		int capacity = n->leaf ? LeafCapacity : InternalCapacity;
+		if (n->count >= capacity / 2)
+			return;
+
+		int i = indexInParent(n);
+		Node* left = i ? p->child[i-1] : NULL;
+		Node* right = i+1 < p->count ? p->child[i+1] : NULL;
+		if (left && left->count + n->count <= capacity) {
+			merge(p, i-1);
+		} else if (right && right->count + n->count <= capacity) {
+			merge(p, i);
+		} else {
+			if (left || right)
+				borrow(p, i, left ? -1 : 1);
+			return;
+		}
+		n = p;
+	}
+}
+
+template <class T, class Metric, class Prefix>
+void IndexedBTree<T,Metric,Prefix>::eraseSlots( Leaf* l, int begin, int end ) {
+	Metric removed = Metric();
+	for(int i=begin; i<end; i++)
+		removed = removed + l->metric[i];
+	std::move(l->data + end, l->data + l->count, l->data + begin);
+	std::move(l->metric + end, l->metric + l->count, l->metric + begin);
+	std::move(l->prefix + end, l->prefix + l->count, l->prefix + begin);
+	for(int i = l->count - (end-begin); i < l->count; i++)
+		l->data[i] = T();
+	l->count -= end - begin;
+	addToAncestors(l, removed, true);
+	if (!begin && l->count)
+		updateSeparator(l);
+	rebalance(l);
+}
+
+template <class T, class Metric, class Prefix>
+void IndexedBTree<T,Metric,Prefix>::erase(iterator item) {
+	if (item == end())
+		return;
+	eraseSlots(item.leaf, item.index, item.index + 1);
+}
+
+template <class T, class Metric, class Prefix>
+void IndexedBTree<T,Metric,Prefix>::erase(iterator begin, iterator end) {
+	if (begin == end)
+		return;
+
+	// Rebalancing moves elements between leaves, so the range is found again by key after each leaf
+	bool toEnd = end == this->end();
+	T endItem = toEnd ? T() : *end;
+	while (true) {
+		Leaf* l = begin.leaf;
+		int stop = toEnd ? l->count : lowerBound(l, endItem, Prefix()(endItem));
+		if (stop <= begin.index)
+			return;
+		bool last = stop < l->count || !l->next;
+		T lastErased = last ? T() : l->data[stop-1];
+		eraseSlots(l, begin.index, stop);
+		if (last)
+			return;
+		begin = upper_bound(lastErased);
+		if (begin == this->end())
+			return;
+	}
+}
+
+template <class T, class Metric, class Prefix>
+int IndexedBTree<T,Metric,Prefix>::testonly_assertValid() const {
+	if (!root)
+		return 0;
+	ASSERT( !root->parent );
+	int leafDepth = -1;
+	Metric total = Metric();
+	Leaf* prevLeaf = NULL;
+	int count = assertValid(root, 0, leafDepth, total, prevLeaf, NULL);
+	ASSERT( !prevLeaf->next );
+	ASSERT( !(total < sumTo(end())) && !(sumTo(end()) < total) );
+	return count;
+}
+
+// Checks the subtree n, whose elements must not be less than *lowerLimit, adding the metrics of its elements to total
+template <class T, class Metric, class Prefix>
+int IndexedBTree<T,Metric,Prefix>::assertValid( Node* n, int depth, int& leafDepth, Metric& total, Leaf*& prevLeaf, T const* lowerLimit ) const {
+	int capacity = n->leaf ? LeafCapacity : InternalCapacity;
+	ASSERT( n->count > 0 && n->count <= capacity );
+
+	if (n->leaf) {
+		Leaf* l = static_cast<Leaf*>(n);
+		if (leafDepth < 0)
+			leafDepth = depth;
+		ASSERT( depth == leafDepth );
+		ASSERT( l->prev == prevLeaf );
+		if (prevLeaf) {
+			ASSERT( prevLeaf->next == l );
+			ASSERT( prevLeaf->data[prevLeaf->count-1] < l->data[0] );
+		}
+		prevLeaf = l;
+		for(int i=0; i<l->count; i++) {
+			ASSERT( l->prefix[i] == Prefix()(l->data[i]) );
+			if (i) {
+				ASSERT( l->data[i-1] < l->data[i] );
+			} else if (lowerLimit) {
+				ASSERT( !(l->data[0] < *lowerLimit) && !(*lowerLimit < l->data[0]) );
+			}
+			total = total + l->metric[i];
+		}
+		return l->count;
+	}
+
+	Internal* in = static_cast<Internal*>(n);
+	int count = 0;
+	for(int i=0; i<in->count; i++) {
+		ASSERT( in->child[i]->parent == in );
+		if (i)
+			ASSERT( in->prefix[i] == Prefix()(in->separator[i]) );
+		Metric childTotal = Metric();
+		count += assertValid( in->child[i], depth+1, leafDepth, childTotal, prevLeaf, i ? &in->separator[i] : lowerLimit );
+		ASSERT( !(childTotal < in->total[i]) && !(in->total[i] < childTotal) );
+		total = total + childTotal;
+	}
+	return count;
+}
+
+template <class T, class Metric, class Prefix>
+int64_t IndexedBTree<T,Metric,Prefix>::testonly_nodeBytes() const {
+	return root ? nodeBytes(root) : 0;
+}
+
+template <class T, class Metric, class Prefix>
+int64_t IndexedBTree<T,Metric,Prefix>::nodeBytes( Node* n ) {
+	if (n->leaf)
+		return sizeof(Leaf);
+	Internal* in = static_cast<Internal*>(n);
+	int64_t bytes = sizeof(Internal);
+	for(int i=0; i<in->count; i++)
+		bytes += nodeBytes(in->child[i]);
+	return bytes;
+}
+
+#endif
@@ -71,11 +71,18 @@ FlowKnobs::FlowKnobs(bool randomize, bool isSimulated) {
 	init( BUGGIFY_SIM_PAGE_CACHE_4K,                           1e6 );
 	init( BUGGIFY_SIM_PAGE_CACHE_64K,                          1e6 );
 	init( MAX_EVICT_ATTEMPTS,                                  100 ); if( randomize && BUGGIFY ) MAX_EVICT_ATTEMPTS = 2;
+	init( CACHE_EVICTION_POLICY,                          "random" ); if( randomize && BUGGIFY ) CACHE_EVICTION_POLICY = "arc";
+	init( PAGE_CACHE_MAX_COALESCED_READ_PAGES,                  64 ); if( randomize && BUGGIFY ) PAGE_CACHE_MAX_COALESCED_READ_PAGES = g_random->randomInt(1, 5);
 
 	//AsyncFileKAIO
 	init( MAX_OUTSTANDING,                                      64 );
 	init( MIN_SUBMIT,                                           10 );
 
+	//AsyncFileIOUring
+	init( USE_IO_URING,                                          0 );
+	init( IO_URING_ENTRIES,                                    256 );
+	init( IO_URING_REGISTERED_PAGES,                         16384 );
+
 	init( PAGE_WRITE_CHECKSUM_HISTORY,                           0 ); if( randomize && BUGGIFY ) PAGE_WRITE_CHECKSUM_HISTORY = 10000000;
 
 	//AsyncFileNonDurable
@@ -99,7 +106,13 @@ FlowKnobs::FlowKnobs(bool randomize, bool isSimulated) {
 	//Network
 	init( PACKET_LIMIT,                                  100LL<<20 );
 	init( PACKET_WARNING,                                  2LL<<20 );  // 2MB packet warning quietly allows for 1MB system messages
+	init( ZERO_COPY_SEND_BYTES,                               8192 ); if( randomize && BUGGIFY ) ZERO_COPY_SEND_BYTES = g_random->randomInt(1, 1000);  // Byte strings at least this long are sent from their arena without being copied into packet buffers
 	init( TIME_OFFSET_LOGGING_INTERVAL,                       60.0 );
+	init( NETWORK_COMPRESSION,                                   0 ); if( randomize && BUGGIFY ) NETWORK_COMPRESSION = 1;  // Ask peers to deflate large packets sent to us, and deflate those sent to peers who ask
+	init( NETWORK_COMPRESSION_MIN_BYTES,                     16384 ); if( randomize && BUGGIFY ) NETWORK_COMPRESSION_MIN_BYTES = g_random->randomInt(16, 1000);
+	init( NETWORK_COMPRESSION_LEVEL,                             1 ); if( randomize && BUGGIFY ) NETWORK_COMPRESSION_LEVEL = g_random->randomInt(1, 10);
+	init( NETWORK_COMPRESSION_MAX_RATIO,                      0.85 );  // Packets which don't shrink at least this much are sent uncompressed
+	init( NETWORK_COMPRESSION_LOGGING_INTERVAL,               10.0 );
 
 	//Sim2
 	init( MIN_OPEN_TIME,                                    0.0002 );
@@ -122,6 +135,7 @@ FlowKnobs::FlowKnobs(bool randomize, bool isSimulated) {
 	init( TRACE_EVENT_METRIC_UNITS_PER_SAMPLE,                 500 );
 	init( TRACE_EVENT_THROTTLER_SAMPLE_EXPIRY,              1800.0 ); // 30 mins
 	init( TRACE_EVENT_THROTTLER_MSG_LIMIT,                   20000 );
+	init( LATENCY_HISTOGRAM_TRACE_LENGTH,                      400 ); if( randomize && BUGGIFY ) LATENCY_HISTOGRAM_TRACE_LENGTH = g_random->randomInt(150, 400); // Histograms merge buckets to fit; several must fit in one event, and each in a 495 byte detail. At least 150 fits any single bucket histogram
 
 	//TDMetrics
 	init( MAX_METRICS,                                         600 );
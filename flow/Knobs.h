@@ -91,11 +91,18 @@ public:
 	int64_t BUGGIFY_SIM_PAGE_CACHE_4K;
 	int64_t BUGGIFY_SIM_PAGE_CACHE_64K;
 	int MAX_EVICT_ATTEMPTS;
+	std::string CACHE_EVICTION_POLICY; // for now, "random" or "arc"
+	int PAGE_CACHE_MAX_COALESCED_READ_PAGES; // <= 1 reads each missing page separately
 
 	//AsyncFileKAIO
 	int MAX_OUTSTANDING;
 	int MIN_SUBMIT;
 
+	//AsyncFileIOUring
+	int USE_IO_URING; // Use AsyncFileIOUring rather than AsyncFileKAIO for unbuffered files, if the kernel supports it
+	int IO_URING_ENTRIES;
+	int64_t IO_URING_REGISTERED_PAGES; // 4k page cache pages allocated from memory registered with the ring
+
 	int PAGE_WRITE_CHECKSUM_HISTORY;
 
 	//AsyncFileNonDurable
@@ -120,7 +127,13 @@ public:
 	//Network
 	int64_t PACKET_LIMIT;
 	int64_t PACKET_WARNING;  // 2MB packet warning quietly allows for 1MB system messages
+	int ZERO_COPY_SEND_BYTES;
 	double TIME_OFFSET_LOGGING_INTERVAL;
+	int NETWORK_COMPRESSION;
+	int NETWORK_COMPRESSION_MIN_BYTES;
+	int NETWORK_COMPRESSION_LEVEL;
+	double NETWORK_COMPRESSION_MAX_RATIO;
+	double NETWORK_COMPRESSION_LOGGING_INTERVAL;
 
 	//Sim2
 	//FIMXE: more parameters could be factored out
@@ -144,6 +157,7 @@ public:
 	int TRACE_EVENT_METRIC_UNITS_PER_SAMPLE;
 	int TRACE_EVENT_THROTTLER_SAMPLE_EXPIRY;
 	int TRACE_EVENT_THROTTLER_MSG_LIMIT;
+	int LATENCY_HISTOGRAM_TRACE_LENGTH;
 
 	//TDMetrics
 	int64_t MAX_METRIC_SIZE;
@@ -0,0 +1,171 @@
+/*
+ * LatencyHistogram.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UnitTest.h"
+#include "LatencyHistogram.h"
+#include "Knobs.h"
+
+std::string LatencyHistogram::toTraceString() const {
+	for (int shift = 0;; shift++) {
+		std::string s = format( "%d %llu %.17g %.17g %.17g", shift, (unsigned long long)total, sum, minSeconds, maxSeconds );
+		int last = -1;
+		uint64_t groupCount = 0;
+		for (int i = 0; i < BUCKETS; i++) {
+			groupCount += counts[i];
+			if ((i+1) % (1<<shift) || !groupCount)
+				continue;
+			int group = i >> shift;
+			s += format( " %x:%llx", unsigned(group - last), (unsigned long long)groupCount );
+			last = group;
+			groupCount = 0;
+		}
+		// BUCKETS is a power of two, so at worst every bucket is in the one group
+		if (s.size() <= FLOW_KNOBS->LATENCY_HISTOGRAM_TRACE_LENGTH || (1<<shift) >= BUCKETS)
+			return s;
+	}
+}
+
+LatencyHistogram LatencyHistogram::fromTraceString( std::string const& s ) {
+	LatencyHistogram h;
+	int shift, consumed = 0;
+	unsigned long long total;
+	if (sscanf( s.c_str(), "%d %llu %lf %lf %lf%n", &shift, &total, &h.sum, &h.minSeconds, &h.maxSeconds, &consumed ) != 5 || shift < 0 || (1<<shift) > BUCKETS)
+		throw attribute_not_found();
+	h.total = total;
+
+	int group = -1;
+	uint64_t seen = 0;
+	for (const char* p = s.c_str() + consumed; *p; ) {
+		unsigned gap;
+		unsigned long long count;
+		int n = 0;
+		if (sscanf( p, " %x:%llx%n", &gap, &count, &n ) != 2 || !n || !gap || gap > BUCKETS)
+			throw attribute_not_found();
+		group += gap;
+		if ((group << shift) >= BUCKETS)
+			throw attribute_not_found();
+		// The middle bucket of a group stands for all of it
+		h.counts[ (group << shift) + ((1<<shift) >> 1) ] += count;
+		seen += count;
+		p += n;
+	}
+	if (seen != h.total)
+		throw attribute_not_found();
+	return h;
+}
+
+TEST_CASE("flow/LatencyHistogram/buckets") {
+	// Every value falls in the bucket that bounds it, and buckets are contiguous
+	for (int b = 0; b < LatencyHistogram::BUCKETS - 1; b++) {
+		ASSERT( LatencyHistogram::bucketLow(b) + LatencyHistogram::bucketWidth(b) == LatencyHistogram::bucketLow(b+1) );
+		ASSERT( LatencyHistogram::bucketOf( LatencyHistogram::bucketLow(b) ) == b );
+		ASSERT( LatencyHistogram::bucketOf( LatencyHistogram::bucketLow(b+1) - 1 ) == b );
+	}
+	int last = LatencyHistogram::BUCKETS - 1;
+	ASSERT( LatencyHistogram::bucketLow(last) + LatencyHistogram::bucketWidth(last) == uint64_t(1) << LatencyHistogram::MAX_VALUE_BITS );
+	return Void();
+}
+
+TEST_CASE("flow/LatencyHistogram/percentiles") {
+	LatencyHistogram h;
+	ASSERT( h.count() == 0 && h.percentile(0.99) == 0 );
+
+	std::vector<double> values;
+	for (int i = 0; i < 100000; i++) {
+		// Spread over microseconds to seconds
+		double v = exp( g_random->random01() * log(1e6) ) * 1e-6;
+		values.push_back( v );
+		h.record( v );
+	}
+	std::sort( values.begin(), values.end() );
+	ASSERT( h.count() == values.size() );
+	ASSERT( h.min() == values.front() && h.max() == values.back() );
+	for (double p : { 0.5, 0.9, 0.99, 0.999 }) {
+		double exact = values[ (int)std::ceil( p * values.size() ) - 1 ];
+		double error = fabs( h.percentile(p) - exact );
+		ASSERT( error <= exact / LatencyHistogram::SUB_BUCKETS + 1e-6 );
+	}
+	ASSERT( h.percentile(1.0) == values.back() );
+
+	h.clear();
+	ASSERT( h.count() == 0 && h.max() == 0 );
+	h.record( -1 );
+	h.record( 1e9 );
+	ASSERT( h.count() == 2 );
+	return Void();
+}
+
+TEST_CASE("flow/LatencyHistogram/merge and serialize") {
+	LatencyHistogram a, b, all;
+	for (int i = 0; i < 10000; i++) {
+		double v = g_random->random01() * (g_random->coinflip() ? 0.001 : 1.0);
+		(g_random->coinflip() ? a : b).record( v );
+		all.record( v );
+	}
+	a.merge( b );
+	ASSERT( a.count() == all.count() && a.min() == all.min() && a.max() == all.max() );
+	for (double p : { 0.01, 0.5, 0.99, 0.999 })
+		ASSERT( a.percentile(p) == all.percentile(p) );
+
+	LatencyHistogram copy = BinaryReader::fromStringRef<LatencyHistogram>( BinaryWriter::toValue( all, Unversioned() ), Unversioned() );
+	ASSERT( copy.count() == all.count() && copy.mean() == all.mean() && copy.min() == all.min() && copy.max() == all.max() );
+	for (int b = 0; b < LatencyHistogram::BUCKETS; b++)
+		ASSERT( copy.percentile( double(b) / LatencyHistogram::BUCKETS ) == all.percentile( double(b) / LatencyHistogram::BUCKETS ) );
+	return Void();
+}
+
+TEST_CASE("flow/LatencyHistogram/trace string") {
+	LatencyHistogram empty = LatencyHistogram::fromTraceString( LatencyHistogram().toTraceString() );
+	ASSERT( empty.count() == 0 && empty.percentile(0.5) == 0 );
+
+	// Latencies in a few buckets round trip exactly
+	LatencyHistogram narrow;
+	for (int i = 0; i < 1000; i++)
+		narrow.record( 0.001 + 0.0001 * g_random->randomInt(0, 4) );
+	LatencyHistogram narrowCopy = LatencyHistogram::fromTraceString( narrow.toTraceString() );
+	ASSERT( narrowCopy.count() == narrow.count() && narrowCopy.min() == narrow.min() && narrowCopy.max() == narrow.max() );
+	for (double p : { 0.01, 0.5, 0.99, 0.999 })
+		ASSERT( narrowCopy.percentile(p) == narrow.percentile(p) );
+
+	// Latencies spread over most buckets are merged into groups to fit, which at worst are an octave wide here
+	LatencyHistogram a, b, all;
+	for (int i = 0; i < 100000; i++) {
+		double v = exp( g_random->random01() * log(1e7) ) * 1e-6;
+		(g_random->coinflip() ? a : b).record( v );
+		all.record( v );
+	}
+	std::string aString = a.toTraceString();
+	ASSERT( aString.size() <= FLOW_KNOBS->LATENCY_HISTOGRAM_TRACE_LENGTH );
+	LatencyHistogram merged = LatencyHistogram::fromTraceString( aString );
+	merged.merge( LatencyHistogram::fromTraceString( b.toTraceString() ) );
+	ASSERT( merged.count() == all.count() && merged.min() == all.min() && merged.max() == all.max() );
+	for (double p : { 0.5, 0.99, 0.999 }) {
+		double exact = all.percentile(p);
+		ASSERT( fabs( merged.percentile(p) - exact ) <= exact * 0.6 );
+	}
+
+	try {
+		LatencyHistogram::fromTraceString( "0 2 1 0.5 0.5 1:1" );
+		ASSERT( false );
+	} catch (Error& e) {
+		ASSERT( e.code() == error_code_attribute_not_found );
+	}
+	return Void();
+}
@@ -0,0 +1,157 @@
+/*
+ * LatencyHistogram.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLOW_LATENCYHISTOGRAM_H
+#define FLOW_LATENCYHISTOGRAM_H
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "Error.h"
+
+#ifdef _WIN32
+#include <intrin.h>
+#pragma intrinsic(_BitScanReverse64)
+#endif
+
+class LatencyHistogram {
+	// Counts latencies, in whole microseconds, in log-linear buckets like those of HdrHistogram: values below 2*SUB_BUCKETS each
+	// have a bucket of their own, and above that every power of two is split into SUB_BUCKETS equal buckets.  Recording is
+	// an increment of one bucket found from the position of the highest set bit, and any percentile is within 1/SUB_BUCKETS
+	// (about 3%) of the exact one.  Unlike ContinuousSample nothing is thrown away, so tail percentiles stay accurate however
+	// many values are recorded.  Histograms merge by adding their buckets, and serialize as just their nonempty buckets.
+	// A histogram belongs to one thread, like everything else in flow; histograms of other threads or processes are merged
+	// from snapshots rather than shared.
+
+public:
+	enum { SUB_BUCKET_BITS = 5, SUB_BUCKETS = 1<<SUB_BUCKET_BITS };
+	enum { MAX_VALUE_BITS = 36 };  // Latencies of 2^36us (about 19 hours) or more are counted as that
+	enum { BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS };
+
+	LatencyHistogram() : counts(BUCKETS, 0), total(0), sum(0), minSeconds(0), maxSeconds(0) {}
+
+	void record( double seconds ) {
+		uint64_t micros = seconds <= 0 ? 0 : std::min( uint64_t(seconds * 1e6), (uint64_t(1)<<MAX_VALUE_BITS) - 1 );
+		++counts[ bucketOf(micros) ];
+		if (!total || seconds < minSeconds) minSeconds = seconds;
+		if (!total || seconds > maxSeconds) maxSeconds = seconds;
+		++total;
+		sum += seconds;
+	}
+
+	void merge( LatencyHistogram const& r ) {
+		if (!r.total) return;
+		for (int i = 0; i < BUCKETS; i++)
+			counts[i] += r.counts[i];
+		minSeconds = total ? std::min( minSeconds, r.minSeconds ) : r.minSeconds;
+		maxSeconds = total ? std::max( maxSeconds, r.maxSeconds ) : r.maxSeconds;
+		total += r.total;
+		sum += r.sum;
+	}
+
+	void clear() {
+		if (!total) return;
+		std::fill( counts.begin(), counts.end(), 0 );
+		total = 0;
+		sum = minSeconds = maxSeconds = 0;
+	}
+
+	uint64_t count() const { return total; }
+	double mean() const { return total ? sum / total : 0; }
+	double min() const { return minSeconds; }
+	double max() const { return maxSeconds; }
+	double median() const { return percentile( 0.5 ); }
+
+	// The midpoint of the bucket holding the value of rank ceil(p*count()), in seconds
+	double percentile( double p ) const {
+		if (!total || p < 0.0 || p > 1.0)
+			return 0;
+		uint64_t rank = std::max<uint64_t>( 1, (uint64_t)std::ceil( p * total ) );
+		uint64_t seen = 0;
+		int i = 0;
+		for (; i < BUCKETS - 1; i++) {
+			seen += counts[i];
+			if (seen >= rank) break;
+		}
+		double value = (bucketLow(i) + bucketWidth(i) * 0.5) / 1e6;
+		return std::max( minSeconds, std::min( maxSeconds, value ) );
+	}
+
+	// A text form for a trace event detail, from which status merges the histograms of many processes.  It has the count, sum,
+	// min and max and then the nonempty buckets as hex gaps and counts.  If that is longer than the LATENCY_HISTOGRAM_TRACE_LENGTH
+	// knob, aligned groups of 2, 4, 8... buckets are merged until it fits, so widely spread latencies lose resolution instead of
+	// being cut off.
+	std::string toTraceString() const;
+	static LatencyHistogram fromTraceString( std::string const& s );  // Throws attribute_not_found if s is not valid
+
+	template <class Ar>
+	void serialize( Ar& ar ) {
+		std::vector<std::pair<int, uint64_t>> nonEmpty;
+		if (!ar.isDeserializing) {
+			for (int i = 0; i < BUCKETS; i++)
+				if (counts[i])
+					nonEmpty.push_back( std::make_pair(i, counts[i]) );
+		}
+		ar & total & sum & minSeconds & maxSeconds & nonEmpty;
+		if (ar.isDeserializing) {
+			std::fill( counts.begin(), counts.end(), 0 );
+			for (auto& b : nonEmpty) {
+				ASSERT( b.first >= 0 && b.first < BUCKETS );
+				counts[b.first] = b.second;
+			}
+		}
+	}
+
+	static int bucketOf( uint64_t micros ) {
+		if (micros < 2*SUB_BUCKETS)
+			return micros;
+		int shift = highestBit( micros ) - SUB_BUCKET_BITS;
+		return shift * SUB_BUCKETS + int(micros >> shift);
+	}
+	static uint64_t bucketLow( int bucket ) {
+		if (bucket < 2*SUB_BUCKETS)
+			return bucket;
+		return uint64_t(bucket % SUB_BUCKETS + SUB_BUCKETS) << (bucket / SUB_BUCKETS - 1);
+	}
+	static uint64_t bucketWidth( int bucket ) {
+		return bucket < 2*SUB_BUCKETS ? 1 : uint64_t(1) << (bucket / SUB_BUCKETS - 1);
+	}
+
+private:
+	std::vector<uint64_t> counts;
+	uint64_t total;
+	double sum, minSeconds, maxSeconds;
+
+	static int highestBit( uint64_t word ) {
+#ifdef _WIN32
+		unsigned long i;
+		_BitScanReverse64( &i, word );
+		return i;
+#else
+		return 63 - __builtin_clzll( word );
+#endif
+	}
+};
+
+#endif
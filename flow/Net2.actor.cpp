@@ -32,6 +32,8 @@
 
 #include "ActorCollection.h"
 #include "ThreadSafeQueue.h"
+#include "TaskQueue.h"
+#include "TimerWheel.h"
 #include "ThreadHelper.actor.h"
 #include "TDMetric.actor.h"
 #include "AsioReactor.h"
@@ -55,7 +57,7 @@ using namespace boost::asio::ip;
 //
 //                                                       xyzdev
 //                                                       vvvv
-const uint64_t currentProtocolVersion        = 0x0FDB00B061020001LL;
+const uint64_t currentProtocolVersion        = 0x0FDB00B061040001LL;
 const uint64_t compatibleProtocolVersionMask = 0xffffffffffff0000LL;
 const uint64_t minValidProtocolVersion       = 0x0FDB00A200060001LL;
 
@@ -181,7 +183,7 @@ public:
 	int lastMinTaskID;
 	double priorityTimer[NetworkMetrics::PRIORITY_BINS];
 
-	std::priority_queue<OrderedTask, std::vector<OrderedTask>> ready;
+	TaskQueue<OrderedTask> ready;
 	ThreadSafeQueue<OrderedTask> threadReady;
 
 	struct DelayedTask : OrderedTask {
@@ -189,14 +191,17 @@ public:
 		DelayedTask(double at, int64_t priority, int taskID, Task* task) : at(at), OrderedTask(priority, taskID, task) {}
 		bool operator < (DelayedTask const& rhs) const { return at > rhs.at; } // Ordering is reversed for priority_queue
 	};
-	std::priority_queue<DelayedTask, std::vector<DelayedTask>> timers;
+	struct DropCancelledTimer {
+		bool operator()( DelayedTask const& t ) const;
+	};
+	TimerWheel<DelayedTask, DropCancelledTimer> timers;
 
 	void checkForSlowTask(int64_t tscBegin, int64_t tscEnd, double duration, int64_t priority);
 	bool check_yield(int taskId, bool isRunLoop);
 	void processThreadReady();
 	void trackMinPriority( int minTaskID, double now );
 	void stopImmediately() {
-		stopped=true; decltype(ready) _1; ready.swap(_1); decltype(timers) _2; timers.swap(_2);
+		stopped=true; ready.clear(); timers.clear();
 	}
 
 	Future<Void> timeOffsetLogger;
@@ -212,6 +217,8 @@ public:
 	Int64MetricHandle countCantSleep;
 	Int64MetricHandle countWontSleep;
 	Int64MetricHandle countTimers;
+	Int64MetricHandle countTimersCancelled;
+	Int64MetricHandle timerQueueDepth;
 	Int64MetricHandle countTasks;
 	Int64MetricHandle countYields;
 	Int64MetricHandle countYieldBigStack;
@@ -480,6 +487,15 @@ struct PromiseTask : public Task, public FastAllocated<PromiseTask> {
 	}
 };
 
+bool Net2::DropCancelledTimer::operator()( DelayedTask const& t ) const {
+	// Every timer is a PromiseTask from delay(), and once its future is gone nothing can observe it firing
+	PromiseTask* task = static_cast<PromiseTask*>( t.task );
+	if (task->promise.getFutureReferenceCount())
+		return false;
+	delete task;
+	return true;
+}
+
 Net2::Net2(NetworkAddress localAddress, bool useThreadPool, bool useMetrics)
 	: useThreadPool(useThreadPool),
 	  network(this),
@@ -535,6 +551,8 @@ void Net2::initMetrics() {
 	countCantSleep.init(LiteralStringRef("Net2.CountCantSleep"));
 	countWontSleep.init(LiteralStringRef("Net2.CountWontSleep"));
 	countTimers.init(LiteralStringRef("Net2.CountTimers"));
+	countTimersCancelled.init(LiteralStringRef("Net2.CountTimersCancelled"));
+	timerQueueDepth.init(LiteralStringRef("Net2.TimerQueueDepth"));
 	countTasks.init(LiteralStringRef("Net2.CountTasks"));
 	countYields.init(LiteralStringRef("Net2.CountYields"));
 	countYieldBigStack.init(LiteralStringRef("Net2.CountYieldBigStack"));
@@ -591,7 +609,7 @@ void Net2::run() {
 		if (b) {
 			sleepTime = 1e99;
 			if (!timers.empty())
-				sleepTime = timers.top().at - timer_monotonic();  // + 500e-6?
+				sleepTime = timers.nextExpiry() - timer_monotonic();  // + 500e-6?
 		}
 
 		awakeMetric = false;
@@ -607,11 +625,15 @@ void Net2::run() {
 			TraceEvent("SomewhatSlowRunLoopTop").detail("Elapsed", now - nnow);
 
 		if (sleepTime) trackMinPriority( 0, now );
-		while (!timers.empty() && timers.top().at < now) {
-			++countTimers;
-			ready.push( timers.top() );
-			timers.pop();
-		}
+		timers.advance( now, [this](DelayedTask const& t) {
+			if (DropCancelledTimer()( t )) {
+				++countTimersCancelled;
+			} else {
+				++countTimers;
+				ready.push( t );
+			}
+		});
+		timerQueueDepth = timers.size();
 
 		processThreadReady();
 
@@ -19,11 +19,13 @@
  */
 
 #include "Net2Packet.h"
+#include "UnitTest.h"
 
 void PacketWriter::init(PacketBuffer* buf, ReliablePacket* reliable) {
 	this->buffer = buf;
 	this->reliable = reliable;
 	this->length = 0;
+	this->minReferenceBytes = FLOW_KNOBS->ZERO_COPY_SEND_BYTES;
 	length -= buffer->bytes_written;
 	if (reliable) {
 		reliable->buffer = buffer; buffer->addref();
@@ -55,17 +57,51 @@ void PacketWriter::serializeBytesAcrossBoundary(const void* data, int bytes) {
 
 void PacketWriter::nextBuffer() {
 	ASSERT( buffer->bytes_written == PacketBuffer::DATA_SIZE );
-	length += PacketBuffer::DATA_SIZE;
-	buffer->next = new PacketBuffer;
-	buffer = buffer->nextPacketBuffer();
+	appendBuffer( new PacketBuffer );
+}
+
+void PacketWriter::appendBuffer( PacketBuffer* next ) {
+	length += buffer->bytes_written;
+	buffer->next = next;
 
 	if (reliable) {
-		reliable->end = PacketBuffer::DATA_SIZE;
+		reliable->end = buffer->bytes_written;
 		reliable->cont = new ReliablePacket;
 		reliable = reliable->cont;
-		reliable->buffer = buffer; buffer->addref();
+		reliable->buffer = next; next->addref();
 		reliable->begin = 0;
 	}
+
+	buffer = next;
+}
+
+void PacketWriter::serializeReferencedBytes( StringRef bytes ) {
+	if (!arena.keepsAlive( bytes.begin(), bytes.size() )) {
+		serializeBytes( bytes.begin(), bytes.size() );
+		return;
+	}
+
+	// Whatever space is left in the current buffer goes unused, and the packet continues in a new buffer after the bytes
+	appendBuffer( PacketBuffer::referenceTo( bytes, arena ) );
+	appendBuffer( new PacketBuffer );
+}
+
+PacketBuffer* PacketBuffer::referenceTo( StringRef bytes, Arena const& owner ) {
+	PacketBuffer* pb = new PacketBuffer;
+	((SendBuffer*)pb)->data = bytes.begin();
+	pb->bytes_written = bytes.size();
+
+	// The otherwise unused data holds a reference to the owner's blocks
+	ArenaBlock* block = owner.impl.getPtr();
+	block->addref();
+	memcpy( pb->data, &block, sizeof(block) );
+	return pb;
+}
+
+void PacketBuffer::releaseOwner() {
+	ArenaBlock* block;
+	memcpy( &block, data, sizeof(block) );
+	block->delref();
 }
 
 void PacketWriter::writeAhead( int bytes, struct SplitBuffer* buf ) {
@@ -142,18 +178,26 @@ void UnsentPacketQueue::sent(int bytes) {
 
 		if (b->bytes_sent + bytes <= b->bytes_written && (b->bytes_sent + bytes != b->bytes_written || (!b->next && b->bytes_unwritten()))) {
 			b->bytes_sent += bytes;
-			ASSERT( b->bytes_sent <= PacketBuffer::DATA_SIZE );
+			ASSERT( b->bytes_sent <= PacketBuffer::DATA_SIZE || b->isReference() );
 			break;
 		}
 
 		// We've sent an entire buffer
 		bytes -= b->bytes_written - b->bytes_sent;
 		b->bytes_sent = b->bytes_written;
-		ASSERT( b->bytes_written <= PacketBuffer::DATA_SIZE );
+		ASSERT( b->bytes_written <= PacketBuffer::DATA_SIZE || b->isReference() );
 		unsent_first = b->nextPacketBuffer();
 		if (!unsent_first) unsent_last = NULL;
 		b->delref();
 	}
+
+	// Only the last buffer, which may still be written to, can be left at the front with nothing to send.  (A buffer
+	// after one which refers to bytes elsewhere can be empty.)
+	while (unsent_first && unsent_first->next && unsent_first->bytes_sent == unsent_first->bytes_written) {
+		PacketBuffer* b = unsent_first;
+		unsent_first = b->nextPacketBuffer();
+		b->delref();
+	}
 }
 
 void UnsentPacketQueue::discardAll() {
@@ -176,7 +220,7 @@ PacketBuffer* ReliablePacketList::compact(PacketBuffer* into, PacketBuffer* end)
 				into = into->nextPacketBuffer();
 			}
 
-			uint8_t* data = &c->buffer->data[c->begin];
+			uint8_t const* data = c->buffer->SendBuffer::data + c->begin;
 			int len = c->end-c->begin;
 
 			if (len > into->bytes_unwritten()) {
@@ -206,3 +250,57 @@ void ReliablePacketList::discardAll() {
 	while (reliable.next != &reliable)
 		reliable.next->remove();
 }
+
+static std::string packetBytes( PacketBuffer* first ) {
+	std::string s;
+	for (SendBuffer* b = first; b; b = b->next)
+		s.append( (const char*)b->data + b->bytes_sent, b->bytes_written - b->bytes_sent );
+	return s;
+}
+
+TEST_CASE("flow/PacketWriter/referencedBytes") {
+	Standalone<StringRef> inArena = makeString( 3*PacketBuffer::DATA_SIZE );
+	std::string notInArena( 2*PacketBuffer::DATA_SIZE, 'x' );
+	for (int i = 0; i < inArena.size(); i++)
+		mutateString(inArena)[i] = g_random->randomInt(0, 256);
+	Standalone<StringRef> small = LiteralStringRef("small");
+
+	BinaryWriter expected( AssumeVersion(currentProtocolVersion) );
+	expected << small << inArena << StringRef(notInArena) << inArena;
+
+	UnsentPacketQueue unsent;
+	ReliablePacketList reliable;
+	ReliablePacket* rp = new ReliablePacket;
+	PacketWriter wr( unsent.getWriteBuffer(), rp, AssumeVersion(currentProtocolVersion) );
+	wr << small << inArena << StringRef(notInArena) << inArena;
+	unsent.setWriteBuffer( wr.finish() );
+	reliable.insert( rp );
+	ASSERT( wr.size() == expected.getLength() );
+
+	int references = 0;
+	for (PacketBuffer* b = unsent.getUnsent(); b; b = b->nextPacketBuffer())
+		references += b->isReference();
+	ASSERT( references == (inArena.size() >= FLOW_KNOBS->ZERO_COPY_SEND_BYTES ? 2 : 0) );
+
+	// The packet keeps the referenced bytes alive
+	Standalone<StringRef> original = inArena;
+	inArena = Standalone<StringRef>();
+	ASSERT( packetBytes( unsent.getUnsent() ) == expected.toStringRef().toString() );
+
+	// Send it in pieces, then resend it from the reliable packet as after a reconnect
+	int total = expected.getLength();
+	while (total) {
+		int n = std::min( total, g_random->randomInt(1, 10000) );
+		unsent.sent( n );
+		total -= n;
+	}
+	ASSERT( unsent.empty() );
+	unsent.discardAll();
+	PacketBuffer* pb = unsent.getWriteBuffer();
+	unsent.setWriteBuffer( reliable.compact( pb, NULL ) );
+	original = Standalone<StringRef>();
+	ASSERT( packetBytes( unsent.getUnsent() ) == expected.toStringRef().toString() );
+
+	reliable.discardAll();
+	return Void();
+}
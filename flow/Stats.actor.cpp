@@ -73,6 +73,8 @@ ACTOR Future<Void> traceCounters(std::string traceEventName, UID traceEventID, d
 
 	for (ICounter* c : counters->counters)
 		c->resetInterval();
+	for (LatencyCounter* l : counters->latencyCounters)
+		l->resetInterval();
 
 	state double last_interval = now();
 
@@ -86,6 +88,13 @@ ACTOR Future<Void> traceCounters(std::string traceEventName, UID traceEventID, d
 				te.detail(c->getName().c_str(), c->getValue());
 			c->resetInterval();
 		}
+		for (LatencyCounter* l : counters->latencyCounters) {
+			LatencyHistogram const& h = l->getHistogram();
+			te.detail(l->getName() + "Count", h.count()).detail(l->getName() + "P50", h.percentile(0.5))
+				.detail(l->getName() + "P99", h.percentile(0.99)).detail(l->getName() + "P999", h.percentile(0.999))
+				.detail(l->getName() + "Histogram", h.toTraceString());
+			l->resetInterval();
+		}
 		if (!trackLatestName.empty())
 			te.trackLatest(trackLatestName.c_str());
 
@@ -37,6 +37,7 @@ MyCounters() : foo("foo", cc), bar("bar", cc), baz("baz", cc) {}
 #include <cstddef>
 #include "flow.h"
 #include "TDMetric.actor.h"
+#include "LatencyHistogram.h"
 
 struct ICounter {
 	// All counters have a name and value
@@ -57,6 +58,7 @@ struct ICounter {
 struct CounterCollection {
 	CounterCollection(std::string name, std::string id = std::string()) : name(name), id(id) {}
 	std::vector<struct ICounter*> counters, counters_to_remove;
+	std::vector<struct LatencyCounter*> latencyCounters;
 	~CounterCollection() { for (auto c : counters_to_remove) c->remove(); }
 	std::string name;
 	std::string id;
@@ -89,6 +91,21 @@ private:
 	Int64MetricHandle metric;
 };
 
+// Latencies logged with a CounterCollection: each trace event has the count and the p50, p99 and p999, in seconds, of the latencies
+// added since the previous one
+struct LatencyCounter {
+	LatencyCounter(std::string const& name, CounterCollection& collection) : name(name) { collection.latencyCounters.push_back(this); }
+
+	void addMeasurement(double seconds) { histogram.record(seconds); }
+	LatencyHistogram const& getHistogram() const { return histogram; }
+	std::string const& getName() const { return name; }
+	void resetInterval() { histogram.clear(); }
+
+private:
+	std::string name;
+	LatencyHistogram histogram;
+};
+
 template <class F>
 struct SpecialCounter : ICounter, FastAllocated<SpecialCounter<F>> {
 	SpecialCounter(CounterCollection& collection, std::string const& name, F && f) : name(name), f(f) { collection.counters.push_back(this); collection.counters_to_remove.push_back(this); }
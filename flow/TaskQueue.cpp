@@ -0,0 +1,115 @@
+/*
+ * TaskQueue.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UnitTest.h"
+#include "TaskQueue.h"
+
+namespace {
+
+// Mirrors Net2's OrderedTask: priority is (taskID<<32) minus a sequence number, so that equal taskIDs are FIFO
+struct TestTask {
+	int64_t priority;
+	int taskID;
+	double queued;
+	TestTask(int64_t priority, int taskID, double queued = 0) : priority(priority), taskID(taskID), queued(queued) {}
+	bool operator < (TestTask const& rhs) const { return priority < rhs.priority; }
+};
+
+const int testTaskIDs[] = { TaskWriteSocket, TaskReadSocket, TaskDiskIOComplete, TaskTLogCommit, TaskProxyCommit, TaskDefaultPromiseEndpoint,
+	TaskDefaultOnMainThread, TaskDefaultDelay, TaskDefaultYield, TaskDefaultYield|1, TaskDiskRead, TaskDefaultEndpoint, TaskUpdateStorage, TaskLowPriority };
+const int testTaskIDCount = sizeof(testTaskIDs)/sizeof(testTaskIDs[0]);
+
+int randomTestTaskID() {
+	return testTaskIDs[ g_random->randomInt(0, testTaskIDCount) ];
+}
+
+// Runs n tasks through q, keeping depth tasks queued.  If latencies is given, it receives how long each task was queued.
+template <class Queue>
+double runTasks( Queue& q, int depth, int n, std::vector<double>* latencies ) {
+	uint64_t seq = 0;
+	double start = timer();
+	for (int i = 0; i < depth + n; i++) {
+		if (i >= depth) {
+			if (latencies) (*latencies)[i-depth] = timer() - q.top().queued;
+			q.pop();
+		}
+		int taskID = randomTestTaskID();
+		q.push( TestTask( (int64_t(taskID)<<32) - (++seq), taskID, latencies ? timer() : 0 ) );
+	}
+	while (!q.empty())
+		q.pop();
+	return timer() - start;
+}
+
+template <class Queue>
+void benchmarkTasks( const char* name, int depth ) {
+	const int N = 2000000;
+	std::vector<double> latencies(N);
+	Queue q;
+	double elapsed = runTasks( q, depth, N, NULL );
+	runTasks( q, depth, N, &latencies );
+	std::sort( latencies.begin(), latencies.end() );
+	printf("%s depth %d: %0.1f M tasks/sec, scheduling latency p50 %0.2f us p99 %0.2f us\n", name, depth, N / 1e6 / elapsed,
+		latencies[N/2]*1e6, latencies[N*99/100]*1e6);
+}
+
+}
+
+TEST_CASE("flow/TaskQueue/order") {
+	TaskQueue<TestTask> q;
+	std::priority_queue<TestTask, std::vector<TestTask>> expected;
+	uint64_t seq = 0;
+
+	for (int i = 0; i < 100000; i++) {
+		if (!expected.empty() && g_random->random01() < 0.5) {
+			ASSERT( q.size() == expected.size() );
+			ASSERT( q.top().priority == expected.top().priority && q.top().taskID == expected.top().taskID );
+			q.pop();
+			expected.pop();
+		} else {
+			int taskID = g_random->random01() < 0.01 ? g_random->randomInt(TaskMinPriority, TaskMaxPriority) : randomTestTaskID();
+			// Like a timer firing, sometimes queue a task which was issued before tasks that are already queued
+			uint64_t s = g_random->random01() < 0.1 ? seq - g_random->randomInt(0, std::min<int>(seq, 100) + 1) : ++seq;
+			TestTask t( (int64_t(taskID)<<32) - s, taskID );
+			q.push( t );
+			expected.push( t );
+		}
+	}
+	while (!expected.empty()) {
+		ASSERT( q.top().priority == expected.top().priority );
+		q.pop();
+		expected.pop();
+	}
+	ASSERT( q.empty() );
+
+	q.push( TestTask( int64_t(TaskDefaultDelay)<<32, TaskDefaultDelay ) );
+	q.clear();
+	ASSERT( q.empty() );
+
+	return Void();
+}
+
+TEST_CASE("flow/perf/TaskQueue") {
+	for (int depth : { 10, 1000, 100000 }) {
+		benchmarkTasks<std::priority_queue<TestTask, std::vector<TestTask>>>( "priority_queue", depth );
+		benchmarkTasks<TaskQueue<TestTask>>( "TaskQueue     ", depth );
+	}
+	return Void();
+}
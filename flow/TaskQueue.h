@@ -0,0 +1,170 @@
+/*
+ * TaskQueue.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLOW_TASKQUEUE_H
+#define FLOW_TASKQUEUE_H
+#pragma once
+
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "Platform.h"
+#include "Deque.h"
+#include "Error.h"
+
+#ifdef _WIN32
+#include <intrin.h>
+#pragma intrinsic(_BitScanReverse64)
+#endif
+
+template <class T>
+class TaskQueue {
+	// A drop-in replacement for std::priority_queue<T> holding the run loop's ready tasks.  T must have an int taskID and be
+	// ordered by operator< such that, among tasks with the same taskID, the task queued first is the greatest.
+	// There is one bucket per distinct taskID, and a bitmap of the nonempty buckets, which are kept sorted by taskID, finds
+	// the highest priority bucket.  Tasks are almost always pushed onto a bucket in order, so each bucket is a FIFO; the
+	// rare task that arrives out of order (e.g. a timer issued before tasks that are already queued) goes into a small heap
+	// in its bucket, so pop order is exactly that of std::priority_queue<T>.
+
+public:
+	TaskQueue() : count(0), lastTaskID(-1), lastBucket(-1) {}
+
+	bool empty() const { return count == 0; }
+	size_t size() const { return count; }
+
+	T const& top() const {
+		return buckets[highestBucket()].top();
+	}
+
+	void push( T const& t ) {
+		int b = findBucket( t.taskID );
+		buckets[b].push( t );
+		nonEmpty[b/64] |= uint64_t(1) << (b%64);
+		++count;
+	}
+
+	void pop() {
+		int b = highestBucket();
+		buckets[b].pop();
+		if (buckets[b].empty())
+			nonEmpty[b/64] &= ~(uint64_t(1) << (b%64));
+		--count;
+	}
+
+	void clear() {
+		for (auto& b : buckets)
+			b.clear();
+		std::fill(nonEmpty.begin(), nonEmpty.end(), 0);
+		count = 0;
+	}
+
+private:
+	struct Bucket {
+		int taskID;
+		Deque<T> fifo;
+		std::priority_queue<T, std::vector<T>> outOfOrder;
+
+		explicit Bucket( int taskID ) : taskID(taskID) {}
+
+		bool empty() const { return fifo.empty() && outOfOrder.empty(); }
+
+		T const& top() const {
+			if (outOfOrder.empty()) return fifo.front();
+			if (fifo.empty() || fifo.front() < outOfOrder.top()) return outOfOrder.top();
+			return fifo.front();
+		}
+
+		void push( T const& t ) {
+			if (fifo.empty() || t < fifo.back())
+				fifo.push_back( t );
+			else
+				outOfOrder.push( t );
+		}
+
+		void pop() {
+			if (outOfOrder.empty() || (!fifo.empty() && outOfOrder.top() < fifo.front()))
+				fifo.pop_front();
+			else
+				outOfOrder.pop();
+		}
+
+		void clear() {
+			fifo.clear();
+			std::priority_queue<T, std::vector<T>>().swap( outOfOrder );
+		}
+	};
+
+	std::vector<Bucket> buckets;		// Sorted by taskID
+	std::vector<uint64_t> nonEmpty;		// Bit b is set iff buckets[b] is not empty
+	std::unordered_map<int, int> bucketIndex;
+	size_t count;
+	int lastTaskID, lastBucket;
+
+	static int highestBit( uint64_t word ) {
+#ifdef _WIN32
+		unsigned long i;
+		_BitScanReverse64( &i, word );
+		return i;
+#else
+		return 63 - __builtin_clzll( word );
+#endif
+	}
+
+	int highestBucket() const {
+		for (int w = nonEmpty.size()-1; w >= 0; w--)
+			if (nonEmpty[w])
+				return w*64 + highestBit( nonEmpty[w] );
+		ASSERT(false);
+		return -1;
+	}
+
+	int findBucket( int taskID ) {
+		if (taskID == lastTaskID)
+			return lastBucket;
+		auto i = bucketIndex.find( taskID );
+		if (i == bucketIndex.end()) {
+			addBucket( taskID );
+			i = bucketIndex.find( taskID );
+		}
+		lastTaskID = taskID;
+		lastBucket = i->second;
+		return lastBucket;
+	}
+
+	// New taskIDs are rare after startup, so keeping the buckets sorted just rebuilds the index and the bitmap
+	void addBucket( int taskID ) {
+		auto pos = buckets.begin();
+		while (pos != buckets.end() && pos->taskID < taskID)
+			++pos;
+		buckets.insert( pos, Bucket(taskID) );
+
+		bucketIndex.clear();
+		nonEmpty.assign( (buckets.size()+63)/64, 0 );
+		for (int b = 0; b < buckets.size(); b++) {
+			bucketIndex[ buckets[b].taskID ] = b;
+			if (!buckets[b].empty())
+				nonEmpty[b/64] |= uint64_t(1) << (b%64);
+		}
+		lastTaskID = -1;
+	}
+};
+
+#endif
@@ -0,0 +1,142 @@
+/*
+ * TimerWheel.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UnitTest.h"
+#include "TimerWheel.h"
+
+namespace {
+
+// Mirrors Net2's DelayedTask; cancelled timers stand in for delays whose futures have all been dropped
+struct TestTimer {
+	double at;
+	int id;
+	bool* cancelled;
+	TestTimer(double at, int id, bool* cancelled) : at(at), id(id), cancelled(cancelled) {}
+	bool operator < (TestTimer const& rhs) const { return at > rhs.at; }
+};
+
+struct DropIfCancelled {
+	bool operator()( TestTimer const& t ) const { return *t.cancelled; }
+};
+
+struct NeverCancelled {
+	bool operator()( TestTimer const& t ) const { return false; }
+};
+
+double randomDelay() {
+	// Mostly short delays, as in a running cluster, with some that reach every level of the wheel and beyond
+	double r = g_random->random01();
+	if (r < 0.6) return g_random->random01() * 0.1;
+	if (r < 0.9) return g_random->random01() * 10;
+	if (r < 0.99) return g_random->random01() * 1000;
+	return g_random->random01() * 1e6;
+}
+
+}
+
+TEST_CASE("flow/TimerWheel/order") {
+	TimerWheel<TestTimer, DropIfCancelled> wheel;
+	std::priority_queue<TestTimer, std::vector<TestTimer>> expected;
+	const int N = 100000;
+	std::vector<bool> fired( N );
+	bool* cancelledFlags = new bool[N];
+	double now = 1e5 + g_random->random01();
+
+	for (int id = 0; id < N; id++) {
+		if (g_random->random01() < 0.3) {
+			// Expire everything up to a new time, checking that the wheel agrees with the heap
+			now += g_random->random01() < 0.9 ? g_random->random01() * 0.01 : randomDelay();
+			std::vector<int> wheelFired;
+			wheel.advance( now, [&](TestTimer const& t) {
+				ASSERT( t.at < now && !fired[t.id] );
+				fired[t.id] = true;
+				if (!*t.cancelled) wheelFired.push_back( t.id );
+			});
+			std::vector<int> heapFired;
+			while (!expected.empty() && expected.top().at < now) {
+				if (!*expected.top().cancelled) heapFired.push_back( expected.top().id );
+				expected.pop();
+			}
+			std::sort( wheelFired.begin(), wheelFired.end() );
+			std::sort( heapFired.begin(), heapFired.end() );
+			ASSERT( wheelFired == heapFired );
+			while (!expected.empty() && *expected.top().cancelled)
+				expected.pop();
+			ASSERT( expected.empty() || wheel.nextExpiry() <= expected.top().at );
+		}
+		cancelledFlags[id] = false;
+		TestTimer t( now + randomDelay(), id, &cancelledFlags[id] );
+		wheel.push( t );
+		expected.push( t );
+		if (g_random->random01() < 0.2)
+			cancelledFlags[ g_random->randomInt(0, id+1) ] = true;
+	}
+
+	wheel.advance( 1e99, [&](TestTimer const& t) {
+		ASSERT( !fired[t.id] );
+		fired[t.id] = true;
+	});
+	ASSERT( wheel.empty() );
+	for (int id = 0; id < N; id++)
+		ASSERT( fired[id] || cancelledFlags[id] );
+	delete[] cancelledFlags;
+
+	bool never = false;
+	TimerWheel<TestTimer, NeverCancelled> exact;
+	exact.push( TestTimer( now + 5, 0, &never ) );
+	exact.push( TestTimer( now + 0.0101, 1, &never ) );
+	exact.push( TestTimer( now + 300, 2, &never ) );
+	ASSERT( exact.nextExpiry() == now + 0.0101 );
+	exact.clear();
+	ASSERT( exact.empty() && exact.nextExpiry() == 1e99 );
+
+	return Void();
+}
+
+TEST_CASE("flow/perf/TimerWheel") {
+	// Schedules and expires N timers with depth of them outstanding, most of which are cancelled before they expire
+	const int N = 2000000;
+	for (int depth : { 1000, 100000 }) {
+		bool cancelled = true, live = false;
+		double elapsed[2];
+		for (int which = 0; which < 2; which++) {
+			TimerWheel<TestTimer, DropIfCancelled> wheel;
+			std::priority_queue<TestTimer, std::vector<TestTimer>> heap;
+			double now = 1e5;
+			int64_t expired = 0;
+			double start = timer();
+			for (int i = 0; i < N; i++) {
+				TestTimer t( now + g_random->random01() * depth * 2e-5, i, g_random->random01() < 0.9 ? &cancelled : &live );
+				now += 1e-5;
+				if (which) {
+					wheel.push( t );
+					if (i % 16 == 0) wheel.advance( now, [&](TestTimer const& t) { expired++; } );
+				} else {
+					heap.push( t );
+					if (i % 16 == 0)
+						while (!heap.empty() && heap.top().at < now) { expired++; heap.pop(); }
+				}
+			}
+			elapsed[which] = timer() - start;
+		}
+		printf("depth %d: priority_queue %0.1f M timers/sec, TimerWheel %0.1f M timers/sec\n", depth, N / 1e6 / elapsed[0], N / 1e6 / elapsed[1]);
+	}
+	return Void();
+}
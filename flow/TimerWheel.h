@@ -0,0 +1,231 @@
+/*
+ * TimerWheel.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLOW_TIMERWHEEL_H
+#define FLOW_TIMERWHEEL_H
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <vector>
+
+#include "Platform.h"
+
+#ifdef _WIN32
+#include <intrin.h>
+#pragma intrinsic(_BitScanForward64)
+#endif
+
+template <class T, class DropIfCancelled>
+class TimerWheel {
+	// A hierarchical timing wheel holding the run loop's timers, as a replacement for std::priority_queue<T>.  T must have
+	// a double `at` (the time at which it expires) and be ordered by operator< like a priority_queue of timers, i.e. the
+	// timer expiring first is the greatest.  DropIfCancelled()(t) returns true if nothing is waiting on t any more, having
+	// disposed of it; such timers are dropped whenever they are touched rather than kept around until they expire.
+	//
+	// Time is divided into millisecond ticks.  Level L has SLOTS slots each spanning SLOTS^L ticks, and a timer lives at
+	// the lowest level whose slots, counted from the current tick, reach its expiry; timers too far away for the top level
+	// wait in a heap.  Inserting is O(1), and advancing moves the timers of each higher level slot down a level when the
+	// current tick reaches it.  advance() expires exactly the timers with at < now, so together with a ready queue that
+	// orders tasks by priority it schedules the same tasks as the heap it replaces.
+
+public:
+	TimerWheel() : currentTick(0), count(0) {
+		for (int l = 0; l < LEVELS; l++) {
+			occupied[l] = 0;
+			std::fill( slotMin[l], slotMin[l] + SLOTS, 1e99 );
+		}
+	}
+
+	bool empty() const { return count == 0; }
+	// Includes cancelled timers that have not been dropped yet
+	size_t size() const { return count; }
+
+	void push( T const& t ) {
+		place( t );
+		++count;
+	}
+
+	// Calls expired(t) for every timer with t.at < now (and drops cancelled timers on the way), in no particular order
+	template <class F>
+	void advance( double now, F const& expired ) {
+		int64_t nowTick = tickOf( now );
+		if (!count) {
+			currentTick = std::max( currentTick, nowTick );
+			return;
+		}
+		while (true) {
+			int s = currentTick % SLOTS;
+			std::vector<T>& slot = slots[0][s];
+			if (currentTick < nowTick) {
+				// Every timer in the current slot expires at or before this tick, and so before now
+				for (auto& t : slot)
+					expired( t );
+				count -= slot.size();
+				clearSlot( 0, s );
+			} else {
+				expireSlot( s, now, expired );
+				return;
+			}
+			currentTick = std::min( nextEventTick(), nowTick );
+			cascade();
+		}
+	}
+
+	// The earliest expiry of a queued timer (or 1e99 if there are none); may be earlier if that timer has been cancelled
+	double nextExpiry() const {
+		double next = overflow.empty() ? 1e99 : overflow.top().at;
+		for (int l = 0; l < LEVELS; l++) {
+			if (!occupied[l]) continue;
+			// The current slot of level 0 holds the current tick; those of higher levels are always empty
+			int first = l ? (levelTick( currentTick, l ) + 1) % SLOTS : currentTick % SLOTS;
+			next = std::min( next, slotMin[l][ nextOccupied( occupied[l], first ) ] );
+		}
+		return next;
+	}
+
+	void clear() {
+		for (int l = 0; l < LEVELS; l++)
+			for (int s = 0; s < SLOTS; s++)
+				clearSlot( l, s );
+		std::priority_queue<T, std::vector<T>>().swap( overflow );
+		count = 0;
+	}
+
+	static const int LEVEL_BITS = 6;
+	static const int SLOTS = 1 << LEVEL_BITS;
+	static const int LEVELS = 4;
+	static const int TICKS_PER_SECOND = 1000;
+
+private:
+	std::vector<T> slots[LEVELS][SLOTS];
+	double slotMin[LEVELS][SLOTS];			// A lower bound on the expiry of each slot's timers
+	uint64_t occupied[LEVELS];				// Bit s is set iff slots[level][s] is not empty
+	std::priority_queue<T, std::vector<T>> overflow;	// Timers beyond the reach of the top level
+	int64_t currentTick;					// Every timer in an earlier tick has expired
+	size_t count;
+
+	static int64_t tickOf( double t ) { return int64_t( std::floor( std::min( t * TICKS_PER_SECOND, 4e18 ) ) ); }
+	static int64_t levelTick( int64_t tick, int level ) { return tick >> (LEVEL_BITS*level); }
+
+	static int lowestBit( uint64_t word ) {
+#ifdef _WIN32
+		unsigned long i;
+		_BitScanForward64( &i, word );
+		return i;
+#else
+		return __builtin_ctzll( word );
+#endif
+	}
+
+	// The first set bit in bits at or after position first, wrapping around
+	static int nextOccupied( uint64_t bits, int first ) {
+		uint64_t rotated = first ? (bits >> first) | (bits << (SLOTS - first)) : bits;
+		return (first + lowestBit( rotated )) % SLOTS;
+	}
+
+	void place( T const& t ) {
+		int64_t tick = std::max( tickOf( t.at ), currentTick );
+		for (int l = 0; l < LEVELS; l++) {
+			if (levelTick( tick, l ) - levelTick( currentTick, l ) < SLOTS) {
+				int s = levelTick( tick, l ) % SLOTS;
+				slots[l][s].push_back( t );
+				slotMin[l][s] = std::min( slotMin[l][s], t.at );
+				occupied[l] |= uint64_t(1) << s;
+				return;
+			}
+		}
+		overflow.push( t );
+	}
+
+	void clearSlot( int level, int s ) {
+		slots[level][s].clear();
+		slotMin[level][s] = 1e99;
+		occupied[level] &= ~(uint64_t(1) << s);
+	}
+
+	// Expires the timers in the current level 0 slot with at < now, keeping the rest
+	template <class F>
+	void expireSlot( int s, double now, F const& expired ) {
+		std::vector<T>& slot = slots[0][s];
+		if (slot.empty() || slotMin[0][s] >= now) return;
+		double remainingMin = 1e99;
+		auto kept = slot.begin();
+		for (auto t = slot.begin(); t != slot.end(); ++t) {
+			if (t->at < now) {
+				expired( *t );
+				--count;
+			} else {
+				remainingMin = std::min( remainingMin, t->at );
+				*kept++ = *t;
+			}
+		}
+		slot.erase( kept, slot.end() );
+		slotMin[0][s] = remainingMin;
+		if (slot.empty())
+			occupied[0] &= ~(uint64_t(1) << s);
+	}
+
+	// The next tick after the current one at which a timer expires or a slot must be moved down a level
+	int64_t nextEventTick() const {
+		int64_t next = std::numeric_limits<int64_t>::max();
+		for (int l = 0; l < LEVELS; l++) {
+			if (!occupied[l]) continue;
+			int64_t current = levelTick( currentTick, l );
+			int s = nextOccupied( occupied[l], (current + 1) % SLOTS );
+			// The current slot is empty here, so s is between 1 and SLOTS-1 slots ahead
+			next = std::min( next, (current + ((s - current) & (SLOTS-1))) << (LEVEL_BITS*l) );
+		}
+		if (!overflow.empty())
+			next = std::min( next, std::max( currentTick + 1, (levelTick( tickOf( overflow.top().at ), LEVELS-1 ) - (SLOTS-1)) << (LEVEL_BITS*(LEVELS-1)) ) );
+		return next;
+	}
+
+	// Having moved to a new tick, redistributes the higher level slots (and overflowing timers) that it has reached
+	void cascade() {
+		DropIfCancelled dropIfCancelled;
+		while (!overflow.empty() && levelTick( tickOf( overflow.top().at ), LEVELS-1 ) - levelTick( currentTick, LEVELS-1 ) < SLOTS) {
+			T t = overflow.top();
+			overflow.pop();
+			if (dropIfCancelled( t ))
+				--count;
+			else
+				place( t );
+		}
+		for (int l = LEVELS-1; l > 0; l--) {
+			if (currentTick & ((int64_t(1) << (LEVEL_BITS*l)) - 1)) continue;
+			int s = levelTick( currentTick, l ) % SLOTS;
+			if (slots[l][s].empty()) continue;
+			std::vector<T> moving;
+			moving.swap( slots[l][s] );
+			clearSlot( l, s );
+			for (auto& t : moving) {
+				if (dropIfCancelled( t ))
+					--count;
+				else
+					place( t );
+			}
+		}
+	}
+};
+
+#endif
@@ -258,15 +258,17 @@ public:
 	void* getData() { return data; }
 	int getLength() { return size; }
 	StringRef toStringRef() { return StringRef(data,size); }
+	// Owns the memory of toStringRef(), which stays valid until the next write
+	Arena const& arena() const { return m_arena; }
 	template <class VersionOptions>
 	explicit BinaryWriter( VersionOptions vo ) : data(NULL), size(0), allocated(0) { vo.write(*this); }
-	BinaryWriter( BinaryWriter&& rhs ) : data(rhs.data), size(rhs.size), allocated(rhs.allocated), m_protocolVersion(rhs.m_protocolVersion) {
+	BinaryWriter( BinaryWriter&& rhs ) : m_arena(std::move(rhs.m_arena)), data(rhs.data), size(rhs.size), allocated(rhs.allocated), m_protocolVersion(rhs.m_protocolVersion) {
 		rhs.size = 0;
 		rhs.allocated = 0;
 		rhs.data = 0;
 	}
 	void operator=( BinaryWriter&& r) {
-		delete[] data;
+		m_arena = std::move(r.m_arena);
 		data = r.data;
 		size = r.size;
 		allocated = r.allocated;
@@ -275,7 +277,6 @@ public:
 		r.allocated = 0;
 		r.data = 0;
 	}
-	~BinaryWriter() { delete[] data; }
 
 	template <class T, class VersionOptions>
 	static Standalone<StringRef> toValue( T const& t, VersionOptions vo ) {
@@ -362,6 +363,7 @@ public:
 	uint64_t protocolVersion() const { return m_protocolVersion; }
 	void setProtocolVersion(uint64_t pv) { m_protocolVersion = pv; }
 private:
+	Arena m_arena;
 	uint8_t* data;
 	int size, allocated;
 	uint64_t m_protocolVersion;
@@ -371,9 +373,10 @@ private:
 		size += s;
 		if (size > allocated) {
 			allocated = std::max(allocated*2, size);
-			uint8_t* newData = new uint8_t[allocated];
+			Arena newArena;
+			uint8_t* newData = new (newArena) uint8_t[allocated];
 			memcpy(newData, data, p);
-			delete[] data;
+			m_arena = std::move(newArena);
 			data = newData;
 		}
 		return data+p;
@@ -576,10 +579,18 @@ struct PacketBuffer : SendBuffer, FastAllocated<PacketBuffer> {
 		((SendBuffer*)this)->data = data;
 		static_assert( sizeof(PacketBuffer) == 4096, "PacketBuffer size mismatch" );
 	}
+	// Returns a buffer which sends the given bytes where they are rather than from its own data, keeping owner alive until
+	// the buffer is destroyed.  Nothing can be written to it.
+	static PacketBuffer* referenceTo( StringRef bytes, Arena const& owner );
+	bool isReference() const { return SendBuffer::data != data; }
+
 	PacketBuffer* nextPacketBuffer() { return (PacketBuffer*)next; }
 	void addref() { ++reference_count; }
-	void delref() { if (!--reference_count) delete this; }
+	void delref() { if (!--reference_count) { if (isReference()) releaseOwner(); delete this; } }
 	int bytes_unwritten() const { return DATA_SIZE-bytes_written; }
+
+private:
+	void releaseOwner();
 };
 
 struct PacketWriter {
@@ -590,6 +601,8 @@ struct PacketWriter {
 	struct ReliablePacket *reliable;  // NULL if this is unreliable; otherwise the last entry in the ReliablePacket::cont chain
 	int length;
 	uint64_t m_protocolVersion;
+	Arena arena;  // The arena most recently serialized, which larger byte strings may be sent by reference to
+	int minReferenceBytes;
 
 	// reliable is NULL if this is an unreliable packet, or points to a ReliablePacket.  PacketWriter is responsible
 	//   for filling in reliable->buffer, ->cont, ->begin, and ->end, but not ->prev or ->next.
@@ -613,6 +626,16 @@ struct PacketWriter {
 	void serializeBytes( StringRef bytes ) {
 		serializeBytes(bytes.begin(), bytes.size());
 	}
+	// Like serializeBytes(), but bytes belonging to the last arena serialized are sent without being copied if there are
+	// enough of them
+	void serializeArenaBytes( StringRef bytes ) {
+		if (bytes.size() >= minReferenceBytes)
+			serializeReferencedBytes(bytes);
+		else
+			serializeBytes(bytes.begin(), bytes.size());
+	}
+	void serializeReferencedBytes( StringRef bytes );
+	void setArena( Arena const& a ) { arena = a; }
 	template <class T>
 	void serializeBinaryItem( const T& t ) {
 		if (sizeof(T) <= buffer->bytes_unwritten()) {
@@ -626,8 +649,17 @@ struct PacketWriter {
 	void setProtocolVersion(uint64_t pv) { m_protocolVersion = pv; }
 private:
 	void init( PacketBuffer* buf, ReliablePacket* reliable );
+	void appendBuffer( PacketBuffer* next );
 };
 
+inline void save( PacketWriter& ar, const Arena& p ) {
+	ar.setArena(p);
+}
+inline void save( PacketWriter& ar, const StringRef& value ) {
+	ar << (uint32_t)value.size();
+	ar.serializeArenaBytes( value );
+}
+
 struct ISerializeSource {
 	virtual void serializePacketWriter( PacketWriter& ) const = 0;
 	virtual void serializeBinaryWriter( BinaryWriter& ) const = 0;